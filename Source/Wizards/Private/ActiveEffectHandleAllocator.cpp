@@ -0,0 +1,127 @@
+// Copyright 2023 John McElmurray (johnmcelmurray.com). All rights reserved.
+
+#include "ActiveEffectHandleAllocator.h"
+
+namespace
+{
+	uint64 MakeFreeListHead(uint64 PreviousHead, int32 TopIndex)
+	{
+		const uint64 Tag = (PreviousHead >> 32) + 1;
+		return (Tag << 32) | static_cast<uint32>(TopIndex + 1);
+	}
+
+	int32 GetFreeListTop(uint64 Head)
+	{
+		return static_cast<int32>(static_cast<uint32>(Head)) - 1;
+	}
+}
+
+FActiveEffectHandleAllocator& FActiveEffectHandleAllocator::Get()
+{
+	static FActiveEffectHandleAllocator Allocator;
+	return Allocator;
+}
+
+FActiveEffectHandleAllocator::FActiveEffectHandleAllocator()
+{
+	for (std::atomic<FSlot*>& CurPage : Pages)
+	{
+		CurPage.store(nullptr, std::memory_order_relaxed);
+	}
+}
+
+FActiveEffectHandleAllocator::~FActiveEffectHandleAllocator()
+{
+	for (std::atomic<FSlot*>& CurPage : Pages)
+	{
+		delete[] CurPage.exchange(nullptr);
+	}
+}
+
+void FActiveEffectHandleAllocator::Allocate(int32& OutIndex, uint32& OutGeneration)
+{
+	// Recycle a released slot first. Slots are never freed, so reading NextFree of a slot another thread
+	// just popped is safe; the tag makes our compare-exchange fail if that happened.
+	uint64 Head = FreeListHead.load(std::memory_order_acquire);
+	while (GetFreeListTop(Head) != INDEX_NONE)
+	{
+		FSlot& TopSlot = *FindSlot(GetFreeListTop(Head));
+		const uint64 NewHead = MakeFreeListHead(Head, TopSlot.NextFree.load(std::memory_order_relaxed));
+		if (FreeListHead.compare_exchange_weak(Head, NewHead, std::memory_order_acq_rel, std::memory_order_acquire))
+		{
+			OutIndex = GetFreeListTop(Head);
+			OutGeneration = TopSlot.Generation.fetch_add(1, std::memory_order_acq_rel) + 1;
+			return;
+		}
+	}
+
+	const int32 NewIndex = NumSlots.fetch_add(1, std::memory_order_relaxed);
+	checkf(NewIndex < MaxPages * SlotsPerPage, TEXT("Too many active layered effects (%d)"), NewIndex);
+
+	OutIndex = NewIndex;
+	OutGeneration = FindOrAddSlot(NewIndex).Generation.fetch_add(1, std::memory_order_acq_rel) + 1;
+}
+
+bool FActiveEffectHandleAllocator::Release(int32 Index, uint32 Generation)
+{
+	FSlot* Slot = FindSlot(Index);
+	if (Slot == nullptr || (Generation & 1) == 0)
+	{
+		return false;
+	}
+
+	// Only the first release of a generation wins, later ones (stale copies) see the bumped generation
+	uint32 ExpectedGeneration = Generation;
+	if (!Slot->Generation.compare_exchange_strong(ExpectedGeneration, Generation + 1, std::memory_order_acq_rel))
+	{
+		return false;
+	}
+
+	uint64 Head = FreeListHead.load(std::memory_order_relaxed);
+	uint64 NewHead = 0;
+	do
+	{
+		Slot->NextFree.store(GetFreeListTop(Head), std::memory_order_relaxed);
+		NewHead = MakeFreeListHead(Head, Index);
+	}
+	while (!FreeListHead.compare_exchange_weak(Head, NewHead, std::memory_order_release, std::memory_order_relaxed));
+
+	return true;
+}
+
+bool FActiveEffectHandleAllocator::IsLive(int32 Index, uint32 Generation) const
+{
+	const FSlot* Slot = FindSlot(Index);
+	return Slot != nullptr && (Generation & 1) != 0 && Slot->Generation.load(std::memory_order_acquire) == Generation;
+}
+
+FActiveEffectHandleAllocator::FSlot* FActiveEffectHandleAllocator::FindSlot(int32 Index) const
+{
+	if (Index < 0 || Index >= MaxPages * SlotsPerPage)
+	{
+		return nullptr;
+	}
+
+	FSlot* Page = Pages[Index >> SlotsPerPageLog2].load(std::memory_order_acquire);
+	return (Page != nullptr) ? &Page[Index & (SlotsPerPage - 1)] : nullptr;
+}
+
+FActiveEffectHandleAllocator::FSlot& FActiveEffectHandleAllocator::FindOrAddSlot(int32 Index)
+{
+	std::atomic<FSlot*>& Page = Pages[Index >> SlotsPerPageLog2];
+	FSlot* PageSlots = Page.load(std::memory_order_acquire);
+	if (PageSlots == nullptr)
+	{
+		// Several threads may race to allocate the same page; the loser frees its copy and uses the winner's
+		FSlot* NewPageSlots = new FSlot[SlotsPerPage];
+		if (Page.compare_exchange_strong(PageSlots, NewPageSlots, std::memory_order_acq_rel, std::memory_order_acquire))
+		{
+			PageSlots = NewPageSlots;
+		}
+		else
+		{
+			delete[] NewPageSlots;
+		}
+	}
+	return PageSlots[Index & (SlotsPerPage - 1)];
+}
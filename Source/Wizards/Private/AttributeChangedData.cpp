@@ -0,0 +1,44 @@
+// Copyright 2023 John McElmurray (johnmcelmurray.com). All rights reserved.
+
+#include "AttributeChangedData.h"
+
+#include "ILayeredAttributes.h"
+
+#pragma region FOnAttributeChangedData
+
+FOnAttributeChangedData::FOnAttributeChangedData(
+	UObject* InOwner,
+	EAttributeKey InAttribute,
+	int32 InOldValue)
+	: Owner(InOwner)
+	, Attribute(InAttribute)
+	, NewValue(0)
+	, OldValue(InOldValue)
+{
+	// When this struct is created, we broadcast the event if it represents an actual change to the attribute.
+	// If nothing is listening, there's no need to evaluate the new value at all.
+	if (ILayeredAttributes* MyOwner = GetOwner();
+		MyOwner != nullptr && MyOwner->HasAttributeListeners(InAttribute))
+	{
+		NewValue = MyOwner->GetCurrentAttribute(InAttribute);
+
+		if (IsValid())
+		{
+			MyOwner->BroadcastAttributeChanged(*this);
+		}
+	}
+}
+
+bool FOnAttributeChangedData::IsValid() const
+{
+	return (GetOwner() != nullptr
+		&& Attribute != EAttributeKey::Invalid
+		&& NewValue != OldValue);
+}
+
+ILayeredAttributes* FOnAttributeChangedData::GetOwner() const
+{
+	return Cast<ILayeredAttributes>(Owner);
+}
+
+#pragma endregion
@@ -0,0 +1,142 @@
+// Copyright 2023 John McElmurray (johnmcelmurray.com). All rights reserved.
+
+#include "AttributeSubscriptions.h"
+
+FDelegateHandle FAttributeSubscriptions::Subscribe(uint32 KeyMask, FOnAttributeChangedDelegate Delegate)
+{
+	FSubscription& NewSubscription = Subscriptions.AddDefaulted_GetRef();
+	NewSubscription.Handle = FDelegateHandle(FDelegateHandle::GenerateNewHandle);
+	NewSubscription.KeyMask = KeyMask;
+	NewSubscription.Delegate = MoveTemp(Delegate);
+
+	WatchedMask |= KeyMask;
+	return NewSubscription.Handle;
+}
+
+FDelegateHandle FAttributeSubscriptions::WatchThreshold(EAttributeKey Key, EAttributeComparison Comparison, int32 Threshold, int32 CurrentValue, FOnAttributeThresholdDelegate Delegate)
+{
+	if (!EAttributeKeyUtils::IsInRange(Key))
+	{
+		return FDelegateHandle();
+	}
+
+	FThresholdWatcher& NewWatcher = ThresholdWatchers[EAttributeKeyUtils::ToIndex(Key)].AddDefaulted_GetRef();
+	NewWatcher.Handle = FDelegateHandle(FDelegateHandle::GenerateNewHandle);
+	NewWatcher.Comparison = Comparison;
+	NewWatcher.Threshold = Threshold;
+	NewWatcher.bConditionMet = EAttributeComparisonUtils::Compare(CurrentValue, Comparison, Threshold);
+	NewWatcher.Delegate = MoveTemp(Delegate);
+
+	WatchedMask |= EAttributeKeyUtils::ToMask(Key);
+	return NewWatcher.Handle;
+}
+
+bool FAttributeSubscriptions::Unsubscribe(FDelegateHandle Handle)
+{
+	if (!Handle.IsValid())
+	{
+		return false;
+	}
+
+	auto UnbindMatching = [Handle](auto& Entries)
+	{
+		for (auto& CurEntry : Entries)
+		{
+			if (CurEntry.Handle == Handle)
+			{
+				CurEntry.Handle.Reset();
+				CurEntry.Delegate.Unbind();
+				return true;
+			}
+		}
+		return false;
+	};
+
+	bool bFound = UnbindMatching(Subscriptions);
+	for (int32 Index = 0; !bFound && Index < EAttributeKeyUtils::Num; Index++)
+	{
+		bFound = UnbindMatching(ThresholdWatchers[Index]);
+	}
+
+	if (bFound)
+	{
+		// Entries may be mid-dispatch, so only drop them once the callbacks have finished
+		bNeedsCompaction = true;
+		if (DispatchDepth == 0)
+		{
+			Compact();
+		}
+	}
+
+	return bFound;
+}
+
+void FAttributeSubscriptions::Dispatch(const FOnAttributeChangedData& Data)
+{
+	OnAnyAttributeValueChanged.Broadcast(Data);
+
+	const EAttributeKey Key = Data.GetAttribute();
+	if ((WatchedMask & EAttributeKeyUtils::ToMask(Key)) == 0)
+	{
+		return;
+	}
+
+	DispatchDepth++;
+
+	// Index loops, since callbacks may add entries (which only hear about later changes)
+	const uint32 KeyMask = EAttributeKeyUtils::ToMask(Key);
+	const int32 NumSubscriptions = Subscriptions.Num();
+	for (int32 Index = 0; Index < NumSubscriptions; Index++)
+	{
+		if ((Subscriptions[Index].KeyMask & KeyMask) != 0)
+		{
+			// Copy, in case the callback adds a subscription and the array reallocates
+			const FOnAttributeChangedDelegate Delegate = Subscriptions[Index].Delegate;
+			Delegate.ExecuteIfBound(Data);
+		}
+	}
+
+	TArray<FThresholdWatcher>& KeyWatchers = ThresholdWatchers[EAttributeKeyUtils::ToIndex(Key)];
+	const int32 NumKeyWatchers = KeyWatchers.Num();
+	for (int32 Index = 0; Index < NumKeyWatchers; Index++)
+	{
+		FThresholdWatcher& CurWatcher = KeyWatchers[Index];
+		const bool bConditionMet = EAttributeComparisonUtils::Compare(Data.GetNewValue(), CurWatcher.Comparison, CurWatcher.Threshold);
+		if (bConditionMet != CurWatcher.bConditionMet)
+		{
+			CurWatcher.bConditionMet = bConditionMet;
+			const FOnAttributeThresholdDelegate Delegate = CurWatcher.Delegate;
+			Delegate.ExecuteIfBound(Data, bConditionMet);
+		}
+	}
+
+	DispatchDepth--;
+
+	if (DispatchDepth == 0 && bNeedsCompaction)
+	{
+		Compact();
+	}
+}
+
+void FAttributeSubscriptions::Compact()
+{
+	auto IsRemoved = [](const auto& CurEntry) { return !CurEntry.Handle.IsValid(); };
+
+	Subscriptions.RemoveAll(IsRemoved);
+	WatchedMask = 0;
+	for (const FSubscription& CurSubscription : Subscriptions)
+	{
+		WatchedMask |= CurSubscription.KeyMask;
+	}
+
+	for (int32 Index = 0; Index < EAttributeKeyUtils::Num; Index++)
+	{
+		ThresholdWatchers[Index].RemoveAll(IsRemoved);
+		if (ThresholdWatchers[Index].Num() > 0)
+		{
+			WatchedMask |= EAttributeKeyUtils::ToMask(static_cast<EAttributeKey>(Index));
+		}
+	}
+
+	bNeedsCompaction = false;
+}
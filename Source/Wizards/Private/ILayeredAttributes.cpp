@@ -2,6 +2,10 @@
 
 #include "ILayeredAttributes.h"
 
+#include "LayeredAttributeStats.h"
+#include "LayeredAttributeSubsystem.h"
+#include "ScopedAttributeTransaction.h"
+
 UObject* ILayeredAttributes::AsObject()
 {
 	return Cast<UObject>(this);
@@ -15,95 +19,413 @@ UWorld* ILayeredAttributes::GetWorld()
 
 void ILayeredAttributes::SetBaseAttribute(EAttributeKey Key, int32 Value)
 {
+	LAYERED_ATTRIBUTES_SCOPE(SetBaseAttribute);
+
+	if (!EAttributeKeyUtils::IsValid(Key))
+	{
+		UE_LOG(LogLayeredEffects, Warning, TEXT("Ignoring base value %d for invalid attribute %d"), Value, EAttributeKeyUtils::ToIndex(Key));
+		return;
+	}
+
+	FLayeredAttributeBlock& Attributes = GetAttributesMutable();
+
 	// Capture the current attribute value
-	const int32 OldValue = GetCurrentAttribute(Key);
+	const TOptional<int32> OldValue = BeginAttributeChange(Attributes, Key);
 
 	// Set the base attribute to the new Value
-	TMap<EAttributeKey, int32>& BaseAttributes = GetBaseAttributesMutable();
-	BaseAttributes.Add(Key, Value);
+	Attributes.SetBaseValue(Key, Value);
 
 	// If there's a change, broadcast it
-	FOnAttributeChangedData(AsObject(), Key, OldValue);
+	EndAttributeChange(Key, OldValue);
+	PublishAttributeSnapshot();
 }
 
 int32 ILayeredAttributes::GetBaseAttribute(EAttributeKey Key) const
 {
-	const TMap<EAttributeKey, int32>& BaseAttributes = GetBaseAttributes();
-	return BaseAttributes.FindRef(Key);
+	return EAttributeKeyUtils::IsValid(Key) ? GetAttributes().GetBaseValue(Key) : 0;
 }
 
 int32 ILayeredAttributes::GetCurrentAttribute(EAttributeKey Key) const
 {
-	const int32 BaseValueForAttribute = GetBaseAttribute(Key);
+	LAYERED_ATTRIBUTES_SCOPE(GetCurrentAttribute);
+	return EAttributeKeyUtils::IsValid(Key) ? GetAttributes().GetCurrentValue(Key) : 0;
+}
+
+void ILayeredAttributes::GetCurrentAttributes(TArrayView<int32> OutValues) const
+{
+	GetAttributes().GetCurrentValues(OutValues);
+}
+
+TMap<EAttributeKey, int32> ILayeredAttributes::GetAllBaseAttributes() const
+{
+	const FLayeredAttributeBlock& Attributes = GetAttributes();
+	TMap<EAttributeKey, int32> BaseValues;
+	BaseValues.Reserve(EAttributeKeyUtils::Num - 1);
+	for (int32 Index = 1; Index < EAttributeKeyUtils::Num; Index++)
+	{
+		const EAttributeKey CurAttribute = static_cast<EAttributeKey>(Index);
+		BaseValues.Add(CurAttribute, Attributes.GetBaseValue(CurAttribute));
+	}
+	return BaseValues;
+}
+
+TMap<EAttributeKey, int32> ILayeredAttributes::GetAllCurrentAttributes() const
+{
+	int32 Values[EAttributeKeyUtils::Num];
+	GetCurrentAttributes(MakeArrayView(Values));
+
+	TMap<EAttributeKey, int32> CurrentValues;
+	CurrentValues.Reserve(EAttributeKeyUtils::Num - 1);
+	for (int32 Index = 1; Index < EAttributeKeyUtils::Num; Index++)
+	{
+		CurrentValues.Add(static_cast<EAttributeKey>(Index), Values[Index]);
+	}
+	return CurrentValues;
+}
 
-	if (const TMap<EAttributeKey, FSortedEffectDefinitions>& ActiveEffects = GetActiveEffects();
-		const FSortedEffectDefinitions* ActiveEffectsForAttribute = ActiveEffects.Find(Key))
+TArray<FActiveEffectDefinition> ILayeredAttributes::GetActiveEffects(EAttributeKey Key) const
+{
+	TArray<FActiveEffectDefinition> ActiveEffects;
+	if (EAttributeKeyUtils::IsValid(Key))
 	{
-		return ActiveEffectsForAttribute->GetCurrentValue(BaseValueForAttribute);
+		const FSortedEffectDefinitions& KeyEffects = GetAttributes().GetEffects(Key);
+		ActiveEffects.Reserve(KeyEffects.NumEffects());
+		KeyEffects.ForEachEffect([&ActiveEffects](const FActiveEffectDefinition& CurEffect)
+		{
+			ActiveEffects.Add(CurEffect);
+		});
 	}
+	return ActiveEffects;
+}
 
-	return BaseValueForAttribute;
+FLayeredAttributeOverlay ILayeredAttributes::MakeAttributeOverlay() const
+{
+	return FLayeredAttributeOverlay(GetAttributes());
 }
 
 FActiveEffectHandle ILayeredAttributes::AddLayeredEffect(FLayeredEffectDefinition Effect, bool& bSuccess)
 {
+	LAYERED_ATTRIBUTES_SCOPE(AddLayeredEffect);
+
 	if (!Effect.IsValid())
 	{
 		bSuccess = false;
 		return FActiveEffectHandle::kInvalid;
 	}
 
+	FLayeredAttributeBlock& Attributes = GetAttributesMutable();
+
 	// Capture the current attribute value
 	const EAttributeKey Key = Effect.GetAttribute();
-	const int32 OldValue = GetCurrentAttribute(Key);
+	const TOptional<int32> OldValue = BeginAttributeChange(Attributes, Key);
 
 	// Add the new layered effect
-	FSortedEffectDefinitions& ActiveEffects = GetActiveEffectsMutable().FindOrAdd(Key);
-	const FActiveEffectHandle NewEffect = ActiveEffects.AddLayeredEffect(GetWorld(), Effect);
+	const FActiveEffectHandle NewEffect = Attributes.AddLayeredEffect(Effect);
 
 	// If there's a change, broadcast it
-	FOnAttributeChangedData(AsObject(), Key, OldValue);
+	EndAttributeChange(Key, OldValue);
+	PublishAttributeSnapshot();
 
 	bSuccess = NewEffect.IsValid();
+	if (bSuccess)
+	{
+		LayeredAttributeStats::RecordStackDepth(Attributes.GetEffects(Key).NumEffects());
+	}
+	return NewEffect;
+}
+
+FActiveEffectHandle ILayeredAttributes::AddExpiringLayeredEffect(FLayeredEffectDefinition Effect, const FLayeredEffectExpiry& Expiry, bool& bSuccess)
+{
+	const FActiveEffectHandle NewEffect = AddLayeredEffect(Effect, bSuccess);
+	if (bSuccess && Expiry.IsSet())
+	{
+		UWorld* World = GetWorld();
+		if (ULayeredAttributeSubsystem* Subsystem = (World != nullptr) ? World->GetSubsystem<ULayeredAttributeSubsystem>() : nullptr)
+		{
+			Subsystem->ScheduleEffectExpiry(AsObject(), NewEffect, Expiry);
+		}
+		else
+		{
+			UE_LOG(LogLayeredEffects, Warning, TEXT("No attribute subsystem to expire '%s', it will last until removed"), *Effect.ToString());
+		}
+	}
 	return NewEffect;
 }
 
 bool ILayeredAttributes::RemoveLayeredEffect(const FActiveEffectHandle& InHandle)
 {
-	if (!InHandle.IsValid())
+	LAYERED_ATTRIBUTES_SCOPE(RemoveLayeredEffect);
+
+	if (!InHandle.IsValid() || !EAttributeKeyUtils::IsValid(InHandle.GetAttribute()))
 	{
 		return false;
 	}
 
-	if (const EAttributeKey Key = InHandle.GetAttribute();
-		FSortedEffectDefinitions* ActiveEffectsForAttribute = GetActiveEffectsMutable().Find(Key))
+	FLayeredAttributeBlock& Attributes = GetAttributesMutable();
+
+	// Capture the current attribute value
+	const EAttributeKey Key = InHandle.GetAttribute();
+	const TOptional<int32> OldValue = BeginAttributeChange(Attributes, Key);
+
+	// See if any effects were removed
+	if (Attributes.RemoveLayeredEffect(InHandle))
+	{
+		// If there's a change, broadcast it
+		EndAttributeChange(Key, OldValue);
+		PublishAttributeSnapshot();
+		return true;
+	}
+
+	return false;
+}
+
+void ILayeredAttributes::ClearLayeredEffects()
+{
+	LAYERED_ATTRIBUTES_SCOPE(ClearLayeredEffects);
+
+	FLayeredAttributeBlock& Attributes = GetAttributesMutable();
+
+	for (int32 Index = 0; Index < EAttributeKeyUtils::Num; Index++)
 	{
-		// Capture the current attribute value
-		const int32 OldValue = GetCurrentAttribute(Key);
+		const EAttributeKey CurAttribute = static_cast<EAttributeKey>(Index);
+		if (!Attributes.GetEffects(CurAttribute).HasEffects())
+		{
+			continue;
+		}
+
+		const TOptional<int32> CurOldValue = BeginAttributeChange(Attributes, CurAttribute);
 
-		// See if any effects were removed
-		if (ActiveEffectsForAttribute->RemoveLayeredEffect(InHandle))
+		if (Attributes.ClearLayeredEffects(CurAttribute))
 		{
 			// If there's a change, broadcast it
-			FOnAttributeChangedData(AsObject(), Key, OldValue);
-			return true;
+			EndAttributeChange(CurAttribute, CurOldValue);
 		}
 	}
 
+	PublishAttributeSnapshot();
+}
+
+void ILayeredAttributes::AddReplicatedLayeredEffect(const FActiveEffectDefinition& Effect)
+{
+	// Anything that arrived over the network is checked before it's used as an index
+	const EAttributeKey Key = Effect.GetEffectDefinition().GetAttribute();
+	if (!EAttributeKeyUtils::IsInRange(Key))
+	{
+		return;
+	}
+
+	FLayeredAttributeBlock& Attributes = GetAttributesMutable();
+	const TOptional<int32> OldValue = BeginAttributeChange(Attributes, Key);
+
+	if (Attributes.AddActiveEffect(Effect))
+	{
+		EndAttributeChange(Key, OldValue);
+		PublishAttributeSnapshot();
+	}
+}
+
+void ILayeredAttributes::RemoveReplicatedLayeredEffect(const FActiveEffectHandle& InHandle)
+{
+	const EAttributeKey Key = InHandle.GetAttribute();
+	if (!EAttributeKeyUtils::IsInRange(Key))
+	{
+		return;
+	}
+
+	FLayeredAttributeBlock& Attributes = GetAttributesMutable();
+	const TOptional<int32> OldValue = BeginAttributeChange(Attributes, Key);
+
+	if (Attributes.RemoveActiveEffect(InHandle))
+	{
+		EndAttributeChange(Key, OldValue);
+		PublishAttributeSnapshot();
+	}
+}
+
+FOnAttributeValueChangedNative& ILayeredAttributes::GetOnAnyAttributeValueChangedNative()
+{
+	// Only ever asked for to add or remove listeners, so assume one is being added
+	NoteAttributeListener();
+	return GetAttributesMutable().GetSubscriptions().OnAnyAttributeValueChanged;
+}
+
+FDelegateHandle ILayeredAttributes::SubscribeToAttribute(EAttributeKey Key, FOnAttributeChangedDelegate Delegate)
+{
+	return SubscribeToAttributes(EAttributeKeyUtils::ToMask(Key), MoveTemp(Delegate));
+}
+
+FDelegateHandle ILayeredAttributes::SubscribeToAttributes(uint32 KeyMask, FOnAttributeChangedDelegate Delegate)
+{
+	NoteAttributeListener();
+	return GetAttributesMutable().GetSubscriptions().Subscribe(KeyMask, MoveTemp(Delegate));
+}
+
+FDelegateHandle ILayeredAttributes::WatchAttributeThreshold(EAttributeKey Key, EAttributeComparison Comparison, int32 Threshold, FOnAttributeThresholdDelegate Delegate)
+{
+	NoteAttributeListener();
+	FLayeredAttributeBlock& Attributes = GetAttributesMutable();
+	return Attributes.GetSubscriptions().WatchThreshold(Key, Comparison, Threshold, Attributes.GetCurrentValue(Key), MoveTemp(Delegate));
+}
+
+bool ILayeredAttributes::UnsubscribeFromAttributes(FDelegateHandle Handle)
+{
+	return GetAttributesMutable().GetSubscriptions().Unsubscribe(Handle);
+}
+
+bool ILayeredAttributes::HasAttributeListeners(EAttributeKey Key) const
+{
+	return (GetAttributes().GetSubscriptions().IsWatching(Key)
+		|| GetOnAnyAttributeValueChanged().IsBound());
+}
+
+void ILayeredAttributes::BroadcastAttributeChanged(const FOnAttributeChangedData& Data)
+{
+	LAYERED_ATTRIBUTES_SCOPE(Broadcast);
+	LayeredAttributeStats::RecordBroadcast();
+
+	GetAttributesMutable().GetSubscriptions().Dispatch(Data);
+
+	// Only pay for ProcessEvent while something is actually bound on the Blueprint side
+	if (const FOnAttributeValueChangedEvent& OnAnyAttributeValueChanged = GetOnAnyAttributeValueChanged();
+		OnAnyAttributeValueChanged.IsBound())
+	{
+		OnAnyAttributeValueChanged.Broadcast(Data);
+	}
+}
+
+void ILayeredAttributes::SetAttributeNotifyMode(ELayeredAttributeNotifyMode InNotifyMode)
+{
+	FLayeredAttributeBlock& Attributes = GetAttributesMutable();
+	if (Attributes.GetNotifyMode() == ELayeredAttributeNotifyMode::Deferred && InNotifyMode != ELayeredAttributeNotifyMode::Deferred)
+	{
+		FlushAttributeNotifications();
+	}
+	Attributes.SetNotifyMode(InNotifyMode);
+}
+
+void ILayeredAttributes::FlushAttributeNotifications()
+{
+	const FPendingAttributeChanges PendingChanges = GetAttributesMutable().ConsumePendingChanges();
+	if (PendingChanges.IsEmpty())
+	{
+		return;
+	}
+
+	UObject* MyObject = AsObject();
+	for (int32 Index = 0; Index < EAttributeKeyUtils::Num; Index++)
+	{
+		if (const EAttributeKey CurAttribute = static_cast<EAttributeKey>(Index);
+			PendingChanges.Contains(CurAttribute))
+		{
+			// Only broadcasts if the attribute ended up somewhere other than where it started this frame
+			FOnAttributeChangedData(MyObject, CurAttribute, PendingChanges.OldValues[Index]);
+		}
+	}
+}
+
+FLayeredAttributeSnapshotReader ILayeredAttributes::GetAttributeSnapshotReader()
+{
+	FLayeredAttributeBlock& Attributes = GetAttributesMutable();
+	if (!Attributes.HasSnapshotBuffer())
+	{
+		if (UWorld* World = GetWorld())
+		{
+			if (ULayeredAttributeSubsystem* Subsystem = World->GetSubsystem<ULayeredAttributeSubsystem>())
+			{
+				Subsystem->RegisterSnapshotOwner(AsObject());
+			}
+		}
+	}
+	return Attributes.GetOrCreateSnapshotBuffer();
+}
+
+void ILayeredAttributes::PublishAttributeSnapshot()
+{
+	// Readers only ever see committed state
+	if (FLayeredAttributeBlock& Attributes = GetAttributesMutable();
+		Attributes.GetActiveTransaction() == nullptr)
+	{
+		Attributes.PublishSnapshot();
+		OnAttributesCommitted();
+	}
+}
+
+TOptional<int32> ILayeredAttributes::BeginAttributeChange(FLayeredAttributeBlock& Attributes, EAttributeKey Key)
+{
+	// The transaction broadcasts once per attribute when it commits
+	if (FScopedAttributeTransaction* Transaction = Attributes.GetActiveTransaction())
+	{
+		Transaction->RecordChange(Attributes, Key);
+		return {};
+	}
+
+	// Nobody would hear about this change, so don't bother evaluating the old value
+	if (!HasAttributeListeners(Key))
+	{
+		return {};
+	}
+
+	if (Attributes.GetNotifyMode() == ELayeredAttributeNotifyMode::Deferred)
+	{
+		// Only the value from before the first change this frame matters
+		FPendingAttributeChanges& PendingChanges = Attributes.GetPendingChanges();
+		if (PendingChanges.Contains(Key))
+		{
+			return {};
+		}
+
+		if (DeferAttributeChange(Attributes, Key, Attributes.GetCurrentValue(Key)))
+		{
+			return {};
+		}
+
+		// No subsystem to flush us (e.g. no world), so fall back to broadcasting immediately
+	}
+
+	return Attributes.GetCurrentValue(Key);
+}
+
+void ILayeredAttributes::EndAttributeChange(EAttributeKey Key, const TOptional<int32>& OldValue)
+{
+	if (OldValue.IsSet())
+	{
+		FOnAttributeChangedData(AsObject(), Key, OldValue.GetValue());
+	}
+}
+
+bool ILayeredAttributes::DeferAttributeChange(FLayeredAttributeBlock& Attributes, EAttributeKey Key, int32 OldValue)
+{
+	FPendingAttributeChanges& PendingChanges = Attributes.GetPendingChanges();
+	if (PendingChanges.bQueued || QueueAttributeNotifications())
+	{
+		PendingChanges.bQueued = true;
+		PendingChanges.Record(Key, OldValue);
+		return true;
+	}
 	return false;
 }
 
-void ILayeredAttributes::ClearLayeredEffects()
+bool ILayeredAttributes::QueueAttributeNotifications()
 {
-	for (TPair<EAttributeKey, FSortedEffectDefinitions>& CurActiveEffects : GetActiveEffectsMutable())
+	if (UWorld* World = GetWorld())
 	{
-		const EAttributeKey CurAttribute = CurActiveEffects.Key;
-		const int32 CurOldValue = GetCurrentAttribute(CurAttribute);
+		if (ULayeredAttributeSubsystem* Subsystem = World->GetSubsystem<ULayeredAttributeSubsystem>())
+		{
+			Subsystem->QueueDeferredNotifications(AsObject());
+			return true;
+		}
+	}
+
+	return false;
+}
 
-		if (CurActiveEffects.Value.ClearLayeredEffects())
+void ILayeredAttributes::NoteAttributeListener()
+{
+	if (UWorld* World = GetWorld())
+	{
+		if (ULayeredAttributeSubsystem* Subsystem = World->GetSubsystem<ULayeredAttributeSubsystem>())
 		{
-			// If there's a change, broadcast it
-			FOnAttributeChangedData(AsObject(), CurAttribute, CurOldValue);
+			Subsystem->NoteSharedEffectListener(AsObject());
 		}
 	}
 }
@@ -1,12 +1,29 @@
 // Copyright 2023 John McElmurray (johnmcelmurray.com). All rights reserved.
 
 #include "Algo/Accumulate.h"
+#include "Algo/AllOf.h"
+#include "Algo/AnyOf.h"
 #include "Algo/ForEach.h"
 #include "Algo/Transform.h"
+#include "Async/Async.h"
+#include "Async/ParallelFor.h"
+#include "HAL/FileManager.h"
+#include "Misc/Paths.h"
+#include "Serialization/BitReader.h"
+#include "Serialization/BitWriter.h"
+#include "UObject/CoreNet.h"
 
 #include "TestUtils.h"
 #include "ILayeredAttributes.h"
+#include "LayeredAttributeStateImage.h"
+#include "LayeredAttributeSubsystem.h"
+#include "LayeredAttributeTimeline.h"
+#include "LayeredEffectBlueprintLibrary.h"
+#include "LayeredEffectBatch.h"
 #include "LayeredEffectDefinition.h"
+#include "ReplicatedAttributeValues.h"
+#include "ReplicatedLayeredEffects.h"
+#include "ScopedAttributeTransaction.h"
 #include "WizardsCharacter.h"
 
 /// <summary>
@@ -19,6 +36,26 @@ struct LayeredEffectTest
 	int32 ExpectedValue;
 };
 
+/// <summary>
+/// Stands in for the net driver's struct serializer, so fast arrays can be delta serialized without a connection.
+/// Only handles structs of plain properties, which is all replicated effects are made of.
+/// </summary>
+class FTestNetSerializeCB : public INetSerializeCB
+{
+public:
+
+	virtual void NetSerializeStruct(FNetDeltaSerializeInfo& Params) override
+	{
+		FArchive& Ar = (Params.Writer != nullptr) ? static_cast<FArchive&>(*Params.Writer) : static_cast<FArchive&>(*Params.Reader);
+		Params.Struct->SerializeBin(Ar, Params.Data);
+	}
+
+	virtual void GatherGuidReferencesForFastArray(FFastArrayDeltaSerializeParams& Params) override { }
+	virtual bool MoveGuidToUnmappedForFastArray(FFastArrayDeltaSerializeParams& Params) override { return false; }
+	virtual void UpdateUnmappedGuidsForFastArray(FFastArrayDeltaSerializeParams& Params) override { }
+	virtual bool NetDeltaSerializeForFastArray(FFastArrayDeltaSerializeParams& Params) override { return false; }
+};
+
 /// <summary>
 /// Test spec validating all of the requirements/specifications for the Wizards coding test.
 /// </summary>
@@ -68,7 +105,26 @@ void AttributeTest::Define()
 		FTestUtils::Exit();
 	});
 
-	Describe("LayeredAttributes", [this]()
+	// Random Power effect of any operation, on a layer from 0 to MaxLayer
+	const auto MakeRandomEffect = [](FRandomStream& RandomStream, int32 MaxLayer)
+	{
+		static const EEffectOperation Operations[] =
+		{
+			EEffectOperation::Set,
+			EEffectOperation::Add,
+			EEffectOperation::Subtract,
+			EEffectOperation::Multiply,
+			EEffectOperation::BitwiseOr,
+			EEffectOperation::BitwiseAnd,
+			EEffectOperation::BitwiseXor,
+		};
+
+		const EEffectOperation Operation = Operations[RandomStream.RandRange(0, static_cast<int32>(UE_ARRAY_COUNT(Operations)) - 1)];
+		const int32 Modification = RandomStream.RandRange(-8, 8);
+		return FLayeredEffectDefinition(EAttributeKey::Power, Operation, Modification, RandomStream.RandRange(0, MaxLayer));
+	};
+
+	Describe("LayeredAttributes", [this, MakeRandomEffect]()
 	{
 		It("Can initialize base attributes", [this]()
 		{
@@ -82,6 +138,26 @@ void AttributeTest::Define()
 			}
 		});
 
+		It("Bulk reading current attributes matches reading them one at a time", [this]()
+		{
+			for (int32 i = 1; i < AllAttributes.Num(); i++)
+			{
+				bool bSuccess = false;
+				MyCharacter->SetBaseAttribute(AllAttributes[i], i);
+				MyCharacter->AddLayeredEffect(FLayeredEffectDefinition(AllAttributes[i], EEffectOperation::Multiply, i, 0), bSuccess);
+				TestTrue("Layered effect was successfully applied", bSuccess);
+			}
+
+			TArray<int32> CurrentValues;
+			CurrentValues.SetNumZeroed(EAttributeKeyUtils::Num);
+			MyCharacter->GetCurrentAttributes(CurrentValues);
+
+			for (const EAttributeKey CurAttribute : AllAttributes)
+			{
+				TestEqual("Bulk current value matches GetCurrentAttribute", CurrentValues[EAttributeKeyUtils::ToIndex(CurAttribute)], MyCharacter->GetCurrentAttribute(CurAttribute));
+			}
+		});
+
 		It("Invalid effects should not be applied", [this]()
 		{
 			{
@@ -99,6 +175,66 @@ void AttributeTest::Define()
 			}
 		});
 
+		It("Invalid and out of range attribute keys are ignored", [this]()
+		{
+			// What a Blueprint could pass in for a byte enum
+			const TArray<EAttributeKey> BadKeys = { EAttributeKey::Invalid, static_cast<EAttributeKey>(EAttributeKeyUtils::Num), static_cast<EAttributeKey>(MAX_uint8) };
+			AddExpectedError(TEXT("invalid attribute"), EAutomationExpectedErrorFlags::Contains, BadKeys.Num());
+			for (const EAttributeKey CurKey : BadKeys)
+			{
+				MyCharacter->SetBaseAttribute(CurKey, 7);
+				TestEqual("Base value of a bad key reads as 0", MyCharacter->GetBaseAttribute(CurKey), 0);
+				TestEqual("Current value of a bad key reads as 0", MyCharacter->GetCurrentAttribute(CurKey), 0);
+				TestEqual("Bad keys have no effects", MyCharacter->GetActiveEffects(CurKey).Num(), 0);
+
+				bool bSuccess = true;
+				MyCharacter->AddLayeredEffect(FLayeredEffectDefinition(CurKey, EEffectOperation::Add, 1, 0), bSuccess);
+				TestFalse("Effects on bad keys are not applied", bSuccess);
+			}
+		});
+
+		It("Blueprints can read every attribute and active effect", [this]()
+		{
+			bool bSuccess = false;
+			MyCharacter->SetBaseAttribute(EAttributeKey::Power, 2);
+			MyCharacter->AddLayeredEffect(FLayeredEffectDefinition(EAttributeKey::Power, EEffectOperation::Multiply, 3, 1), bSuccess);
+			const FActiveEffectHandle Added = MyCharacter->AddLayeredEffect(FLayeredEffectDefinition(EAttributeKey::Power, EEffectOperation::Add, 1, 0), bSuccess);
+
+			const TMap<EAttributeKey, int32> BaseValues = MyCharacter->GetAllBaseAttributes();
+			const TMap<EAttributeKey, int32> CurrentValues = MyCharacter->GetAllCurrentAttributes();
+			TestEqual("Every attribute but Invalid has a base value", BaseValues.Num(), EAttributeKeyUtils::Num - 1);
+			TestFalse("Invalid is left out", BaseValues.Contains(EAttributeKey::Invalid));
+			TestEqual("Base values are live", BaseValues.FindRef(EAttributeKey::Power), 2);
+			TestEqual("Current values are live", CurrentValues.FindRef(EAttributeKey::Power), (2 + 1) * 3);
+
+			const TArray<FActiveEffectDefinition> PowerEffects = MyCharacter->GetActiveEffects(EAttributeKey::Power);
+			TestEqual("Every active effect is listed", PowerEffects.Num(), 2);
+			TestTrue("Effects are listed in application order", PowerEffects.Num() == 2 && PowerEffects[0].GetHandle() == Added);
+			TestEqual("Untouched attributes have no effects", MyCharacter->GetActiveEffects(EAttributeKey::Toughness).Num(), 0);
+
+			// Graphs reading the character's BaseAttributes and ActiveEffects variables see the same live state
+			const FMapProperty* BaseProperty = FindFProperty<FMapProperty>(AWizardsCharacter::StaticClass(), TEXT("BaseAttributes"));
+			const FMapProperty* EffectsProperty = FindFProperty<FMapProperty>(AWizardsCharacter::StaticClass(), TEXT("ActiveEffects"));
+			TestTrue("BaseAttributes is readable from Blueprints", BaseProperty != nullptr && BaseProperty->HasAllPropertyFlags(CPF_BlueprintVisible | CPF_BlueprintReadOnly));
+			TestTrue("ActiveEffects is readable from Blueprints", EffectsProperty != nullptr && EffectsProperty->HasAllPropertyFlags(CPF_BlueprintVisible | CPF_BlueprintReadOnly));
+			if (BaseProperty == nullptr || EffectsProperty == nullptr)
+			{
+				return;
+			}
+
+			const TMap<EAttributeKey, int32>& MirroredBaseValues = *BaseProperty->ContainerPtrToValuePtr<TMap<EAttributeKey, int32>>(MyCharacter);
+			const TMap<EAttributeKey, FSortedEffectDefinitions>& MirroredEffects = *EffectsProperty->ContainerPtrToValuePtr<TMap<EAttributeKey, FSortedEffectDefinitions>>(MyCharacter);
+			TestEqual("BaseAttributes mirrors live base values", MirroredBaseValues.FindRef(EAttributeKey::Power), 2);
+			TestTrue("ActiveEffects mirrors live effects", MirroredEffects.Contains(EAttributeKey::Power) && MirroredEffects[EAttributeKey::Power].NumEffects() == 2);
+
+			MyCharacter->RemoveLayeredEffect(Added);
+			TestTrue("ActiveEffects follows removals", MirroredEffects.Contains(EAttributeKey::Power) && MirroredEffects[EAttributeKey::Power].NumEffects() == 1);
+			if (const FSortedEffectDefinitions* MirroredPower = MirroredEffects.Find(EAttributeKey::Power))
+			{
+				TestEqual("Mirrored effects evaluate like the character", MirroredPower->GetCurrentValue(2), MyCharacter->GetCurrentAttribute(EAttributeKey::Power));
+			}
+		});
+
 		It("Changes to base attributes when layered effects are active should adjust current attribute", [this]()
 		{
 			const EAttributeKey Attribute = EAttributeKey::Power;
@@ -281,6 +417,1059 @@ void AttributeTest::Define()
 			}
 		});
 
+		It("Composed transform tree backend evaluates the same as the layer bucket backend", [this, MakeRandomEffect]()
+		{
+			FSortedEffectDefinitions ArrayEffects(ELayeredEffectBackend::LayerBuckets);
+			FSortedEffectDefinitions TreeEffects(ELayeredEffectBackend::ComposedTree);
+			TArray<TPair<FActiveEffectHandle, FActiveEffectHandle>> ActiveHandles;
+
+			// Interleave affine and bitwise effects across a few layers, removing some as we go
+			FRandomStream RandomStream(1337);
+			for (int32 i = 0; i < 200; i++)
+			{
+				const FLayeredEffectDefinition CurEffect = MakeRandomEffect(RandomStream, 4);
+				ActiveHandles.Add(MakeTuple(ArrayEffects.AddLayeredEffect(CurEffect), TreeEffects.AddLayeredEffect(CurEffect)));
+
+				if (i % 3 == 2)
+				{
+					const int32 RemoveIndex = RandomStream.RandRange(0, ActiveHandles.Num() - 1);
+					TestTrue("Effect removed from layer buckets", ArrayEffects.RemoveLayeredEffect(ActiveHandles[RemoveIndex].Key));
+					TestTrue("Effect removed from composed tree", TreeEffects.RemoveLayeredEffect(ActiveHandles[RemoveIndex].Value));
+					FActiveEffectHandle::Release(ActiveHandles[RemoveIndex].Key);
+					FActiveEffectHandle::Release(ActiveHandles[RemoveIndex].Value);
+					ActiveHandles.RemoveAtSwap(RemoveIndex);
+				}
+
+				const int32 CurBaseValue = RandomStream.RandRange(-100, 100);
+				TestEqual("Composed tree matches layer buckets", TreeEffects.GetCurrentValue(CurBaseValue), ArrayEffects.GetCurrentValue(CurBaseValue));
+			}
+
+			for (const TPair<FActiveEffectHandle, FActiveEffectHandle>& CurHandles : ActiveHandles)
+			{
+				FActiveEffectHandle::Release(CurHandles.Key);
+				FActiveEffectHandle::Release(CurHandles.Value);
+			}
+			TestTrue("Composed tree cleared", TreeEffects.ClearLayeredEffects());
+			TestEqual("Cleared composed tree leaves the base value", TreeEffects.GetCurrentValue(7), 7);
+		});
+
+		It("Effect stacks order same-layer effects by application sequence, without needing a world or the game thread", [this]()
+		{
+			const int64 FirstSequence = FActiveEffectDefinition::GenerateSequence();
+			TestTrue("Application sequence only moves forward", FActiveEffectDefinition::GenerateSequence() > FirstSequence);
+
+			for (const ELayeredEffectBackend Backend : { ELayeredEffectBackend::LayerBuckets, ELayeredEffectBackend::ComposedTree })
+			{
+				TFuture<int32> Result = Async(EAsyncExecution::Thread, [Backend]()
+				{
+					FSortedEffectDefinitions Stack(Backend);
+					Stack.AddLayeredEffect(FLayeredEffectDefinition(EAttributeKey::Power, EEffectOperation::Set, 2, 0));
+					Stack.AddLayeredEffect(FLayeredEffectDefinition(EAttributeKey::Power, EEffectOperation::Multiply, 3, 0));
+					Stack.AddLayeredEffect(FLayeredEffectDefinition(EAttributeKey::Power, EEffectOperation::Add, 1, 0));
+					const int32 Value = Stack.GetCurrentValue(0);
+
+					Stack.ForEachEffect([](const FActiveEffectDefinition& CurEffect)
+					{
+						FActiveEffectHandle::Release(CurEffect.GetHandle());
+					});
+					return Value;
+				});
+				TestEqual(FString::Printf(TEXT("%s applies same-layer effects in the order they were added"), *UEnumLibrary::GetEnumValueShortAsString(Backend)), Result.Get(), 7);
+			}
+		});
+
+		It("Compiled effect programs fold effect stacks into a few steps that evaluate like the effects one by one", [this, MakeRandomEffect]()
+		{
+			FSortedEffectDefinitions Effects(ELayeredEffectBackend::LayerBuckets);
+			TArray<FActiveEffectHandle> ActiveHandles;
+
+			FRandomStream RandomStream(4242);
+			for (int32 i = 0; i < 200; i++)
+			{
+				ActiveHandles.Add(Effects.AddLayeredEffect(MakeRandomEffect(RandomStream, 4)));
+
+				if (i % 3 == 2)
+				{
+					const int32 RemoveIndex = RandomStream.RandRange(0, ActiveHandles.Num() - 1);
+					Effects.RemoveLayeredEffect(ActiveHandles[RemoveIndex]);
+					FActiveEffectHandle::Release(ActiveHandles[RemoveIndex]);
+					ActiveHandles.RemoveAtSwap(RemoveIndex);
+				}
+
+				const int32 CurBaseValue = RandomStream.RandRange(-100, 100);
+				int32 ExpectedValue = CurBaseValue;
+				Effects.ForEachEffect([&ExpectedValue](const FActiveEffectDefinition& CurEffect)
+				{
+					ExpectedValue = EEffectOperationUtils::Evaluate(ExpectedValue, CurEffect.GetEffectDefinition().GetModification(), CurEffect.GetEffectDefinition().GetOperation());
+				});
+				TestEqual("Compiled program matches evaluating each effect", Effects.GetCurrentValue(CurBaseValue), ExpectedValue);
+			}
+			for (const FActiveEffectHandle& CurHandle : ActiveHandles)
+			{
+				FActiveEffectHandle::Release(CurHandle);
+			}
+			TestTrue("Cleared", Effects.ClearLayeredEffects());
+
+			// 500 arithmetic effects fold into a single multiply-add
+			for (int32 i = 0; i < 500; i++)
+			{
+				const EEffectOperation Operation = (i % 50 == 0) ? EEffectOperation::Multiply : ((i % 2 == 0) ? EEffectOperation::Add : EEffectOperation::Subtract);
+				Effects.AddLayeredEffect(FLayeredEffectDefinition(EAttributeKey::Power, Operation, (i % 50 == 0) ? 2 : 3, i % 5));
+			}
+			TestEqual("Arithmetic runs fold into one step", Effects.GetCompiledProgram().NumSteps(), 1);
+
+			Effects.AddLayeredEffect(FLayeredEffectDefinition(EAttributeKey::Power, EEffectOperation::BitwiseOr, 1, 10));
+			Effects.AddLayeredEffect(FLayeredEffectDefinition(EAttributeKey::Power, EEffectOperation::BitwiseAnd, 0xFF, 10));
+			TestEqual("Adjacent masks merge into one step", Effects.GetCompiledProgram().NumSteps(), 2);
+
+			const FActiveEffectHandle SetHandle = Effects.AddLayeredEffect(FLayeredEffectDefinition(EAttributeKey::Power, EEffectOperation::Set, 5, 20));
+			Effects.AddLayeredEffect(FLayeredEffectDefinition(EAttributeKey::Power, EEffectOperation::Add, 2, 20));
+			TestEqual("A Set drops everything before it, and folds everything after it", Effects.GetCompiledProgram().NumSteps(), 1);
+			TestEqual("Set then add ignores the base value", Effects.GetCurrentValue(1000), 7);
+
+			TestTrue("Set removed", Effects.RemoveLayeredEffect(SetHandle));
+			FActiveEffectHandle::Release(SetHandle);
+			TestEqual("Removing the Set recompiles what it hid", Effects.GetCompiledProgram().NumSteps(), 3);
+
+			Effects.ForEachEffect([](const FActiveEffectDefinition& CurEffect)
+			{
+				FActiveEffectHandle::Release(CurEffect.GetHandle());
+			});
+		});
+
+		It("Batch evaluation matches evaluating each effect stack on its own", [this, MakeRandomEffect]()
+		{
+			// Mix stacks sharing a common effect (long same-operation runs) with random ones of different lengths
+			FRandomStream RandomStream(4242);
+			TArray<FSortedEffectDefinitions> Stacks;
+			TArray<int32> BaseValues;
+			for (int32 i = 0; i < 300; i++)
+			{
+				FSortedEffectDefinitions& CurStack = Stacks.Emplace_GetRef(ELayeredEffectBackend::LayerBuckets);
+				CurStack.AddLayeredEffect(FLayeredEffectDefinition(EAttributeKey::Power, EEffectOperation::Add, 1, 0));
+				const int32 NumRandomEffects = (i % 4 == 0) ? 0 : RandomStream.RandRange(1, 6);
+				for (int32 j = 0; j < NumRandomEffects; j++)
+				{
+					CurStack.AddLayeredEffect(MakeRandomEffect(RandomStream, 3));
+				}
+				BaseValues.Add(RandomStream.RandRange(-100, 100));
+			}
+
+			FLayeredEffectBatch Batch;
+			for (int32 i = 0; i < Stacks.Num(); i++)
+			{
+				TestEqual("Lanes are numbered in order", Batch.AddLane(BaseValues[i], Stacks[i]), i);
+			}
+			Batch.Evaluate();
+
+			for (int32 i = 0; i < Stacks.Num(); i++)
+			{
+				if (Batch.GetResult(i) != Stacks[i].GetCurrentValue(BaseValues[i]))
+				{
+					AddError(FString::Printf(TEXT("Lane %d evaluated to %d, expected %d"), i, Batch.GetResult(i), Stacks[i].GetCurrentValue(BaseValues[i])));
+					break;
+				}
+			}
+
+			Batch.Reset();
+			TestEqual("Reset removes every lane", Batch.Num(), 0);
+
+			for (const FSortedEffectDefinitions& CurStack : Stacks)
+			{
+				CurStack.ForEachEffect([](const FActiveEffectDefinition& CurEffect)
+				{
+					FActiveEffectHandle::Release(CurEffect.GetHandle());
+				});
+			}
+		});
+
+		It("Rolling back a transaction restores base values and effects, committing keeps them", [this]()
+		{
+			const EAttributeKey Attribute = EAttributeKey::Toughness;
+			const int32 BaseValue = 3;
+			const int32 AddAmt = 2;
+
+			bool bSuccess = false;
+			MyCharacter->SetBaseAttribute(Attribute, BaseValue);
+			const FActiveEffectHandle AddHandle = MyCharacter->AddLayeredEffect(FLayeredEffectDefinition(Attribute, EEffectOperation::Add, AddAmt, 0), bSuccess);
+			TestTrue("Layered effect was successfully applied", bSuccess);
+
+			{
+				FScopedAttributeTransaction Transaction(*MyCharacter);
+				MyCharacter->SetBaseAttribute(Attribute, 10);
+				TestTrue("Effect removed inside the transaction", MyCharacter->RemoveLayeredEffect(AddHandle));
+				MyCharacter->AddLayeredEffect(FLayeredEffectDefinition(Attribute, EEffectOperation::Multiply, 4, 1), bSuccess);
+				TestEqual("Changes are visible inside the transaction", MyCharacter->GetCurrentAttribute(Attribute), 40);
+				Transaction.Rollback();
+			}
+
+			TestEqual("Base value restored by rollback", MyCharacter->GetBaseAttribute(Attribute), BaseValue);
+			TestEqual("Effects restored by rollback", MyCharacter->GetCurrentAttribute(Attribute), (BaseValue + AddAmt));
+			TestTrue("Handle of an effect restored by rollback is still live", AddHandle.IsLive());
+
+			{
+				FScopedAttributeTransaction Transaction(*MyCharacter);
+				{
+					FScopedAttributeTransaction NestedTransaction(*MyCharacter);
+					MyCharacter->SetBaseAttribute(Attribute, 10);
+				}
+				TestTrue("Restored effect can still be removed by its handle", MyCharacter->RemoveLayeredEffect(AddHandle));
+			}
+
+			TestEqual("Committed changes are kept", MyCharacter->GetCurrentAttribute(Attribute), 10);
+			TestFalse("Handle of an effect removed by a committed transaction is released", AddHandle.IsLive());
+		});
+
+		It("Effect handles are unique across threads, and go stale once released even if their slot is reused", [this]()
+		{
+			constexpr int32 NumHandles = 4096;
+			TArray<FActiveEffectHandle> Handles;
+			Handles.SetNum(NumHandles);
+			ParallelFor(NumHandles, [&Handles](int32 Index)
+			{
+				Handles[Index] = FActiveEffectHandle::GenerateNewHandle(EAttributeKey::Power);
+			});
+
+			TSet<FActiveEffectHandle> UniqueHandles(Handles);
+			TestEqual("Every handle generated in parallel is unique", UniqueHandles.Num(), NumHandles);
+			TestTrue("Generated handles are live", Algo::AllOf(Handles, [](const FActiveEffectHandle& CurHandle) { return CurHandle.IsLive(); }));
+
+			ParallelFor(NumHandles, [&Handles](int32 Index)
+			{
+				FActiveEffectHandle::Release(Handles[Index]);
+			});
+			TestFalse("Released handles are stale", Algo::AnyOf(Handles, [](const FActiveEffectHandle& CurHandle) { return CurHandle.IsLive(); }));
+
+			const FActiveEffectHandle Recycled = FActiveEffectHandle::GenerateNewHandle(EAttributeKey::Power);
+			TestFalse("A recycled slot doesn't match any released handle", UniqueHandles.Contains(Recycled));
+			FActiveEffectHandle::Release(Recycled);
+			FActiveEffectHandle::Release(Recycled);
+			TestFalse("Releasing twice is harmless", Recycled.IsLive());
+		});
+
+		It("Snapshot readers on other threads see every attribute from the same commit", [this]()
+		{
+			const FLayeredAttributeSnapshotReader Reader = MyCharacter->GetAttributeSnapshotReader();
+
+			// Power and Toughness only ever change together, so a reader must never see them differ
+			std::atomic<bool> bStopReading { false };
+			std::atomic<int32> NumTornReads { 0 };
+			std::atomic<int32> NumReads { 0 };
+			TFuture<void> ReaderTask = Async(EAsyncExecution::Thread, [Reader, &bStopReading, &NumTornReads, &NumReads]()
+			{
+				while (!bStopReading.load())
+				{
+					const FLayeredAttributeSnapshot Snapshot = Reader->Read();
+					if (Snapshot.GetValue(EAttributeKey::Power) != Snapshot.GetValue(EAttributeKey::Toughness))
+					{
+						NumTornReads++;
+					}
+					NumReads++;
+				}
+			});
+
+			constexpr int32 NumCommits = 2000;
+			for (int32 i = 1; i <= NumCommits; i++)
+			{
+				FScopedAttributeTransaction Transaction(*MyCharacter);
+				MyCharacter->SetBaseAttribute(EAttributeKey::Power, i);
+				MyCharacter->SetBaseAttribute(EAttributeKey::Toughness, i);
+			}
+
+			bStopReading = true;
+			ReaderTask.Wait();
+
+			TestEqual("No reader saw a half-applied transaction", NumTornReads.load(), 0);
+			TestTrue("Reader actually ran", NumReads.load() > 0);
+			TestEqual("Latest commit is published", Reader->Read().GetValue(EAttributeKey::Power), NumCommits);
+
+			const uint32 PublishedVersion = Reader->GetVersion();
+			MyCharacter->SetBaseAttribute(EAttributeKey::Power, NumCommits);
+			TestEqual("Unchanged values aren't published again", Reader->GetVersion(), PublishedVersion);
+		});
+
+		It("Commands queued from other threads are applied in order when the subsystem drains them, with one broadcast per attribute", [this]()
+		{
+			ULayeredAttributeSubsystem* Subsystem = World->GetSubsystem<ULayeredAttributeSubsystem>();
+			TestNotNull("World has a layered attribute subsystem", Subsystem);
+			if (Subsystem == nullptr)
+			{
+				return;
+			}
+
+			int32 NumPowerBroadcasts = 0;
+			const FDelegateHandle ListenerHandle = MyCharacter->GetOnAnyAttributeValueChangedNative().AddLambda([&NumPowerBroadcasts](const FOnAttributeChangedData& Data)
+			{
+				NumPowerBroadcasts += (Data.GetAttribute() == EAttributeKey::Power) ? 1 : 0;
+			});
+
+			const FLayeredAttributeEntityHandle Entity = Subsystem->CreateAttributeEntity();
+			FLayeredAttributeCommandQueue& Queue = Subsystem->GetCommandQueue();
+
+			// Each worker adds 1 to Power of both the character and the entity
+			constexpr int32 NumWorkers = 64;
+			TArray<TFuture<FActiveEffectHandle>> CharacterHandles;
+			TArray<TFuture<FActiveEffectHandle>> EntityHandles;
+			CharacterHandles.SetNum(NumWorkers);
+			EntityHandles.SetNum(NumWorkers);
+			AWizardsCharacter* Character = MyCharacter;
+			ParallelFor(NumWorkers, [&Queue, &CharacterHandles, &EntityHandles, Character, Entity](int32 Index)
+			{
+				CharacterHandles[Index] = Queue.AddLayeredEffect(Character, FLayeredEffectDefinition(EAttributeKey::Power, EEffectOperation::Add, 1, 0));
+				EntityHandles[Index] = Queue.AddLayeredEffect(Entity, FLayeredEffectDefinition(EAttributeKey::Power, EEffectOperation::Add, 1, 0));
+			});
+			Queue.SetBaseAttribute(Character, EAttributeKey::Power, 10);
+
+			TestEqual("Nothing is applied until the queue is drained", MyCharacter->GetCurrentAttribute(EAttributeKey::Power), 0);
+			TestFalse("Handles aren't known until the queue is drained", CharacterHandles[0].IsReady());
+
+			TestEqual("Every queued command is drained", Subsystem->ExecuteQueuedCommands(), (NumWorkers * 2) + 1);
+			TestEqual("Character has every queued effect", MyCharacter->GetCurrentAttribute(EAttributeKey::Power), 10 + NumWorkers);
+			TestEqual("Entity has every queued effect", Subsystem->GetEntityCurrentAttribute(Entity, EAttributeKey::Power), NumWorkers);
+			TestEqual("Queued changes to one object are broadcast once per attribute", NumPowerBroadcasts, 1);
+			TestTrue("Every handle is fulfilled with a valid handle", Algo::AllOf(CharacterHandles, [](const TFuture<FActiveEffectHandle>& CurHandle)
+			{
+				return CurHandle.IsReady() && CurHandle.Get().IsValid();
+			}));
+
+			TFuture<bool> Removed = Queue.RemoveLayeredEffect(Character, CharacterHandles[0].Get());
+			TFuture<bool> RemovedTwice = Queue.RemoveLayeredEffect(Character, CharacterHandles[0].Get());
+			Queue.ClearLayeredEffects(Entity);
+			Subsystem->ExecuteQueuedCommands();
+			TestTrue("Queued removal succeeded", Removed.Get());
+			TestFalse("Queued removals apply in order", RemovedTwice.Get());
+			TestEqual("Character lost one effect", MyCharacter->GetCurrentAttribute(EAttributeKey::Power), 10 + NumWorkers - 1);
+			TestEqual("Entity lost every effect", Subsystem->GetEntityCurrentAttribute(Entity, EAttributeKey::Power), 0);
+
+			Subsystem->DestroyAttributeEntity(Entity);
+			TFuture<FActiveEffectHandle> Dropped = Queue.AddLayeredEffect(Entity, FLayeredEffectDefinition(EAttributeKey::Power, EEffectOperation::Add, 1, 0));
+			Subsystem->ExecuteQueuedCommands();
+			TestFalse("Commands on destroyed targets are dropped", Dropped.Get().IsValid());
+
+			MyCharacter->GetOnAnyAttributeValueChangedNative().Remove(ListenerHandle);
+		});
+
+		It("Expiring effects remove themselves exactly when their time runs out or their scope ends, one broadcast per object", [this]()
+		{
+			// Durations landing on every level of the timer wheel, driven by a fake clock
+			FLayeredEffectExpiryScheduler Scheduler;
+			const TArray<double> Durations = { 0.5, 1.0, 90.0, 3600.0 };
+			TArray<FActiveEffectHandle> Handles;
+			for (const double CurDuration : Durations)
+			{
+				Handles.Add(FActiveEffectHandle::GenerateNewHandle(EAttributeKey::Power));
+				Scheduler.Schedule(MyCharacter, Handles.Last(), FLayeredEffectExpiry::AfterSeconds(CurDuration), 0.0);
+			}
+			const FActiveEffectHandle RemovedEarly = FActiveEffectHandle::GenerateNewHandle(EAttributeKey::Power);
+			Scheduler.Schedule(MyCharacter, RemovedEarly, FLayeredEffectExpiry::AfterSeconds(2.0), 0.0);
+			FActiveEffectHandle::Release(RemovedEarly);
+
+			TArray<FExpiredLayeredEffect> Expired;
+			for (int32 i = 0; i < Durations.Num(); i++)
+			{
+				Scheduler.Advance(Durations[i] - 0.05, Expired);
+				TestEqual(FString::Printf(TEXT("Nothing expires before %.1fs"), Durations[i]), Expired.Num(), 0);
+				Scheduler.Advance(Durations[i], Expired);
+				TestTrue(FString::Printf(TEXT("Only the %.1fs effect expires at %.1fs"), Durations[i], Durations[i]), Expired.Num() == 1 && Expired[0].Handle == Handles[i]);
+				Expired.Reset();
+			}
+			TestEqual("Every timer is gone, including the one for the effect removed early", Scheduler.NumTimers(), 0);
+			for (const FActiveEffectHandle& CurHandle : Handles)
+			{
+				FActiveEffectHandle::Release(CurHandle);
+			}
+
+			ULayeredAttributeSubsystem* Subsystem = World->GetSubsystem<ULayeredAttributeSubsystem>();
+			TestNotNull("World has a layered attribute subsystem", Subsystem);
+			if (Subsystem == nullptr)
+			{
+				return;
+			}
+
+			int32 NumPowerBroadcasts = 0;
+			const FDelegateHandle ListenerHandle = MyCharacter->GetOnAnyAttributeValueChangedNative().AddLambda([&NumPowerBroadcasts](const FOnAttributeChangedData& Data)
+			{
+				NumPowerBroadcasts += (Data.GetAttribute() == EAttributeKey::Power) ? 1 : 0;
+			});
+
+			static const FName TurnScope = TEXT("Turn");
+			bool bSuccess = false;
+			MyCharacter->SetBaseAttribute(EAttributeKey::Power, 1);
+			MyCharacter->AddLayeredEffect(FLayeredEffectDefinition(EAttributeKey::Power, EEffectOperation::Multiply, 3, 1), bSuccess);
+			MyCharacter->AddExpiringLayeredEffect(FLayeredEffectDefinition(EAttributeKey::Power, EEffectOperation::Add, 2, 0), FLayeredEffectExpiry::UntilEndOf(TurnScope), bSuccess);
+			MyCharacter->AddExpiringLayeredEffect(FLayeredEffectDefinition(EAttributeKey::Power, EEffectOperation::Add, 4, 0), FLayeredEffectExpiry::UntilEndOf(TurnScope), bSuccess);
+			const FActiveEffectHandle Removed = MyCharacter->AddExpiringLayeredEffect(FLayeredEffectDefinition(EAttributeKey::Power, EEffectOperation::Add, 8, 0), FLayeredEffectExpiry::UntilEndOf(TurnScope), bSuccess);
+			MyCharacter->RemoveLayeredEffect(Removed);
+			TestEqual("Scoped effects apply until their scope ends", MyCharacter->GetCurrentAttribute(EAttributeKey::Power), (1 + 2 + 4) * 3);
+
+			NumPowerBroadcasts = 0;
+			Subsystem->EndExpiryScope(TurnScope);
+			TestEqual("Ending the scope removes only its effects", MyCharacter->GetCurrentAttribute(EAttributeKey::Power), 3);
+			TestEqual("Expired effects are broadcast together", NumPowerBroadcasts, 1);
+
+			MyCharacter->GetOnAnyAttributeValueChangedNative().Remove(ListenerHandle);
+		});
+
+		It("Replicated effects reach clients as deltas, with the server's handles and ordering", [this]()
+		{
+			FLayeredAttributeBlock ServerAttributes;
+			ServerAttributes.SetBaseValue(EAttributeKey::Power, 1);
+			const FActiveEffectHandle Doubled = ServerAttributes.AddLayeredEffect(FLayeredEffectDefinition(EAttributeKey::Power, EEffectOperation::Multiply, 2, 1));
+			ServerAttributes.AddLayeredEffect(FLayeredEffectDefinition(EAttributeKey::Power, EEffectOperation::Add, 3, 0));
+			ServerAttributes.AddLayeredEffect(FLayeredEffectDefinition(EAttributeKey::Power, EEffectOperation::Set, 5, 0));
+			ServerAttributes.AddLayeredEffect(FLayeredEffectDefinition(EAttributeKey::Toughness, EEffectOperation::Add, 4, 0));
+
+			FReplicatedLayeredEffects ServerEffects;
+			TestTrue("First sync adds every effect", ServerEffects.SyncFrom(ServerAttributes));
+			TestEqual("One item per effect", ServerEffects.GetItems().Num(), 4);
+			TestFalse("Syncing unchanged stacks does nothing", ServerEffects.SyncFrom(ServerAttributes));
+
+			// Apply in reverse, as a client might receive them, to check the ordering travels with the effects
+			FLayeredAttributeBlock ClientAttributes;
+			ClientAttributes.SetBaseValue(EAttributeKey::Power, 1);
+			for (int32 i = ServerEffects.GetItems().Num() - 1; i >= 0; i--)
+			{
+				TestTrue("Client applies the replicated effect", ClientAttributes.AddActiveEffect(ServerEffects.GetItems()[i].Effect));
+			}
+			TestFalse("Effects already applied are ignored", ClientAttributes.AddActiveEffect(ServerEffects.GetItems()[0].Effect));
+			TestEqual("Client evaluates Power like the server", ClientAttributes.GetCurrentValue(EAttributeKey::Power), ServerAttributes.GetCurrentValue(EAttributeKey::Power));
+			TestEqual("Client evaluates Toughness like the server", ClientAttributes.GetCurrentValue(EAttributeKey::Toughness), ServerAttributes.GetCurrentValue(EAttributeKey::Toughness));
+
+			// Clients don't have the server's shared effects, so the ones that apply travel with the object's own
+			FSharedEffectRegistry SharedEffects;
+			ServerAttributes.SetSharedEffects(&SharedEffects);
+			const FActiveEffectHandle Shared = SharedEffects.AddSharedEffect(FLayeredEffectDefinition(EAttributeKey::Power, EEffectOperation::Add, 10, 0), FSharedEffectTargetFilter());
+			const FActiveEffectHandle OtherControllers = SharedEffects.AddSharedEffect(FLayeredEffectDefinition(EAttributeKey::Power, EEffectOperation::Add, 100, 0), FSharedEffectTargetFilter(true, 7, 0));
+			TestTrue("Adding a shared effect that applies changes the mirror", ServerEffects.SyncFrom(ServerAttributes));
+			TestEqual("Only the shared effect that applies is sent", ServerEffects.GetItems().Num(), 5);
+			for (const FReplicatedLayeredEffect& CurItem : ServerEffects.GetItems())
+			{
+				ClientAttributes.AddActiveEffect(CurItem.Effect);
+			}
+			TestEqual("Client evaluates shared effects like the server", ClientAttributes.GetCurrentValue(EAttributeKey::Power), ServerAttributes.GetCurrentValue(EAttributeKey::Power));
+
+			ServerAttributes.SetBaseValue(EAttributeKey::Controller, 7);
+			TestTrue("Starting to match another shared effect changes the mirror", ServerEffects.SyncFrom(ServerAttributes));
+			TestEqual("Both shared effects are sent", ServerEffects.GetItems().Num(), 6);
+			ClientAttributes.SetBaseValue(EAttributeKey::Controller, 7);
+			for (const FReplicatedLayeredEffect& CurItem : ServerEffects.GetItems())
+			{
+				ClientAttributes.AddActiveEffect(CurItem.Effect);
+			}
+			TestEqual("Client follows the server's shared effect targeting", ClientAttributes.GetCurrentValue(EAttributeKey::Power), ServerAttributes.GetCurrentValue(EAttributeKey::Power));
+
+			SharedEffects.Reset();
+			TestTrue("Removing shared effects changes the mirror", ServerEffects.SyncFrom(ServerAttributes));
+			TestEqual("Removed shared effects are dropped", ServerEffects.GetItems().Num(), 4);
+			TestTrue("Client removes the shared effect by the server's handle", ClientAttributes.RemoveActiveEffect(Shared));
+			TestTrue("Client removes the other shared effect by the server's handle", ClientAttributes.RemoveActiveEffect(OtherControllers));
+			ServerAttributes.SetSharedEffects(nullptr);
+
+			ServerAttributes.RemoveLayeredEffect(Doubled);
+			TestTrue("Removing an effect changes the mirror", ServerEffects.SyncFrom(ServerAttributes));
+			TestEqual("Only the removed effect's item is gone", ServerEffects.GetItems().Num(), 3);
+			TestTrue("Client removes the effect by the server's handle", ClientAttributes.RemoveActiveEffect(Doubled));
+			TestEqual("Client still matches the server", ClientAttributes.GetCurrentValue(EAttributeKey::Power), ServerAttributes.GetCurrentValue(EAttributeKey::Power));
+
+			ServerAttributes.ClearLayeredEffects(EAttributeKey::Power);
+			ServerAttributes.ClearLayeredEffects(EAttributeKey::Toughness);
+		});
+
+		It("Replicated effects survive a round trip through NetDeltaSerialize and apply to the client's object", [this]()
+		{
+			FLayeredAttributeBlock ServerAttributes;
+			ServerAttributes.SetBaseValue(EAttributeKey::Power, 1);
+			const FActiveEffectHandle Doubled = ServerAttributes.AddLayeredEffect(FLayeredEffectDefinition(EAttributeKey::Power, EEffectOperation::Multiply, 2, 1));
+			ServerAttributes.AddLayeredEffect(FLayeredEffectDefinition(EAttributeKey::Power, EEffectOperation::Add, 3, 0));
+			ServerAttributes.AddLayeredEffect(FLayeredEffectDefinition(EAttributeKey::Toughness, EEffectOperation::Add, 4, 0));
+
+			FReplicatedLayeredEffects ServerEffects;
+			FReplicatedLayeredEffects ClientEffects;
+			ClientEffects.SetOwner(MyCharacter);
+			MyCharacter->SetBaseAttribute(EAttributeKey::Power, 1);
+
+			FTestNetSerializeCB NetSerializeCB;
+			UPackageMap* PackageMap = NewObject<UPackageMap>();
+			TSharedPtr<INetDeltaBaseState> AckedState;
+			const auto Replicate = [this, &ServerEffects, &ClientEffects, &NetSerializeCB, PackageMap, &AckedState]() -> int64
+			{
+				FBitWriter Writer(0, true);
+				TSharedPtr<INetDeltaBaseState> NewState;
+				FNetDeltaSerializeInfo WriteParams;
+				WriteParams.Writer = &Writer;
+				WriteParams.Map = PackageMap;
+				WriteParams.NetSerializeCB = &NetSerializeCB;
+				WriteParams.Object = MyCharacter;
+				WriteParams.OldState = AckedState.Get();
+				WriteParams.NewState = &NewState;
+				if (!ServerEffects.NetDeltaSerialize(WriteParams))
+				{
+					return 0;
+				}
+				AckedState = NewState;
+
+				FBitReader Reader(Writer.GetData(), Writer.GetNumBits());
+				FNetDeltaSerializeInfo ReadParams;
+				ReadParams.Reader = &Reader;
+				ReadParams.Map = PackageMap;
+				ReadParams.NetSerializeCB = &NetSerializeCB;
+				ReadParams.Object = MyCharacter;
+				TestTrue("Client reads the update", ClientEffects.NetDeltaSerialize(ReadParams) && !Reader.IsError());
+				return Writer.GetNumBits();
+			};
+
+			ServerEffects.SyncFrom(ServerAttributes);
+			TestTrue("First update is sent", Replicate() > 0);
+			TestEqual("Client has every effect", ClientEffects.GetItems().Num(), 3);
+			TestEqual("Client evaluates Power like the server", MyCharacter->GetCurrentAttribute(EAttributeKey::Power), ServerAttributes.GetCurrentValue(EAttributeKey::Power));
+			TestEqual("Client evaluates Toughness like the server", MyCharacter->GetCurrentAttribute(EAttributeKey::Toughness), ServerAttributes.GetCurrentValue(EAttributeKey::Toughness));
+			TestEqual("Nothing is sent to an up to date client", Replicate(), 0);
+
+			ServerAttributes.RemoveLayeredEffect(Doubled);
+			ServerEffects.SyncFrom(ServerAttributes);
+			TestTrue("Removal is sent", Replicate() > 0);
+			TestEqual("Client dropped the removed effect", ClientEffects.GetItems().Num(), 2);
+			TestEqual("Client still matches the server", MyCharacter->GetCurrentAttribute(EAttributeKey::Power), ServerAttributes.GetCurrentValue(EAttributeKey::Power));
+
+			// Clearing replicates as removals, so the client lets go of the server's handles before they're released
+			ServerAttributes.ClearLayeredEffects(EAttributeKey::Power);
+			ServerAttributes.ClearLayeredEffects(EAttributeKey::Toughness);
+			ServerEffects.SyncFrom(ServerAttributes);
+			Replicate();
+			TestEqual("Client has no effects left", ClientEffects.GetItems().Num(), 0);
+			TestEqual("Client's Toughness is back to its base value", MyCharacter->GetCurrentAttribute(EAttributeKey::Toughness), 0);
+		});
+
+		It("Current values reach clients as bit-packed changes against the last state they were sent", [this]()
+		{
+			FLayeredAttributeBlock ServerAttributes;
+			ServerAttributes.SetBaseValue(EAttributeKey::Power, 3);
+			ServerAttributes.SetBaseValue(EAttributeKey::Toughness, -100);
+			const FActiveEffectHandle Boost = ServerAttributes.AddLayeredEffect(FLayeredEffectDefinition(EAttributeKey::Power, EEffectOperation::Multiply, 4, 0));
+
+			FReplicatedAttributeValues ServerValues;
+			FReplicatedAttributeValues ClientValues;
+			ClientValues.SetOwner(MyCharacter);
+			TSharedPtr<INetDeltaBaseState> AckedState;
+			const auto Replicate = [&ServerValues, &ClientValues, &AckedState]() -> int64
+			{
+				FBitWriter Writer(0, true);
+				TSharedPtr<INetDeltaBaseState> NewState;
+				FNetDeltaSerializeInfo WriteParams;
+				WriteParams.Writer = &Writer;
+				WriteParams.OldState = AckedState.Get();
+				WriteParams.NewState = &NewState;
+				if (!ServerValues.NetDeltaSerialize(WriteParams))
+				{
+					return 0;
+				}
+				AckedState = NewState;
+
+				FBitReader Reader(Writer.GetData(), Writer.GetNumBits());
+				FNetDeltaSerializeInfo ReadParams;
+				ReadParams.Reader = &Reader;
+				ClientValues.NetDeltaSerialize(ReadParams);
+				return Writer.GetNumBits();
+			};
+
+			TestTrue("Sync picks up the current values", ServerValues.SyncFrom(ServerAttributes));
+			TestTrue("First update is sent", Replicate() > 0);
+			TestEqual("Client receives Power", MyCharacter->GetCurrentAttribute(EAttributeKey::Power), 12);
+			TestEqual("Client receives negative values", MyCharacter->GetCurrentAttribute(EAttributeKey::Toughness), -100);
+
+			TestFalse("Sync without changes does nothing", ServerValues.SyncFrom(ServerAttributes));
+			TestEqual("Nothing is sent to an up to date client", Replicate(), 0);
+
+			ServerAttributes.RemoveLayeredEffect(Boost);
+			ServerValues.SyncFrom(ServerAttributes);
+			const int64 NumBits = Replicate();
+			TestEqual("Client receives the changed value", MyCharacter->GetCurrentAttribute(EAttributeKey::Power), 3);
+			TestEqual("Unchanged values are left alone", MyCharacter->GetCurrentAttribute(EAttributeKey::Toughness), -100);
+			TestTrue("Only the changed value is sent, packed into a few bits", NumBits > 0 && NumBits <= EAttributeKeyUtils::Num + 6 + 3);
+		});
+
+		It("Attribute state images restore base values, effects and their order, from memory or a mapped file", [this]()
+		{
+			constexpr int32 NumObjects = 3;
+			FLayeredAttributeBlock SavedAttributes[NumObjects];
+			for (int32 i = 0; i < NumObjects; i++)
+			{
+				SavedAttributes[i].SetBaseValue(EAttributeKey::Power, i + 1);
+				SavedAttributes[i].SetBaseValue(EAttributeKey::Toughness, -i);
+				for (int32 j = 0; j < i; j++)
+				{
+					// Same layer, so only the saved order tells these apart
+					SavedAttributes[i].AddLayeredEffect(FLayeredEffectDefinition(EAttributeKey::Power, EEffectOperation::Set, 10 * j, 0));
+					SavedAttributes[i].AddLayeredEffect(FLayeredEffectDefinition(EAttributeKey::Power, EEffectOperation::Add, j, 0));
+				}
+			}
+
+			FLayeredAttributeStateWriter Writer;
+			for (const FLayeredAttributeBlock& CurAttributes : SavedAttributes)
+			{
+				Writer.AddObject(CurAttributes);
+			}
+			TArray64<uint8> Bytes;
+			Writer.Write(Bytes);
+
+			const auto TestRestore = [this, &SavedAttributes](const FString& What, const FLayeredAttributeStateImage& Image)
+			{
+				TestEqual(What + TEXT(" has every object"), Image.NumObjects(), NumObjects);
+				for (int32 i = 0; i < Image.NumObjects(); i++)
+				{
+					FLayeredAttributeBlock RestoredAttributes;
+					TestTrue(What + TEXT(" restores the object"), Image.RestoreObject(i, RestoredAttributes));
+					for (const EAttributeKey CurAttribute : { EAttributeKey::Power, EAttributeKey::Toughness })
+					{
+						TestEqual(What + TEXT(" restores the base value"), RestoredAttributes.GetBaseValue(CurAttribute), SavedAttributes[i].GetBaseValue(CurAttribute));
+						TestEqual(What + TEXT(" restores the current value"), RestoredAttributes.GetCurrentValue(CurAttribute), SavedAttributes[i].GetCurrentValue(CurAttribute));
+					}
+
+					// Effects added after restoring still apply after the restored ones
+					RestoredAttributes.AddLayeredEffect(FLayeredEffectDefinition(EAttributeKey::Power, EEffectOperation::Add, 100, 0));
+					TestEqual(What + TEXT(" orders new effects after restored ones"), RestoredAttributes.GetCurrentValue(EAttributeKey::Power), SavedAttributes[i].GetCurrentValue(EAttributeKey::Power) + 100);
+					RestoredAttributes.ClearLayeredEffects(EAttributeKey::Power);
+				}
+			};
+			TestRestore(TEXT("Image in memory"), FLayeredAttributeStateImage(Bytes));
+
+			const FString Filename = FPaths::Combine(FPaths::AutomationTransientDir(), TEXT("LayeredAttributeState.bin"));
+			TestTrue("Image is saved to a file", Writer.SaveToFile(Filename));
+			{
+				FMappedLayeredAttributeStateImage MappedImage;
+				TestTrue("Saved image is mapped", MappedImage.Open(Filename));
+				TestRestore(TEXT("Mapped image"), MappedImage.GetImage());
+			}
+			IFileManager::Get().Delete(*Filename);
+
+			AddExpectedError(TEXT("truncated or corrupt"), EAutomationExpectedErrorFlags::Contains, 1);
+			Bytes.SetNum(Bytes.Num() - 1);
+			TestFalse("Truncated images are rejected", FLayeredAttributeStateImage().Initialize(Bytes));
+
+			for (FLayeredAttributeBlock& CurAttributes : SavedAttributes)
+			{
+				CurAttributes.ClearLayeredEffects(EAttributeKey::Power);
+			}
+		});
+
+		It("Timeline checkpoints roll attributes back to where they were, bringing removed effects back with their handles", [this]()
+		{
+			FLayeredAttributeTimeline Timeline;
+			FLayeredAttributeBlock Attributes;
+			Attributes.SetTimeline(&Timeline);
+			Attributes.SetBaseValue(EAttributeKey::Power, 2);
+			const FActiveEffectHandle Tripled = Attributes.AddLayeredEffect(FLayeredEffectDefinition(EAttributeKey::Power, EEffectOperation::Multiply, 3, 1));
+			TestEqual("Nothing is logged before the first checkpoint", Timeline.NumChanges(), 0);
+
+			const FLayeredAttributeCheckpoint Start = Timeline.Checkpoint();
+			Attributes.SetBaseValue(EAttributeKey::Power, 5);
+			Attributes.RemoveLayeredEffect(Tripled);
+			TestTrue("Removed effects keep their handle while a checkpoint can bring them back", Tripled.IsLive());
+
+			const FLayeredAttributeCheckpoint Middle = Timeline.Checkpoint();
+			Attributes.AddLayeredEffect(FLayeredEffectDefinition(EAttributeKey::Power, EEffectOperation::Add, 1, 0));
+			Attributes.ClearLayeredEffects(EAttributeKey::Power);
+			Attributes.SetBaseValue(EAttributeKey::Power, 7);
+			TestEqual("Changes apply as usual while recording", Attributes.GetCurrentValue(EAttributeKey::Power), 7);
+
+			TestTrue("Rolls back to the middle checkpoint", Timeline.Rollback(Middle));
+			TestEqual("Power is back to its middle value", Attributes.GetCurrentValue(EAttributeKey::Power), 5);
+			TestTrue("Rolls back to the start checkpoint", Timeline.Rollback(Start));
+			TestEqual("Power is back to its start value", Attributes.GetCurrentValue(EAttributeKey::Power), 6);
+			TestNotNull("Removed effect is back with its original handle", Attributes.GetEffects(EAttributeKey::Power).FindEffect(Tripled));
+			TestEqual("Only changes after the checkpoint were undone", Timeline.NumChanges(), 0);
+
+			Attributes.SetBaseValue(EAttributeKey::Power, 1);
+			TestFalse("Checkpoints that were rolled back past are stale, even once new changes reuse their position", Timeline.IsValid(Middle));
+			TestTrue("The checkpoint rolled back to is still valid", Timeline.IsValid(Start));
+
+			Timeline.Reset();
+			TestFalse("Reset stops recording", Timeline.IsRecording());
+			Attributes.ClearLayeredEffects(EAttributeKey::Power);
+			TestFalse("Handles are released as usual once nothing is recording", Tripled.IsLive());
+			Attributes.SetTimeline(nullptr);
+
+			// Every object in the world attaches to the subsystem's timeline
+			ULayeredAttributeSubsystem* Subsystem = World->GetSubsystem<ULayeredAttributeSubsystem>();
+			TestNotNull("World has a layered attribute subsystem", Subsystem);
+			if (Subsystem == nullptr)
+			{
+				return;
+			}
+
+			int32 NumPowerBroadcasts = 0;
+			const FDelegateHandle ListenerHandle = MyCharacter->GetOnAnyAttributeValueChangedNative().AddLambda([&NumPowerBroadcasts](const FOnAttributeChangedData& Data)
+			{
+				NumPowerBroadcasts += (Data.GetAttribute() == EAttributeKey::Power) ? 1 : 0;
+			});
+
+			const int32 StartPower = MyCharacter->GetCurrentAttribute(EAttributeKey::Power);
+			const FLayeredAttributeCheckpoint WorldStart = Subsystem->GetTimeline().Checkpoint();
+			bool bSuccess = false;
+			MyCharacter->SetBaseAttribute(EAttributeKey::Power, StartPower + 4);
+			MyCharacter->AddLayeredEffect(FLayeredEffectDefinition(EAttributeKey::Power, EEffectOperation::Multiply, 2, 0), bSuccess);
+
+			NumPowerBroadcasts = 0;
+			TestTrue("Rolls the world back", Subsystem->GetTimeline().Rollback(WorldStart));
+			TestEqual("Character's Power is back to its start value", MyCharacter->GetCurrentAttribute(EAttributeKey::Power), StartPower);
+			TestEqual("Rolling back broadcasts once per changed attribute", NumPowerBroadcasts, 1);
+
+			Subsystem->GetTimeline().Reset();
+			MyCharacter->GetOnAnyAttributeValueChangedNative().Remove(ListenerHandle);
+		});
+
+		It("What-if overlays evaluate hypothetical changes without touching or broadcasting from the object", [this]()
+		{
+			bool bSuccess = false;
+			MyCharacter->SetBaseAttribute(EAttributeKey::Power, 2);
+			const FActiveEffectHandle Doubled = MyCharacter->AddLayeredEffect(FLayeredEffectDefinition(EAttributeKey::Power, EEffectOperation::Multiply, 2, 1), bSuccess);
+			MyCharacter->AddLayeredEffect(FLayeredEffectDefinition(EAttributeKey::Power, EEffectOperation::Add, 3, 2), bSuccess);
+			TestEqual("Power starts at (2 * 2) + 3", MyCharacter->GetCurrentAttribute(EAttributeKey::Power), 7);
+
+			int32 NumBroadcasts = 0;
+			const FDelegateHandle ListenerHandle = MyCharacter->GetOnAnyAttributeValueChangedNative().AddLambda([&NumBroadcasts](const FOnAttributeChangedData& Data)
+			{
+				NumBroadcasts++;
+			});
+
+			FLayeredAttributeOverlay WhatIf = MyCharacter->MakeAttributeOverlay();
+			TestFalse("A fresh overlay changes nothing", WhatIf.IsChanged(EAttributeKey::Power));
+
+			// Layer 0 applies before the object's own effects, even though it is added last
+			TestTrue("Adds a hypothetical effect", WhatIf.AddLayeredEffect(FLayeredEffectDefinition(EAttributeKey::Power, EEffectOperation::Add, 1, 0)));
+			TestEqual("Hypothetical effects apply in layer order", WhatIf.GetCurrentValue(EAttributeKey::Power), ((2 + 1) * 2) + 3);
+
+			TestTrue("Removes one of the object's effects", WhatIf.RemoveLayeredEffect(Doubled));
+			TestFalse("Can't remove an effect twice", WhatIf.RemoveLayeredEffect(Doubled));
+			TestEqual("Removed effects no longer apply", WhatIf.GetCurrentValue(EAttributeKey::Power), (2 + 1) + 3);
+
+			// Copies branch without affecting each other
+			FLayeredAttributeOverlay Branch = WhatIf;
+			Branch.SetBaseValue(EAttributeKey::Power, 10);
+			TestEqual("Branch uses its hypothetical base value", Branch.GetCurrentValue(EAttributeKey::Power), (10 + 1) + 3);
+			TestEqual("Original overlay is unaffected by its branch", WhatIf.GetCurrentValue(EAttributeKey::Power), (2 + 1) + 3);
+
+			Branch.ClearLayeredEffects(EAttributeKey::Power);
+			TestEqual("Clearing drops the object's and the overlay's effects", Branch.GetCurrentValue(EAttributeKey::Power), 10);
+			TestEqual("Attributes the overlay doesn't change read through", Branch.GetCurrentValue(EAttributeKey::Toughness), MyCharacter->GetCurrentAttribute(EAttributeKey::Toughness));
+
+			TestEqual("Object's Power is untouched", MyCharacter->GetCurrentAttribute(EAttributeKey::Power), 7);
+			TestTrue("Object still has the effect removed in the overlay", MyCharacter->RemoveLayeredEffect(Doubled));
+			TestEqual("Overlays never broadcast", NumBroadcasts, 1);
+
+			WhatIf.Reset();
+			TestEqual("Reset overlays read the same as the object", WhatIf.GetCurrentValue(EAttributeKey::Power), MyCharacter->GetCurrentAttribute(EAttributeKey::Power));
+
+			MyCharacter->GetOnAnyAttributeValueChangedNative().Remove(ListenerHandle);
+		});
+
+		It("Deferred objects broadcast committed transactions with the rest of the frame's changes, once per attribute", [this]()
+		{
+			ULayeredAttributeSubsystem* Subsystem = World->GetSubsystem<ULayeredAttributeSubsystem>();
+			TestNotNull("World has a layered attribute subsystem", Subsystem);
+			if (Subsystem == nullptr)
+			{
+				return;
+			}
+
+			TArray<FOnAttributeChangedData> PowerChanges;
+			const FDelegateHandle ListenerHandle = MyCharacter->SubscribeToAttribute(EAttributeKey::Power, FOnAttributeChangedDelegate::CreateLambda([&PowerChanges](const FOnAttributeChangedData& Data)
+			{
+				PowerChanges.Add(Data);
+			}));
+			MyCharacter->SetAttributeNotifyMode(ELayeredAttributeNotifyMode::Deferred);
+
+			bool bSuccess = false;
+			{
+				FScopedAttributeTransaction Transaction(*MyCharacter);
+				MyCharacter->SetBaseAttribute(EAttributeKey::Power, 1);
+				MyCharacter->AddLayeredEffect(FLayeredEffectDefinition(EAttributeKey::Power, EEffectOperation::Add, 2, 0), bSuccess);
+			}
+			TestEqual("Committing doesn't broadcast for deferred objects", PowerChanges.Num(), 0);
+
+			MyCharacter->SetBaseAttribute(EAttributeKey::Power, 5);
+			{
+				FScopedAttributeTransaction Transaction(*MyCharacter);
+				MyCharacter->AddLayeredEffect(FLayeredEffectDefinition(EAttributeKey::Power, EEffectOperation::Multiply, 2, 1), bSuccess);
+				Transaction.Commit();
+			}
+			TestEqual("Nothing is broadcast until the subsystem flushes", PowerChanges.Num(), 0);
+			TestEqual("Values are up to date before the broadcast", MyCharacter->GetCurrentAttribute(EAttributeKey::Power), (5 + 2) * 2);
+
+			Subsystem->Tick(0.0f);
+			TestEqual("Every change this frame is broadcast once", PowerChanges.Num(), 1);
+			TestTrue("The broadcast spans the whole frame", PowerChanges.Num() == 1 && PowerChanges[0].GetOldValue() == 0 && PowerChanges[0].GetNewValue() == (5 + 2) * 2);
+
+			Subsystem->Tick(0.0f);
+			TestEqual("Nothing is broadcast twice", PowerChanges.Num(), 1);
+
+			MyCharacter->SetAttributeNotifyMode(ELayeredAttributeNotifyMode::Immediate);
+			MyCharacter->UnsubscribeFromAttributes(ListenerHandle);
+		});
+
+		It("Native listeners hear every change, and transactions coalesce them into one per changed attribute", [this]()
+		{
+			TArray<FOnAttributeChangedData> Changes;
+			const FDelegateHandle ListenerHandle = MyCharacter->GetOnAnyAttributeValueChangedNative().AddLambda([&Changes](const FOnAttributeChangedData& Data)
+			{
+				Changes.Add(Data);
+			});
+
+			MyCharacter->SetBaseAttribute(EAttributeKey::Power, 1);
+			MyCharacter->SetBaseAttribute(EAttributeKey::Power, 1);
+			TestEqual("Only actual changes are broadcast", Changes.Num(), 1);
+
+			Changes.Reset();
+			{
+				FScopedAttributeTransaction Transaction(*MyCharacter);
+				MyCharacter->SetBaseAttribute(EAttributeKey::Power, 2);
+				MyCharacter->SetBaseAttribute(EAttributeKey::Power, 3);
+				MyCharacter->SetBaseAttribute(EAttributeKey::Loyalty, 4);
+				MyCharacter->SetBaseAttribute(EAttributeKey::Loyalty, 0);
+				TestEqual("Nothing is broadcast until the transaction commits", Changes.Num(), 0);
+			}
+
+			TestEqual("One broadcast per attribute that actually changed", Changes.Num(), 1);
+			if (Changes.Num() == 1)
+			{
+				TestEqual("Coalesced change is for Power", Changes[0].GetAttribute(), EAttributeKey::Power);
+				TestEqual("Coalesced old value is from before the transaction", Changes[0].GetOldValue(), 1);
+				TestEqual("Coalesced new value is the final value", Changes[0].GetNewValue(), 3);
+			}
+
+			MyCharacter->GetOnAnyAttributeValueChangedNative().Remove(ListenerHandle);
+		});
+
+		It("Native subscriptions only hear about their attributes, threshold watchers only fire when their condition flips", [this]()
+		{
+			int32 NumToughnessChanges = 0;
+			const FDelegateHandle ToughnessHandle = MyCharacter->SubscribeToAttribute(EAttributeKey::Toughness,
+				FOnAttributeChangedDelegate::CreateLambda([&NumToughnessChanges](const FOnAttributeChangedData& Data)
+				{
+					NumToughnessChanges++;
+				}));
+
+			TArray<bool> DeathConditionChanges;
+			const FDelegateHandle DeathHandle = MyCharacter->WatchAttributeThreshold(EAttributeKey::Toughness, EAttributeComparison::LessOrEqual, 0,
+				FOnAttributeThresholdDelegate::CreateLambda([&DeathConditionChanges](const FOnAttributeChangedData& Data, bool bConditionMet)
+				{
+					DeathConditionChanges.Add(bConditionMet);
+				}));
+
+			MyCharacter->SetBaseAttribute(EAttributeKey::Power, 5);
+			TestEqual("Power changes don't wake Toughness subscribers", NumToughnessChanges, 0);
+
+			MyCharacter->SetBaseAttribute(EAttributeKey::Toughness, 3);
+			MyCharacter->SetBaseAttribute(EAttributeKey::Toughness, 2);
+			TestEqual("Every Toughness change is heard", NumToughnessChanges, 2);
+			TestEqual("Toughness <= 0 stopped holding once, then stayed false", DeathConditionChanges.Num(), 1);
+
+			bool bSuccess = false;
+			MyCharacter->AddLayeredEffect(FLayeredEffectDefinition(EAttributeKey::Toughness, EEffectOperation::Subtract, 5, 0), bSuccess);
+			MyCharacter->SetBaseAttribute(EAttributeKey::Toughness, 1);
+			TestEqual("Toughness <= 0 started holding once", DeathConditionChanges.Num(), 2);
+			TestTrue("Latest condition state is met", DeathConditionChanges.Last());
+
+			TestTrue("Unsubscribed from Toughness", MyCharacter->UnsubscribeFromAttributes(ToughnessHandle));
+			TestTrue("Stopped watching Toughness", MyCharacter->UnsubscribeFromAttributes(DeathHandle));
+			MyCharacter->SetBaseAttribute(EAttributeKey::Toughness, 10);
+			TestEqual("Unsubscribed delegates are not called", NumToughnessChanges, 4);
+		});
+
+		It("Attribute entities in the world subsystem evaluate the same as characters, and go stale once destroyed", [this]()
+		{
+			ULayeredAttributeSubsystem* Subsystem = World->GetSubsystem<ULayeredAttributeSubsystem>();
+			TestNotNull("World has a layered attribute subsystem", Subsystem);
+			if (Subsystem == nullptr)
+			{
+				return;
+			}
+
+			constexpr int32 NumEntities = 5000;
+			TArray<FLayeredAttributeEntityHandle> Entities;
+			for (int32 i = 0; i < NumEntities; i++)
+			{
+				const FLayeredAttributeEntityHandle Entity = Subsystem->CreateAttributeEntity();
+				Subsystem->SetEntityBaseAttribute(Entity, EAttributeKey::Power, i);
+				Entities.Add(Entity);
+			}
+
+			// Every other entity gets doubled, then boosted on a later layer
+			bool bSuccess = false;
+			for (int32 i = 0; i < NumEntities; i += 2)
+			{
+				Subsystem->AddEntityLayeredEffect(Entities[i], FLayeredEffectDefinition(EAttributeKey::Power, EEffectOperation::Add, 1, 1), bSuccess);
+				Subsystem->AddEntityLayeredEffect(Entities[i], FLayeredEffectDefinition(EAttributeKey::Power, EEffectOperation::Multiply, 2, 0), bSuccess);
+			}
+
+			MyCharacter->SetBaseAttribute(EAttributeKey::Power, 6);
+			MyCharacter->AddLayeredEffect(FLayeredEffectDefinition(EAttributeKey::Power, EEffectOperation::Add, 1, 1), bSuccess);
+			MyCharacter->AddLayeredEffect(FLayeredEffectDefinition(EAttributeKey::Power, EEffectOperation::Multiply, 2, 0), bSuccess);
+
+			Subsystem->RecomputeAttributes();
+			const TConstArrayView<int32> PowerColumn = Subsystem->GetStore().GetCurrentValueColumn(EAttributeKey::Power);
+			TestEqual("Entity matches a character with the same base and effects", PowerColumn[Entities[6].GetIndex()], MyCharacter->GetCurrentAttribute(EAttributeKey::Power));
+			for (int32 i = 0; i < NumEntities; i++)
+			{
+				const int32 Expected = (i % 2 == 0) ? ((i * 2) + 1) : i;
+				if (PowerColumn[Entities[i].GetIndex()] != Expected || Subsystem->GetEntityCurrentAttribute(Entities[i], EAttributeKey::Power) != Expected)
+				{
+					AddError(FString::Printf(TEXT("Entity %d has Power %d, expected %d"), i, PowerColumn[Entities[i].GetIndex()], Expected));
+					break;
+				}
+			}
+
+			// Copies of a bound block are unbound snapshots of its entity, so changing them leaves the entity alone
+			// Listeners, pending changes and snapshot readers stay with the original
+			FLayeredAttributeBlock Bound;
+			Bound.BindToStore(Subsystem->GetStore(), Entities[2]);
+			Bound.SetNotifyMode(ELayeredAttributeNotifyMode::Deferred);
+			int32 NumOriginalCalls = 0;
+			Bound.GetSubscriptions().Subscribe(EAttributeKeyUtils::ToMask(EAttributeKey::Power), FOnAttributeChangedDelegate::CreateLambda([&NumOriginalCalls](const FOnAttributeChangedData& Data)
+			{
+				NumOriginalCalls++;
+			}));
+			Bound.GetPendingChanges().Record(EAttributeKey::Power, 0);
+			Bound.GetPendingChanges().bQueued = true;
+			const FLayeredAttributeSnapshotReader Reader = Bound.GetOrCreateSnapshotBuffer();
+
+			FLayeredAttributeBlock Copy = Bound;
+			TestFalse("Copy of a bound block is unbound", Copy.IsBoundToStore());
+			TestEqual("Copy reads the entity's values", Copy.GetCurrentValue(EAttributeKey::Power), (2 * 2) + 1);
+			TestEqual("Copy keeps the notify mode", Copy.GetNotifyMode(), ELayeredAttributeNotifyMode::Deferred);
+			TestTrue("Copy has no pending changes", Copy.GetPendingChanges().IsEmpty());
+			TestFalse("Copy isn't queued, so it queues itself on its next change", Copy.GetPendingChanges().bQueued);
+			TestFalse("Copy doesn't listen with the original's subscribers", Copy.GetSubscriptions().IsWatching(EAttributeKey::Power));
+			TestFalse("Copy doesn't publish to the original's snapshot readers", Copy.HasSnapshotBuffer());
+
+			Copy.SetBaseValue(EAttributeKey::Power, 100);
+			Copy.GetOrCreateSnapshotBuffer();
+			Copy.PublishSnapshot();
+			TestEqual("Changing the copy leaves the entity alone", Subsystem->GetEntityCurrentAttribute(Entities[2], EAttributeKey::Power), (2 * 2) + 1);
+			TestEqual("Original's snapshot readers still see the entity", Reader->Read().GetValue(EAttributeKey::Power), (2 * 2) + 1);
+			TestTrue("Original keeps its pending change", Bound.GetPendingChanges().Contains(EAttributeKey::Power));
+			TestTrue("Original keeps its subscribers", Bound.GetSubscriptions().IsWatching(EAttributeKey::Power));
+			TestEqual("Original's subscribers heard nothing from the copy", NumOriginalCalls, 0);
+			Bound.ConsumePendingChanges();
+			Bound.AbandonStoreEntity();
+
+			const FLayeredAttributeEntityHandle Destroyed = Entities[0];
+			TestTrue("Destroyed entity", Subsystem->DestroyAttributeEntity(Destroyed));
+			TestFalse("Destroyed handle is stale", Subsystem->IsAttributeEntityValid(Destroyed));
+			const FLayeredAttributeEntityHandle Reused = Subsystem->CreateAttributeEntity();
+			TestEqual("Freed index is reused", Reused.GetIndex(), Destroyed.GetIndex());
+			TestFalse("Reused index does not revive the old handle", Subsystem->IsAttributeEntityValid(Destroyed));
+			TestEqual("Reused entity starts from scratch", Subsystem->GetEntityCurrentAttribute(Reused, EAttributeKey::Power), 0);
+
+			for (const FLayeredAttributeEntityHandle& Entity : Entities)
+			{
+				Subsystem->DestroyAttributeEntity(Entity);
+			}
+			Subsystem->DestroyAttributeEntity(Reused);
+		});
+
+		It("Shared effects apply in layer order to every matching object without being added to each one", [this]()
+		{
+			ULayeredAttributeSubsystem* Subsystem = World->GetSubsystem<ULayeredAttributeSubsystem>();
+			TestNotNull("World has a layered attribute subsystem", Subsystem);
+			if (Subsystem == nullptr)
+			{
+				return;
+			}
+
+			constexpr int32 CreatureType = 1 << 2;
+			MyCharacter->SetBaseAttribute(EAttributeKey::Controller, 1);
+			MyCharacter->SetBaseAttribute(EAttributeKey::Types, CreatureType);
+			MyCharacter->SetBaseAttribute(EAttributeKey::Power, 2);
+
+			const FLayeredAttributeEntityHandle OurToken = Subsystem->CreateAttributeEntity();
+			Subsystem->SetEntityBaseAttribute(OurToken, EAttributeKey::Controller, 1);
+			Subsystem->SetEntityBaseAttribute(OurToken, EAttributeKey::Types, CreatureType);
+			const FLayeredAttributeEntityHandle TheirToken = Subsystem->CreateAttributeEntity();
+			Subsystem->SetEntityBaseAttribute(TheirToken, EAttributeKey::Controller, 2);
+			Subsystem->SetEntityBaseAttribute(TheirToken, EAttributeKey::Types, CreatureType);
+
+			bool bSuccess = false;
+			MyCharacter->AddLayeredEffect(FLayeredEffectDefinition(EAttributeKey::Power, EEffectOperation::Multiply, 2, 1), bSuccess);
+			TestEqual("Own effects apply", MyCharacter->GetCurrentAttribute(EAttributeKey::Power), 4);
+
+			// "Creatures you control get +1", applied on an earlier layer than the character's own effect
+			const FActiveEffectHandle Anthem = Subsystem->AddSharedLayeredEffect(
+				FLayeredEffectDefinition(EAttributeKey::Power, EEffectOperation::Add, 1, 0),
+				FSharedEffectTargetFilter(true, 1, CreatureType),
+				bSuccess);
+			TestTrue("Shared effect added", bSuccess);
+			TestEqual("Shared effect is merged into the character's layer order", MyCharacter->GetCurrentAttribute(EAttributeKey::Power), 6);
+			TestEqual("Shared effect applies to matching entities", Subsystem->GetEntityCurrentAttribute(OurToken, EAttributeKey::Power), 1);
+			TestEqual("Shared effect skips entities that don't match", Subsystem->GetEntityCurrentAttribute(TheirToken, EAttributeKey::Power), 0);
+
+			MyCharacter->SetBaseAttribute(EAttributeKey::Controller, 2);
+			TestEqual("Changing controller stops the shared effect applying", MyCharacter->GetCurrentAttribute(EAttributeKey::Power), 4);
+			MyCharacter->SetBaseAttribute(EAttributeKey::Controller, 1);
+
+			bSuccess = true;
+			Subsystem->AddSharedLayeredEffect(FLayeredEffectDefinition(EAttributeKey::Controller, EEffectOperation::Set, 1, 0), FSharedEffectTargetFilter(), bSuccess);
+			TestFalse("Shared effects can't modify the attributes that choose their targets", bSuccess);
+
+			TestTrue("Shared effect removed", Subsystem->RemoveSharedLayeredEffect(Anthem));
+			TestFalse("Shared effect can only be removed once", Subsystem->RemoveSharedLayeredEffect(Anthem));
+			TestEqual("Removing the shared effect restores the character", MyCharacter->GetCurrentAttribute(EAttributeKey::Power), 4);
+			Subsystem->RecomputeAttributes();
+			TestEqual("Removing the shared effect restores entities", Subsystem->GetStore().GetCurrentValueColumn(EAttributeKey::Power)[OurToken.GetIndex()], 0);
+
+			Subsystem->DestroyAttributeEntity(OurToken);
+			Subsystem->DestroyAttributeEntity(TheirToken);
+		});
+
+		It("Adding and removing shared effects broadcasts to the matching objects they change", [this]()
+		{
+			ULayeredAttributeSubsystem* Subsystem = World->GetSubsystem<ULayeredAttributeSubsystem>();
+			TestNotNull("World has a layered attribute subsystem", Subsystem);
+			if (Subsystem == nullptr)
+			{
+				return;
+			}
+
+			MyCharacter->SetBaseAttribute(EAttributeKey::Controller, 1);
+			MyCharacter->SetBaseAttribute(EAttributeKey::Power, 2);
+			const FLayeredAttributeSnapshotReader Reader = MyCharacter->GetAttributeSnapshotReader();
+
+			TArray<FOnAttributeChangedData> PowerChanges;
+			const FDelegateHandle ListenerHandle = MyCharacter->SubscribeToAttribute(EAttributeKey::Power, FOnAttributeChangedDelegate::CreateLambda([&PowerChanges](const FOnAttributeChangedData& Data)
+			{
+				PowerChanges.Add(Data);
+			}));
+
+			bool bSuccess = false;
+			const FActiveEffectHandle Ours = Subsystem->AddSharedLayeredEffect(FLayeredEffectDefinition(EAttributeKey::Power, EEffectOperation::Add, 3, 0), FSharedEffectTargetFilter(true, 1, 0), bSuccess);
+			TestTrue("Adding a matching shared effect broadcasts once", PowerChanges.Num() == 1 && PowerChanges[0].GetOldValue() == 2 && PowerChanges[0].GetNewValue() == 5);
+			TestEqual("Snapshot readers see the shared effect", Reader->Read().GetValue(EAttributeKey::Power), 5);
+
+			const FActiveEffectHandle Theirs = Subsystem->AddSharedLayeredEffect(FLayeredEffectDefinition(EAttributeKey::Power, EEffectOperation::Add, 3, 0), FSharedEffectTargetFilter(true, 2, 0), bSuccess);
+			TestEqual("Shared effects for other objects don't broadcast", PowerChanges.Num(), 1);
+
+			Subsystem->RemoveSharedLayeredEffect(Ours);
+			TestTrue("Removing a matching shared effect broadcasts", PowerChanges.Num() == 2 && PowerChanges[1].GetOldValue() == 5 && PowerChanges[1].GetNewValue() == 2);
+			TestEqual("Snapshot readers see the removal", Reader->Read().GetValue(EAttributeKey::Power), 2);
+			Subsystem->RemoveSharedLayeredEffect(Theirs);
+			TestEqual("Removing a shared effect for another object doesn't broadcast", PowerChanges.Num(), 2);
+
+			// Targets without listeners aren't visited, but still see the effect the next time they read the attribute
+			MyCharacter->UnsubscribeFromAttributes(ListenerHandle);
+			TestFalse("Character has no listeners left", MyCharacter->HasAttributeListeners(EAttributeKey::Power));
+			Subsystem->Tick(0.0f);
+			const FActiveEffectHandle Unheard = Subsystem->AddSharedLayeredEffect(FLayeredEffectDefinition(EAttributeKey::Power, EEffectOperation::Add, 4, 0), FSharedEffectTargetFilter(true, 1, 0), bSuccess);
+			TestEqual("Unlistened targets pick up shared effects lazily", MyCharacter->GetCurrentAttribute(EAttributeKey::Power), 6);
+			Subsystem->RemoveSharedLayeredEffect(Unheard);
+			TestEqual("Unlistened targets pick up removals lazily", MyCharacter->GetCurrentAttribute(EAttributeKey::Power), 2);
+
+			const uint32 ControllerVersion = Subsystem->GetSharedEffects().GetVersion(EAttributeKey::Controller);
+			AddExpectedError(TEXT("used to choose its targets"), EAutomationExpectedErrorFlags::Contains, 1);
+			Subsystem->AddSharedLayeredEffect(FLayeredEffectDefinition(EAttributeKey::Controller, EEffectOperation::Set, 2, 0), FSharedEffectTargetFilter(), bSuccess);
+			TestFalse("Shared effects can't modify targeting attributes", bSuccess);
+			TestEqual("Rejected shared effects never reach the registry", Subsystem->GetSharedEffects().GetVersion(EAttributeKey::Controller), ControllerVersion);
+		});
+
 		It("Clearing attributes removes all layered effects from this object - after this call, all current attributes will be equal to the base attributes", [this]()
 		{
 			for (int32 i = 1; i < AllAttributes.Num(); i++)
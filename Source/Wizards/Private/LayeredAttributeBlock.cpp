@@ -0,0 +1,363 @@
+// Copyright 2023 John McElmurray (johnmcelmurray.com). All rights reserved.
+
+#include "LayeredAttributeBlock.h"
+
+#include "ScopedAttributeTransaction.h"
+
+FLayeredAttributeBlock::FLayeredAttributeBlock()
+{
+	FMemory::Memzero(BaseValues);
+	FMemory::Memzero(CurrentValues);
+	FMemory::Memzero(SharedEffectVersions);
+	FMemory::Memzero(PublishedValues);
+}
+
+FLayeredAttributeBlock::FLayeredAttributeBlock(const FLayeredAttributeBlock& Other)
+	: FLayeredAttributeBlock()
+{
+	*this = Other;
+}
+
+FLayeredAttributeBlock& FLayeredAttributeBlock::operator=(const FLayeredAttributeBlock& Other)
+{
+	if (this == &Other)
+	{
+		return *this;
+	}
+
+	UnbindFromStore();
+
+	// Read through Other's accessors, so a bound block's values come from its store entity
+	for (int32 Index = 0; Index < EAttributeKeyUtils::Num; Index++)
+	{
+		const EAttributeKey Key = static_cast<EAttributeKey>(Index);
+		BaseValues[Index] = Other.GetBaseValue(Key);
+		Effects[Index] = Other.GetEffects(Key);
+	}
+
+	// A store's shared effects keep applying to the copy, which evaluates everything afresh
+	SetSharedEffects(Other.GetSharedEffects());
+	NotifyMode = Other.NotifyMode;
+
+	// Listeners, pending notifications and the snapshot buffer belong to Other's owner, so the copy starts without any
+	PendingChanges = FPendingAttributeChanges();
+	Subscriptions = FAttributeSubscriptions();
+	SnapshotBuffer.Reset();
+	FMemory::Memzero(PublishedValues);
+	return *this;
+}
+
+void FLayeredAttributeBlock::SetBaseValue(EAttributeKey Key, int32 Value)
+{
+	checkSlow(EAttributeKeyUtils::IsInRange(Key));
+	if (FLayeredAttributeTimeline* Timeline = GetRecordingTimeline())
+	{
+		Timeline->RecordBaseValue(TimelineBinding.Participant, Key, GetBaseValue(Key));
+	}
+	if (Store != nullptr)
+	{
+		Store->SetBaseValue(StoreEntity, Key, Value);
+	}
+	else
+	{
+		BaseValues[EAttributeKeyUtils::ToIndex(Key)] = Value;
+		MarkDirty(Key);
+	}
+}
+
+void FLayeredAttributeBlock::GetCurrentValues(TArrayView<int32> OutValues) const
+{
+	const int32 NumValues = FMath::Min(OutValues.Num(), EAttributeKeyUtils::Num);
+	for (int32 Index = 0; Index < NumValues; Index++)
+	{
+		OutValues[Index] = GetCurrentValue(static_cast<EAttributeKey>(Index));
+	}
+}
+
+FActiveEffectHandle FLayeredAttributeBlock::AddLayeredEffect(const FLayeredEffectDefinition& Effect)
+{
+	const EAttributeKey Key = Effect.GetAttribute();
+	if (!EAttributeKeyUtils::IsInRange(Key))
+	{
+		return FActiveEffectHandle::kInvalid;
+	}
+	FActiveEffectHandle NewEffect = FActiveEffectHandle::kInvalid;
+	if (Store != nullptr)
+	{
+		NewEffect = Store->AddLayeredEffect(StoreEntity, Effect);
+	}
+	else
+	{
+		NewEffect = Effects[EAttributeKeyUtils::ToIndex(Key)].AddLayeredEffect(Effect);
+		if (NewEffect.IsValid())
+		{
+			MarkDirty(Key);
+		}
+	}
+
+	// A rolled back transaction drops this effect again, so it needs to know to release the handle
+	if (NewEffect.IsValid() && ActiveTransaction != nullptr)
+	{
+		ActiveTransaction->RecordAddedEffect(NewEffect);
+	}
+	if (FLayeredAttributeTimeline* Timeline = GetRecordingTimeline(); NewEffect.IsValid() && Timeline != nullptr)
+	{
+		Timeline->RecordAddedEffect(TimelineBinding.Participant, NewEffect, true);
+	}
+	return NewEffect;
+}
+
+bool FLayeredAttributeBlock::RemoveLayeredEffect(const FActiveEffectHandle& InHandle)
+{
+	if (RemoveActiveEffect(InHandle))
+	{
+		ReleaseRemovedEffect(InHandle);
+		return true;
+	}
+	return false;
+}
+
+bool FLayeredAttributeBlock::AddActiveEffect(const FActiveEffectDefinition& Effect)
+{
+	const EAttributeKey Key = Effect.GetEffectDefinition().GetAttribute();
+	if (!EAttributeKeyUtils::IsInRange(Key))
+	{
+		return false;
+	}
+	bool bAdded = false;
+	if (Store != nullptr)
+	{
+		bAdded = Store->AddActiveEffect(StoreEntity, Effect);
+	}
+	else if (Effects[EAttributeKeyUtils::ToIndex(Key)].AddActiveEffect(Effect))
+	{
+		MarkDirty(Key);
+		bAdded = true;
+	}
+
+	// The handle came from elsewhere, so rolling back only drops the effect
+	if (FLayeredAttributeTimeline* Timeline = GetRecordingTimeline(); bAdded && Timeline != nullptr)
+	{
+		Timeline->RecordAddedEffect(TimelineBinding.Participant, Effect.GetHandle(), false);
+	}
+	return bAdded;
+}
+
+bool FLayeredAttributeBlock::RemoveActiveEffect(const FActiveEffectHandle& InHandle)
+{
+	const EAttributeKey Key = InHandle.GetAttribute();
+	if (!EAttributeKeyUtils::IsInRange(Key))
+	{
+		return false;
+	}
+	// Rolling back needs the whole effect back, not just its handle
+	FLayeredAttributeTimeline* Timeline = GetRecordingTimeline();
+	const FActiveEffectDefinition* RemovedEffect = (Timeline != nullptr) ? GetEffects(Key).FindEffect(InHandle) : nullptr;
+	if (RemovedEffect != nullptr)
+	{
+		Timeline->RecordRemovedEffect(TimelineBinding.Participant, *RemovedEffect);
+	}
+
+	bool bRemoved = false;
+	if (Store != nullptr)
+	{
+		bRemoved = Store->RemoveLayeredEffect(StoreEntity, InHandle);
+	}
+	else if (Effects[EAttributeKeyUtils::ToIndex(Key)].RemoveLayeredEffect(InHandle))
+	{
+		MarkDirty(Key);
+		bRemoved = true;
+	}
+	checkSlow(bRemoved || RemovedEffect == nullptr);
+	return bRemoved;
+}
+
+bool FLayeredAttributeBlock::ClearLayeredEffects(EAttributeKey Key)
+{
+	checkSlow(EAttributeKeyUtils::IsInRange(Key));
+	FLayeredAttributeTimeline* Timeline = GetRecordingTimeline();
+	TArray<FActiveEffectHandle, TInlineAllocator<8>> ClearedHandles;
+	GetEffects(Key).ForEachEffect([this, Timeline, &ClearedHandles](const FActiveEffectDefinition& CurEffect)
+	{
+		ClearedHandles.Add(CurEffect.GetHandle());
+		if (Timeline != nullptr)
+		{
+			Timeline->RecordRemovedEffect(TimelineBinding.Participant, CurEffect);
+		}
+	});
+
+	bool bCleared = false;
+	if (Store != nullptr)
+	{
+		bCleared = Store->ClearLayeredEffects(StoreEntity, Key);
+	}
+	else if (Effects[EAttributeKeyUtils::ToIndex(Key)].ClearLayeredEffects())
+	{
+		MarkDirty(Key);
+		bCleared = true;
+	}
+
+	for (const FActiveEffectHandle& CurHandle : ClearedHandles)
+	{
+		ReleaseRemovedEffect(CurHandle);
+	}
+	return bCleared;
+}
+
+void FLayeredAttributeBlock::SetAttributeState(EAttributeKey Key, int32 BaseValue, const FSortedEffectDefinitions& InEffects)
+{
+	checkSlow(EAttributeKeyUtils::IsInRange(Key));
+	if (FLayeredAttributeTimeline* Timeline = GetRecordingTimeline())
+	{
+		Timeline->RecordAttributeState(TimelineBinding.Participant, Key, GetBaseValue(Key), GetEffects(Key));
+	}
+	if (Store != nullptr)
+	{
+		Store->SetAttributeState(StoreEntity, Key, BaseValue, InEffects);
+		return;
+	}
+
+	const int32 Index = EAttributeKeyUtils::ToIndex(Key);
+	BaseValues[Index] = BaseValue;
+	Effects[Index] = InEffects;
+	MarkDirty(Key);
+}
+
+void FLayeredAttributeBlock::BindToStore(FLayeredAttributeStore& InStore, const FLayeredAttributeEntityHandle& Entity)
+{
+	check(InStore.IsValid(Entity));
+	UnbindFromStore();
+
+	for (int32 Index = 0; Index < EAttributeKeyUtils::Num; Index++)
+	{
+		// The effects move to the store along with their handles, so reset rather than clear (which would release them)
+		InStore.SetAttributeState(Entity.GetIndex(), static_cast<EAttributeKey>(Index), BaseValues[Index], Effects[Index]);
+		BaseValues[Index] = 0;
+		Effects[Index] = FSortedEffectDefinitions(Effects[Index].GetBackend());
+	}
+	DirtyMask = MAX_uint32;
+
+	Store = &InStore;
+	StoreEntity = Entity.GetIndex();
+}
+
+void FLayeredAttributeBlock::UnbindFromStore()
+{
+	if (Store == nullptr)
+	{
+		return;
+	}
+
+	for (int32 Index = 0; Index < EAttributeKeyUtils::Num; Index++)
+	{
+		const EAttributeKey Key = static_cast<EAttributeKey>(Index);
+		BaseValues[Index] = Store->GetBaseValue(StoreEntity, Key);
+		Effects[Index] = Store->GetEffects(StoreEntity, Key);
+		Store->SetAttributeState(StoreEntity, Key, 0, FSortedEffectDefinitions(Effects[Index].GetBackend()));
+	}
+	DirtyMask = MAX_uint32;
+
+	Store = nullptr;
+	StoreEntity = INDEX_NONE;
+}
+
+void FLayeredAttributeBlock::AbandonStoreEntity()
+{
+	Store = nullptr;
+	StoreEntity = INDEX_NONE;
+	DirtyMask = MAX_uint32;
+}
+
+void FLayeredAttributeBlock::SetSharedEffects(FSharedEffectRegistry* InSharedEffects)
+{
+	SharedEffects = InSharedEffects;
+	for (int32 Index = 0; Index < EAttributeKeyUtils::Num; Index++)
+	{
+		SharedEffectVersions[Index] = (SharedEffects != nullptr) ? SharedEffects->GetVersion(static_cast<EAttributeKey>(Index)) : 0;
+	}
+	DirtyMask = MAX_uint32;
+}
+
+void FLayeredAttributeBlock::SetTimeline(FLayeredAttributeTimeline* InTimeline, ILayeredAttributes* Owner)
+{
+	if (TimelineBinding.Timeline != nullptr)
+	{
+		TimelineBinding.Timeline->Detach(TimelineBinding);
+	}
+	if (InTimeline != nullptr)
+	{
+		InTimeline->Attach(*this, TimelineBinding, Owner);
+	}
+}
+
+void FLayeredAttributeBlock::ReleaseHandle(const FActiveEffectHandle& InHandle)
+{
+	// A rolled back timeline brings the effect back, so only release once the timeline forgets it
+	if (FLayeredAttributeTimeline* Timeline = GetRecordingTimeline())
+	{
+		Timeline->RecordReleasedHandle(InHandle);
+	}
+	else
+	{
+		FActiveEffectHandle::Release(InHandle);
+	}
+}
+
+FLayeredAttributeSnapshotReader FLayeredAttributeBlock::GetOrCreateSnapshotBuffer()
+{
+	check(IsInGameThread());
+	if (!SnapshotBuffer.IsValid())
+	{
+		SnapshotBuffer = MakeShared<FLayeredAttributeSnapshotBuffer, ESPMode::ThreadSafe>();
+		GetCurrentValues(PublishedValues);
+		SnapshotBuffer->Publish(PublishedValues);
+	}
+	return SnapshotBuffer.ToSharedRef();
+}
+
+void FLayeredAttributeBlock::PublishSnapshot()
+{
+	if (!SnapshotBuffer.IsValid())
+	{
+		return;
+	}
+
+	int32 NewValues[EAttributeKeyUtils::Num];
+	GetCurrentValues(NewValues);
+	if (FMemory::Memcmp(NewValues, PublishedValues, sizeof(PublishedValues)) != 0)
+	{
+		FMemory::Memcpy(PublishedValues, NewValues, sizeof(PublishedValues));
+		SnapshotBuffer->Publish(PublishedValues);
+	}
+}
+
+void FLayeredAttributeBlock::ReleaseRemovedEffect(const FActiveEffectHandle& InHandle)
+{
+	// A rolled back transaction brings the effect back, so only release once the outermost transaction commits
+	if (ActiveTransaction != nullptr)
+	{
+		ActiveTransaction->RecordRemovedEffect(InHandle);
+	}
+	else
+	{
+		ReleaseHandle(InHandle);
+	}
+}
+
+int32 FLayeredAttributeBlock::EvaluateCurrentValue(EAttributeKey Key) const
+{
+	const int32 Index = EAttributeKeyUtils::ToIndex(Key);
+	if (SharedEffects != nullptr && SharedEffects->HasEffects(Key))
+	{
+		return SharedEffects->Evaluate(Key, BaseValues[Index], Effects[Index],
+			GetCurrentValue(EAttributeKey::Controller), GetCurrentValue(EAttributeKey::Types));
+	}
+	return Effects[Index].GetCurrentValue(BaseValues[Index]);
+}
+
+FPendingAttributeChanges FLayeredAttributeBlock::ConsumePendingChanges()
+{
+	const FPendingAttributeChanges ConsumedChanges = PendingChanges;
+	PendingChanges = FPendingAttributeChanges();
+	return ConsumedChanges;
+}
@@ -0,0 +1,160 @@
+// Copyright 2023 John McElmurray (johnmcelmurray.com). All rights reserved.
+
+#include "LayeredAttributeCommandQueue.h"
+
+#include "ILayeredAttributes.h"
+#include "LayeredAttributeSubsystem.h"
+#include "ScopedAttributeTransaction.h"
+
+namespace
+{
+	/// <summary>
+	/// Indices of the drained commands targeting one object, in the order they were enqueued.
+	/// </summary>
+	struct FObjectCommandGroup
+	{
+		UObject* Object = nullptr;
+		TArray<int32, TInlineAllocator<4>> CommandIndices;
+	};
+}
+
+void FLayeredAttributeCommandQueue::SetBaseAttribute(const FLayeredAttributeCommandTarget& Target, EAttributeKey Key, int32 Value)
+{
+	FCommand NewCommand(FCommand::EType::SetBaseAttribute, Target);
+	NewCommand.Key = Key;
+	NewCommand.Value = Value;
+	Commands.Enqueue(MoveTemp(NewCommand));
+}
+
+TFuture<FActiveEffectHandle> FLayeredAttributeCommandQueue::AddLayeredEffect(const FLayeredAttributeCommandTarget& Target, const FLayeredEffectDefinition& Effect)
+{
+	FCommand NewCommand(FCommand::EType::AddLayeredEffect, Target);
+	NewCommand.Effect = Effect;
+	NewCommand.AddPromise = MakeUnique<TPromise<FActiveEffectHandle>>();
+	TFuture<FActiveEffectHandle> Future = NewCommand.AddPromise->GetFuture();
+	Commands.Enqueue(MoveTemp(NewCommand));
+	return Future;
+}
+
+TFuture<bool> FLayeredAttributeCommandQueue::RemoveLayeredEffect(const FLayeredAttributeCommandTarget& Target, const FActiveEffectHandle& InHandle)
+{
+	FCommand NewCommand(FCommand::EType::RemoveLayeredEffect, Target);
+	NewCommand.Handle = InHandle;
+	NewCommand.RemovePromise = MakeUnique<TPromise<bool>>();
+	TFuture<bool> Future = NewCommand.RemovePromise->GetFuture();
+	Commands.Enqueue(MoveTemp(NewCommand));
+	return Future;
+}
+
+void FLayeredAttributeCommandQueue::ClearLayeredEffects(const FLayeredAttributeCommandTarget& Target)
+{
+	Commands.Enqueue(FCommand(FCommand::EType::ClearLayeredEffects, Target));
+}
+
+int32 FLayeredAttributeCommandQueue::Execute(ULayeredAttributeSubsystem& Subsystem)
+{
+	check(IsInGameThread());
+
+	// Only drain what's queued right now; commands enqueued by listeners wait for the next drain
+	TArray<FCommand> DrainedCommands;
+
+	// Group each object's commands together, keeping the order they were enqueued in.
+	// Groups run in the order their objects first appear, so the outcome doesn't depend on where objects live in memory.
+	TMap<UObject*, int32> GroupIndices;
+	TArray<FObjectCommandGroup> Groups;
+	for (FCommand CurCommand; Commands.Dequeue(CurCommand); )
+	{
+		FCommand& NewCommand = DrainedCommands.Add_GetRef(MoveTemp(CurCommand));
+		if (NewCommand.Target.Entity.IsValid())
+		{
+			// Entities don't broadcast, so there's nothing to batch
+			ExecuteOnEntity(NewCommand, Subsystem);
+		}
+		else
+		{
+			UObject* Object = NewCommand.Target.Object.Get();
+			const int32 GroupIndex = GroupIndices.FindOrAdd(Object, Groups.Num());
+			if (GroupIndex == Groups.Num())
+			{
+				Groups.AddDefaulted_GetRef().Object = Object;
+			}
+			Groups[GroupIndex].CommandIndices.Add(DrainedCommands.Num() - 1);
+		}
+	}
+
+	for (const FObjectCommandGroup& CurGroup : Groups)
+	{
+		// One transaction per object, so each attribute it changes is broadcast once
+		ILayeredAttributes* Target = Cast<ILayeredAttributes>(CurGroup.Object);
+		TOptional<FScopedAttributeTransaction> Transaction;
+		if (Target != nullptr)
+		{
+			Transaction.Emplace(*Target);
+		}
+		for (const int32 CommandIndex : CurGroup.CommandIndices)
+		{
+			ExecuteOnObject(DrainedCommands[CommandIndex], Target);
+		}
+	}
+
+	return DrainedCommands.Num();
+}
+
+void FLayeredAttributeCommandQueue::ExecuteOnObject(FCommand& Command, ILayeredAttributes* Target)
+{
+	switch (Command.Type)
+	{
+		case FCommand::EType::SetBaseAttribute:
+			if (Target != nullptr)
+			{
+				Target->SetBaseAttribute(Command.Key, Command.Value);
+			}
+			break;
+		case FCommand::EType::AddLayeredEffect:
+		{
+			bool bSuccess = false;
+			Command.AddPromise->SetValue((Target != nullptr) ? Target->AddLayeredEffect(Command.Effect, bSuccess) : FActiveEffectHandle::kInvalid);
+			break;
+		}
+		case FCommand::EType::RemoveLayeredEffect:
+			Command.RemovePromise->SetValue((Target != nullptr) && Target->RemoveLayeredEffect(Command.Handle));
+			break;
+		case FCommand::EType::ClearLayeredEffects:
+			if (Target != nullptr)
+			{
+				Target->ClearLayeredEffects();
+			}
+			break;
+
+		default:
+			checkNoEntry();
+			break;
+	}
+}
+
+void FLayeredAttributeCommandQueue::ExecuteOnEntity(FCommand& Command, ULayeredAttributeSubsystem& Subsystem)
+{
+	const FLayeredAttributeEntityHandle& Entity = Command.Target.Entity;
+	switch (Command.Type)
+	{
+		case FCommand::EType::SetBaseAttribute:
+			Subsystem.SetEntityBaseAttribute(Entity, Command.Key, Command.Value);
+			break;
+		case FCommand::EType::AddLayeredEffect:
+		{
+			bool bSuccess = false;
+			Command.AddPromise->SetValue(Subsystem.AddEntityLayeredEffect(Entity, Command.Effect, bSuccess));
+			break;
+		}
+		case FCommand::EType::RemoveLayeredEffect:
+			Command.RemovePromise->SetValue(Subsystem.RemoveEntityLayeredEffect(Entity, Command.Handle));
+			break;
+		case FCommand::EType::ClearLayeredEffects:
+			Subsystem.ClearEntityLayeredEffects(Entity);
+			break;
+
+		default:
+			checkNoEntry();
+			break;
+	}
+}
@@ -0,0 +1,199 @@
+// Copyright 2023 John McElmurray (johnmcelmurray.com). All rights reserved.
+
+#include "LayeredAttributeOverlay.h"
+
+#include "LayeredAttributeBlock.h"
+
+namespace
+{
+	/// <summary>
+	/// One effect to apply to a changed attribute, wherever it came from.
+	/// </summary>
+	struct FOverlayStep
+	{
+		int32 Layer = 0;
+		int64 Sequence = 0;
+		int32 Modification = 0;
+		EEffectOperation Operation = EEffectOperation::Add;
+	};
+
+	FOverlayStep MakeStep(const FLayeredEffectDefinition& Definition, int64 Sequence)
+	{
+		FOverlayStep NewStep;
+		NewStep.Layer = Definition.GetLayer();
+		NewStep.Sequence = Sequence;
+		NewStep.Modification = Definition.GetModification();
+		NewStep.Operation = Definition.GetOperation();
+		return NewStep;
+	}
+
+	const uint32 TargetingMask = (1u << EAttributeKeyUtils::ToIndex(EAttributeKey::Controller))
+		| (1u << EAttributeKeyUtils::ToIndex(EAttributeKey::Types));
+}
+
+#pragma region FLayeredAttributeOverlay
+
+FLayeredAttributeOverlay::FLayeredAttributeOverlay(const FLayeredAttributeBlock& InAttributes)
+	: Attributes(&InAttributes)
+{ }
+
+void FLayeredAttributeOverlay::SetBaseValue(EAttributeKey Key, int32 Value)
+{
+	checkSlow(EAttributeKeyUtils::IsInRange(Key));
+	const uint32 KeyBit = (1u << EAttributeKeyUtils::ToIndex(Key));
+	BaseValues[EAttributeKeyUtils::ToIndex(Key)] = Value;
+	BaseValueMask |= KeyBit;
+	ChangedMask |= KeyBit;
+}
+
+bool FLayeredAttributeOverlay::AddLayeredEffect(const FLayeredEffectDefinition& Effect)
+{
+	if (!Effect.IsValid() || !EAttributeKeyUtils::IsInRange(Effect.GetAttribute()))
+	{
+		return false;
+	}
+
+	AddedEffects.Add(Effect);
+	ChangedMask |= (1u << EAttributeKeyUtils::ToIndex(Effect.GetAttribute()));
+	return true;
+}
+
+bool FLayeredAttributeOverlay::RemoveLayeredEffect(const FActiveEffectHandle& InHandle)
+{
+	const EAttributeKey Key = InHandle.GetAttribute();
+	if (!InHandle.IsValid() || !EAttributeKeyUtils::IsInRange(Key) || IsRemoved(InHandle))
+	{
+		return false;
+	}
+
+	const uint32 KeyBit = (1u << EAttributeKeyUtils::ToIndex(Key));
+	if ((ClearedMask & KeyBit) != 0 || !Attributes->GetEffects(Key).ContainsEffect(InHandle))
+	{
+		return false;
+	}
+
+	RemovedHandles.Add(InHandle);
+	ChangedMask |= KeyBit;
+	return true;
+}
+
+void FLayeredAttributeOverlay::ClearLayeredEffects(EAttributeKey Key)
+{
+	checkSlow(EAttributeKeyUtils::IsInRange(Key));
+	const uint32 KeyBit = (1u << EAttributeKeyUtils::ToIndex(Key));
+	AddedEffects.RemoveAll([Key](const FLayeredEffectDefinition& CurEffect)
+	{
+		return CurEffect.GetAttribute() == Key;
+	});
+	ClearedMask |= KeyBit;
+	ChangedMask |= KeyBit;
+}
+
+void FLayeredAttributeOverlay::Reset()
+{
+	BaseValueMask = 0;
+	ClearedMask = 0;
+	ChangedMask = 0;
+	AddedEffects.Reset();
+	RemovedHandles.Reset();
+}
+
+int32 FLayeredAttributeOverlay::GetBaseValue(EAttributeKey Key) const
+{
+	checkSlow(EAttributeKeyUtils::IsInRange(Key));
+	const int32 Index = EAttributeKeyUtils::ToIndex(Key);
+	return ((BaseValueMask & (1u << Index)) != 0) ? BaseValues[Index] : Attributes->GetBaseValue(Key);
+}
+
+int32 FLayeredAttributeOverlay::GetCurrentValue(EAttributeKey Key) const
+{
+	return IsChanged(Key) ? EvaluateCurrentValue(Key) : Attributes->GetCurrentValue(Key);
+}
+
+void FLayeredAttributeOverlay::GetCurrentValues(TArrayView<int32> OutValues) const
+{
+	const int32 NumValues = FMath::Min(OutValues.Num(), static_cast<int32>(EAttributeKeyUtils::Num));
+	for (int32 Index = 0; Index < NumValues; Index++)
+	{
+		OutValues[Index] = GetCurrentValue(static_cast<EAttributeKey>(Index));
+	}
+}
+
+bool FLayeredAttributeOverlay::IsChanged(EAttributeKey Key) const
+{
+	checkSlow(EAttributeKeyUtils::IsInRange(Key));
+	if ((ChangedMask & (1u << EAttributeKeyUtils::ToIndex(Key))) != 0)
+	{
+		return true;
+	}
+
+	// Which shared effects apply depends on Controller and Types, so changing them can change any attribute
+	const FSharedEffectRegistry* SharedEffects = Attributes->GetSharedEffects();
+	return ((ChangedMask & TargetingMask) != 0 && SharedEffects != nullptr && SharedEffects->HasEffects(Key));
+}
+
+int32 FLayeredAttributeOverlay::EvaluateCurrentValue(EAttributeKey Key) const
+{
+	const uint32 KeyBit = (1u << EAttributeKeyUtils::ToIndex(Key));
+	TArray<FOverlayStep, TInlineAllocator<32>> Steps;
+
+	if ((ClearedMask & KeyBit) == 0)
+	{
+		Attributes->GetEffects(Key).ForEachEffect([this, &Steps](const FActiveEffectDefinition& CurEffect)
+		{
+			if (!IsRemoved(CurEffect.GetHandle()))
+			{
+				Steps.Add(MakeStep(CurEffect.GetEffectDefinition(), CurEffect.GetSequence()));
+			}
+		});
+	}
+
+	bool bNeedsSort = false;
+	const FSharedEffectRegistry* SharedEffects = Attributes->GetSharedEffects();
+	if (SharedEffects != nullptr && SharedEffects->HasEffects(Key))
+	{
+		// Shared effects never modify Controller or Types, so reading them here doesn't recurse.
+		// They may not be in application order yet, which the sort below takes care of
+		SharedEffects->ForEachMatchingEffect(Key, GetCurrentValue(EAttributeKey::Controller), GetCurrentValue(EAttributeKey::Types),
+			[&Steps, &bNeedsSort](const FActiveEffectDefinition& CurEffect)
+			{
+				Steps.Add(MakeStep(CurEffect.GetEffectDefinition(), CurEffect.GetSequence()));
+				bNeedsSort = true;
+			});
+	}
+
+	// As if added just now: after every existing effect, in the order they were added here
+	int64 NextSequence = MAX_int64 - AddedEffects.Num();
+	for (const FLayeredEffectDefinition& CurEffect : AddedEffects)
+	{
+		++NextSequence;
+		if (CurEffect.GetAttribute() == Key)
+		{
+			Steps.Add(MakeStep(CurEffect, NextSequence));
+			bNeedsSort = true;
+		}
+	}
+
+	// The object's own effects are already in application order, so only merging in others needs a sort
+	if (bNeedsSort)
+	{
+		Steps.Sort([](const FOverlayStep& A, const FOverlayStep& B)
+		{
+			return (A.Layer != B.Layer) ? (A.Layer < B.Layer) : (A.Sequence < B.Sequence);
+		});
+	}
+
+	int32 CurrentValue = GetBaseValue(Key);
+	for (const FOverlayStep& CurStep : Steps)
+	{
+		CurrentValue = EEffectOperationUtils::Evaluate(CurrentValue, CurStep.Modification, CurStep.Operation);
+	}
+	return CurrentValue;
+}
+
+bool FLayeredAttributeOverlay::IsRemoved(const FActiveEffectHandle& InHandle) const
+{
+	return RemovedHandles.Contains(InHandle);
+}
+
+#pragma endregion
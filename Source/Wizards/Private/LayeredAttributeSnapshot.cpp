@@ -0,0 +1,63 @@
+// Copyright 2023 John McElmurray (johnmcelmurray.com). All rights reserved.
+
+#include "LayeredAttributeSnapshot.h"
+
+FLayeredAttributeSnapshotBuffer::FLayeredAttributeSnapshotBuffer()
+{
+	for (std::atomic<int32>& CurValue : Values)
+	{
+		CurValue.store(0, std::memory_order_relaxed);
+	}
+}
+
+void FLayeredAttributeSnapshotBuffer::Publish(TConstArrayView<int32> InValues)
+{
+	check(InValues.Num() == EAttributeKeyUtils::Num);
+
+	// Odd sequence tells readers that what they copy from here on may be torn
+	const uint32 StartSequence = Sequence.load(std::memory_order_relaxed);
+	Sequence.store(StartSequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	for (int32 Index = 0; Index < EAttributeKeyUtils::Num; Index++)
+	{
+		Values[Index].store(InValues[Index], std::memory_order_relaxed);
+	}
+
+	Sequence.store(StartSequence + 2, std::memory_order_release);
+}
+
+bool FLayeredAttributeSnapshotBuffer::TryRead(FLayeredAttributeSnapshot& OutSnapshot) const
+{
+	const uint32 StartSequence = Sequence.load(std::memory_order_acquire);
+	if ((StartSequence & 1) != 0)
+	{
+		return false;
+	}
+
+	for (int32 Index = 0; Index < EAttributeKeyUtils::Num; Index++)
+	{
+		OutSnapshot.Values[Index] = Values[Index].load(std::memory_order_relaxed);
+	}
+
+	// If the sequence moved while we copied, a publish overlapped us
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (Sequence.load(std::memory_order_relaxed) != StartSequence)
+	{
+		return false;
+	}
+
+	OutSnapshot.Version = StartSequence / 2;
+	return true;
+}
+
+FLayeredAttributeSnapshot FLayeredAttributeSnapshotBuffer::Read() const
+{
+	FLayeredAttributeSnapshot Snapshot;
+	while (!TryRead(Snapshot))
+	{
+		// Publishing is a handful of stores, so the writer is about to finish
+		FPlatformProcess::YieldThread();
+	}
+	return Snapshot;
+}
@@ -0,0 +1,233 @@
+// Copyright 2023 John McElmurray (johnmcelmurray.com). All rights reserved.
+
+#include "LayeredAttributeStateImage.h"
+
+#include "Async/MappedFileHandle.h"
+#include "HAL/PlatformFileManager.h"
+#include "Misc/FileHelper.h"
+
+#include "LayeredAttributeBlock.h"
+
+using namespace LayeredAttributeStateImage;
+
+namespace
+{
+	/// <summary>
+	/// Byte offsets of each section of an image, which follow from its counts alone.
+	/// </summary>
+	struct FImageLayout
+	{
+		FImageLayout(uint64 NumObjects, uint64 NumAttributes, uint64 NumEffects)
+			: ObjectsOffset(sizeof(FHeader))
+			, BaseValuesOffset(ObjectsOffset + NumObjects * sizeof(FObject))
+			, EffectsOffset(BaseValuesOffset + Align(NumObjects * NumAttributes * sizeof(int32), alignof(FEffect)))
+			, TotalSize(EffectsOffset + NumEffects * sizeof(FEffect))
+		{ }
+
+		uint64 ObjectsOffset;
+		uint64 BaseValuesOffset;
+		uint64 EffectsOffset;
+		uint64 TotalSize;
+	};
+}
+
+#pragma region FLayeredAttributeStateWriter
+
+int32 FLayeredAttributeStateWriter::AddObject(const FLayeredAttributeBlock& Attributes)
+{
+	FObject& NewObject = Objects.AddDefaulted_GetRef();
+	NewObject.FirstEffect = static_cast<uint32>(Effects.Num());
+
+	for (int32 Index = 0; Index < EAttributeKeyUtils::Num; Index++)
+	{
+		const EAttributeKey CurAttribute = static_cast<EAttributeKey>(Index);
+		BaseValues.Add(Attributes.GetBaseValue(CurAttribute));
+
+		Attributes.GetEffects(CurAttribute).ForEachEffect([this](const FActiveEffectDefinition& CurEffect)
+		{
+			const FLayeredEffectDefinition& Def = CurEffect.GetEffectDefinition();
+			FEffect& NewEffect = Effects.AddDefaulted_GetRef();
+			NewEffect.Sequence = CurEffect.GetSequence();
+			NewEffect.Modification = Def.GetModification();
+			NewEffect.Layer = Def.GetLayer();
+			NewEffect.Attribute = static_cast<uint8>(Def.GetAttribute());
+			NewEffect.Operation = static_cast<uint8>(Def.GetOperation());
+		});
+	}
+
+	NewObject.NumEffects = static_cast<uint32>(Effects.Num()) - NewObject.FirstEffect;
+	return Objects.Num() - 1;
+}
+
+void FLayeredAttributeStateWriter::Write(TArray64<uint8>& OutBytes) const
+{
+	const FImageLayout Layout(Objects.Num(), EAttributeKeyUtils::Num, Effects.Num());
+
+	// Zeroed, so padding is deterministic and images of the same state compare equal
+	OutBytes.Reset();
+	OutBytes.AddZeroed(static_cast<int64>(Layout.TotalSize));
+
+	FHeader Header;
+	Header.Magic = LayeredAttributeStateImage::Magic;
+	Header.Version = LayeredAttributeStateImage::Version;
+	Header.NumAttributes = static_cast<uint16>(EAttributeKeyUtils::Num);
+	Header.NumObjects = static_cast<uint32>(Objects.Num());
+	Header.NumEffects = static_cast<uint32>(Effects.Num());
+	Header.TotalSize = Layout.TotalSize;
+
+	uint8* Data = OutBytes.GetData();
+	FMemory::Memcpy(Data, &Header, sizeof(Header));
+	FMemory::Memcpy(Data + Layout.ObjectsOffset, Objects.GetData(), static_cast<SIZE_T>(Objects.Num()) * sizeof(FObject));
+	FMemory::Memcpy(Data + Layout.BaseValuesOffset, BaseValues.GetData(), static_cast<SIZE_T>(BaseValues.Num()) * sizeof(int32));
+	FMemory::Memcpy(Data + Layout.EffectsOffset, Effects.GetData(), static_cast<SIZE_T>(Effects.Num()) * sizeof(FEffect));
+}
+
+bool FLayeredAttributeStateWriter::SaveToFile(const FString& Filename) const
+{
+	TArray64<uint8> Bytes;
+	Write(Bytes);
+	return FFileHelper::SaveArrayToFile(Bytes, *Filename);
+}
+
+#pragma endregion
+
+
+#pragma region FLayeredAttributeStateImage
+
+bool FLayeredAttributeStateImage::Initialize(TArrayView64<const uint8> InBytes)
+{
+	*this = FLayeredAttributeStateImage();
+
+	const uint8* Data = InBytes.GetData();
+	if (InBytes.Num() < static_cast<int64>(sizeof(FHeader)) || !IsAligned(Data, alignof(FEffect)))
+	{
+		return false;
+	}
+
+	const FHeader* NewHeader = reinterpret_cast<const FHeader*>(Data);
+	if (NewHeader->Magic != LayeredAttributeStateImage::Magic || NewHeader->Version != LayeredAttributeStateImage::Version)
+	{
+		UE_LOG(LogLayeredEffects, Warning, TEXT("Not an attribute state image of version %d"), LayeredAttributeStateImage::Version);
+		return false;
+	}
+
+	const FImageLayout Layout(NewHeader->NumObjects, NewHeader->NumAttributes, NewHeader->NumEffects);
+	if (NewHeader->TotalSize != Layout.TotalSize || Layout.TotalSize > static_cast<uint64>(InBytes.Num()) || NewHeader->NumObjects > static_cast<uint32>(MAX_int32))
+	{
+		UE_LOG(LogLayeredEffects, Warning, TEXT("Attribute state image is truncated or corrupt"));
+		return false;
+	}
+
+	Header = NewHeader;
+	Objects = reinterpret_cast<const FObject*>(Data + Layout.ObjectsOffset);
+	BaseValues = reinterpret_cast<const int32*>(Data + Layout.BaseValuesOffset);
+	Effects = reinterpret_cast<const FEffect*>(Data + Layout.EffectsOffset);
+	return true;
+}
+
+int32 FLayeredAttributeStateImage::GetBaseValue(int32 ObjectIndex, EAttributeKey Key) const
+{
+	checkSlow(ObjectIndex >= 0 && ObjectIndex < NumObjects());
+	const int32 KeyIndex = EAttributeKeyUtils::ToIndex(Key);
+	return (KeyIndex < Header->NumAttributes) ? BaseValues[static_cast<int64>(ObjectIndex) * Header->NumAttributes + KeyIndex] : 0;
+}
+
+TArrayView<const FEffect> FLayeredAttributeStateImage::GetEffects(int32 ObjectIndex) const
+{
+	checkSlow(ObjectIndex >= 0 && ObjectIndex < NumObjects());
+	const FObject& Object = Objects[ObjectIndex];
+	if (Object.FirstEffect > Header->NumEffects || Object.NumEffects > Header->NumEffects - Object.FirstEffect)
+	{
+		return {};
+	}
+	return TArrayView<const FEffect>(Effects + Object.FirstEffect, Object.NumEffects);
+}
+
+bool FLayeredAttributeStateImage::RestoreObject(int32 ObjectIndex, FLayeredAttributeBlock& Attributes) const
+{
+	if (ObjectIndex < 0 || ObjectIndex >= NumObjects())
+	{
+		return false;
+	}
+
+	const TArrayView<const FEffect> SavedEffects = GetEffects(ObjectIndex);
+	int64 MaxSequence = 0;
+	for (const FEffect& CurEffect : SavedEffects)
+	{
+		MaxSequence = FMath::Max(MaxSequence, CurEffect.Sequence);
+	}
+	FActiveEffectDefinition::ReserveSequence(MaxSequence);
+
+	for (int32 Index = 0; Index < EAttributeKeyUtils::Num; Index++)
+	{
+		const EAttributeKey CurAttribute = static_cast<EAttributeKey>(Index);
+		Attributes.ClearLayeredEffects(CurAttribute);
+		Attributes.SetBaseValue(CurAttribute, GetBaseValue(ObjectIndex, CurAttribute));
+	}
+
+	for (const FEffect& CurEffect : SavedEffects)
+	{
+		const FLayeredEffectDefinition Def(
+			static_cast<EAttributeKey>(CurEffect.Attribute),
+			static_cast<EEffectOperation>(CurEffect.Operation),
+			CurEffect.Modification,
+			CurEffect.Layer);
+
+		// Skip attributes and operations this build doesn't know about
+		if (!Def.IsValid() || !EAttributeKeyUtils::IsInRange(Def.GetAttribute()) || CurEffect.Operation > static_cast<uint8>(EEffectOperation::BitwiseXor))
+		{
+			continue;
+		}
+
+		// Handles are generated here, so the block owns and releases them like any other
+		Attributes.AddActiveEffect(FActiveEffectDefinition(Def, CurEffect.Sequence));
+	}
+	return true;
+}
+
+#pragma endregion
+
+
+#pragma region FMappedLayeredAttributeStateImage
+
+FMappedLayeredAttributeStateImage::FMappedLayeredAttributeStateImage() = default;
+
+FMappedLayeredAttributeStateImage::~FMappedLayeredAttributeStateImage()
+{
+	Close();
+}
+
+bool FMappedLayeredAttributeStateImage::Open(const FString& Filename)
+{
+	Close();
+
+	MappedFile.Reset(FPlatformFileManager::Get().GetPlatformFile().OpenMapped(*Filename));
+	if (MappedFile.IsValid())
+	{
+		MappedRegion.Reset(MappedFile->MapRegion());
+	}
+	if (!MappedRegion.IsValid())
+	{
+		UE_LOG(LogLayeredEffects, Warning, TEXT("Couldn't map attribute state image '%s'"), *Filename);
+		Close();
+		return false;
+	}
+
+	if (!Image.Initialize(TArrayView64<const uint8>(MappedRegion->GetMappedPtr(), MappedRegion->GetMappedSize())))
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void FMappedLayeredAttributeStateImage::Close()
+{
+	Image = FLayeredAttributeStateImage();
+
+	// Regions must be unmapped before their file is closed
+	MappedRegion.Reset();
+	MappedFile.Reset();
+}
+
+#pragma endregion
@@ -0,0 +1,92 @@
+// Copyright 2023 John McElmurray (johnmcelmurray.com). All rights reserved.
+
+#include "LayeredAttributeStats.h"
+
+#if LAYERED_ATTRIBUTES_STATS
+
+#include "ProfilingDebugging/CountersTrace.h"
+
+#include <atomic>
+
+DEFINE_STAT(STAT_LayeredAttributes_SetBaseAttribute);
+DEFINE_STAT(STAT_LayeredAttributes_GetCurrentAttribute);
+DEFINE_STAT(STAT_LayeredAttributes_AddLayeredEffect);
+DEFINE_STAT(STAT_LayeredAttributes_RemoveLayeredEffect);
+DEFINE_STAT(STAT_LayeredAttributes_ClearLayeredEffects);
+DEFINE_STAT(STAT_LayeredAttributes_Broadcast);
+DEFINE_STAT(STAT_LayeredAttributes_Broadcasts);
+DEFINE_STAT(STAT_LayeredAttributes_Depth1);
+DEFINE_STAT(STAT_LayeredAttributes_Depth2);
+DEFINE_STAT(STAT_LayeredAttributes_Depth4);
+DEFINE_STAT(STAT_LayeredAttributes_Depth8);
+DEFINE_STAT(STAT_LayeredAttributes_Depth16);
+DEFINE_STAT(STAT_LayeredAttributes_Depth64);
+DEFINE_STAT(STAT_LayeredAttributes_Depth256);
+DEFINE_STAT(STAT_LayeredAttributes_Depth1024);
+
+UE_TRACE_CHANNEL_DEFINE(LayeredAttributesChannel);
+
+TRACE_DECLARE_INT_COUNTER(LayeredAttributes_Broadcasts, TEXT("LayeredAttributes/Broadcasts"));
+TRACE_DECLARE_INT_COUNTER(LayeredAttributes_MaxStackDepth, TEXT("LayeredAttributes/Max Stack Depth"));
+
+namespace
+{
+	std::atomic<int32> FrameBroadcasts { 0 };
+	std::atomic<int32> FrameMaxStackDepth { 0 };
+	uint64 LastEndedFrame = MAX_uint64;
+
+	/// <returns>Index of the histogram bucket for a stack of NumEffects effects.</returns>
+	int32 GetDepthBucket(int32 NumEffects)
+	{
+		// Buckets grow by powers of two at first, then by powers of four
+		const int32 Log2 = FMath::FloorLog2(static_cast<uint32>(FMath::Max(NumEffects, 1)));
+		return (Log2 < 4) ? Log2 : FMath::Min(4 + (Log2 - 4) / 2, 7);
+	}
+}
+
+namespace LayeredAttributeStats
+{
+	void RecordBroadcast()
+	{
+		INC_DWORD_STAT(STAT_LayeredAttributes_Broadcasts);
+		FrameBroadcasts.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void RecordStackDepth(int32 NumEffects)
+	{
+#if STATS
+		static const FName DepthStats[] =
+		{
+			GET_STATFNAME(STAT_LayeredAttributes_Depth1),
+			GET_STATFNAME(STAT_LayeredAttributes_Depth2),
+			GET_STATFNAME(STAT_LayeredAttributes_Depth4),
+			GET_STATFNAME(STAT_LayeredAttributes_Depth8),
+			GET_STATFNAME(STAT_LayeredAttributes_Depth16),
+			GET_STATFNAME(STAT_LayeredAttributes_Depth64),
+			GET_STATFNAME(STAT_LayeredAttributes_Depth256),
+			GET_STATFNAME(STAT_LayeredAttributes_Depth1024),
+		};
+		INC_DWORD_STAT_FName(DepthStats[GetDepthBucket(NumEffects)]);
+#endif
+
+		int32 MaxDepth = FrameMaxStackDepth.load(std::memory_order_relaxed);
+		while (NumEffects > MaxDepth && !FrameMaxStackDepth.compare_exchange_weak(MaxDepth, NumEffects, std::memory_order_relaxed))
+		{
+		}
+	}
+
+	void EndFrame()
+	{
+		// Every world's subsystem ticks, but the totals are process wide
+		if (LastEndedFrame == GFrameCounter)
+		{
+			return;
+		}
+		LastEndedFrame = GFrameCounter;
+
+		TRACE_COUNTER_SET(LayeredAttributes_Broadcasts, FrameBroadcasts.exchange(0, std::memory_order_relaxed));
+		TRACE_COUNTER_SET(LayeredAttributes_MaxStackDepth, FrameMaxStackDepth.exchange(0, std::memory_order_relaxed));
+	}
+}
+
+#endif
@@ -0,0 +1,287 @@
+// Copyright 2023 John McElmurray (johnmcelmurray.com). All rights reserved.
+
+#include "LayeredAttributeStore.h"
+
+#include "Async/ParallelFor.h"
+
+#include "LayeredEffectBatch.h"
+
+#pragma region FLayeredAttributeEntityHandle
+
+const FLayeredAttributeEntityHandle FLayeredAttributeEntityHandle::kInvalid = FLayeredAttributeEntityHandle();
+
+#pragma endregion
+
+
+#pragma region FLayeredAttributeStore
+
+FLayeredAttributeEntityHandle FLayeredAttributeStore::CreateEntity()
+{
+	if (FreeEntities.Num() > 0)
+	{
+		// Columns were already reset when this slot was destroyed
+		const int32 Entity = FreeEntities.Pop(false);
+		return FLayeredAttributeEntityHandle(Entity, Generations[Entity]);
+	}
+
+	const int32 Entity = Generations.Add(0);
+	for (int32 KeyIndex = 0; KeyIndex < EAttributeKeyUtils::Num; KeyIndex++)
+	{
+		BaseValues[KeyIndex].Add(0);
+		CurrentValues[KeyIndex].Add(0);
+		EffectStackIndices[KeyIndex].Add(INDEX_NONE);
+	}
+	DirtyMasks.Add(0);
+	return FLayeredAttributeEntityHandle(Entity, Generations[Entity]);
+}
+
+bool FLayeredAttributeStore::DestroyEntity(const FLayeredAttributeEntityHandle& Entity)
+{
+	if (!IsValid(Entity))
+	{
+		return false;
+	}
+
+	const int32 Index = Entity.GetIndex();
+	for (int32 KeyIndex = 0; KeyIndex < EAttributeKeyUtils::Num; KeyIndex++)
+	{
+		// The entity is gone for good, so its effects' handles can be reused
+		GetEffects(Index, static_cast<EAttributeKey>(KeyIndex)).ForEachEffect([](const FActiveEffectDefinition& CurEffect)
+		{
+			FActiveEffectHandle::Release(CurEffect.GetHandle());
+		});
+		ReleaseEffects(Index, static_cast<EAttributeKey>(KeyIndex));
+		BaseValues[KeyIndex][Index] = 0;
+		CurrentValues[KeyIndex][Index] = 0;
+	}
+	DirtyMasks[Index] = 0;
+
+	Generations[Index]++;
+	FreeEntities.Add(Index);
+	return true;
+}
+
+void FLayeredAttributeStore::SetBaseValue(int32 Entity, EAttributeKey Key, int32 Value)
+{
+	BaseValues[EAttributeKeyUtils::ToIndex(Key)][Entity] = Value;
+	MarkDirty(Entity, Key);
+}
+
+const FSortedEffectDefinitions& FLayeredAttributeStore::GetEffects(int32 Entity, EAttributeKey Key) const
+{
+	static const FSortedEffectDefinitions NoEffects;
+
+	const int32 StackIndex = EffectStackIndices[EAttributeKeyUtils::ToIndex(Key)][Entity];
+	return (StackIndex == INDEX_NONE) ? NoEffects : EffectStacks[StackIndex];
+}
+
+FActiveEffectHandle FLayeredAttributeStore::AddLayeredEffect(int32 Entity, const FLayeredEffectDefinition& Effect)
+{
+	const EAttributeKey Key = Effect.GetAttribute();
+	if (!EAttributeKeyUtils::IsInRange(Key))
+	{
+		return FActiveEffectHandle::kInvalid;
+	}
+
+	const FActiveEffectHandle NewEffect = FindOrAddEffects(Entity, Key).AddLayeredEffect(Effect);
+	if (NewEffect.IsValid())
+	{
+		MarkDirty(Entity, Key);
+	}
+	else if (!GetEffects(Entity, Key).HasEffects())
+	{
+		ReleaseEffects(Entity, Key);
+	}
+	return NewEffect;
+}
+
+bool FLayeredAttributeStore::AddActiveEffect(int32 Entity, const FActiveEffectDefinition& Effect)
+{
+	const EAttributeKey Key = Effect.GetEffectDefinition().GetAttribute();
+	if (!EAttributeKeyUtils::IsInRange(Key))
+	{
+		return false;
+	}
+
+	if (FindOrAddEffects(Entity, Key).AddActiveEffect(Effect))
+	{
+		MarkDirty(Entity, Key);
+		return true;
+	}
+	if (!GetEffects(Entity, Key).HasEffects())
+	{
+		ReleaseEffects(Entity, Key);
+	}
+	return false;
+}
+
+bool FLayeredAttributeStore::RemoveLayeredEffect(int32 Entity, const FActiveEffectHandle& InHandle)
+{
+	const EAttributeKey Key = InHandle.GetAttribute();
+	if (!EAttributeKeyUtils::IsInRange(Key))
+	{
+		return false;
+	}
+
+	const int32 StackIndex = EffectStackIndices[EAttributeKeyUtils::ToIndex(Key)][Entity];
+	if (StackIndex == INDEX_NONE || !EffectStacks[StackIndex].RemoveLayeredEffect(InHandle))
+	{
+		return false;
+	}
+
+	if (!EffectStacks[StackIndex].HasEffects())
+	{
+		ReleaseEffects(Entity, Key);
+	}
+	MarkDirty(Entity, Key);
+	return true;
+}
+
+bool FLayeredAttributeStore::ClearLayeredEffects(int32 Entity, EAttributeKey Key)
+{
+	const int32 StackIndex = EffectStackIndices[EAttributeKeyUtils::ToIndex(Key)][Entity];
+	if (StackIndex == INDEX_NONE)
+	{
+		return false;
+	}
+
+	const bool bCleared = EffectStacks[StackIndex].ClearLayeredEffects();
+	ReleaseEffects(Entity, Key);
+	MarkDirty(Entity, Key);
+	return bCleared;
+}
+
+void FLayeredAttributeStore::SetAttributeState(int32 Entity, EAttributeKey Key, int32 BaseValue, const FSortedEffectDefinitions& InEffects)
+{
+	BaseValues[EAttributeKeyUtils::ToIndex(Key)][Entity] = BaseValue;
+	if (InEffects.HasEffects())
+	{
+		FindOrAddEffects(Entity, Key) = InEffects;
+	}
+	else
+	{
+		ReleaseEffects(Entity, Key);
+	}
+	MarkDirty(Entity, Key);
+}
+
+void FLayeredAttributeStore::SetSharedEffects(FSharedEffectRegistry* InSharedEffects)
+{
+	SharedEffects = InSharedEffects;
+	for (int32 KeyIndex = 0; KeyIndex < EAttributeKeyUtils::Num; KeyIndex++)
+	{
+		SharedEffectVersions[KeyIndex] = (SharedEffects != nullptr) ? SharedEffects->GetVersion(static_cast<EAttributeKey>(KeyIndex)) : 0;
+	}
+	for (uint32& CurDirtyMask : DirtyMasks)
+	{
+		CurDirtyMask = MAX_uint32;
+	}
+}
+
+void FLayeredAttributeStore::RecomputeDirtyValues()
+{
+	// Worker threads must only read shared effects, so pick up their changes and sort them up front
+	if (SharedEffects != nullptr)
+	{
+		for (int32 KeyIndex = 0; KeyIndex < EAttributeKeyUtils::Num; KeyIndex++)
+		{
+			if (SharedEffects->GetVersion(static_cast<EAttributeKey>(KeyIndex)) != SharedEffectVersions[KeyIndex])
+			{
+				SyncSharedEffectVersion(KeyIndex);
+			}
+		}
+		SharedEffects->PrepareForEvaluation();
+	}
+
+	const int32 NumEntities = DirtyMasks.Num();
+	const int32 NumBatches = FMath::DivideAndRoundUp(NumEntities, RecomputeBatchSize);
+
+	// Each batch only touches its own entities' columns and effect stacks, so batches never share writes
+	ParallelFor(NumBatches, [this, NumEntities](int32 BatchIndex)
+	{
+		const int32 FirstEntity = BatchIndex * RecomputeBatchSize;
+		const int32 LastEntity = FMath::Min(FirstEntity + RecomputeBatchSize, NumEntities);
+
+		// Layer bucket stacks are walked effect by effect, so evaluate them together with the vector kernels.
+		// Composed trees already evaluate in closed form, and attributes without effects are just their base value.
+		// Lanes are added attribute by attribute, so the same effect on many entities lines up into one run.
+		FLayeredEffectBatch EffectBatch;
+		TArray<TPair<int32, int32>> BatchedAttributes;
+		for (int32 KeyIndex = 0; KeyIndex < EAttributeKeyUtils::Num; KeyIndex++)
+		{
+			const uint32 KeyBit = (1u << KeyIndex);
+			const bool bHasSharedEffects = (SharedEffects != nullptr && SharedEffects->HasEffects(static_cast<EAttributeKey>(KeyIndex)));
+			for (int32 Entity = FirstEntity; Entity < LastEntity; Entity++)
+			{
+				if ((DirtyMasks[Entity] & KeyBit) == 0)
+				{
+					continue;
+				}
+
+				const int32 StackIndex = EffectStackIndices[KeyIndex][Entity];
+				if (StackIndex != INDEX_NONE && EffectStacks[StackIndex].GetBackend() == ELayeredEffectBackend::LayerBuckets && !bHasSharedEffects)
+				{
+					EffectBatch.AddLane(BaseValues[KeyIndex][Entity], EffectStacks[StackIndex]);
+					BatchedAttributes.Emplace(Entity, KeyIndex);
+				}
+				else
+				{
+					CurrentValues[KeyIndex][Entity] = EvaluateAttribute(Entity, KeyIndex);
+				}
+			}
+		}
+
+		FMemory::Memzero(&DirtyMasks[FirstEntity], (LastEntity - FirstEntity) * sizeof(uint32));
+		EffectBatch.Evaluate();
+		for (int32 Lane = 0; Lane < BatchedAttributes.Num(); Lane++)
+		{
+			CurrentValues[BatchedAttributes[Lane].Value][BatchedAttributes[Lane].Key] = EffectBatch.GetResult(Lane);
+		}
+	});
+}
+
+int32 FLayeredAttributeStore::EvaluateAttribute(int32 Entity, int32 KeyIndex) const
+{
+	const EAttributeKey Key = static_cast<EAttributeKey>(KeyIndex);
+	const int32 StackIndex = EffectStackIndices[KeyIndex][Entity];
+	const int32 BaseValue = BaseValues[KeyIndex][Entity];
+	if (SharedEffects != nullptr && SharedEffects->HasEffects(Key))
+	{
+		return SharedEffects->Evaluate(Key, BaseValue, GetEffects(Entity, Key),
+			GetCurrentValue(Entity, EAttributeKey::Controller), GetCurrentValue(Entity, EAttributeKey::Types));
+	}
+	return (StackIndex == INDEX_NONE) ? BaseValue : EffectStacks[StackIndex].GetCurrentValue(BaseValue);
+}
+
+void FLayeredAttributeStore::SyncSharedEffectVersion(int32 KeyIndex) const
+{
+	SharedEffectVersions[KeyIndex] = SharedEffects->GetVersion(static_cast<EAttributeKey>(KeyIndex));
+
+	const uint32 KeyBit = (1u << KeyIndex);
+	for (uint32& CurDirtyMask : DirtyMasks)
+	{
+		CurDirtyMask |= KeyBit;
+	}
+}
+
+FSortedEffectDefinitions& FLayeredAttributeStore::FindOrAddEffects(int32 Entity, EAttributeKey Key)
+{
+	int32& StackIndex = EffectStackIndices[EAttributeKeyUtils::ToIndex(Key)][Entity];
+	if (StackIndex == INDEX_NONE)
+	{
+		StackIndex = EffectStacks.Add(FSortedEffectDefinitions());
+	}
+	return EffectStacks[StackIndex];
+}
+
+void FLayeredAttributeStore::ReleaseEffects(int32 Entity, EAttributeKey Key)
+{
+	int32& StackIndex = EffectStackIndices[EAttributeKeyUtils::ToIndex(Key)][Entity];
+	if (StackIndex != INDEX_NONE)
+	{
+		EffectStacks.RemoveAt(StackIndex);
+		StackIndex = INDEX_NONE;
+	}
+}
+
+#pragma endregion
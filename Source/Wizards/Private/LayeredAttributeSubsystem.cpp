@@ -0,0 +1,304 @@
+// Copyright 2023 John McElmurray (johnmcelmurray.com). All rights reserved.
+
+#include "LayeredAttributeSubsystem.h"
+
+#include "ILayeredAttributes.h"
+#include "LayeredAttributeStats.h"
+#include "ScopedAttributeTransaction.h"
+
+void ULayeredAttributeSubsystem::QueueDeferredNotifications(UObject* Owner)
+{
+	QueuedOwners.Emplace(Owner);
+}
+
+void ULayeredAttributeSubsystem::FlushDeferredNotifications()
+{
+	// Listeners may change attributes while we flush, which queues their owners for next time
+	TArray<TWeakObjectPtr<UObject>> OwnersToFlush = MoveTemp(QueuedOwners);
+	QueuedOwners.Reset();
+
+	for (const TWeakObjectPtr<UObject>& CurOwner : OwnersToFlush)
+	{
+		if (ILayeredAttributes* LayeredAttributes = Cast<ILayeredAttributes>(CurOwner.Get()))
+		{
+			LayeredAttributes->FlushAttributeNotifications();
+		}
+	}
+}
+
+void ULayeredAttributeSubsystem::RegisterSnapshotOwner(UObject* Owner)
+{
+	SnapshotOwners.AddUnique(Owner);
+}
+
+void ULayeredAttributeSubsystem::RegisterSharedEffectTarget(UObject* Owner)
+{
+	SharedEffectTargets.Add(Owner);
+	NoteSharedEffectListener(Owner);
+}
+
+void ULayeredAttributeSubsystem::UnregisterSharedEffectTarget(UObject* Owner)
+{
+	SharedEffectTargets.Remove(Owner);
+	ListenedSharedEffectTargets.Remove(Owner);
+}
+
+void ULayeredAttributeSubsystem::NoteSharedEffectListener(UObject* Owner)
+{
+	if (SharedEffectTargets.Contains(Owner))
+	{
+		ListenedSharedEffectTargets.Add(Owner);
+	}
+}
+
+void ULayeredAttributeSubsystem::RefreshSharedEffectListeners()
+{
+	ListenedSharedEffectTargets.Reset();
+	for (auto It = SharedEffectTargets.CreateIterator(); It; ++It)
+	{
+		const ILayeredAttributes* Owner = Cast<ILayeredAttributes>(It->Get());
+		if (Owner == nullptr)
+		{
+			It.RemoveCurrent();
+			continue;
+		}
+
+		for (int32 KeyIndex = 1; KeyIndex < EAttributeKeyUtils::Num; KeyIndex++)
+		{
+			if (Owner->HasAttributeListeners(static_cast<EAttributeKey>(KeyIndex)))
+			{
+				ListenedSharedEffectTargets.Add(*It);
+				break;
+			}
+		}
+	}
+}
+
+void ULayeredAttributeSubsystem::SetEntityBaseAttribute(const FLayeredAttributeEntityHandle& Entity, EAttributeKey Key, int32 Value)
+{
+	if (Store.IsValid(Entity) && EAttributeKeyUtils::IsInRange(Key))
+	{
+		Store.SetBaseValue(Entity.GetIndex(), Key, Value);
+	}
+}
+
+int32 ULayeredAttributeSubsystem::GetEntityCurrentAttribute(const FLayeredAttributeEntityHandle& Entity, EAttributeKey Key) const
+{
+	if (Store.IsValid(Entity) && EAttributeKeyUtils::IsInRange(Key))
+	{
+		return Store.GetCurrentValue(Entity.GetIndex(), Key);
+	}
+	return 0;
+}
+
+FActiveEffectHandle ULayeredAttributeSubsystem::AddEntityLayeredEffect(const FLayeredAttributeEntityHandle& Entity, const FLayeredEffectDefinition& Effect, bool& bSuccess)
+{
+	bSuccess = false;
+	if (!Store.IsValid(Entity) || !Effect.IsValid())
+	{
+		return FActiveEffectHandle::kInvalid;
+	}
+
+	const FActiveEffectHandle NewEffect = Store.AddLayeredEffect(Entity.GetIndex(), Effect);
+	bSuccess = NewEffect.IsValid();
+	return NewEffect;
+}
+
+bool ULayeredAttributeSubsystem::RemoveEntityLayeredEffect(const FLayeredAttributeEntityHandle& Entity, const FActiveEffectHandle& Handle)
+{
+	if (Store.IsValid(Entity) && Store.RemoveLayeredEffect(Entity.GetIndex(), Handle))
+	{
+		FActiveEffectHandle::Release(Handle);
+		return true;
+	}
+	return false;
+}
+
+void ULayeredAttributeSubsystem::ClearEntityLayeredEffects(const FLayeredAttributeEntityHandle& Entity)
+{
+	if (!Store.IsValid(Entity))
+	{
+		return;
+	}
+
+	for (int32 Index = 0; Index < EAttributeKeyUtils::Num; Index++)
+	{
+		const EAttributeKey Key = static_cast<EAttributeKey>(Index);
+		Store.GetEffects(Entity.GetIndex(), Key).ForEachEffect([](const FActiveEffectDefinition& CurEffect)
+		{
+			FActiveEffectHandle::Release(CurEffect.GetHandle());
+		});
+		Store.ClearLayeredEffects(Entity.GetIndex(), Key);
+	}
+}
+
+void ULayeredAttributeSubsystem::ScheduleEffectExpiry(const FLayeredAttributeCommandTarget& Target, const FActiveEffectHandle& Handle, const FLayeredEffectExpiry& Expiry)
+{
+	ExpiryScheduler.Schedule(Target, Handle, Expiry, GetWorld()->GetTimeSeconds());
+}
+
+void ULayeredAttributeSubsystem::EndExpiryScope(FName Scope)
+{
+	TArray<FExpiredLayeredEffect> ScopeEffects;
+	ExpiryScheduler.EndScope(Scope, ScopeEffects);
+	RemoveExpiredEffects(ScopeEffects);
+}
+
+void ULayeredAttributeSubsystem::ExpireEffects()
+{
+	ExpiryScheduler.Advance(GetWorld()->GetTimeSeconds(), ExpiredEffects);
+	RemoveExpiredEffects(ExpiredEffects);
+}
+
+void ULayeredAttributeSubsystem::RemoveExpiredEffects(TArray<FExpiredLayeredEffect>& Expired)
+{
+	// Entities don't broadcast, so only objects need their removals grouped.
+	// Objects go in the order they first expire, so the outcome doesn't depend on where they live in memory.
+	TMap<ILayeredAttributes*, int32> GroupIndices;
+	TArray<TPair<ILayeredAttributes*, TArray<int32, TInlineAllocator<4>>>> Groups;
+	for (int32 Index = 0; Index < Expired.Num(); Index++)
+	{
+		const FExpiredLayeredEffect& CurEffect = Expired[Index];
+		if (CurEffect.Target.Entity.IsValid())
+		{
+			RemoveEntityLayeredEffect(CurEffect.Target.Entity, CurEffect.Handle);
+		}
+		else if (ILayeredAttributes* Owner = Cast<ILayeredAttributes>(CurEffect.Target.Object.Get()))
+		{
+			const int32 GroupIndex = GroupIndices.FindOrAdd(Owner, Groups.Num());
+			if (GroupIndex == Groups.Num())
+			{
+				Groups.AddDefaulted_GetRef().Key = Owner;
+			}
+			Groups[GroupIndex].Value.Add(Index);
+		}
+	}
+
+	for (const TPair<ILayeredAttributes*, TArray<int32, TInlineAllocator<4>>>& CurGroup : Groups)
+	{
+		// One transaction per object, so each attribute it loses effects on is broadcast once
+		FScopedAttributeTransaction Transaction(*CurGroup.Key);
+		for (const int32 ExpiredIndex : CurGroup.Value)
+		{
+			CurGroup.Key->RemoveLayeredEffect(Expired[ExpiredIndex].Handle);
+		}
+	}
+
+	Expired.Reset();
+}
+
+FActiveEffectHandle ULayeredAttributeSubsystem::AddSharedLayeredEffect(const FLayeredEffectDefinition& Effect, const FSharedEffectTargetFilter& Filter, bool& bSuccess)
+{
+	const EAttributeKey Key = Effect.GetAttribute();
+	if (!Effect.IsValid())
+	{
+		UE_LOG(LogLayeredEffects, Error, TEXT("Invalid effect '%s'"), *Effect.ToString());
+		bSuccess = false;
+		return FActiveEffectHandle::kInvalid;
+	}
+
+	if (FSharedEffectRegistry::IsTargetingAttribute(Key))
+	{
+		UE_LOG(LogLayeredEffects, Error, TEXT("Shared effect '%s' can't modify an attribute used to choose its targets"), *Effect.ToString());
+		bSuccess = false;
+		return FActiveEffectHandle::kInvalid;
+	}
+
+	TArray<FSharedEffectTargetChange> Targets;
+	BeginSharedEffectChange(Key, Filter, Targets);
+	const FActiveEffectHandle NewEffect = SharedEffects.AddSharedEffect(Effect, Filter);
+	EndSharedEffectChange(Key, Targets);
+
+	bSuccess = NewEffect.IsValid();
+	return NewEffect;
+}
+
+bool ULayeredAttributeSubsystem::RemoveSharedLayeredEffect(const FActiveEffectHandle& Handle)
+{
+	const FSharedEffectTargetFilter* Filter = SharedEffects.FindFilter(Handle);
+	if (Filter == nullptr)
+	{
+		return false;
+	}
+
+	const EAttributeKey Key = Handle.GetAttribute();
+	TArray<FSharedEffectTargetChange> Targets;
+	BeginSharedEffectChange(Key, *Filter, Targets);
+	SharedEffects.RemoveSharedEffect(Handle);
+	EndSharedEffectChange(Key, Targets);
+	return true;
+}
+
+void ULayeredAttributeSubsystem::BeginSharedEffectChange(EAttributeKey Key, const FSharedEffectTargetFilter& Filter, TArray<FSharedEffectTargetChange>& OutTargets)
+{
+	// Everyone else re-evaluates lazily, when they next read Key and see the registry's version moved
+	for (const TWeakObjectPtr<UObject>& CurTarget : ListenedSharedEffectTargets)
+	{
+		ILayeredAttributes* Owner = Cast<ILayeredAttributes>(CurTarget.Get());
+		if (Owner == nullptr)
+		{
+			continue;
+		}
+
+		// Only objects the effect applies to can change; Controller and Types can't be changed by shared effects
+		FLayeredAttributeBlock& Attributes = Owner->GetAttributesMutable();
+		if (Attributes.GetSharedEffects() != &SharedEffects
+			|| !Filter.Matches(Attributes.GetCurrentValue(EAttributeKey::Controller), Attributes.GetCurrentValue(EAttributeKey::Types)))
+		{
+			continue;
+		}
+
+		OutTargets.Emplace(Owner, Owner->BeginAttributeChange(Attributes, Key));
+	}
+}
+
+void ULayeredAttributeSubsystem::EndSharedEffectChange(EAttributeKey Key, const TArray<FSharedEffectTargetChange>& Targets)
+{
+	for (const FSharedEffectTargetChange& CurTarget : Targets)
+	{
+		CurTarget.Key->EndAttributeChange(Key, CurTarget.Value);
+		CurTarget.Key->PublishAttributeSnapshot();
+	}
+}
+
+void ULayeredAttributeSubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Super::Initialize(Collection);
+
+	Store.SetSharedEffects(&SharedEffects);
+}
+
+void ULayeredAttributeSubsystem::Tick(float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+
+	LayeredAttributeStats::EndFrame();
+
+	// Picks up Blueprint listeners bound since the last tick, which have no hook to note them as they subscribe
+	RefreshSharedEffectListeners();
+
+	// Commands from other threads and expired effects go first, so this frame's recompute and notifications include them
+	ExecuteQueuedCommands();
+	ExpireEffects();
+
+	// Evaluate everything in parallel up front, so listeners reading values during the flush hit the cache
+	RecomputeAttributes();
+	FlushDeferredNotifications();
+
+	SnapshotOwners.RemoveAllSwap([](const TWeakObjectPtr<UObject>& CurOwner)
+	{
+		ILayeredAttributes* LayeredAttributes = Cast<ILayeredAttributes>(CurOwner.Get());
+		if (LayeredAttributes == nullptr)
+		{
+			return true;
+		}
+
+		LayeredAttributes->PublishAttributeSnapshot();
+		return false;
+	});
+}
+
+TStatId ULayeredAttributeSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(ULayeredAttributeSubsystem, STATGROUP_Tickables);
+}
@@ -0,0 +1,282 @@
+// Copyright 2023 John McElmurray (johnmcelmurray.com). All rights reserved.
+
+#include "LayeredAttributeTimeline.h"
+
+#include "ILayeredAttributes.h"
+#include "LayeredAttributeBlock.h"
+
+#pragma region FLayeredAttributeTimelineBinding
+
+FLayeredAttributeTimelineBinding::~FLayeredAttributeTimelineBinding()
+{
+	if (Timeline != nullptr)
+	{
+		Timeline->Detach(*this);
+	}
+}
+
+#pragma endregion
+
+
+#pragma region FLayeredAttributeTimeline
+
+FLayeredAttributeTimeline::~FLayeredAttributeTimeline()
+{
+	Reset();
+
+	// Blocks that outlive us must stop recording into us
+	for (FParticipant& CurParticipant : Participants)
+	{
+		if (CurParticipant.Block != nullptr)
+		{
+			CurParticipant.Block->TimelineBinding.Timeline = nullptr;
+			CurParticipant.Block->TimelineBinding.Participant = INDEX_NONE;
+		}
+	}
+}
+
+FLayeredAttributeCheckpoint FLayeredAttributeTimeline::Checkpoint()
+{
+	bRecording = true;
+
+	FLayeredAttributeCheckpoint NewCheckpoint;
+	NewCheckpoint.Position = FirstPosition + Changes.Num();
+	NewCheckpoint.Serial = GetSerialBefore(NewCheckpoint.Position);
+	return NewCheckpoint;
+}
+
+bool FLayeredAttributeTimeline::IsValid(const FLayeredAttributeCheckpoint& Checkpoint) const
+{
+	return (Checkpoint.IsSet()
+		&& Checkpoint.Position >= FirstPosition
+		&& Checkpoint.Position <= FirstPosition + Changes.Num()
+		&& GetSerialBefore(Checkpoint.Position) == Checkpoint.Serial);
+}
+
+bool FLayeredAttributeTimeline::Rollback(const FLayeredAttributeCheckpoint& Checkpoint)
+{
+	if (!IsValid(Checkpoint))
+	{
+		UE_LOG(LogLayeredEffects, Warning, TEXT("Rolling back to a checkpoint that was forgotten or already rolled back past"));
+		return false;
+	}
+
+	// Value of every attribute before its first undo, so owners broadcast once for wherever it ends up
+	TMap<int32, FPendingAttributeChanges> UndoneChanges;
+
+	TGuardValue<bool> RollingBackGuard(bRollingBack, true);
+	const int32 NumKept = static_cast<int32>(Checkpoint.Position - FirstPosition);
+	for (int32 Index = Changes.Num() - 1; Index >= NumKept; Index--)
+	{
+		FChange& CurChange = Changes[Index];
+
+		// A release that never happened, nothing to undo
+		if (CurChange.Type == EChangeType::ReleasedHandle)
+		{
+			continue;
+		}
+
+		FLayeredAttributeBlock* Block = Participants[CurChange.Participant].Block;
+		if (Block == nullptr)
+		{
+			if (CurChange.Type == EChangeType::AddedEffect && CurChange.bOwnsHandle)
+			{
+				FActiveEffectHandle::Release(CurChange.Handle);
+			}
+			continue;
+		}
+		ensureMsgf(Block->GetActiveTransaction() == nullptr, TEXT("Rolling back a timeline while one of its blocks is in a transaction"));
+
+		if (Participants[CurChange.Participant].Owner != nullptr)
+		{
+			UndoneChanges.FindOrAdd(CurChange.Participant).Record(CurChange.Key, Block->GetCurrentValue(CurChange.Key));
+		}
+
+		switch (CurChange.Type)
+		{
+			case EChangeType::BaseValue:
+				Block->SetBaseValue(CurChange.Key, CurChange.OldBaseValue);
+				break;
+
+			case EChangeType::AddedEffect:
+				Block->RemoveActiveEffect(CurChange.Handle);
+				if (CurChange.bOwnsHandle)
+				{
+					FActiveEffectHandle::Release(CurChange.Handle);
+				}
+				break;
+
+			case EChangeType::RemovedEffect:
+				Block->AddActiveEffect(CurChange.Effect);
+				break;
+
+			case EChangeType::AttributeState:
+				Block->SetAttributeState(CurChange.Key, CurChange.OldBaseValue, *CurChange.OldEffects);
+				break;
+
+			default:
+				checkNoEntry();
+				break;
+		}
+	}
+
+	for (int32 Index = NumKept; Index < Changes.Num(); Index++)
+	{
+		ReleaseParticipant(Changes[Index].Participant);
+	}
+	Changes.SetNum(NumKept);
+
+	for (const TPair<int32, FPendingAttributeChanges>& CurUndone : UndoneChanges)
+	{
+		const FParticipant& CurParticipant = Participants[CurUndone.Key];
+		if (CurParticipant.Block == nullptr || CurParticipant.Owner == nullptr)
+		{
+			continue;
+		}
+
+		// FOnAttributeChangedData only broadcasts if the value actually ended somewhere new
+		UObject* OwnerObject = CurParticipant.Owner->AsObject();
+		for (int32 KeyIndex = 0; KeyIndex < EAttributeKeyUtils::Num; KeyIndex++)
+		{
+			if (const EAttributeKey CurAttribute = static_cast<EAttributeKey>(KeyIndex);
+				CurUndone.Value.Contains(CurAttribute))
+			{
+				FOnAttributeChangedData(OwnerObject, CurAttribute, CurUndone.Value.OldValues[KeyIndex]);
+			}
+		}
+		CurParticipant.Owner->PublishAttributeSnapshot();
+	}
+	return true;
+}
+
+void FLayeredAttributeTimeline::Forget(const FLayeredAttributeCheckpoint& Oldest)
+{
+	if (!IsValid(Oldest))
+	{
+		return;
+	}
+
+	const int32 NumForgotten = static_cast<int32>(Oldest.Position - FirstPosition);
+	for (int32 Index = 0; Index < NumForgotten; Index++)
+	{
+		// Nothing can bring these effects back anymore
+		if (Changes[Index].Type == EChangeType::ReleasedHandle)
+		{
+			FActiveEffectHandle::Release(Changes[Index].Handle);
+		}
+		ReleaseParticipant(Changes[Index].Participant);
+	}
+
+	if (NumForgotten > 0)
+	{
+		FirstSerial = Changes[NumForgotten - 1].Serial;
+		FirstPosition += NumForgotten;
+		Changes.RemoveAt(0, NumForgotten);
+	}
+}
+
+void FLayeredAttributeTimeline::Reset()
+{
+	Forget(Checkpoint());
+	bRecording = false;
+}
+
+void FLayeredAttributeTimeline::Attach(FLayeredAttributeBlock& Block, FLayeredAttributeTimelineBinding& Binding, ILayeredAttributes* Owner)
+{
+	check(Binding.Timeline == nullptr);
+	Binding.Timeline = this;
+	if (FreeParticipants.Num() > 0)
+	{
+		Binding.Participant = FreeParticipants.Pop(false);
+	}
+	else
+	{
+		Binding.Participant = Participants.AddDefaulted();
+	}
+	Participants[Binding.Participant].Block = &Block;
+	Participants[Binding.Participant].Owner = Owner;
+}
+
+void FLayeredAttributeTimeline::Detach(FLayeredAttributeTimelineBinding& Binding)
+{
+	check(Binding.Timeline == this);
+	FParticipant& CurParticipant = Participants[Binding.Participant];
+	CurParticipant.Block = nullptr;
+	CurParticipant.Owner = nullptr;
+
+	// Changes that still refer to the slot keep it from being reused by another block, until they're forgotten or undone
+	if (CurParticipant.NumChanges == 0)
+	{
+		FreeParticipants.Add(Binding.Participant);
+	}
+
+	Binding.Timeline = nullptr;
+	Binding.Participant = INDEX_NONE;
+}
+
+void FLayeredAttributeTimeline::RecordBaseValue(int32 Participant, EAttributeKey Key, int32 OldBaseValue)
+{
+	AddChange(EChangeType::BaseValue, Participant, Key).OldBaseValue = OldBaseValue;
+}
+
+void FLayeredAttributeTimeline::RecordAddedEffect(int32 Participant, const FActiveEffectHandle& InHandle, bool bOwnsHandle)
+{
+	FChange& NewChange = AddChange(EChangeType::AddedEffect, Participant, InHandle.GetAttribute());
+	NewChange.Handle = InHandle;
+	NewChange.bOwnsHandle = bOwnsHandle;
+}
+
+void FLayeredAttributeTimeline::RecordRemovedEffect(int32 Participant, const FActiveEffectDefinition& Effect)
+{
+	AddChange(EChangeType::RemovedEffect, Participant, Effect.GetHandle().GetAttribute()).Effect = Effect;
+}
+
+void FLayeredAttributeTimeline::RecordAttributeState(int32 Participant, EAttributeKey Key, int32 OldBaseValue, const FSortedEffectDefinitions& OldEffects)
+{
+	FChange& NewChange = AddChange(EChangeType::AttributeState, Participant, Key);
+	NewChange.OldBaseValue = OldBaseValue;
+	NewChange.OldEffects = MakeUnique<FSortedEffectDefinitions>(OldEffects);
+}
+
+void FLayeredAttributeTimeline::RecordReleasedHandle(const FActiveEffectHandle& InHandle)
+{
+	AddChange(EChangeType::ReleasedHandle, INDEX_NONE, InHandle.GetAttribute()).Handle = InHandle;
+}
+
+FLayeredAttributeTimeline::FChange& FLayeredAttributeTimeline::AddChange(EChangeType Type, int32 Participant, EAttributeKey Key)
+{
+	checkSlow(IsRecording());
+	FChange& NewChange = Changes.AddDefaulted_GetRef();
+	NewChange.Type = Type;
+	NewChange.Participant = Participant;
+	NewChange.Key = Key;
+	NewChange.Serial = NextSerial++;
+	if (Participant != INDEX_NONE)
+	{
+		Participants[Participant].NumChanges++;
+	}
+	return NewChange;
+}
+
+void FLayeredAttributeTimeline::ReleaseParticipant(int32 Participant)
+{
+	if (Participant == INDEX_NONE)
+	{
+		return;
+	}
+
+	FParticipant& CurParticipant = Participants[Participant];
+	checkSlow(CurParticipant.NumChanges > 0);
+	if (--CurParticipant.NumChanges == 0 && CurParticipant.Block == nullptr)
+	{
+		FreeParticipants.Add(Participant);
+	}
+}
+
+uint64 FLayeredAttributeTimeline::GetSerialBefore(int64 Position) const
+{
+	checkSlow(Position >= FirstPosition && Position <= FirstPosition + Changes.Num());
+	return (Position == FirstPosition) ? FirstSerial : Changes[static_cast<int32>(Position - FirstPosition) - 1].Serial;
+}
+
+#pragma endregion
@@ -0,0 +1,212 @@
+// Copyright 2023 John McElmurray (johnmcelmurray.com). All rights reserved.
+
+#include "LayeredEffectBatch.h"
+
+#include "Math/VectorRegister.h"
+
+#pragma region EEffectOperationUtils
+
+namespace
+{
+	/// <summary>
+	/// Values handled per unrolled iteration: four 4-wide integer registers.
+	/// </summary>
+	constexpr int32 ValuesPerIteration = 16;
+
+	/// <summary>
+	/// Applies VectorOp to Values/Modifications 16 lanes at a time, then ScalarOp to whatever is left over.
+	/// Both ops are passed as lambdas, since the VectorInt* intrinsics are macros on some platforms.
+	/// </summary>
+	template <typename VectorOpType, typename ScalarOpType>
+	void EvaluateRunWith(int32* Values, const int32* Modifications, int32 NumValues, VectorOpType VectorOp, ScalarOpType ScalarOp)
+	{
+		int32 Index = 0;
+		for (; Index + ValuesPerIteration <= NumValues; Index += ValuesPerIteration)
+		{
+			const VectorRegister4Int Result0 = VectorOp(VectorIntLoad(Values + Index), VectorIntLoad(Modifications + Index));
+			const VectorRegister4Int Result1 = VectorOp(VectorIntLoad(Values + Index + 4), VectorIntLoad(Modifications + Index + 4));
+			const VectorRegister4Int Result2 = VectorOp(VectorIntLoad(Values + Index + 8), VectorIntLoad(Modifications + Index + 8));
+			const VectorRegister4Int Result3 = VectorOp(VectorIntLoad(Values + Index + 12), VectorIntLoad(Modifications + Index + 12));
+			VectorIntStore(Result0, Values + Index);
+			VectorIntStore(Result1, Values + Index + 4);
+			VectorIntStore(Result2, Values + Index + 8);
+			VectorIntStore(Result3, Values + Index + 12);
+		}
+
+		for (; Index + 4 <= NumValues; Index += 4)
+		{
+			VectorIntStore(VectorOp(VectorIntLoad(Values + Index), VectorIntLoad(Modifications + Index)), Values + Index);
+		}
+
+		for (; Index < NumValues; Index++)
+		{
+			Values[Index] = ScalarOp(Values[Index], Modifications[Index]);
+		}
+	}
+}
+
+void EEffectOperationUtils::EvaluateRun(EEffectOperation Operation, TArrayView<int32> Values, TConstArrayView<int32> Modifications)
+{
+	check(Values.Num() == Modifications.Num());
+	int32* ValueData = Values.GetData();
+	const int32* ModificationData = Modifications.GetData();
+	const int32 NumValues = Values.Num();
+
+	switch (Operation)
+	{
+		case EEffectOperation::Set:
+			FMemory::Memcpy(ValueData, ModificationData, NumValues * sizeof(int32));
+			break;
+		case EEffectOperation::Add:
+			EvaluateRunWith(ValueData, ModificationData, NumValues,
+				[](const VectorRegister4Int& A, const VectorRegister4Int& B) { return VectorIntAdd(A, B); },
+				[](int32 A, int32 B) { return A + B; });
+			break;
+		case EEffectOperation::Subtract:
+			EvaluateRunWith(ValueData, ModificationData, NumValues,
+				[](const VectorRegister4Int& A, const VectorRegister4Int& B) { return VectorIntSubtract(A, B); },
+				[](int32 A, int32 B) { return A - B; });
+			break;
+		case EEffectOperation::Multiply:
+			EvaluateRunWith(ValueData, ModificationData, NumValues,
+				[](const VectorRegister4Int& A, const VectorRegister4Int& B) { return VectorIntMultiply(A, B); },
+				[](int32 A, int32 B) { return A * B; });
+			break;
+		case EEffectOperation::BitwiseOr:
+			EvaluateRunWith(ValueData, ModificationData, NumValues,
+				[](const VectorRegister4Int& A, const VectorRegister4Int& B) { return VectorIntOr(A, B); },
+				[](int32 A, int32 B) { return A | B; });
+			break;
+		case EEffectOperation::BitwiseAnd:
+			EvaluateRunWith(ValueData, ModificationData, NumValues,
+				[](const VectorRegister4Int& A, const VectorRegister4Int& B) { return VectorIntAnd(A, B); },
+				[](int32 A, int32 B) { return A & B; });
+			break;
+		case EEffectOperation::BitwiseXor:
+			EvaluateRunWith(ValueData, ModificationData, NumValues,
+				[](const VectorRegister4Int& A, const VectorRegister4Int& B) { return VectorIntXor(A, B); },
+				[](int32 A, int32 B) { return A ^ B; });
+			break;
+
+		default:
+			checkNoEntry();
+			break;
+	}
+}
+
+bool EEffectOperationUtils::GetIdentityModification(EEffectOperation Operation, int32& OutModification)
+{
+	switch (Operation)
+	{
+		case EEffectOperation::Add:
+		case EEffectOperation::Subtract:
+		case EEffectOperation::BitwiseOr:
+		case EEffectOperation::BitwiseXor:
+			OutModification = 0;
+			return true;
+		case EEffectOperation::Multiply:
+			OutModification = 1;
+			return true;
+		case EEffectOperation::BitwiseAnd:
+			OutModification = -1;
+			return true;
+
+		default:
+			return false;
+	}
+}
+
+#pragma endregion
+
+
+#pragma region FLayeredEffectBatch
+
+void FLayeredEffectBatch::Reset()
+{
+	Values.Reset();
+	for (int32 Step = 0; Step < NumSteps; Step++)
+	{
+		StepOperations[Step].Reset();
+		StepModifications[Step].Reset();
+	}
+	NumSteps = 0;
+}
+
+int32 FLayeredEffectBatch::AddLane(int32 BaseValue, const FSortedEffectDefinitions& Effects)
+{
+	const int32 Lane = Values.Add(BaseValue);
+
+	int32 Step = 0;
+	Effects.ForEachEffect([this, Lane, &Step](const FActiveEffectDefinition& CurEffect)
+	{
+		const FLayeredEffectDefinition& Definition = CurEffect.GetEffectDefinition();
+		AddStep(Lane, Step++, Definition.GetOperation(), Definition.GetModification());
+	});
+
+	return Lane;
+}
+
+void FLayeredEffectBatch::Evaluate()
+{
+	const int32 NumLanes = Values.Num();
+	for (int32 Step = 0; Step < NumSteps; Step++)
+	{
+		PadStep(Step, NumLanes);
+		const TArray<EEffectOperation>& Operations = StepOperations[Step];
+		const TArray<int32>& Modifications = StepModifications[Step];
+
+		int32 RunStart = 0;
+		while (RunStart < NumLanes)
+		{
+			const EEffectOperation RunOperation = Operations[RunStart];
+			int32 RunEnd = RunStart + 1;
+			while (RunEnd < NumLanes && Operations[RunEnd] == RunOperation)
+			{
+				RunEnd++;
+			}
+
+			const int32 RunLength = RunEnd - RunStart;
+			EEffectOperationUtils::EvaluateRun(RunOperation,
+				MakeArrayView(Values.GetData() + RunStart, RunLength),
+				MakeArrayView(Modifications.GetData() + RunStart, RunLength));
+			RunStart = RunEnd;
+		}
+	}
+}
+
+void FLayeredEffectBatch::AddStep(int32 Lane, int32 Step, EEffectOperation Operation, int32 Modification)
+{
+	if (Step == NumSteps)
+	{
+		if (StepOperations.Num() == NumSteps)
+		{
+			StepOperations.AddDefaulted();
+			StepModifications.AddDefaulted();
+		}
+		NumSteps++;
+	}
+
+	PadStep(Step, Lane);
+	StepOperations[Step].Add(Operation);
+	StepModifications[Step].Add(Modification);
+}
+
+void FLayeredEffectBatch::PadStep(int32 Step, int32 NumLanes)
+{
+	TArray<EEffectOperation>& Operations = StepOperations[Step];
+	TArray<int32>& Modifications = StepModifications[Step];
+	while (Operations.Num() < NumLanes)
+	{
+		EEffectOperation PadOperation = (Operations.Num() > 0) ? Operations.Last() : EEffectOperation::Add;
+		int32 PadModification = 0;
+		if (!EEffectOperationUtils::GetIdentityModification(PadOperation, PadModification))
+		{
+			PadOperation = EEffectOperation::Add;
+			PadModification = 0;
+		}
+		Operations.Add(PadOperation);
+		Modifications.Add(PadModification);
+	}
+}
+
+#pragma endregion
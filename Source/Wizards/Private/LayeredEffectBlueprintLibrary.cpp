@@ -0,0 +1,29 @@
+// Copyright 2023 John McElmurray (johnmcelmurray.com). All rights reserved.
+
+#include "LayeredEffectBlueprintLibrary.h"
+
+#pragma region ULayeredEffectBlueprintLibrary
+
+int32 GetValueClampedToInt32(uint32 Value)
+{
+	UE_CLOG(!FMath::IsWithinInclusive(Value, static_cast<uint32>(0), static_cast<uint32>(MAX_int32)),
+		LogLayeredEffects, Error, TEXT("Clamping incoming unsigned value %u to [%d, %d]."), Value, 0, MAX_int32);
+	return FMath::Clamp(Value, static_cast<uint32>(0), static_cast<uint32>(MAX_int32));
+}
+
+FColor ULayeredEffectBlueprintLibrary::Conv_IntToColor(int32 Value)
+{
+	const uint32 UnsignedValue = std::make_unsigned_t<int32>(Value);
+	FColor ColorValue = FColor(UnsignedValue);
+	ColorValue.A = 255;
+	return ColorValue;
+}
+
+int32 ULayeredEffectBlueprintLibrary::Conv_ColorToInt(FColor Value)
+{
+	const uint32 UnsignedValue = Value.ToPackedARGB();
+	const int32 SignedValue = GetValueClampedToInt32(UnsignedValue);
+	return SignedValue;
+}
+
+#pragma endregion
@@ -2,189 +2,627 @@
 
 #include "LayeredEffectDefinition.h"
 
-#include "ILayeredAttributes.h"
+#include "Algo/BinarySearch.h"
+#include "HAL/IConsoleManager.h"
+
+#include "ActiveEffectHandleAllocator.h"
+
+#include <atomic>
 
 DEFINE_LOG_CATEGORY(LogLayeredEffects);
 
-#pragma region FOnAttributeChangedData
+static TAutoConsoleVariable<int32> CVarLayeredEffectsBackend(
+	TEXT("LayeredEffects.Backend"),
+	0,
+	TEXT("Storage used by newly created layered effect stacks.\n")
+	TEXT(" 0: per-layer buckets, re-evaluated on every change (default)\n")
+	TEXT(" 1: balanced tree of composed transforms, O(log n) add/remove"),
+	ECVF_Default);
+
+#pragma region FLayeredEffectDefinition
+
+FString FLayeredEffectDefinition::ToString() const
+{
+	return FString::Printf(TEXT("L%d %s: %s %d"),
+		Layer,
+		*StaticEnum<EAttributeKey>()->GetNameStringByValue(static_cast<int64>(Attribute)),
+		*EEffectOperationUtils::OperatorToString(Operation),
+		Modification);
+}
+
+#pragma endregion
+
+
+#pragma region FActiveEffectHandle
+
+const FActiveEffectHandle FActiveEffectHandle::kInvalid = FActiveEffectHandle();
+
+FActiveEffectHandle FActiveEffectHandle::GenerateNewHandle(EAttributeKey Attribute)
+{
+	int32 NewIndex = INDEX_NONE;
+	uint32 NewGeneration = 0;
+	FActiveEffectHandleAllocator::Get().Allocate(NewIndex, NewGeneration);
+	return FActiveEffectHandle(NewIndex, NewGeneration, Attribute);
+}
+
+void FActiveEffectHandle::Release(const FActiveEffectHandle& InHandle)
+{
+	if (InHandle.IsValid())
+	{
+		FActiveEffectHandleAllocator::Get().Release(InHandle.Index, InHandle.Generation);
+	}
+}
+
+bool FActiveEffectHandle::IsLive() const
+{
+	return IsValid() && FActiveEffectHandleAllocator::Get().IsLive(Index, Generation);
+}
+
+#pragma endregion
+
+
+#pragma region FActiveEffectDefinition
+
+namespace
+{
+	// 0 is reserved for default constructed (invalid) effects
+	std::atomic<int64> NextSequence { 1 };
+}
+
+int64 FActiveEffectDefinition::GenerateSequence()
+{
+	return NextSequence.fetch_add(1, std::memory_order_relaxed);
+}
+
+void FActiveEffectDefinition::ReserveSequence(int64 Sequence)
+{
+	int64 Expected = NextSequence.load(std::memory_order_relaxed);
+	while (Expected <= Sequence && !NextSequence.compare_exchange_weak(Expected, Sequence + 1, std::memory_order_relaxed))
+	{
+	}
+}
+
+#pragma endregion
+
+
+#pragma region FComposedEffectTransform
+
+namespace
+{
+	FComposedEffectTransform MakeTransform(FComposedEffectTransform::EKind Kind, uint32 A, uint32 B)
+	{
+		FComposedEffectTransform Transform;
+		Transform.Kind = Kind;
+		Transform.A = A;
+		Transform.B = B;
+		return Transform;
+	}
+}
+
+FComposedEffectTransform FComposedEffectTransform::FromOperation(EEffectOperation Operation, int32 Modification)
+{
+	const uint32 Mod = static_cast<uint32>(Modification);
+
+	switch (Operation)
+	{
+		case EEffectOperation::Set:
+			return MakeTransform(EKind::Constant, 0, Mod);
+		case EEffectOperation::Add:
+			return MakeTransform(EKind::Affine, 1, Mod);
+		case EEffectOperation::Subtract:
+			return MakeTransform(EKind::Affine, 1, 0u - Mod);
+		case EEffectOperation::Multiply:
+			return MakeTransform(EKind::Affine, Mod, 0);
+		case EEffectOperation::BitwiseOr:
+			return MakeTransform(EKind::Bitwise, ~Mod, Mod);
+		case EEffectOperation::BitwiseAnd:
+			return MakeTransform(EKind::Bitwise, Mod, 0);
+		case EEffectOperation::BitwiseXor:
+			return MakeTransform(EKind::Bitwise, MAX_uint32, Mod);
+
+		default:
+			checkNoEntry();
+			return FComposedEffectTransform();
+	}
+}
+
+FComposedEffectTransform FComposedEffectTransform::Compose(const FComposedEffectTransform& First, const FComposedEffectTransform& Second)
+{
+	if (Second.Kind == EKind::Identity)
+	{
+		return First;
+	}
+
+	if (First.Kind == EKind::Identity)
+	{
+		return Second;
+	}
+
+	// A Set discards everything that was applied before it
+	if (Second.Kind == EKind::Constant)
+	{
+		return Second;
+	}
+
+	if (First.Kind == EKind::Mixed || Second.Kind == EKind::Mixed)
+	{
+		return MakeTransform(EKind::Mixed, 1, 0);
+	}
 
-FOnAttributeChangedData::FOnAttributeChangedData(
-	UObject* InOwner,
-	EAttributeKey InAttribute,
-	int32 InOldValue)
-	: Owner(InOwner)
-	, Attribute(InAttribute)
-	, NewValue(0)
-	, OldValue(InOldValue)
+	if (First.Kind == EKind::Constant)
+	{
+		return MakeTransform(EKind::Constant, 0, static_cast<uint32>(Second.Apply(static_cast<int32>(First.B))));
+	}
+
+	if (First.Kind == EKind::Affine && Second.Kind == EKind::Affine)
+	{
+		// ((x * A1) + B1) * A2 + B2
+		return MakeTransform(EKind::Affine, Second.A * First.A, (Second.A * First.B) + Second.B);
+	}
+
+	if (First.Kind == EKind::Bitwise && Second.Kind == EKind::Bitwise)
+	{
+		// (((x & A1) ^ B1) & A2) ^ B2
+		return MakeTransform(EKind::Bitwise, First.A & Second.A, (First.B & Second.A) ^ Second.B);
+	}
+
+	// Affine and bitwise operations interleave
+	return MakeTransform(EKind::Mixed, 1, 0);
+}
+
+#pragma endregion
+
+
+#pragma region FCompiledEffectProgram
+
+namespace
 {
-	// When this struct is created, we broadcast the event if it represents an actual change to the attribute
-	if (const ILayeredAttributes* MyOwner = GetOwner())
+	FCompiledEffectProgram::FStep MakeStep(const FComposedEffectTransform& Transform)
 	{
-		NewValue = MyOwner->GetCurrentAttribute(InAttribute);
+		using EKind = FComposedEffectTransform::EKind;
+		checkSlow(Transform.IsClosedForm());
 
-		if (IsValid())
+		// Every kind is a special case of ((Value & Mask) * Multiplier + Addend) ^ Flip
+		FCompiledEffectProgram::FStep Step;
+		switch (Transform.Kind)
 		{
-			MyOwner->GetOnAnyAttributeValueChanged().Broadcast(*this);
+			case EKind::Constant:
+				Step.Mask = 0;
+				Step.Addend = Transform.B;
+				break;
+			case EKind::Affine:
+				Step.Multiplier = Transform.A;
+				Step.Addend = Transform.B;
+				break;
+			case EKind::Bitwise:
+				Step.Mask = Transform.A;
+				Step.Flip = Transform.B;
+				break;
+			default:
+				break;
 		}
+		return Step;
 	}
 }
 
-bool FOnAttributeChangedData::IsValid() const
+void FCompiledEffectProgram::Append(EEffectOperation Operation, int32 Modification)
 {
-	return (GetOwner() != nullptr
-		&& Attribute != EAttributeKey::Invalid
-		&& NewValue != OldValue);
+	const FComposedEffectTransform Transform = FComposedEffectTransform::FromOperation(Operation, Modification);
+
+	// A Set discards everything that was applied before it
+	if (Transform.Kind == FComposedEffectTransform::EKind::Constant)
+	{
+		Steps.Reset();
+	}
+
+	const FComposedEffectTransform Folded = FComposedEffectTransform::Compose(LastTransform, Transform);
+	if (Steps.Num() > 0 && Folded.IsClosedForm())
+	{
+		LastTransform = Folded;
+		Steps.Last() = MakeStep(Folded);
+	}
+	else
+	{
+		LastTransform = Transform;
+		Steps.Add(MakeStep(Transform));
+	}
 }
 
-ILayeredAttributes* FOnAttributeChangedData::GetOwner() const
+void FCompiledEffectProgram::Reset()
 {
-	return Cast<ILayeredAttributes>(Owner);
+	Steps.Reset();
+	LastTransform = FComposedEffectTransform();
 }
 
 #pragma endregion
 
 
-#pragma region FLayeredEffectDefinition
+#pragma region FComposedEffectTree
 
-FString FLayeredEffectDefinition::ToString() const
+void FComposedEffectTree::Insert(const FActiveEffectDefinition& Effect)
 {
-	return FString::Printf(TEXT("L%d %s: %s %d"),
-		Layer,
-		*UEnumLibrary::GetEnumValueShortAsString(Attribute),
-		*EEffectOperationUtils::OperatorToString(Operation),
-		Modification);
+	int32 NodeIndex = INDEX_NONE;
+	if (FreeNodes.Num() > 0)
+	{
+		NodeIndex = FreeNodes.Pop(false);
+		Nodes[NodeIndex] = FNode();
+	}
+	else
+	{
+		NodeIndex = Nodes.AddDefaulted();
+	}
+
+	FNode& NewNode = Nodes[NodeIndex];
+	NewNode.Effect = Effect;
+	NewNode.Priority = static_cast<uint32>(MurmurFinalize64(static_cast<uint64>(Effect.GetSequence())));
+	NewNode.Self = FComposedEffectTransform::FromOperation(
+		Effect.GetEffectDefinition().GetOperation(),
+		Effect.GetEffectDefinition().GetModification());
+	NewNode.Composed = NewNode.Self;
+
+	// Everything ordered before the new node goes to its left, everything else to its right
+	int32 LeftIndex = INDEX_NONE;
+	int32 RightIndex = INDEX_NONE;
+	Split(Root, NewNode, LeftIndex, RightIndex);
+	Root = Merge(Merge(LeftIndex, NodeIndex), RightIndex);
+
+	HandleToNode.Add(Effect.GetHandle(), NodeIndex);
 }
 
-#pragma endregion
+bool FComposedEffectTree::Remove(const FActiveEffectHandle& InHandle)
+{
+	int32 NodeIndex = INDEX_NONE;
+	if (!HandleToNode.RemoveAndCopyValue(InHandle, NodeIndex))
+	{
+		return false;
+	}
 
+	Root = Erase(Root, NodeIndex);
 
-#pragma region FActiveEffectHandle
+	Nodes[NodeIndex] = FNode();
+	FreeNodes.Add(NodeIndex);
+	return true;
+}
 
-const FActiveEffectHandle FActiveEffectHandle::kInvalid = FActiveEffectHandle();
+void FComposedEffectTree::Reset()
+{
+	Nodes.Reset();
+	FreeNodes.Reset();
+	HandleToNode.Reset();
+	Root = INDEX_NONE;
+}
 
-FActiveEffectHandle FActiveEffectHandle::GenerateNewHandle(EAttributeKey Attribute)
+int32 FComposedEffectTree::Evaluate(const int32 BaseValue) const
 {
-	static int32 GHandleID = 0;
-	FActiveEffectHandle NewHandle(GHandleID++, Attribute);
-	return NewHandle;
+	return EvaluateSubtree(Root, BaseValue);
 }
 
-#pragma endregion
+bool FComposedEffectTree::IsOrderedBefore(const FNode& A, const FNode& B) const
+{
+	// Smaller numbered layers get applied first
+	const int32 LayerA = A.Effect.GetEffectDefinition().GetLayer();
+	const int32 LayerB = B.Effect.GetEffectDefinition().GetLayer();
+	if (LayerA != LayerB)
+	{
+		return LayerA < LayerB;
+	}
 
+	// Effects with the same layer get applied in the order that they were added (sequence order)
+	return A.Effect.GetSequence() < B.Effect.GetSequence();
+}
 
-#pragma region FSortedEffectDefinitions
+const FComposedEffectTransform& FComposedEffectTree::GetComposed(int32 NodeIndex) const
+{
+	static const FComposedEffectTransform Identity;
+	return (NodeIndex == INDEX_NONE ? Identity : Nodes[NodeIndex].Composed);
+}
+
+void FComposedEffectTree::UpdateComposed(int32 NodeIndex)
+{
+	FNode& Node = Nodes[NodeIndex];
+	Node.Composed = FComposedEffectTransform::Compose(
+		FComposedEffectTransform::Compose(GetComposed(Node.Left), Node.Self),
+		GetComposed(Node.Right));
+}
 
-FActiveEffectHandle FSortedEffectDefinitions::AddLayeredEffect(const UWorld* World, const FLayeredEffectDefinition& Effect)
+void FComposedEffectTree::Split(int32 NodeIndex, const FNode& Pivot, int32& OutLeft, int32& OutRight)
 {
-	if (World == nullptr)
+	if (NodeIndex == INDEX_NONE)
 	{
-		UE_LOG(LogLayeredEffects, Error, TEXT("Invalid world"));
-		return FActiveEffectHandle::kInvalid;
+		OutLeft = INDEX_NONE;
+		OutRight = INDEX_NONE;
+		return;
+	}
+
+	FNode& Node = Nodes[NodeIndex];
+	if (IsOrderedBefore(Node, Pivot))
+	{
+		Split(Node.Right, Pivot, Node.Right, OutRight);
+		OutLeft = NodeIndex;
+	}
+	else
+	{
+		Split(Node.Left, Pivot, OutLeft, Node.Left);
+		OutRight = NodeIndex;
+	}
+
+	UpdateComposed(NodeIndex);
+}
+
+int32 FComposedEffectTree::Merge(int32 LeftIndex, int32 RightIndex)
+{
+	if (LeftIndex == INDEX_NONE)
+	{
+		return RightIndex;
+	}
+
+	if (RightIndex == INDEX_NONE)
+	{
+		return LeftIndex;
+	}
+
+	if (Nodes[LeftIndex].Priority > Nodes[RightIndex].Priority)
+	{
+		const int32 NewRight = Merge(Nodes[LeftIndex].Right, RightIndex);
+		Nodes[LeftIndex].Right = NewRight;
+		UpdateComposed(LeftIndex);
+		return LeftIndex;
+	}
+	else
+	{
+		const int32 NewLeft = Merge(LeftIndex, Nodes[RightIndex].Left);
+		Nodes[RightIndex].Left = NewLeft;
+		UpdateComposed(RightIndex);
+		return RightIndex;
+	}
+}
+
+int32 FComposedEffectTree::Erase(int32 SubtreeIndex, int32 NodeIndex)
+{
+	if (SubtreeIndex == INDEX_NONE)
+	{
+		checkNoEntry();
+		return INDEX_NONE;
+	}
+
+	if (SubtreeIndex == NodeIndex)
+	{
+		return Merge(Nodes[NodeIndex].Left, Nodes[NodeIndex].Right);
+	}
+
+	if (IsOrderedBefore(Nodes[NodeIndex], Nodes[SubtreeIndex]))
+	{
+		const int32 NewLeft = Erase(Nodes[SubtreeIndex].Left, NodeIndex);
+		Nodes[SubtreeIndex].Left = NewLeft;
+	}
+	else
+	{
+		const int32 NewRight = Erase(Nodes[SubtreeIndex].Right, NodeIndex);
+		Nodes[SubtreeIndex].Right = NewRight;
 	}
 
+	UpdateComposed(SubtreeIndex);
+	return SubtreeIndex;
+}
+
+int32 FComposedEffectTree::EvaluateSubtree(int32 NodeIndex, int32 Value) const
+{
+	if (NodeIndex == INDEX_NONE)
+	{
+		return Value;
+	}
+
+	const FNode& Node = Nodes[NodeIndex];
+	if (Node.Composed.IsClosedForm())
+	{
+		return Node.Composed.Apply(Value);
+	}
+
+	// No closed form for this subtree, so evaluate it piece by piece
+	Value = EvaluateSubtree(Node.Left, Value);
+	Value = Node.Self.Apply(Value);
+	return EvaluateSubtree(Node.Right, Value);
+}
+
+#pragma endregion
+
+
+#pragma region FSortedEffectDefinitions
+
+FSortedEffectDefinitions::FSortedEffectDefinitions()
+	: Backend(CVarLayeredEffectsBackend.GetValueOnAnyThread() == 1 ? ELayeredEffectBackend::ComposedTree : ELayeredEffectBackend::LayerBuckets)
+{ }
+
+FActiveEffectHandle FSortedEffectDefinitions::AddLayeredEffect(const FLayeredEffectDefinition& Effect)
+{
 	if (!Effect.IsValid())
 	{
 		UE_LOG(LogLayeredEffects, Error, TEXT("Invalid effect '%s'"), *Effect.ToString());
 		return FActiveEffectHandle::kInvalid;
 	}
 
-	const FActiveEffectDefinition NewActiveEffect = FActiveEffectDefinition(World, Effect);
-	if (!NewActiveEffect.IsValid())
+	const FActiveEffectDefinition NewActiveEffect = FActiveEffectDefinition(Effect);
+	if (!AddActiveEffect(NewActiveEffect))
 	{
 		UE_LOG(LogLayeredEffects, Error, TEXT("Invalid active effect created from '%s'"), *NewActiveEffect.ToString());
+		FActiveEffectHandle::Release(NewActiveEffect.GetHandle());
 		return FActiveEffectHandle::kInvalid;
 	}
 
-	const int32 NewEffectLayer = NewActiveEffect.GetEffectDefinition().GetLayer();
-	const float NewEffectStartTime = NewActiveEffect.GetStartTime();
+	// Return the handle for this newly applied effect
+	return NewActiveEffect.GetHandle();
+}
 
-	int32 IndexToInsert = 0;
-	for (const FActiveEffectDefinition& CurEffect : SortedEffects)
+bool FSortedEffectDefinitions::AddActiveEffect(const FActiveEffectDefinition& NewActiveEffect)
+{
+	if (!NewActiveEffect.IsValid() || ContainsEffect(NewActiveEffect.GetHandle()))
 	{
-		if (CurEffect.IsValid())
-		{
-			const int32 CurEffectLayer = CurEffect.GetEffectDefinition().GetLayer();
-			const float CurEffectStartTime = CurEffect.GetStartTime();
-
-			if (NewEffectLayer > CurEffectLayer // Smaller numbered layers get applied first
-				|| (NewEffectLayer == CurEffectLayer // Effects with the same layer get applied in the order that they were added (timestamp order)
-					&& NewEffectStartTime >= CurEffectStartTime))
-			{
-				// This effect should be at a higher layer - continue
-				IndexToInsert++;
-			}
-			else
-			{
-				// We found the spot to insert
-				break;
-			}
-		}
+		return false;
+	}
+
+	if (Backend == ELayeredEffectBackend::ComposedTree)
+	{
+		ComposedTree.Insert(NewActiveEffect);
+		MarkChanged();
+		return true;
 	}
 
-	SortedEffects.Insert(NewActiveEffect, IndexToInsert);
+	// Smaller numbered layers get applied first, so find (or create) this effect's layer bucket
+	const int32 NewEffectLayer = NewActiveEffect.GetEffectDefinition().GetLayer();
+	const int32 BucketIndex = Algo::LowerBoundBy(LayerBuckets, NewEffectLayer, &FLayeredEffectBucket::Layer);
+	if (!LayerBuckets.IsValidIndex(BucketIndex) || LayerBuckets[BucketIndex].Layer != NewEffectLayer)
+	{
+		LayerBuckets.Insert(FLayeredEffectBucket(NewEffectLayer), BucketIndex);
+	}
 
-	// Return the handle for this newly applied effect
-	return NewActiveEffect.GetHandle();
+	// Effects with the same layer get applied in the order that they were added (sequence order).
+	// The sequence only moves forward, so this is almost always an append; effects activated elsewhere may not be.
+	TArray<FActiveEffectDefinition>& BucketEffects = LayerBuckets[BucketIndex].Effects;
+	const int64 NewEffectSequence = NewActiveEffect.GetSequence();
+	if (BucketEffects.Num() == 0 || BucketEffects.Last().GetSequence() < NewEffectSequence)
+	{
+		const int32 NewIndex = BucketEffects.Add(NewActiveEffect);
+		HandleToSlot.Add(NewActiveEffect.GetHandle(), FEffectSlot{ NewEffectLayer, NewIndex });
+	}
+	else
+	{
+		const int32 IndexToInsert = Algo::UpperBoundBy(BucketEffects, NewEffectSequence, &FActiveEffectDefinition::GetSequence);
+		BucketEffects.Insert(NewActiveEffect, IndexToInsert);
+		ReindexBucket(BucketIndex, IndexToInsert);
+	}
+
+	MarkChanged();
+	return true;
 }
 
 bool FSortedEffectDefinitions::RemoveLayeredEffect(const FActiveEffectHandle& InHandle)
 {
-	const int32 NumRemovedEffects = SortedEffects.RemoveAll([InHandle](const FActiveEffectDefinition& CurActiveEffect) {
-		return CurActiveEffect.GetHandle() == InHandle;
-	});
-	return (NumRemovedEffects > 0);
+	int32 NumRemovedEffects = 0;
+	if (Backend == ELayeredEffectBackend::ComposedTree)
+	{
+		NumRemovedEffects = (ComposedTree.Remove(InHandle) ? 1 : 0);
+	}
+	else if (FEffectSlot Slot; HandleToSlot.RemoveAndCopyValue(InHandle, Slot))
+	{
+		const int32 BucketIndex = FindBucketIndex(Slot.Layer);
+		check(BucketIndex != INDEX_NONE);
+
+		// Leave a tombstone behind instead of shifting the rest of the bucket
+		FLayeredEffectBucket& Bucket = LayerBuckets[BucketIndex];
+		Bucket.Effects[Slot.Index].Invalidate();
+		Bucket.NumTombstones++;
+		NumRemovedEffects = 1;
+
+		if (Bucket.NumLiveEffects() == 0)
+		{
+			// Drop empty layers so evaluation and insertion only see live buckets
+			LayerBuckets.RemoveAt(BucketIndex);
+		}
+		else if (Bucket.NumTombstones > Bucket.NumLiveEffects())
+		{
+			// Compacting only once tombstones outnumber live effects keeps removal O(1) amortized
+			CompactBucket(BucketIndex);
+		}
+	}
+
+	if (NumRemovedEffects > 0)
+	{
+		MarkChanged();
+		return true;
+	}
+	return false;
 }
 
 int32 FSortedEffectDefinitions::GetCurrentValue(const int32 BaseValue) const
 {
-	int32 CurrentValue = BaseValue;
-
-	for (const FActiveEffectDefinition& CurEffect : SortedEffects)
+	// Only re-walk the stack if an effect changed, or the base value moved underneath us
+	if (bCachedValueDirty || BaseValue != CachedBaseValue)
 	{
-		if (CurEffect.IsValid())
-		{
-			const int32 CurEffectMod = CurEffect.GetEffectDefinition().GetModification();
-			const EEffectOperation CurEffectOp = CurEffect.GetEffectDefinition().GetOperation();
+		CachedBaseValue = BaseValue;
+		CachedCurrentValue = EvaluateEffects(BaseValue);
+		bCachedValueDirty = false;
+	}
 
-			CurrentValue = EEffectOperationUtils::Evaluate(CurrentValue, CurEffectMod, CurEffectOp);
-		}
+	return CachedCurrentValue;
+}
+
+int32 FSortedEffectDefinitions::EvaluateEffects(const int32 BaseValue) const
+{
+	if (Backend == ELayeredEffectBackend::ComposedTree)
+	{
+		return ComposedTree.Evaluate(BaseValue);
 	}
 
-	return CurrentValue;
+	return GetCompiledProgram().Evaluate(BaseValue);
+}
+
+const FCompiledEffectProgram& FSortedEffectDefinitions::GetCompiledProgram() const
+{
+	if (bProgramDirty)
+	{
+		CompiledProgram.Reset();
+		ForEachEffect([this](const FActiveEffectDefinition& CurEffect)
+		{
+			CompiledProgram.Append(CurEffect.GetEffectDefinition().GetOperation(), CurEffect.GetEffectDefinition().GetModification());
+		});
+		bProgramDirty = false;
+	}
+	return CompiledProgram;
 }
 
 bool FSortedEffectDefinitions::ClearLayeredEffects()
 {
-	const bool bAnyEffectsCleared = (SortedEffects.Num() > 0);
-	SortedEffects.Empty();
+	const bool bAnyEffectsCleared = HasEffects();
+	LayerBuckets.Empty();
+	HandleToSlot.Reset();
+	ComposedTree.Reset();
+	MarkChanged();
 	return bAnyEffectsCleared;
 }
 
-#pragma endregion
-
+const FActiveEffectDefinition* FSortedEffectDefinitions::FindEffect(const FActiveEffectHandle& InHandle) const
+{
+	if (Backend == ELayeredEffectBackend::ComposedTree)
+	{
+		return ComposedTree.Find(InHandle);
+	}
 
-#pragma region ULayeredEffectBlueprintLibrary
+	const FEffectSlot* Slot = HandleToSlot.Find(InHandle);
+	if (Slot == nullptr)
+	{
+		return nullptr;
+	}
+	const int32 BucketIndex = FindBucketIndex(Slot->Layer);
+	return (BucketIndex != INDEX_NONE) ? &LayerBuckets[BucketIndex].Effects[Slot->Index] : nullptr;
+}
 
-int32 GetValueClampedToInt32(uint32 Value)
+int32 FSortedEffectDefinitions::FindBucketIndex(int32 Layer) const
 {
-	UE_CLOG(!FMath::IsWithinInclusive(Value, static_cast<uint32>(0), static_cast<uint32>(MAX_int32)),
-		LogLayeredEffects, Error, TEXT("Clamping incoming unsigned value %u to [%d, %d]."), Value, 0, MAX_int32);
-	return FMath::Clamp(Value, static_cast<uint32>(0), static_cast<uint32>(MAX_int32));
+	return Algo::BinarySearchBy(LayerBuckets, Layer, &FLayeredEffectBucket::Layer);
 }
 
-FColor ULayeredEffectBlueprintLibrary::Conv_IntToColor(int32 Value)
+void FSortedEffectDefinitions::ReindexBucket(int32 BucketIndex, int32 StartIndex)
 {
-	const uint32 UnsignedValue = std::make_unsigned_t<int32>(Value);
-	FColor ColorValue = FColor(UnsignedValue);
-	ColorValue.A = 255;
-	return ColorValue;
+	const FLayeredEffectBucket& Bucket = LayerBuckets[BucketIndex];
+	for (int32 EffectIndex = StartIndex; EffectIndex < Bucket.Effects.Num(); EffectIndex++)
+	{
+		if (const FActiveEffectDefinition& CurEffect = Bucket.Effects[EffectIndex];
+			CurEffect.IsValid())
+		{
+			HandleToSlot.Add(CurEffect.GetHandle(), FEffectSlot{ Bucket.Layer, EffectIndex });
+		}
+	}
 }
 
-int32 ULayeredEffectBlueprintLibrary::Conv_ColorToInt(FColor Value)
+void FSortedEffectDefinitions::CompactBucket(int32 BucketIndex)
 {
-	const uint32 UnsignedValue = Value.ToPackedARGB();
-	const int32 SignedValue = GetValueClampedToInt32(UnsignedValue);
-	return SignedValue;
+	FLayeredEffectBucket& Bucket = LayerBuckets[BucketIndex];
+	Bucket.Effects.RemoveAll([](const FActiveEffectDefinition& CurEffect) {
+		return !CurEffect.IsValid();
+	});
+	Bucket.NumTombstones = 0;
+
+	ReindexBucket(BucketIndex, 0);
 }
 
-#pragma endregion
\ No newline at end of file
+#pragma endregion
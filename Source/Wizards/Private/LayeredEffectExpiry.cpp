@@ -0,0 +1,136 @@
+// Copyright 2023 John McElmurray (johnmcelmurray.com). All rights reserved.
+
+#include "LayeredEffectExpiry.h"
+
+void FLayeredEffectExpiryScheduler::Schedule(const FLayeredAttributeCommandTarget& Target, const FActiveEffectHandle& Handle, const FLayeredEffectExpiry& Expiry, double Now)
+{
+	if (!Handle.IsValid())
+	{
+		return;
+	}
+
+	if (Expiry.HasScope())
+	{
+		ScopedEffects.FindOrAdd(Expiry.GetScope()).Add(FExpiredLayeredEffect{ Target, Handle });
+	}
+
+	if (Expiry.HasDuration())
+	{
+		// Nothing to expire on the way, so an idle wheel can jump straight to the present
+		if (NumScheduledTimers == 0)
+		{
+			CurrentTick = FMath::Max(CurrentTick, ToTick(Now));
+		}
+
+		// Round up, so an effect never expires before its duration is over
+		FTimer NewTimer;
+		NewTimer.Effect = FExpiredLayeredEffect{ Target, Handle };
+		NewTimer.DueTick = FMath::Max(CurrentTick + 1, static_cast<uint64>(FMath::CeilToDouble((Now + Expiry.GetDuration()) * TicksPerSecond)));
+		Insert(MoveTemp(NewTimer));
+		NumScheduledTimers++;
+	}
+}
+
+void FLayeredEffectExpiryScheduler::Advance(double Now, TArray<FExpiredLayeredEffect>& OutExpired)
+{
+	const uint64 TargetTick = ToTick(Now);
+	while (CurrentTick < TargetTick && NumScheduledTimers > 0)
+	{
+		CurrentTick++;
+
+		// Entering a new slot on a level moves that slot's timers down, now that they're due within its span
+		for (int32 Level = 1; Level < NumLevels; Level++)
+		{
+			const int32 Shift = SlotBits * Level;
+			if ((CurrentTick & ((1ull << Shift) - 1)) != 0)
+			{
+				break;
+			}
+			Cascade(Level, static_cast<int32>((CurrentTick >> Shift) & SlotMask));
+		}
+
+		if ((CurrentTick & ((1ull << (SlotBits * NumLevels)) - 1)) == 0)
+		{
+			TArray<FTimer> FarTimers = MoveTemp(Overflow);
+			for (FTimer& CurTimer : FarTimers)
+			{
+				Insert(MoveTemp(CurTimer));
+			}
+		}
+
+		TArray<FTimer>& DueTimers = Slots[0][CurrentTick & SlotMask];
+		for (FTimer& CurTimer : DueTimers)
+		{
+			checkSlow(CurTimer.DueTick == CurrentTick);
+			if (CurTimer.Effect.Handle.IsLive())
+			{
+				OutExpired.Add(MoveTemp(CurTimer.Effect));
+			}
+		}
+		NumScheduledTimers -= DueTimers.Num();
+		DueTimers.Reset();
+	}
+
+	CurrentTick = FMath::Max(CurrentTick, TargetTick);
+}
+
+void FLayeredEffectExpiryScheduler::EndScope(FName Scope, TArray<FExpiredLayeredEffect>& OutExpired)
+{
+	TArray<FExpiredLayeredEffect> Effects;
+	if (!ScopedEffects.RemoveAndCopyValue(Scope, Effects))
+	{
+		return;
+	}
+
+	for (FExpiredLayeredEffect& CurEffect : Effects)
+	{
+		if (CurEffect.Handle.IsLive())
+		{
+			OutExpired.Add(MoveTemp(CurEffect));
+		}
+	}
+}
+
+void FLayeredEffectExpiryScheduler::Reset()
+{
+	for (TArray<FTimer>(&CurLevel)[SlotsPerLevel] : Slots)
+	{
+		for (TArray<FTimer>& CurSlot : CurLevel)
+		{
+			CurSlot.Reset();
+		}
+	}
+	Overflow.Reset();
+	ScopedEffects.Reset();
+	NumScheduledTimers = 0;
+}
+
+uint64 FLayeredEffectExpiryScheduler::ToTick(double Seconds)
+{
+	return static_cast<uint64>(FMath::Max(0.0, FMath::FloorToDouble(Seconds * TicksPerSecond)));
+}
+
+void FLayeredEffectExpiryScheduler::Insert(FTimer&& Timer)
+{
+	checkSlow(Timer.DueTick >= CurrentTick);
+	const uint64 TicksUntilDue = Timer.DueTick - CurrentTick;
+	for (int32 Level = 0; Level < NumLevels; Level++)
+	{
+		const int32 Shift = SlotBits * Level;
+		if (TicksUntilDue < (1ull << (Shift + SlotBits)))
+		{
+			Slots[Level][(Timer.DueTick >> Shift) & SlotMask].Add(MoveTemp(Timer));
+			return;
+		}
+	}
+	Overflow.Add(MoveTemp(Timer));
+}
+
+void FLayeredEffectExpiryScheduler::Cascade(int32 Level, int32 SlotIndex)
+{
+	TArray<FTimer> Timers = MoveTemp(Slots[Level][SlotIndex]);
+	for (FTimer& CurTimer : Timers)
+	{
+		Insert(MoveTemp(CurTimer));
+	}
+}
@@ -0,0 +1,212 @@
+// Copyright 2023 John McElmurray (johnmcelmurray.com). All rights reserved.
+
+#include "ReplicatedAttributeValues.h"
+
+#include "Engine/NetConnection.h"
+#include "Engine/PackageMapClient.h"
+#include "Engine/World.h"
+#include "GameFramework/Actor.h"
+
+#include "ILayeredAttributes.h"
+#include "LayeredAttributeBlock.h"
+#include "ScopedAttributeTransaction.h"
+
+namespace
+{
+	/// <summary>
+	/// What a connection was last sent, which the next update to it is encoded against.
+	/// The net driver hands back the last acknowledged one whenever an update gets lost.
+	/// </summary>
+	class FAttributeValuesBaseState : public INetDeltaBaseState
+	{
+	public:
+
+		virtual bool IsStateEqual(INetDeltaBaseState* OtherState) override
+		{
+			return Revision == static_cast<FAttributeValuesBaseState*>(OtherState)->Revision;
+		}
+
+		int32 Values[EAttributeKeyUtils::Num] = { };
+		uint32 Revision = 0;
+		double SendTime = 0.0;
+	};
+
+	// Zigzag maps small magnitudes of either sign to small unsigned numbers, then only the significant bits are sent
+	constexpr uint32 MaxValueBits = 32;
+
+	void WritePackedValue(FBitWriter& Writer, int32 Value)
+	{
+		uint32 Zigzag = (static_cast<uint32>(Value) << 1) ^ static_cast<uint32>(Value >> 31);
+		uint32 NumBits = (Zigzag == 0) ? 0 : FMath::FloorLog2(Zigzag) + 1;
+		Writer.SerializeInt(NumBits, MaxValueBits + 1);
+		Writer.SerializeBits(&Zigzag, NumBits);
+	}
+
+	int32 ReadPackedValue(FBitReader& Reader)
+	{
+		uint32 NumBits = 0;
+		Reader.SerializeInt(NumBits, MaxValueBits + 1);
+		uint32 Zigzag = 0;
+		Reader.SerializeBits(&Zigzag, FMath::Min(NumBits, MaxValueBits));
+		return static_cast<int32>((Zigzag >> 1) ^ (0u - (Zigzag & 1)));
+	}
+}
+
+bool FReplicatedAttributeValues::SyncFrom(const FLayeredAttributeBlock& Attributes)
+{
+	int32 NewValues[EAttributeKeyUtils::Num];
+	Attributes.GetCurrentValues(NewValues);
+	if (FMemory::Memcmp(NewValues, Values, sizeof(Values)) == 0)
+	{
+		return false;
+	}
+
+	FMemory::Memcpy(Values, NewValues, sizeof(Values));
+	Revision++;
+	return true;
+}
+
+int32 FReplicatedAttributeValues::GetValue(EAttributeKey Key) const
+{
+	checkSlow(EAttributeKeyUtils::IsInRange(Key));
+	return Values[EAttributeKeyUtils::ToIndex(Key)];
+}
+
+bool FReplicatedAttributeValues::NetDeltaSerialize(FNetDeltaSerializeInfo& DeltaParams)
+{
+	if (DeltaParams.Writer != nullptr)
+	{
+		const FAttributeValuesBaseState* OldState = static_cast<const FAttributeValuesBaseState*>(DeltaParams.OldState);
+		if (OldState != nullptr && OldState->Revision == Revision)
+		{
+			return false;
+		}
+
+		const UPackageMapClient* PackageMap = Cast<UPackageMapClient>(DeltaParams.Map);
+		double UpdateInterval = 0.0;
+		if (!GetUpdateInterval(PackageMap != nullptr ? PackageMap->GetConnection() : nullptr, UpdateInterval))
+		{
+			return false;
+		}
+
+		const double Now = GetTimeSeconds();
+		if (OldState != nullptr && Now - OldState->SendTime < UpdateInterval)
+		{
+			return false;
+		}
+
+		TSharedPtr<FAttributeValuesBaseState> NewState = MakeShared<FAttributeValuesBaseState>();
+		FMemory::Memcpy(NewState->Values, Values, sizeof(Values));
+		NewState->Revision = Revision;
+		NewState->SendTime = Now;
+
+		// Values are sent whole rather than as differences, so resending one the client already has is harmless.
+		// A connection with no base state yet is sent everything.
+		bool bChanged[EAttributeKeyUtils::Num];
+		FBitWriter& Writer = *DeltaParams.Writer;
+		for (int32 Index = 0; Index < EAttributeKeyUtils::Num; Index++)
+		{
+			bChanged[Index] = (OldState == nullptr || OldState->Values[Index] != Values[Index]);
+			Writer.WriteBit(bChanged[Index] ? 1 : 0);
+		}
+		for (int32 Index = 0; Index < EAttributeKeyUtils::Num; Index++)
+		{
+			if (bChanged[Index])
+			{
+				WritePackedValue(Writer, Values[Index]);
+			}
+		}
+
+		*DeltaParams.NewState = MoveTemp(NewState);
+		return true;
+	}
+
+	if (DeltaParams.Reader != nullptr)
+	{
+		FBitReader& Reader = *DeltaParams.Reader;
+		bool bChanged[EAttributeKeyUtils::Num];
+		for (int32 Index = 0; Index < EAttributeKeyUtils::Num; Index++)
+		{
+			bChanged[Index] = (Reader.ReadBit() != 0);
+		}
+
+		int32 NewValues[EAttributeKeyUtils::Num];
+		FMemory::Memcpy(NewValues, Values, sizeof(Values));
+		for (int32 Index = 0; Index < EAttributeKeyUtils::Num; Index++)
+		{
+			if (bChanged[Index])
+			{
+				NewValues[Index] = ReadPackedValue(Reader);
+			}
+		}
+
+		if (Reader.IsError())
+		{
+			return false;
+		}
+		FMemory::Memcpy(Values, NewValues, sizeof(Values));
+
+		// Everything in one update is broadcast together
+		if (Owner != nullptr)
+		{
+			FScopedAttributeTransaction Transaction(*Owner);
+			for (int32 Index = 0; Index < EAttributeKeyUtils::Num; Index++)
+			{
+				if (bChanged[Index])
+				{
+					Owner->SetBaseAttribute(static_cast<EAttributeKey>(Index), Values[Index]);
+				}
+			}
+		}
+		return true;
+	}
+
+	// No object references to map
+	return false;
+}
+
+bool FReplicatedAttributeValues::GetUpdateInterval(const UNetConnection* Connection, double& OutInterval) const
+{
+	OutInterval = 0.0;
+	const AActor* OwnerActor = (Owner != nullptr) ? Cast<AActor>(Owner->AsObject()) : nullptr;
+	if (Connection == nullptr || OwnerActor == nullptr)
+	{
+		return true;
+	}
+
+	const double MaxInterval = (Relevancy.MaxUpdateRate > 0.f) ? 1.0 / Relevancy.MaxUpdateRate : 0.0;
+	const AActor* Viewer = Connection->ViewTarget;
+	if (OwnerActor->GetNetConnection() == Connection || Viewer == OwnerActor)
+	{
+		OutInterval = MaxInterval;
+		return true;
+	}
+
+	if (OwnerActor->IsHidden() && !Relevancy.bRelevantWhenHidden)
+	{
+		return false;
+	}
+
+	if (Viewer == nullptr || Relevancy.CullDistance <= 0.f)
+	{
+		OutInterval = MaxInterval;
+		return true;
+	}
+
+	const double Distance = FVector::Dist(Viewer->GetActorLocation(), OwnerActor->GetActorLocation());
+	if (Distance > Relevancy.CullDistance)
+	{
+		return false;
+	}
+
+	// Priority falls off with distance, and with it the update rate
+	const double UpdateRate = FMath::Lerp(static_cast<double>(Relevancy.MaxUpdateRate), static_cast<double>(Relevancy.MinUpdateRate), Distance / Relevancy.CullDistance);
+	OutInterval = (UpdateRate > 0.0) ? 1.0 / UpdateRate : 0.0;
+	return true;
+}
+
+double FReplicatedAttributeValues::GetTimeSeconds() const
+{
+	const UWorld* World = (Owner != nullptr) ? Owner->GetWorld() : nullptr;
+	return (World != nullptr) ? World->GetTimeSeconds() : FPlatformTime::Seconds();
+}
@@ -0,0 +1,115 @@
+// Copyright 2023 John McElmurray (johnmcelmurray.com). All rights reserved.
+
+#include "ReplicatedLayeredEffects.h"
+
+#include "Algo/ForEach.h"
+
+#include "ILayeredAttributes.h"
+#include "LayeredAttributeBlock.h"
+
+#pragma region FReplicatedLayeredEffect
+
+void FReplicatedLayeredEffect::PreReplicatedRemove(const FReplicatedLayeredEffects& InArraySerializer)
+{
+	if (ILayeredAttributes* Owner = InArraySerializer.GetOwner())
+	{
+		Owner->RemoveReplicatedLayeredEffect(Effect.GetHandle());
+	}
+}
+
+void FReplicatedLayeredEffect::PostReplicatedAdd(const FReplicatedLayeredEffects& InArraySerializer)
+{
+	if (ILayeredAttributes* Owner = InArraySerializer.GetOwner())
+	{
+		Owner->AddReplicatedLayeredEffect(Effect);
+	}
+}
+
+#pragma endregion
+
+
+#pragma region FReplicatedLayeredEffects
+
+bool FReplicatedLayeredEffects::SyncFrom(const FLayeredAttributeBlock& Attributes)
+{
+	// Clients don't have the server's shared effects, so the ones applying to the object are sent like its own.
+	// Which ones apply depends on Controller and Types, so a change to either re-diffs every attribute
+	const FSharedEffectRegistry* SharedEffects = Attributes.GetSharedEffects();
+	const int32 TargetController = Attributes.GetCurrentValue(EAttributeKey::Controller);
+	const int32 TargetTypes = Attributes.GetCurrentValue(EAttributeKey::Types);
+	const bool bTargetChanged = (SharedEffects != SyncedSharedEffects || TargetController != SyncedController || TargetTypes != SyncedTypes);
+	SyncedSharedEffects = SharedEffects;
+	SyncedController = TargetController;
+	SyncedTypes = TargetTypes;
+
+	bool bAnyChanges = false;
+	for (int32 KeyIndex = 0; KeyIndex < EAttributeKeyUtils::Num; KeyIndex++)
+	{
+		const EAttributeKey Key = static_cast<EAttributeKey>(KeyIndex);
+		const FSortedEffectDefinitions& KeyEffects = Attributes.GetEffects(Key);
+		const uint32 SharedVersion = (SharedEffects != nullptr) ? SharedEffects->GetVersion(Key) : 0;
+		if (!bTargetChanged && KeyEffects.GetRevision() == SyncedRevisions[KeyIndex] && SharedVersion == SyncedSharedVersions[KeyIndex])
+		{
+			continue;
+		}
+		SyncedRevisions[KeyIndex] = KeyEffects.GetRevision();
+		SyncedSharedVersions[KeyIndex] = SharedVersion;
+
+		TArray<FActiveEffectDefinition, TInlineAllocator<8>> MatchingSharedEffects;
+		if (SharedEffects != nullptr && SharedEffects->HasEffects(Key))
+		{
+			SharedEffects->ForEachMatchingEffect(Key, TargetController, TargetTypes, [&MatchingSharedEffects](const FActiveEffectDefinition& CurEffect)
+			{
+				MatchingSharedEffects.Add(CurEffect);
+			});
+		}
+		const auto IsMatchingSharedEffect = [&MatchingSharedEffects](const FActiveEffectHandle& InHandle)
+		{
+			return MatchingSharedEffects.ContainsByPredicate([&InHandle](const FActiveEffectDefinition& CurEffect)
+			{
+				return CurEffect.GetHandle() == InHandle;
+			});
+		};
+
+		// Drop the items of effects that are gone, then add the effects that have no item yet
+		TSet<FActiveEffectHandle> SyncedHandles;
+		for (int32 ItemIndex = Items.Num() - 1; ItemIndex >= 0; ItemIndex--)
+		{
+			const FActiveEffectHandle& ItemHandle = Items[ItemIndex].Effect.GetHandle();
+			if (ItemHandle.GetAttribute() != Key)
+			{
+				continue;
+			}
+
+			if (KeyEffects.ContainsEffect(ItemHandle) || IsMatchingSharedEffect(ItemHandle))
+			{
+				SyncedHandles.Add(ItemHandle);
+			}
+			else
+			{
+				Items.RemoveAtSwap(ItemIndex, 1, false);
+				bAnyChanges = true;
+			}
+		}
+
+		const auto AddMissingItem = [this, &SyncedHandles, &bAnyChanges](const FActiveEffectDefinition& CurEffect)
+		{
+			if (!SyncedHandles.Contains(CurEffect.GetHandle()))
+			{
+				MarkItemDirty(Items.Emplace_GetRef(CurEffect));
+				bAnyChanges = true;
+			}
+		};
+		KeyEffects.ForEachEffect(AddMissingItem);
+		Algo::ForEach(MatchingSharedEffects, AddMissingItem);
+	}
+
+	if (bAnyChanges)
+	{
+		// Covers removals, which have no item left to mark
+		MarkArrayDirty();
+	}
+	return bAnyChanges;
+}
+
+#pragma endregion
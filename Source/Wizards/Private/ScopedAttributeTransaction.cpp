@@ -0,0 +1,133 @@
+// Copyright 2023 John McElmurray (johnmcelmurray.com). All rights reserved.
+
+#include "ScopedAttributeTransaction.h"
+
+#include "ILayeredAttributes.h"
+
+FScopedAttributeTransaction::FScopedAttributeTransaction(ILayeredAttributes& InOwner)
+	: Owner(&InOwner)
+{
+	FLayeredAttributeBlock& Attributes = Owner->GetAttributesMutable();
+	OuterTransaction = Attributes.GetActiveTransaction();
+	Attributes.SetActiveTransaction(this);
+}
+
+FScopedAttributeTransaction::~FScopedAttributeTransaction()
+{
+	if (IsActive())
+	{
+		Commit();
+	}
+}
+
+void FScopedAttributeTransaction::Commit()
+{
+	if (!IsActive())
+	{
+		UE_LOG(LogLayeredEffects, Error, TEXT("Committing a transaction that already ended"));
+		return;
+	}
+
+	FLayeredAttributeBlock& Attributes = Owner->GetAttributesMutable();
+	check(Attributes.GetActiveTransaction() == this);
+	Attributes.SetActiveTransaction(OuterTransaction);
+
+	if (OuterTransaction != nullptr)
+	{
+		// The outer transaction will broadcast once it commits
+		OuterTransaction->MergeNested(*this);
+	}
+	else
+	{
+		// FOnAttributeChangedData only broadcasts if the value actually ended somewhere new.
+		// Deferred owners fold the changes into the next flush instead, along with the rest of the frame's changes.
+		UObject* OwnerObject = Owner->AsObject();
+		const bool bDeferred = (Attributes.GetNotifyMode() == ELayeredAttributeNotifyMode::Deferred);
+		for (const FSavedAttribute& CurSavedAttribute : SavedAttributes)
+		{
+			if (!bDeferred || !Owner->DeferAttributeChange(Attributes, CurSavedAttribute.Key, CurSavedAttribute.OldValue))
+			{
+				FOnAttributeChangedData(OwnerObject, CurSavedAttribute.Key, CurSavedAttribute.OldValue);
+			}
+		}
+
+		// Removals are final now
+		for (const FActiveEffectHandle& CurHandle : RemovedEffects)
+		{
+			Attributes.ReleaseHandle(CurHandle);
+		}
+
+		Owner->PublishAttributeSnapshot();
+	}
+
+	SavedAttributes.Reset();
+	AddedEffects.Reset();
+	RemovedEffects.Reset();
+	TouchedMask = 0;
+	Owner = nullptr;
+}
+
+void FScopedAttributeTransaction::Rollback()
+{
+	if (!IsActive())
+	{
+		UE_LOG(LogLayeredEffects, Error, TEXT("Rolling back a transaction that already ended"));
+		return;
+	}
+
+	FLayeredAttributeBlock& Attributes = Owner->GetAttributesMutable();
+	check(Attributes.GetActiveTransaction() == this);
+
+	for (const FSavedAttribute& CurSavedAttribute : SavedAttributes)
+	{
+		Attributes.SetAttributeState(CurSavedAttribute.Key, CurSavedAttribute.BaseValue, CurSavedAttribute.Effects);
+	}
+
+	Attributes.SetActiveTransaction(OuterTransaction);
+
+	// Effects added during the transaction are gone again, while removed ones are back
+	for (const FActiveEffectHandle& CurHandle : AddedEffects)
+	{
+		Attributes.ReleaseHandle(CurHandle);
+	}
+
+	// Nothing was published during the transaction, but an outer transaction may still be holding changes back
+	Owner->PublishAttributeSnapshot();
+
+	SavedAttributes.Reset();
+	AddedEffects.Reset();
+	RemovedEffects.Reset();
+	TouchedMask = 0;
+	Owner = nullptr;
+}
+
+void FScopedAttributeTransaction::RecordChange(const FLayeredAttributeBlock& Attributes, EAttributeKey Key)
+{
+	if (HasTouched(Key))
+	{
+		return;
+	}
+
+	TouchedMask |= (1u << EAttributeKeyUtils::ToIndex(Key));
+
+	FSavedAttribute& SavedAttribute = SavedAttributes.AddDefaulted_GetRef();
+	SavedAttribute.Key = Key;
+	SavedAttribute.OldValue = Attributes.GetCurrentValue(Key);
+	SavedAttribute.BaseValue = Attributes.GetBaseValue(Key);
+	SavedAttribute.Effects = Attributes.GetEffects(Key);
+}
+
+void FScopedAttributeTransaction::MergeNested(FScopedAttributeTransaction& Nested)
+{
+	for (FSavedAttribute& CurSavedAttribute : Nested.SavedAttributes)
+	{
+		if (!HasTouched(CurSavedAttribute.Key))
+		{
+			TouchedMask |= (1u << EAttributeKeyUtils::ToIndex(CurSavedAttribute.Key));
+			SavedAttributes.Add(MoveTemp(CurSavedAttribute));
+		}
+	}
+
+	AddedEffects.Append(Nested.AddedEffects);
+	RemovedEffects.Append(Nested.RemovedEffects);
+}
@@ -0,0 +1,168 @@
+// Copyright 2023 John McElmurray (johnmcelmurray.com). All rights reserved.
+
+#include "SharedEffectRegistry.h"
+
+namespace
+{
+	/// <summary>
+	/// True if effect A is applied before effect B.
+	/// </summary>
+	bool IsOrderedBefore(const FActiveEffectDefinition& A, const FActiveEffectDefinition& B)
+	{
+		// Smaller numbered layers get applied first, then effects are applied in the order that they were added
+		const int32 LayerA = A.GetEffectDefinition().GetLayer();
+		const int32 LayerB = B.GetEffectDefinition().GetLayer();
+		return (LayerA != LayerB) ? (LayerA < LayerB) : (A.GetSequence() < B.GetSequence());
+	}
+}
+
+FActiveEffectHandle FSharedEffectRegistry::AddSharedEffect(const FLayeredEffectDefinition& Effect, const FSharedEffectTargetFilter& Filter)
+{
+	if (!Effect.IsValid() || !EAttributeKeyUtils::IsInRange(Effect.GetAttribute()))
+	{
+		UE_LOG(LogLayeredEffects, Error, TEXT("Invalid effect '%s'"), *Effect.ToString());
+		return FActiveEffectHandle::kInvalid;
+	}
+
+	if (IsTargetingAttribute(Effect.GetAttribute()))
+	{
+		UE_LOG(LogLayeredEffects, Error, TEXT("Shared effect '%s' can't modify an attribute used to choose its targets"), *Effect.ToString());
+		return FActiveEffectHandle::kInvalid;
+	}
+
+	FSharedEffect NewSharedEffect;
+	NewSharedEffect.Effect = FActiveEffectDefinition(Effect);
+	NewSharedEffect.Filter = Filter;
+
+	const int32 KeyIndex = EAttributeKeyUtils::ToIndex(Effect.GetAttribute());
+	TArray<int32>& KeyEffects = OrderedEffects[KeyIndex];
+
+	// The sequence only moves forward, so the new effect only lands out of order when it has a smaller layer
+	if (KeyEffects.Num() > 0)
+	{
+		if (IsOrderedBefore(NewSharedEffect.Effect, Effects[KeyEffects.Last()].Effect))
+		{
+			UnpreparedMask |= (1u << KeyIndex);
+		}
+	}
+
+	const FActiveEffectHandle NewHandle = NewSharedEffect.Effect.GetHandle();
+	const int32 NewIndex = Effects.Add(MoveTemp(NewSharedEffect));
+	KeyEffects.Add(NewIndex);
+	HandleToIndex.Add(NewHandle, NewIndex);
+	NumEffects[KeyIndex]++;
+	Versions[KeyIndex]++;
+	return NewHandle;
+}
+
+bool FSharedEffectRegistry::RemoveSharedEffect(const FActiveEffectHandle& InHandle)
+{
+	int32 RemovedIndex = INDEX_NONE;
+	if (!HandleToIndex.RemoveAndCopyValue(InHandle, RemovedIndex))
+	{
+		return false;
+	}
+
+	// Leave a tombstone, which is dropped from OrderedEffects the next time it is prepared
+	const int32 KeyIndex = EAttributeKeyUtils::ToIndex(InHandle.GetAttribute());
+	Effects[RemovedIndex].Effect.Invalidate();
+	FActiveEffectHandle::Release(InHandle);
+	UnpreparedMask |= (1u << KeyIndex);
+	NumEffects[KeyIndex]--;
+	Versions[KeyIndex]++;
+	return true;
+}
+
+void FSharedEffectRegistry::Reset()
+{
+	for (const TPair<FActiveEffectHandle, int32>& CurEffect : HandleToIndex)
+	{
+		FActiveEffectHandle::Release(CurEffect.Key);
+	}
+	Effects.Reset();
+	HandleToIndex.Reset();
+	for (int32 KeyIndex = 0; KeyIndex < EAttributeKeyUtils::Num; KeyIndex++)
+	{
+		if (OrderedEffects[KeyIndex].Num() > 0)
+		{
+			OrderedEffects[KeyIndex].Reset();
+			NumEffects[KeyIndex] = 0;
+			Versions[KeyIndex]++;
+		}
+	}
+	UnpreparedMask = 0;
+}
+
+void FSharedEffectRegistry::PrepareForEvaluation()
+{
+	for (uint32 Mask = UnpreparedMask; Mask != 0; Mask &= Mask - 1)
+	{
+		PrepareForEvaluation(FMath::CountTrailingZeros(Mask));
+	}
+}
+
+void FSharedEffectRegistry::PrepareForEvaluation(int32 KeyIndex)
+{
+	const uint32 KeyBit = (1u << KeyIndex);
+	if ((UnpreparedMask & KeyBit) == 0)
+	{
+		return;
+	}
+
+	TArray<int32>& KeyEffects = OrderedEffects[KeyIndex];
+	KeyEffects.RemoveAll([this](int32 EffectIndex)
+	{
+		if (!Effects[EffectIndex].Effect.IsValid())
+		{
+			Effects.RemoveAt(EffectIndex);
+			return true;
+		}
+		return false;
+	});
+
+	KeyEffects.Sort([this](int32 IndexA, int32 IndexB)
+	{
+		return IsOrderedBefore(Effects[IndexA].Effect, Effects[IndexB].Effect);
+	});
+
+	UnpreparedMask &= ~KeyBit;
+}
+
+int32 FSharedEffectRegistry::Evaluate(EAttributeKey Key, int32 BaseValue, const FSortedEffectDefinitions& OwnEffects, int32 TargetController, int32 TargetTypes)
+{
+	const int32 KeyIndex = EAttributeKeyUtils::ToIndex(Key);
+	PrepareForEvaluation(KeyIndex);
+
+	const TArray<int32>& KeyEffects = OrderedEffects[KeyIndex];
+	int32 CurrentValue = BaseValue;
+	int32 NextShared = 0;
+
+	auto ApplyNextShared = [&]()
+	{
+		const FSharedEffect& CurShared = Effects[KeyEffects[NextShared++]];
+		if (CurShared.Filter.Matches(TargetController, TargetTypes))
+		{
+			const FLayeredEffectDefinition& Definition = CurShared.Effect.GetEffectDefinition();
+			CurrentValue = EEffectOperationUtils::Evaluate(CurrentValue, Definition.GetModification(), Definition.GetOperation());
+		}
+	};
+
+	// Both sequences are already in application order, so interleave them like a merge
+	OwnEffects.ForEachEffect([&](const FActiveEffectDefinition& OwnEffect)
+	{
+		while (NextShared < KeyEffects.Num() && IsOrderedBefore(Effects[KeyEffects[NextShared]].Effect, OwnEffect))
+		{
+			ApplyNextShared();
+		}
+
+		const FLayeredEffectDefinition& Definition = OwnEffect.GetEffectDefinition();
+		CurrentValue = EEffectOperationUtils::Evaluate(CurrentValue, Definition.GetModification(), Definition.GetOperation());
+	});
+
+	while (NextShared < KeyEffects.Num())
+	{
+		ApplyNextShared();
+	}
+
+	return CurrentValue;
+}
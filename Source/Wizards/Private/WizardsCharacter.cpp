@@ -12,6 +12,9 @@
 #include "GameFramework/SpringArmComponent.h"
 #include "Materials/Material.h"
 #include "Engine/World.h"
+#include "Net/UnrealNetwork.h"
+
+#include "LayeredAttributeSubsystem.h"
 
 AWizardsCharacter::AWizardsCharacter()
 {
@@ -47,12 +50,54 @@ AWizardsCharacter::AWizardsCharacter()
 	PrimaryActorTick.bStartWithTickEnabled = true;
 }
 
+void AWizardsCharacter::PostInitializeComponents()
+{
+	Super::PostInitializeComponents();
+
+	// Clients apply replicated effects and values straight to our attributes.
+	// Set here rather than in the constructor, which also builds the CDO and archetypes that never receive replication.
+	ReplicatedEffects.SetOwner(this);
+	ReplicatedValues.SetOwner(this);
+}
+
 void AWizardsCharacter::BeginPlay()
 {
 	Super::BeginPlay();
 
-	// Register BP callback for attribute changes
-	OnAnyAttributeValueChanged.AddUniqueDynamic(this, &AWizardsCharacter::HandleOnAnyAttributeValueChanged);
+	// Register BP callback for attribute changes, but only if the Blueprint implements it,
+	// so that characters without one never broadcast through reflection
+	if (GetClass()->IsFunctionImplementedInScript(GET_FUNCTION_NAME_CHECKED(AWizardsCharacter, HandleOnAnyAttributeValueChanged)))
+	{
+		OnAnyAttributeValueChanged.AddUniqueDynamic(this, &AWizardsCharacter::HandleOnAnyAttributeValueChanged);
+	}
+	Attributes.SetNotifyMode(AttributeNotifyMode);
+
+	if (HasAuthority())
+	{
+		// Our owner always gets the full stacks; everyone else gets what AttributeReplicationMode asks for
+		const bool bValuesOnly = (AttributeReplicationMode == EAttributeReplicationMode::CurrentValues);
+		DOREPDYNAMICCONDITION_SETCONDITION_FAST(AWizardsCharacter, ReplicatedEffects, bValuesOnly ? COND_OwnerOnly : COND_None);
+		DOREPDYNAMICCONDITION_SETCONDITION_FAST(AWizardsCharacter, ReplicatedBaseValues, bValuesOnly ? COND_OwnerOnly : COND_None);
+		DOREPDYNAMICCONDITION_SETCONDITION_FAST(AWizardsCharacter, ReplicatedValues, bValuesOnly ? COND_SkipOwner : COND_Never);
+		ReplicatedValues.SetRelevancy(AttributeValueRelevancy);
+	}
+
+	if (ULayeredAttributeSubsystem* Subsystem = GetWorld()->GetSubsystem<ULayeredAttributeSubsystem>())
+	{
+		if (bStoreAttributesInSubsystem)
+		{
+			AttributeEntity = Subsystem->CreateAttributeEntity();
+			Attributes.BindToStore(Subsystem->GetStore(), AttributeEntity);
+		}
+		else
+		{
+			Attributes.SetSharedEffects(&Subsystem->GetSharedEffects());
+		}
+		Subsystem->RegisterSharedEffectTarget(this);
+
+		// Only costs anything while someone holds a checkpoint
+		Attributes.SetTimeline(&Subsystem->GetTimeline(), this);
+	}
 
 	// Clear and re-load up all of our initial attributes to trigger changed delegates when character begins play
 	const TMap<EAttributeKey, int32> InitialAttributes = BaseAttributes;
@@ -62,7 +107,112 @@ void AWizardsCharacter::BeginPlay()
 	});
 }
 
+void AWizardsCharacter::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	ULayeredAttributeSubsystem* Subsystem = GetWorld()->GetSubsystem<ULayeredAttributeSubsystem>();
+	if (Subsystem != nullptr)
+	{
+		Subsystem->UnregisterSharedEffectTarget(this);
+	}
+
+	Attributes.SetSharedEffects(nullptr);
+	Attributes.SetTimeline(nullptr);
+	if (Attributes.IsBoundToStore())
+	{
+		// Destroying the entity releases its effects' handles, so don't move them back here first.
+		// Replicated effects carry the server's handles though, which aren't ours to release.
+		if (HasAuthority())
+		{
+			Attributes.AbandonStoreEntity();
+		}
+		else
+		{
+			Attributes.UnbindFromStore();
+		}
+		if (Subsystem != nullptr)
+		{
+			Subsystem->DestroyAttributeEntity(AttributeEntity);
+		}
+		AttributeEntity = FLayeredAttributeEntityHandle::kInvalid;
+	}
+	else if (HasAuthority())
+	{
+		// Nothing else releases the handles of effects still applied when we go away
+		for (int32 KeyIndex = 0; KeyIndex < EAttributeKeyUtils::Num; KeyIndex++)
+		{
+			Attributes.ClearLayeredEffects(static_cast<EAttributeKey>(KeyIndex));
+		}
+	}
+
+	Super::EndPlay(EndPlayReason);
+}
+
 void AWizardsCharacter::Tick(float DeltaSeconds)
 {
 	Super::Tick(DeltaSeconds);
 }
+
+void AWizardsCharacter::GetLifetimeReplicatedProps(TArray<FLifetimeProperty>& OutLifetimeProps) const
+{
+	Super::GetLifetimeReplicatedProps(OutLifetimeProps);
+
+	// Conditions are picked per character in BeginPlay, from AttributeReplicationMode
+	DOREPLIFETIME_CONDITION(AWizardsCharacter, ReplicatedEffects, COND_Dynamic);
+	DOREPLIFETIME_CONDITION(AWizardsCharacter, ReplicatedBaseValues, COND_Dynamic);
+	DOREPLIFETIME_CONDITION(AWizardsCharacter, ReplicatedValues, COND_Dynamic);
+}
+
+void AWizardsCharacter::PreReplication(IRepChangedPropertyTracker& ChangedPropertyTracker)
+{
+	Super::PreReplication(ChangedPropertyTracker);
+
+	if (HasAuthority())
+	{
+		// Only the stacks that changed since the last replication are diffed
+		ReplicatedEffects.SyncFrom(Attributes);
+		if (AttributeReplicationMode == EAttributeReplicationMode::CurrentValues)
+		{
+			ReplicatedValues.SyncFrom(Attributes);
+		}
+
+		ReplicatedBaseValues.SetNumUninitialized(EAttributeKeyUtils::Num);
+		for (int32 Index = 0; Index < EAttributeKeyUtils::Num; Index++)
+		{
+			ReplicatedBaseValues[Index] = Attributes.GetBaseValue(static_cast<EAttributeKey>(Index));
+		}
+	}
+}
+
+void AWizardsCharacter::OnAttributesCommitted()
+{
+	// Mirror into the Blueprint-readable maps, only copying the effect stacks that changed since the last commit
+	for (int32 Index = 1; Index < EAttributeKeyUtils::Num; Index++)
+	{
+		const EAttributeKey CurAttribute = static_cast<EAttributeKey>(Index);
+		if (const int32 CurBaseValue = Attributes.GetBaseValue(CurAttribute);
+			CurBaseValue != BaseAttributes.FindRef(CurAttribute))
+		{
+			BaseAttributes.Add(CurAttribute, CurBaseValue);
+		}
+
+		if (const FSortedEffectDefinitions& CurEffects = Attributes.GetEffects(CurAttribute);
+			CurEffects.GetRevision() != MirroredEffectRevisions[Index])
+		{
+			MirroredEffectRevisions[Index] = CurEffects.GetRevision();
+			ActiveEffects.Add(CurAttribute, CurEffects);
+		}
+	}
+}
+
+void AWizardsCharacter::OnRep_ReplicatedBaseValues()
+{
+	const int32 NumValues = FMath::Min(ReplicatedBaseValues.Num(), static_cast<int32>(EAttributeKeyUtils::Num));
+	for (int32 Index = 0; Index < NumValues; Index++)
+	{
+		const EAttributeKey CurAttribute = static_cast<EAttributeKey>(Index);
+		if (Attributes.GetBaseValue(CurAttribute) != ReplicatedBaseValues[Index])
+		{
+			SetBaseAttribute(CurAttribute, ReplicatedBaseValues[Index]);
+		}
+	}
+}
@@ -0,0 +1,90 @@
+// Copyright 2023 John McElmurray (johnmcelmurray.com). All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include <atomic>
+
+/// <summary>
+/// Generational slot map backing FActiveEffectHandle.
+/// A handle is a slot index plus the generation the slot had when it was allocated. Releasing a handle
+/// bumps its slot's generation and pushes the slot onto a free list, so stale handles never match a
+/// recycled slot. Live generations are always odd and free ones even.
+///
+/// Every operation is lock-free and O(1), so handles can be created and released from any thread.
+/// Slots live in fixed-size pages that are allocated on demand and never move or get freed,
+/// so readers never race a reallocation.
+/// </summary>
+class WIZARDS_API FActiveEffectHandleAllocator
+{
+public:
+
+	/// <summary>
+	/// Allocator shared by every world, so handles stay unique across PIE instances.
+	/// </summary>
+	static FActiveEffectHandleAllocator& Get();
+
+	FActiveEffectHandleAllocator();
+	~FActiveEffectHandleAllocator();
+
+	FActiveEffectHandleAllocator(const FActiveEffectHandleAllocator&) = delete;
+	FActiveEffectHandleAllocator& operator=(const FActiveEffectHandleAllocator&) = delete;
+
+	/// <summary>
+	/// Reuses a released slot if there is one, otherwise takes a fresh one.
+	/// </summary>
+	void Allocate(int32& OutIndex, uint32& OutGeneration);
+
+	/// <summary>
+	/// Frees the slot for reuse. Releasing a handle that is already released (or was never allocated) does nothing,
+	/// so copies of an effect stack can't free a slot twice.
+	/// </summary>
+	/// <returns>True if the handle was live.</returns>
+	bool Release(int32 Index, uint32 Generation);
+
+	/// <returns>True if the handle was allocated and hasn't been released since.</returns>
+	bool IsLive(int32 Index, uint32 Generation) const;
+
+private:
+
+	struct FSlot
+	{
+		std::atomic<uint32> Generation { 0 };
+
+		/// <summary>
+		/// Next slot on the free list, while this slot is on it.
+		/// </summary>
+		std::atomic<int32> NextFree { INDEX_NONE };
+	};
+
+	static constexpr int32 SlotsPerPageLog2 = 14;
+	static constexpr int32 SlotsPerPage = 1 << SlotsPerPageLog2;
+
+	/// <summary>
+	/// Caps the number of handles live at once at MaxPages * SlotsPerPage (16M).
+	/// </summary>
+	static constexpr int32 MaxPages = 1024;
+
+	/// <returns>Slot for Index, or nullptr if it was never allocated.</returns>
+	FSlot* FindSlot(int32 Index) const;
+
+	/// <summary>
+	/// Allocates the page holding Index, unless another thread already has.
+	/// </summary>
+	FSlot& FindOrAddSlot(int32 Index);
+
+	std::atomic<FSlot*> Pages[MaxPages];
+
+	/// <summary>
+	/// Number of slots ever handed out. Slots below this index are either live or on the free list.
+	/// </summary>
+	std::atomic<int32> NumSlots { 0 };
+
+	/// <summary>
+	/// Top of the free list: the low 32 bits hold the slot index + 1 (0 when empty),
+	/// and the high 32 bits a counter bumped on every change, so a pop can't succeed against a list
+	/// that was popped and pushed back to the same top in between (ABA).
+	/// </summary>
+	std::atomic<uint64> FreeListHead { 0 };
+};
@@ -0,0 +1,67 @@
+// Copyright 2023 John McElmurray (johnmcelmurray.com). All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "UObject/NoExportTypes.h"
+
+#include "LayeredEffectDefinition.h"
+
+#include "AttributeChangedData.generated.h"
+
+class ILayeredAttributes;
+
+/// <summary>
+/// Temporary parameter struct used when an attribute has changed.
+/// The Owner should create this struct any time an attribute is being modified,
+/// so that attribute changes can be detected and broadcast to UI/etc.
+/// </summary>
+USTRUCT(BlueprintType)
+struct WIZARDS_API FOnAttributeChangedData
+{
+	GENERATED_BODY()
+
+public:
+
+	FOnAttributeChangedData() = default;
+
+	FOnAttributeChangedData(
+		UObject* InOwner,
+		EAttributeKey InAttribute,
+		int32 InOldValue);
+
+	bool IsValid() const;
+
+	ILayeredAttributes* GetOwner() const;
+
+	EAttributeKey GetAttribute() const { return Attribute; }
+	int32 GetNewValue() const { return NewValue; }
+	int32 GetOldValue() const { return OldValue; }
+
+
+private:
+
+	/// <summary>
+	/// Who owns this attribute.
+	/// </summary>
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, meta = (AllowPrivateAccess = "true"))
+	UObject* Owner = nullptr;
+
+	/// <summary>
+	/// Which attribute was affected.
+	/// </summary>
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, meta = (AllowPrivateAccess = "true"))
+	EAttributeKey Attribute = EAttributeKey::Invalid;
+
+	/// <summary>
+	/// New/current value for the attribute.
+	/// </summary>
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, meta = (AllowPrivateAccess = "true"))
+	int32 NewValue = 0;
+
+	/// <summary>
+	/// Old/previous value for the attribute.
+	/// </summary>
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, meta = (AllowPrivateAccess = "true"))
+	int32 OldValue = 0;
+};
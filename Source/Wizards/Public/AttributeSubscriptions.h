@@ -0,0 +1,151 @@
+// Copyright 2023 John McElmurray (johnmcelmurray.com). All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include "AttributeChangedData.h"
+#include "LayeredEffectDefinition.h"
+
+/// <summary>
+/// Native counterpart of FOnAttributeValueChangedEvent, invoked for every attribute change.
+/// Broadcasting is a plain function call per listener, with no reflection.
+/// </summary>
+DECLARE_MULTICAST_DELEGATE_OneParam(FOnAttributeValueChangedNative, const FOnAttributeChangedData& /*Data*/);
+
+/// <summary>
+/// Native callback for a change to one of the subscribed attributes.
+/// </summary>
+DECLARE_DELEGATE_OneParam(FOnAttributeChangedDelegate, const FOnAttributeChangedData& /*Data*/);
+
+/// <summary>
+/// Native callback for a threshold watcher whose condition flipped.
+/// bConditionMet is the new state of the condition.
+/// </summary>
+DECLARE_DELEGATE_TwoParams(FOnAttributeThresholdDelegate, const FOnAttributeChangedData& /*Data*/, bool /*bConditionMet*/);
+
+/// <summary>
+/// How a threshold watcher compares an attribute's current value against its threshold.
+/// </summary>
+enum class EAttributeComparison : uint8
+{
+	Equal,
+	NotEqual,
+	Less,
+	LessOrEqual,
+	Greater,
+	GreaterOrEqual,
+};
+namespace EAttributeComparisonUtils
+{
+	/// <returns>True if "Value Comparison Threshold" holds, e.g. Value <= Threshold.</returns>
+	inline bool Compare(int32 Value, EAttributeComparison Comparison, int32 Threshold)
+	{
+		switch (Comparison)
+		{
+			case EAttributeComparison::Equal:
+				return Value == Threshold;
+			case EAttributeComparison::NotEqual:
+				return Value != Threshold;
+			case EAttributeComparison::Less:
+				return Value < Threshold;
+			case EAttributeComparison::LessOrEqual:
+				return Value <= Threshold;
+			case EAttributeComparison::Greater:
+				return Value > Threshold;
+			case EAttributeComparison::GreaterOrEqual:
+				return Value >= Threshold;
+
+			default:
+				checkNoEntry();
+				return false;
+		}
+	}
+}
+
+
+/// <summary>
+/// Native listeners of a single object's attributes.
+/// OnAnyAttributeValueChanged hears every change. Subscriptions are only invoked for changes to the attributes in their key mask,
+/// and threshold watchers are only evaluated when their attribute changes, firing when their condition flips.
+/// Listeners may subscribe or unsubscribe from inside a callback.
+/// </summary>
+class WIZARDS_API FAttributeSubscriptions
+{
+public:
+
+	/// <summary>
+	/// Calls Delegate whenever an attribute in KeyMask changes (see EAttributeKeyUtils::ToMask).
+	/// </summary>
+	FDelegateHandle Subscribe(uint32 KeyMask, FOnAttributeChangedDelegate Delegate);
+
+	/// <summary>
+	/// Calls Delegate whenever "current value of Key Comparison Threshold" flips.
+	/// </summary>
+	/// <param name="CurrentValue">Current value of Key, so the watcher starts from the right state.</param>
+	FDelegateHandle WatchThreshold(EAttributeKey Key, EAttributeComparison Comparison, int32 Threshold, int32 CurrentValue, FOnAttributeThresholdDelegate Delegate);
+
+	/// <summary>
+	/// Removes a subscription or threshold watcher.
+	/// </summary>
+	/// <returns>True if Handle was found.</returns>
+	bool Unsubscribe(FDelegateHandle Handle);
+
+	/// <returns>True if any native listener cares about Key.</returns>
+	bool IsWatching(EAttributeKey Key) const
+	{
+		return ((WatchedMask & EAttributeKeyUtils::ToMask(Key)) != 0
+			|| OnAnyAttributeValueChanged.IsBound());
+	}
+
+	/// <summary>
+	/// Invokes OnAnyAttributeValueChanged, then every subscription and threshold watcher interested in Data's attribute.
+	/// </summary>
+	void Dispatch(const FOnAttributeChangedData& Data);
+
+	/// <summary>
+	/// Native listeners for every attribute change.
+	/// </summary>
+	FOnAttributeValueChangedNative OnAnyAttributeValueChanged;
+
+private:
+
+	struct FSubscription
+	{
+		FDelegateHandle Handle;
+		uint32 KeyMask = 0;
+		FOnAttributeChangedDelegate Delegate;
+	};
+
+	struct FThresholdWatcher
+	{
+		FDelegateHandle Handle;
+		EAttributeComparison Comparison = EAttributeComparison::Equal;
+		int32 Threshold = 0;
+		bool bConditionMet = false;
+		FOnAttributeThresholdDelegate Delegate;
+	};
+
+	/// <summary>
+	/// Rebuilds WatchedMask and drops entries unsubscribed during a dispatch.
+	/// </summary>
+	void Compact();
+
+	TArray<FSubscription> Subscriptions;
+
+	/// <summary>
+	/// Threshold watchers, indexed by the attribute they watch.
+	/// </summary>
+	TArray<FThresholdWatcher> ThresholdWatchers[EAttributeKeyUtils::Num];
+
+	/// <summary>
+	/// One bit per attribute that any subscription or watcher cares about.
+	/// </summary>
+	uint32 WatchedMask = 0;
+
+	/// <summary>
+	/// Greater than zero while callbacks are running; removals are deferred until it drops back to zero.
+	/// </summary>
+	int32 DispatchDepth = 0;
+	bool bNeedsCompaction = false;
+};
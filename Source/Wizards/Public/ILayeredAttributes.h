@@ -5,7 +5,10 @@
 #include "CoreMinimal.h"
 #include "UObject/Interface.h"
 
+#include "LayeredAttributeBlock.h"
+#include "LayeredAttributeOverlay.h"
 #include "LayeredEffectDefinition.h"
+#include "LayeredEffectExpiry.h"
 
 #include "ILayeredAttributes.generated.h"
 
@@ -13,7 +16,7 @@ DECLARE_DYNAMIC_MULTICAST_DELEGATE_OneParam(FOnAttributeValueChangedEvent, const
 
 // This class does not need to be modified.
 UINTERFACE(BlueprintType, meta = (CannotImplementInterfaceInBlueprint))
-class ULayeredAttributes : public UInterface
+class WIZARDS_API ULayeredAttributes : public UInterface
 {
 	GENERATED_BODY()
 };
@@ -68,6 +71,43 @@ public:
 	UFUNCTION(BlueprintCallable)
 	virtual int32 GetCurrentAttribute(EAttributeKey Key) const;
 
+	/// <summary>
+	/// Return the current value of every attribute on this object in one call.
+	/// OutValues is indexed by EAttributeKey; only the first
+	/// min(OutValues.Num(), EAttributeKeyUtils::Num) entries are written.
+	/// </summary>
+	/// <param name="OutValues">Receives the current values, accounting for all layered effects.</param>
+	virtual void GetCurrentAttributes(TArrayView<int32> OutValues) const;
+
+	/// <summary>
+	/// Base value of every attribute on this object, for Blueprints.
+	/// </summary>
+	/// <returns>Base value for each attribute, excluding Invalid.</returns>
+	UFUNCTION(BlueprintPure, Category = Attributes)
+	virtual TMap<EAttributeKey, int32> GetAllBaseAttributes() const;
+
+	/// <summary>
+	/// Current value of every attribute on this object, for Blueprints. Prefer GetCurrentAttributes(...) from C++.
+	/// </summary>
+	/// <returns>Current value for each attribute, excluding Invalid, accounting for all layered effects.</returns>
+	UFUNCTION(BlueprintPure, Category = Attributes)
+	virtual TMap<EAttributeKey, int32> GetAllCurrentAttributes() const;
+
+	/// <summary>
+	/// Layered effects currently active on an attribute of this object.
+	/// Shared effects (see ULayeredAttributeSubsystem) are not included.
+	/// </summary>
+	/// <param name="Key">The attribute whose effects are being retrieved.</param>
+	/// <returns>The active effects on the attribute, in application order.</returns>
+	UFUNCTION(BlueprintPure, Category = Attributes)
+	virtual TArray<FActiveEffectDefinition> GetActiveEffects(EAttributeKey Key) const;
+
+	/// <summary>
+	/// Read-only view of this object's attributes to try hypothetical changes on, e.g. for AI search.
+	/// Nothing done to the overlay changes, broadcasts from or allocates on this object (see FLayeredAttributeOverlay).
+	/// </summary>
+	FLayeredAttributeOverlay MakeAttributeOverlay() const;
+
 	/// <summary>
 	/// Applies a new layered effect to this object's attributes. See
 	/// LayeredEffectDefinition for details on how layered effects are
@@ -81,6 +121,17 @@ public:
 	UFUNCTION(BlueprintCallable)
 	virtual FActiveEffectHandle AddLayeredEffect(FLayeredEffectDefinition Effect, bool& bSuccess);
 
+	/// <summary>
+	/// Same as AddLayeredEffect(...), but the effect removes itself once Expiry is reached
+	/// (see ULayeredAttributeSubsystem). It can still be removed earlier through its handle.
+	/// </summary>
+	/// <param name="Effect">The new layered effect to apply.</param>
+	/// <param name="Expiry">When the effect should be removed.</param>
+	/// <param name="bSuccess">Whether or not the effect was successfully applied.</param>
+	/// <returns>The handle to the newly applied effect.</returns>
+	UFUNCTION(BlueprintCallable)
+	virtual FActiveEffectHandle AddExpiringLayeredEffect(FLayeredEffectDefinition Effect, const FLayeredEffectExpiry& Expiry, bool& bSuccess);
+
 	/// <summary>
 	/// Removes an active layered effect.
 	/// </summary>
@@ -97,17 +148,138 @@ public:
 	virtual void ClearLayeredEffects();
 
 	/// <summary>
-	/// Delegate invoked when an attribute changes.
+	/// Applies an effect that was added on the server, keeping its handle and sequence so it stays identifiable
+	/// and ordered the same as on the server. Called on clients by FReplicatedLayeredEffects.
+	/// </summary>
+	void AddReplicatedLayeredEffect(const FActiveEffectDefinition& Effect);
+
+	/// <summary>
+	/// Removes an effect that was removed on the server. Its handle belongs to the server, so it isn't released here.
+	/// Called on clients by FReplicatedLayeredEffects.
+	/// </summary>
+	void RemoveReplicatedLayeredEffect(const FActiveEffectHandle& InHandle);
+
+	/// <summary>
+	/// Delegate invoked when an attribute changes, for Blueprint listeners.
+	/// Prefer GetOnAnyAttributeValueChangedNative() from C++.
 	/// </summary>
 	virtual const FOnAttributeValueChangedEvent& GetOnAnyAttributeValueChanged() const = 0;
 
+	/// <summary>
+	/// Native delegate invoked when an attribute changes. Broadcast before GetOnAnyAttributeValueChanged(),
+	/// without going through reflection.
+	/// </summary>
+	FOnAttributeValueChangedNative& GetOnAnyAttributeValueChangedNative();
+
+	/// <summary>
+	/// Calls Delegate whenever Key changes on this object.
+	/// </summary>
+	/// <returns>Handle to pass to UnsubscribeFromAttributes(...).</returns>
+	FDelegateHandle SubscribeToAttribute(EAttributeKey Key, FOnAttributeChangedDelegate Delegate);
+
+	/// <summary>
+	/// Calls Delegate whenever any attribute in KeyMask changes on this object (see EAttributeKeyUtils::ToMask).
+	/// </summary>
+	/// <returns>Handle to pass to UnsubscribeFromAttributes(...).</returns>
+	FDelegateHandle SubscribeToAttributes(uint32 KeyMask, FOnAttributeChangedDelegate Delegate);
+
+	/// <summary>
+	/// Calls Delegate whenever "current value of Key Comparison Threshold" flips,
+	/// e.g. (Toughness, LessOrEqual, 0) for a death check.
+	/// Only evaluated when Key changes, so there's no need to poll GetCurrentAttribute(...).
+	/// </summary>
+	/// <returns>Handle to pass to UnsubscribeFromAttributes(...).</returns>
+	FDelegateHandle WatchAttributeThreshold(EAttributeKey Key, EAttributeComparison Comparison, int32 Threshold, FOnAttributeThresholdDelegate Delegate);
+
+	/// <summary>
+	/// Removes a subscription or threshold watcher.
+	/// </summary>
+	/// <returns>True if Handle was found.</returns>
+	bool UnsubscribeFromAttributes(FDelegateHandle Handle);
+
+	/// <returns>True if anything is listening for changes to Key on this object.
+	/// When nothing is, old and new values are not evaluated for broadcasting at all.</returns>
+	virtual bool HasAttributeListeners(EAttributeKey Key) const;
+
+	/// <summary>
+	/// Sends a change to every listener: native listeners first, then GetOnAnyAttributeValueChanged()
+	/// only if a Blueprint listener is bound. Called by FOnAttributeChangedData.
+	/// </summary>
+	void BroadcastAttributeChanged(const FOnAttributeChangedData& Data);
+
+	/// <summary>
+	/// Whether changes to this object's attributes are broadcast as they happen or once per frame.
+	/// Switching to Immediate broadcasts any changes still waiting for the next flush first.
+	/// </summary>
+	ELayeredAttributeNotifyMode GetAttributeNotifyMode() const { return GetAttributes().GetNotifyMode(); }
+	void SetAttributeNotifyMode(ELayeredAttributeNotifyMode InNotifyMode);
+
+	/// <summary>
+	/// Broadcasts every change recorded in ELayeredAttributeNotifyMode::Deferred,
+	/// at most once per attribute. Called once per frame by ULayeredAttributeSubsystem.
+	/// </summary>
+	void FlushAttributeNotifications();
+
+	/// <summary>
+	/// Gives jobs on other threads lock-free access to this object's current attributes (see FLayeredAttributeSnapshotBuffer).
+	/// Call on the game thread, then read from anywhere; every read sees all attributes as of the same publish.
+	/// Values are published after every change made outside a transaction, when the outermost transaction ends,
+	/// and once per frame by ULayeredAttributeSubsystem (which picks up shared effect changes).
+	/// </summary>
+	FLayeredAttributeSnapshotReader GetAttributeSnapshotReader();
+
+	/// <summary>
+	/// Publishes this object's current attributes to snapshot readers, unless a transaction is in progress
+	/// or nobody has asked for a reader, then calls OnAttributesCommitted().
+	/// </summary>
+	void PublishAttributeSnapshot();
+
 
 protected:
 
-	virtual TMap<EAttributeKey, int32>& GetBaseAttributesMutable() = 0;
-	virtual const TMap<EAttributeKey, int32>& GetBaseAttributes() const = 0;
+	friend class FScopedAttributeTransaction;
+	friend class ULayeredAttributeSubsystem;
 
-	virtual TMap<EAttributeKey, FSortedEffectDefinitions>& GetActiveEffectsMutable() = 0;
-	virtual const TMap<EAttributeKey, FSortedEffectDefinitions>& GetActiveEffects() const = 0;
+	/// <summary>
+	/// Called right before Key is modified. Lets any active transaction snapshot the attribute
+	/// so it can be rolled back, or records the change for a deferred broadcast.
+	/// </summary>
+	/// <returns>The old value, only if the change needs to be broadcast immediately by EndAttributeChange(...).</returns>
+	TOptional<int32> BeginAttributeChange(FLayeredAttributeBlock& Attributes, EAttributeKey Key);
+
+	/// <summary>
+	/// Broadcasts the change to Key, if BeginAttributeChange(...) asked for an immediate broadcast.
+	/// </summary>
+	void EndAttributeChange(EAttributeKey Key, const TOptional<int32>& OldValue);
+
+	/// <summary>
+	/// Records that Key changed from OldValue, to be broadcast on the next deferred flush, queueing this object if needed.
+	/// Keeps the old value of an earlier change to Key that's still pending.
+	/// </summary>
+	/// <returns>False if there's no subsystem to flush it, in which case the change should be broadcast right away.</returns>
+	bool DeferAttributeChange(FLayeredAttributeBlock& Attributes, EAttributeKey Key, int32 OldValue);
+
+	/// <summary>
+	/// Asks ULayeredAttributeSubsystem to call FlushAttributeNotifications() on this object next frame.
+	/// </summary>
+	/// <returns>False if there's no subsystem to queue with.</returns>
+	bool QueueAttributeNotifications();
+
+	/// <summary>
+	/// Lets ULayeredAttributeSubsystem know this object has a new native listener, so it hears about shared effect changes.
+	/// </summary>
+	void NoteAttributeListener();
+
+	/// <summary>
+	/// Called whenever changes to this object's attributes are committed (see PublishAttributeSnapshot()),
+	/// e.g. to keep Blueprint-readable copies of them up to date.
+	/// </summary>
+	virtual void OnAttributesCommitted() { }
+
+	/// <summary>
+	/// Storage for this object's base attributes and active effects.
+	/// </summary>
+	virtual FLayeredAttributeBlock& GetAttributesMutable() = 0;
+	virtual const FLayeredAttributeBlock& GetAttributes() const = 0;
 
 };
@@ -0,0 +1,383 @@
+// Copyright 2023 John McElmurray (johnmcelmurray.com). All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include "AttributeSubscriptions.h"
+#include "LayeredAttributeSnapshot.h"
+#include "LayeredAttributeStore.h"
+#include "LayeredAttributeTimeline.h"
+#include "SharedEffectRegistry.h"
+#include "LayeredEffectDefinition.h"
+
+#include "LayeredAttributeBlock.generated.h"
+
+class FScopedAttributeTransaction;
+class ILayeredAttributes;
+
+/// <summary>
+/// When an object broadcasts changes to its attributes.
+/// </summary>
+UENUM(BlueprintType)
+enum class ELayeredAttributeNotifyMode : uint8
+{
+	/// <summary>
+	/// Broadcast as part of every SetBaseAttribute/AddLayeredEffect/RemoveLayeredEffect/ClearLayeredEffects call.
+	/// </summary>
+	Immediate,
+
+	/// <summary>
+	/// Record which attributes changed and broadcast them once per frame
+	/// (see ULayeredAttributeSubsystem::FlushDeferredNotifications).
+	/// </summary>
+	Deferred,
+};
+
+
+/// <summary>
+/// Attributes that changed since their owner last broadcast, with the value each had before its first change.
+/// </summary>
+struct FPendingAttributeChanges
+{
+	bool Contains(EAttributeKey Key) const
+	{
+		return (DirtyMask & (1u << EAttributeKeyUtils::ToIndex(Key))) != 0;
+	}
+
+	/// <summary>
+	/// Keeps OldValue unless Key is already pending.
+	/// </summary>
+	void Record(EAttributeKey Key, int32 OldValue)
+	{
+		if (!Contains(Key))
+		{
+			DirtyMask |= (1u << EAttributeKeyUtils::ToIndex(Key));
+			OldValues[EAttributeKeyUtils::ToIndex(Key)] = OldValue;
+		}
+	}
+
+	bool IsEmpty() const { return DirtyMask == 0; }
+
+	/// <summary>
+	/// One bit per pending attribute.
+	/// </summary>
+	uint32 DirtyMask = 0;
+
+	/// <summary>
+	/// True once the owner has been queued for the next flush.
+	/// </summary>
+	bool bQueued = false;
+
+	/// <summary>
+	/// Value of each pending attribute before its first change. Only valid where DirtyMask is set.
+	/// </summary>
+	int32 OldValues[EAttributeKeyUtils::Num] = { };
+};
+
+
+/// <summary>
+/// Dense storage for every attribute of a single object, indexed directly by EAttributeKey.
+/// Base values and memoized current values each fit in a single cache line, so reading
+/// an attribute is an array lookup instead of a TMap probe.
+/// A block can instead be bound to an entity in a FLayeredAttributeStore, in which case values and
+/// effects live in the store and the block only keeps its owner's notification state.
+/// </summary>
+USTRUCT(BlueprintType)
+struct WIZARDS_API FLayeredAttributeBlock
+{
+	GENERATED_BODY()
+
+public:
+
+	FLayeredAttributeBlock();
+
+	/// <summary>
+	/// Copies never share a store entity: copying a bound block snapshots its entity's base values and effects into
+	/// the copy, which starts out unbound. Only values, effects, shared effects and the notify mode are copied;
+	/// listeners, pending changes, the snapshot buffer, the timeline binding and the active transaction stay with the original.
+	/// </summary>
+	FLayeredAttributeBlock(const FLayeredAttributeBlock& Other);
+
+	/// <summary>
+	/// See the copy constructor. A bound block is unbound from its store before being overwritten.
+	/// </summary>
+	FLayeredAttributeBlock& operator=(const FLayeredAttributeBlock& Other);
+
+	int32 GetBaseValue(EAttributeKey Key) const
+	{
+		checkSlow(EAttributeKeyUtils::IsInRange(Key));
+		if (Store != nullptr)
+		{
+			return Store->GetBaseValue(StoreEntity, Key);
+		}
+		return BaseValues[EAttributeKeyUtils::ToIndex(Key)];
+	}
+
+	void SetBaseValue(EAttributeKey Key, int32 Value);
+
+	/// <returns>The base value of Key, modified by all of its active layered effects.</returns>
+	int32 GetCurrentValue(EAttributeKey Key) const
+	{
+		checkSlow(EAttributeKeyUtils::IsInRange(Key));
+		if (Store != nullptr)
+		{
+			return Store->GetCurrentValue(StoreEntity, Key);
+		}
+		const int32 Index = EAttributeKeyUtils::ToIndex(Key);
+		const uint32 KeyBit = (1u << Index);
+		if (SharedEffects != nullptr && SharedEffects->GetVersion(Key) != SharedEffectVersions[Index])
+		{
+			// Shared effects on Key were added or removed since we last evaluated it
+			SharedEffectVersions[Index] = SharedEffects->GetVersion(Key);
+			DirtyMask |= KeyBit;
+		}
+		if ((DirtyMask & KeyBit) != 0)
+		{
+			CurrentValues[Index] = EvaluateCurrentValue(Key);
+			DirtyMask &= ~KeyBit;
+		}
+		return CurrentValues[Index];
+	}
+
+	/// <summary>
+	/// Fills OutValues with the current value of every attribute, indexed by EAttributeKey.
+	/// Only the first min(OutValues.Num(), EAttributeKeyUtils::Num) entries are written.
+	/// </summary>
+	void GetCurrentValues(TArrayView<int32> OutValues) const;
+
+	const FSortedEffectDefinitions& GetEffects(EAttributeKey Key) const
+	{
+		checkSlow(EAttributeKeyUtils::IsInRange(Key));
+		if (Store != nullptr)
+		{
+			return Store->GetEffects(StoreEntity, Key);
+		}
+		return Effects[EAttributeKeyUtils::ToIndex(Key)];
+	}
+
+	/// <summary>
+	/// See FSortedEffectDefinitions::AddLayeredEffect(...).
+	/// </summary>
+	FActiveEffectHandle AddLayeredEffect(const FLayeredEffectDefinition& Effect);
+
+	/// <summary>
+	/// See FSortedEffectDefinitions::RemoveLayeredEffect(...).
+	/// </summary>
+	bool RemoveLayeredEffect(const FActiveEffectHandle& InHandle);
+
+	/// <summary>
+	/// Adds an effect activated elsewhere (e.g. replicated from the server), keeping its handle.
+	/// Not recorded by transactions, since the handle isn't this process's to release.
+	/// </summary>
+	/// <returns>False if Effect is invalid or already applied.</returns>
+	bool AddActiveEffect(const FActiveEffectDefinition& Effect);
+
+	/// <summary>
+	/// Removes an effect added with AddActiveEffect(...), without releasing its handle.
+	/// </summary>
+	/// <returns>True if the effect was found and removed.</returns>
+	bool RemoveActiveEffect(const FActiveEffectHandle& InHandle);
+
+	/// <summary>
+	/// Removes every layered effect applied to Key.
+	/// </summary>
+	/// <returns>True if any effect was removed.</returns>
+	bool ClearLayeredEffects(EAttributeKey Key);
+
+	/// <summary>
+	/// Overwrites the base value and effects of Key, e.g. when rolling back a transaction.
+	/// </summary>
+	void SetAttributeState(EAttributeKey Key, int32 BaseValue, const FSortedEffectDefinitions& InEffects);
+
+	/// <summary>
+	/// Moves every base value and effect into Entity of InStore. Until UnbindFromStore() is called,
+	/// all value accessors read and write the store instead of this block.
+	/// The store must outlive the binding. Copies of a bound block are unbound snapshots of its entity.
+	/// </summary>
+	void BindToStore(FLayeredAttributeStore& InStore, const FLayeredAttributeEntityHandle& Entity);
+
+	/// <summary>
+	/// Moves the bound entity's base values and effects back into this block and stops forwarding to the store.
+	/// The entity itself is left for its creator to destroy.
+	/// </summary>
+	void UnbindFromStore();
+
+	/// <summary>
+	/// Stops forwarding to the store without moving anything back, for when the bound entity is being
+	/// destroyed along with its effects (see FLayeredAttributeStore::DestroyEntity(...), which releases their handles).
+	/// </summary>
+	void AbandonStoreEntity();
+
+	bool IsBoundToStore() const { return Store != nullptr; }
+
+	/// <summary>
+	/// Applies the shared effects of InSharedEffects that target this block's owner on top of its own effects.
+	/// Pass nullptr to stop. Blocks bound to a store use the store's shared effects instead.
+	/// The registry must outlive the binding.
+	/// </summary>
+	void SetSharedEffects(FSharedEffectRegistry* InSharedEffects);
+
+	/// <returns>Shared effects applied on top of this block's own, from the store if bound to one.</returns>
+	FSharedEffectRegistry* GetSharedEffects() const { return (Store != nullptr) ? Store->GetSharedEffects() : SharedEffects; }
+
+	/// <summary>
+	/// Buffer that other threads read this block's current values from, created on first use. Game thread only.
+	/// Values are only as fresh as the last PublishSnapshot().
+	/// </summary>
+	FLayeredAttributeSnapshotReader GetOrCreateSnapshotBuffer();
+
+	bool HasSnapshotBuffer() const { return SnapshotBuffer.IsValid(); }
+
+	/// <summary>
+	/// Publishes every current value to the snapshot buffer, if there is one and any value changed since the last publish.
+	/// </summary>
+	void PublishSnapshot();
+
+	/// <summary>
+	/// Innermost transaction currently holding back change notifications for this block, if any.
+	/// See FScopedAttributeTransaction.
+	/// </summary>
+	FScopedAttributeTransaction* GetActiveTransaction() const { return ActiveTransaction; }
+	void SetActiveTransaction(FScopedAttributeTransaction* InTransaction) { ActiveTransaction = InTransaction; }
+
+	/// <summary>
+	/// Logs every change to this block in InTimeline while it records, so they can be rolled back.
+	/// Owner, if set, broadcasts the changes rolling back makes. Pass nullptr to detach.
+	/// The block must not move while attached; copies start out detached.
+	/// </summary>
+	void SetTimeline(FLayeredAttributeTimeline* InTimeline, ILayeredAttributes* Owner = nullptr);
+	FLayeredAttributeTimeline* GetTimeline() const { return TimelineBinding.Timeline; }
+
+	/// <summary>
+	/// Releases the handle of an effect that was removed for good, unless the timeline may still bring it back.
+	/// </summary>
+	void ReleaseHandle(const FActiveEffectHandle& InHandle);
+
+	ELayeredAttributeNotifyMode GetNotifyMode() const { return NotifyMode; }
+	void SetNotifyMode(ELayeredAttributeNotifyMode InNotifyMode) { NotifyMode = InNotifyMode; }
+
+	/// <summary>
+	/// Changes waiting to be broadcast (ELayeredAttributeNotifyMode::Deferred).
+	/// </summary>
+	FPendingAttributeChanges& GetPendingChanges() { return PendingChanges; }
+
+	/// <summary>
+	/// Returns the pending changes and starts a new, empty set.
+	/// </summary>
+	FPendingAttributeChanges ConsumePendingChanges();
+
+	/// <summary>
+	/// Native per-attribute subscriptions and threshold watchers.
+	/// </summary>
+	FAttributeSubscriptions& GetSubscriptions() { return Subscriptions; }
+	const FAttributeSubscriptions& GetSubscriptions() const { return Subscriptions; }
+
+private:
+
+	friend class FLayeredAttributeTimeline;
+
+	/// <returns>Timeline to log changes in, or nullptr if no timeline is recording.</returns>
+	FLayeredAttributeTimeline* GetRecordingTimeline() const
+	{
+		FLayeredAttributeTimeline* Timeline = TimelineBinding.Timeline;
+		return (Timeline != nullptr && Timeline->IsRecording()) ? Timeline : nullptr;
+	}
+
+	void MarkDirty(EAttributeKey Key)
+	{
+		// Which shared effects apply depends on Controller and Types, so changing them can change any attribute
+		const bool bChangesSharedTargets = (SharedEffects != nullptr && FSharedEffectRegistry::IsTargetingAttribute(Key));
+		DirtyMask |= bChangesSharedTargets ? MAX_uint32 : (1u << EAttributeKeyUtils::ToIndex(Key));
+	}
+
+	/// <summary>
+	/// Releases the handle of an effect this block removed, or leaves it to the active transaction.
+	/// </summary>
+	void ReleaseRemovedEffect(const FActiveEffectHandle& InHandle);
+
+	/// <summary>
+	/// Evaluates the base value of Key modified by its own effects and any matching shared effects.
+	/// </summary>
+	int32 EvaluateCurrentValue(EAttributeKey Key) const;
+
+	static_assert(EAttributeKeyUtils::Num <= 32, "DirtyMask needs one bit per EAttributeKey");
+
+	/// <summary>
+	/// Base value of every attribute. All base values default to 0 until set.
+	/// </summary>
+	UPROPERTY(VisibleAnywhere, Category = Attributes)
+	int32 BaseValues[EAttributeKeyUtils::Num];
+
+	/// <summary>
+	/// Active effects modifying each attribute.
+	/// </summary>
+	UPROPERTY(VisibleAnywhere, Category = Attributes)
+	FSortedEffectDefinitions Effects[EAttributeKeyUtils::Num];
+
+	/// <summary>
+	/// Memoized current value of every attribute. Only valid where DirtyMask is clear.
+	/// </summary>
+	mutable int32 CurrentValues[EAttributeKeyUtils::Num];
+
+	/// <summary>
+	/// One bit per attribute whose base value or effects changed since CurrentValues was evaluated.
+	/// </summary>
+	mutable uint32 DirtyMask = MAX_uint32;
+
+	/// <summary>
+	/// Effects shared with other objects, applied on top of Effects. See SetSharedEffects(...).
+	/// </summary>
+	FSharedEffectRegistry* SharedEffects = nullptr;
+
+	/// <summary>
+	/// Version of each attribute in SharedEffects that CurrentValues was evaluated against.
+	/// </summary>
+	mutable uint32 SharedEffectVersions[EAttributeKeyUtils::Num];
+
+	/// <summary>
+	/// Store holding this block's values, if bound. See BindToStore(...).
+	/// </summary>
+	FLayeredAttributeStore* Store = nullptr;
+
+	/// <summary>
+	/// Entity index in Store. Only meaningful while Store is set.
+	/// </summary>
+	int32 StoreEntity = INDEX_NONE;
+
+	/// <summary>
+	/// When changes to these attributes are broadcast.
+	/// </summary>
+	UPROPERTY(VisibleAnywhere, Category = Attributes)
+	ELayeredAttributeNotifyMode NotifyMode = ELayeredAttributeNotifyMode::Immediate;
+
+	/// <summary>
+	/// Changes recorded while in ELayeredAttributeNotifyMode::Deferred.
+	/// </summary>
+	FPendingAttributeChanges PendingChanges;
+
+	/// <summary>
+	/// Native listeners filtered by attribute.
+	/// </summary>
+	FAttributeSubscriptions Subscriptions;
+
+	/// <summary>
+	/// Values for readers on other threads. See GetOrCreateSnapshotBuffer().
+	/// </summary>
+	TSharedPtr<FLayeredAttributeSnapshotBuffer, ESPMode::ThreadSafe> SnapshotBuffer;
+
+	/// <summary>
+	/// Values last written to SnapshotBuffer, so unchanged values aren't published again.
+	/// </summary>
+	int32 PublishedValues[EAttributeKeyUtils::Num];
+
+	/// <summary>
+	/// Points at a stack-allocated transaction, so it is only valid for that transaction's scope.
+	/// </summary>
+	FScopedAttributeTransaction* ActiveTransaction = nullptr;
+
+	/// <summary>
+	/// Timeline logging this block's changes, if any. See SetTimeline(...).
+	/// </summary>
+	FLayeredAttributeTimelineBinding TimelineBinding;
+};
@@ -0,0 +1,110 @@
+// Copyright 2023 John McElmurray (johnmcelmurray.com). All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Async/Future.h"
+#include "Containers/Queue.h"
+
+#include "LayeredAttributeStore.h"
+#include "LayeredEffectDefinition.h"
+
+class ULayeredAttributeSubsystem;
+
+/// <summary>
+/// What a queued attribute command applies to: an object implementing ILayeredAttributes,
+/// or an entity in the world's FLayeredAttributeStore.
+/// </summary>
+struct FLayeredAttributeCommandTarget
+{
+	FLayeredAttributeCommandTarget() = default;
+
+	FLayeredAttributeCommandTarget(UObject* InObject)
+		: Object(InObject)
+	{ }
+
+	FLayeredAttributeCommandTarget(const FLayeredAttributeEntityHandle& InEntity)
+		: Entity(InEntity)
+	{ }
+
+	TWeakObjectPtr<UObject> Object;
+	FLayeredAttributeEntityHandle Entity;
+};
+
+
+/// <summary>
+/// Lets any thread request attribute changes without touching the targets, which is only safe on the game thread.
+/// Commands go into a lock-free multi-producer queue and are applied on the game thread when
+/// ULayeredAttributeSubsystem ticks, before attributes are recomputed and notifications flushed.
+/// Commands for the same object are applied in the order they were enqueued, inside one transaction,
+/// so each changed attribute is broadcast once per drain. Commands on targets that no longer exist are dropped.
+/// Handles of queued effects come back as futures, fulfilled when the command is applied.
+/// </summary>
+class WIZARDS_API FLayeredAttributeCommandQueue
+{
+public:
+
+	// The enqueue methods below are safe to call from any thread
+
+	void SetBaseAttribute(const FLayeredAttributeCommandTarget& Target, EAttributeKey Key, int32 Value);
+
+	/// <returns>The effect's handle once applied, or an invalid handle if it couldn't be.</returns>
+	TFuture<FActiveEffectHandle> AddLayeredEffect(const FLayeredAttributeCommandTarget& Target, const FLayeredEffectDefinition& Effect);
+
+	/// <returns>Whether the effect was removed, once applied.</returns>
+	TFuture<bool> RemoveLayeredEffect(const FLayeredAttributeCommandTarget& Target, const FActiveEffectHandle& InHandle);
+
+	void ClearLayeredEffects(const FLayeredAttributeCommandTarget& Target);
+
+	/// <summary>
+	/// Applies every command queued so far. Game thread only.
+	/// </summary>
+	/// <returns>Number of commands applied or dropped.</returns>
+	int32 Execute(ULayeredAttributeSubsystem& Subsystem);
+
+private:
+
+	struct FCommand
+	{
+		enum class EType : uint8
+		{
+			SetBaseAttribute,
+			AddLayeredEffect,
+			RemoveLayeredEffect,
+			ClearLayeredEffects,
+		};
+
+		FCommand() = default;
+
+		FCommand(EType InType, const FLayeredAttributeCommandTarget& InTarget)
+			: Type(InType)
+			, Target(InTarget)
+		{ }
+
+		EType Type = EType::SetBaseAttribute;
+		FLayeredAttributeCommandTarget Target;
+
+		EAttributeKey Key = EAttributeKey::Invalid;
+		int32 Value = 0;
+		FLayeredEffectDefinition Effect;
+		FActiveEffectHandle Handle;
+
+		/// <summary>
+		/// Only set for AddLayeredEffect / RemoveLayeredEffect.
+		/// </summary>
+		TUniquePtr<TPromise<FActiveEffectHandle>> AddPromise;
+		TUniquePtr<TPromise<bool>> RemovePromise;
+	};
+
+	/// <summary>
+	/// Applies Command to an object, which must be inside a transaction.
+	/// </summary>
+	static void ExecuteOnObject(FCommand& Command, class ILayeredAttributes* Target);
+
+	/// <summary>
+	/// Applies Command to an entity. Ignored if the entity was destroyed.
+	/// </summary>
+	static void ExecuteOnEntity(FCommand& Command, ULayeredAttributeSubsystem& Subsystem);
+
+	TQueue<FCommand, EQueueMode::Mpsc> Commands;
+};
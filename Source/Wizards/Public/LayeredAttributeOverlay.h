@@ -0,0 +1,112 @@
+// Copyright 2023 John McElmurray (johnmcelmurray.com). All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include "LayeredEffectDefinition.h"
+
+struct FLayeredAttributeBlock;
+
+/// <summary>
+/// Read-only "what if" view of an object's attributes, for AI search and previews: hypothetical base values,
+/// added effects and removed effects are layered on top of the object without touching it.
+/// Nothing is broadcast, no handles are generated, and the object allocates nothing.
+///
+/// Attributes the overlay doesn't change read straight through to the object's memoized current values.
+/// Changed attributes are evaluated on demand, by walking the object's effects (and its shared effects)
+/// merged with the hypothetical ones, in the same layer/sequence order as if they had really been applied.
+/// Hypothetical effects apply after every existing effect in their layer, as if they had been added just now.
+///
+/// Overlays are small values: copy one to branch a search. They read the object live, so an overlay
+/// must not outlive it, and shows any change made to the object since.
+/// Reading an overlay never changes its shared effects, but can evaluate and memoize the object's current values,
+/// so overlays are only read on the game thread (or whichever thread owns the object), like the object itself.
+/// </summary>
+class WIZARDS_API FLayeredAttributeOverlay
+{
+public:
+
+	explicit FLayeredAttributeOverlay(const FLayeredAttributeBlock& InAttributes);
+
+	/// <summary>
+	/// Pretends the base value of Key is Value.
+	/// </summary>
+	void SetBaseValue(EAttributeKey Key, int32 Value);
+
+	/// <summary>
+	/// Pretends Effect was added to the object.
+	/// </summary>
+	/// <returns>False if Effect is invalid.</returns>
+	bool AddLayeredEffect(const FLayeredEffectDefinition& Effect);
+
+	/// <summary>
+	/// Pretends the object's effect with InHandle was removed. Shared effects can't be removed.
+	/// </summary>
+	/// <returns>False if the object doesn't have the effect, or it is already removed.</returns>
+	bool RemoveLayeredEffect(const FActiveEffectHandle& InHandle);
+
+	/// <summary>
+	/// Pretends every effect of the object and of this overlay on Key was removed.
+	/// </summary>
+	void ClearLayeredEffects(EAttributeKey Key);
+
+	/// <summary>
+	/// Drops every hypothetical change, so the overlay reads the same as the object.
+	/// </summary>
+	void Reset();
+
+	int32 GetBaseValue(EAttributeKey Key) const;
+
+	/// <returns>What the current value of Key would be, with the same semantics as ILayeredAttributes::GetCurrentAttribute(...).</returns>
+	int32 GetCurrentValue(EAttributeKey Key) const;
+
+	/// <summary>
+	/// Fills OutValues with what every current value would be, indexed by EAttributeKey.
+	/// Only the first min(OutValues.Num(), EAttributeKeyUtils::Num) entries are written.
+	/// </summary>
+	void GetCurrentValues(TArrayView<int32> OutValues) const;
+
+	/// <returns>True if the overlay changes anything that goes into Key.</returns>
+	bool IsChanged(EAttributeKey Key) const;
+
+private:
+
+	/// <summary>
+	/// Evaluates Key from the hypothetical base value, the object's remaining effects and the added ones.
+	/// </summary>
+	int32 EvaluateCurrentValue(EAttributeKey Key) const;
+
+	bool IsRemoved(const FActiveEffectHandle& InHandle) const;
+
+	static_assert(EAttributeKeyUtils::Num <= 32, "Overlay masks need one bit per EAttributeKey");
+
+	const FLayeredAttributeBlock* Attributes = nullptr;
+
+	/// <summary>
+	/// Hypothetical base values. Only valid where BaseValueMask is set.
+	/// </summary>
+	int32 BaseValues[EAttributeKeyUtils::Num];
+
+	uint32 BaseValueMask = 0;
+
+	/// <summary>
+	/// One bit per attribute whose own effects are all pretended removed.
+	/// </summary>
+	uint32 ClearedMask = 0;
+
+	/// <summary>
+	/// One bit per attribute with a base value, effect or removal in this overlay.
+	/// </summary>
+	uint32 ChangedMask = 0;
+
+	/// <summary>
+	/// Hypothetical effects, in the order they were added. Inline, since a what-if rarely adds more than a few.
+	/// </summary>
+	TArray<FLayeredEffectDefinition, TInlineAllocator<4>> AddedEffects;
+
+	/// <summary>
+	/// Handles of the object's effects pretended removed.
+	/// </summary>
+	TArray<FActiveEffectHandle, TInlineAllocator<4>> RemovedHandles;
+};
@@ -0,0 +1,79 @@
+// Copyright 2023 John McElmurray (johnmcelmurray.com). All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include "LayeredEffectDefinition.h"
+
+#include <atomic>
+
+/// <summary>
+/// Current value of every attribute of an object, as published at one point in time.
+/// </summary>
+struct FLayeredAttributeSnapshot
+{
+	int32 GetValue(EAttributeKey Key) const
+	{
+		checkSlow(EAttributeKeyUtils::IsInRange(Key));
+		return Values[EAttributeKeyUtils::ToIndex(Key)];
+	}
+
+	int32 Values[EAttributeKeyUtils::Num] = { };
+
+	/// <summary>
+	/// Number of snapshots published before this one. Increases every time the values change.
+	/// </summary>
+	uint32 Version = 0;
+};
+
+
+/// <summary>
+/// Publishes an object's current attribute values from the game thread to readers on any thread (a seqlock).
+/// Publishing never waits on readers, and readers never take a lock: they copy the values and retry
+/// in the rare case a publish landed mid-copy, so every read sees all attributes from the same publish.
+/// Only one thread may publish.
+/// </summary>
+class WIZARDS_API FLayeredAttributeSnapshotBuffer
+{
+public:
+
+	FLayeredAttributeSnapshotBuffer();
+
+	FLayeredAttributeSnapshotBuffer(const FLayeredAttributeSnapshotBuffer&) = delete;
+	FLayeredAttributeSnapshotBuffer& operator=(const FLayeredAttributeSnapshotBuffer&) = delete;
+
+	/// <summary>
+	/// Replaces the published values. Values is indexed by EAttributeKey and must hold EAttributeKeyUtils::Num entries.
+	/// </summary>
+	void Publish(TConstArrayView<int32> Values);
+
+	/// <summary>
+	/// Copies the latest published values, unless a publish is in progress.
+	/// </summary>
+	/// <returns>False if OutSnapshot may be torn, in which case try again.</returns>
+	bool TryRead(FLayeredAttributeSnapshot& OutSnapshot) const;
+
+	/// <summary>
+	/// Copies the latest published values, retrying until it gets a consistent copy.
+	/// </summary>
+	FLayeredAttributeSnapshot Read() const;
+
+	/// <returns>Version of the latest published snapshot.</returns>
+	uint32 GetVersion() const { return Sequence.load(std::memory_order_acquire) / 2; }
+
+private:
+
+	/// <summary>
+	/// Odd while a publish is in progress. Bumped twice per publish.
+	/// </summary>
+	std::atomic<uint32> Sequence { 0 };
+
+	std::atomic<int32> Values[EAttributeKeyUtils::Num];
+};
+
+/// <summary>
+/// Shared, read-only access to an object's published attributes. Stays valid after the object is destroyed,
+/// so jobs on other threads can keep one without keeping the object alive.
+/// </summary>
+using FLayeredAttributeSnapshotReader = TSharedRef<const FLayeredAttributeSnapshotBuffer, ESPMode::ThreadSafe>;
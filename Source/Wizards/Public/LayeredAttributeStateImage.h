@@ -0,0 +1,168 @@
+// Copyright 2023 John McElmurray (johnmcelmurray.com). All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include "LayeredEffectDefinition.h"
+
+class IMappedFileHandle;
+class IMappedFileRegion;
+struct FLayeredAttributeBlock;
+
+/// <summary>
+/// Binary layout of a saved attribute state image, for any number of objects.
+/// Every record is plain data at a fixed offset, little endian and 8 byte aligned, so an image is read
+/// in place (e.g. straight out of a memory mapped file) without being parsed first:
+///
+///		FHeader
+///		FObject[NumObjects]					which of the effect records belong to each object
+///		int32[NumObjects * NumAttributes]	base values, one row per object, padded to 8 bytes
+///		FEffect[NumEffects]					every object's effects, grouped by object and attribute, in application order
+///
+/// Bump Version whenever a record changes. Images with a different number of attributes still load:
+/// attributes only one side knows about are skipped.
+/// </summary>
+namespace LayeredAttributeStateImage
+{
+	static_assert(PLATFORM_LITTLE_ENDIAN, "Attribute state images are read in place, which assumes a little endian platform");
+
+	constexpr uint32 Magic = 0x5354414C; // "LATS"
+	constexpr uint16 Version = 1;
+
+	struct FHeader
+	{
+		uint32 Magic = 0;
+		uint16 Version = 0;
+		uint16 NumAttributes = 0;
+		uint32 NumObjects = 0;
+		uint32 NumEffects = 0;
+
+		/// <summary>
+		/// Size of the whole image, header included, to catch truncated files.
+		/// </summary>
+		uint64 TotalSize = 0;
+	};
+	static_assert(sizeof(FHeader) == 24, "Attribute state image layout changed, bump Version");
+
+	struct FObject
+	{
+		uint32 FirstEffect = 0;
+		uint32 NumEffects = 0;
+	};
+	static_assert(sizeof(FObject) == 8, "Attribute state image layout changed, bump Version");
+
+	struct FEffect
+	{
+		/// <summary>
+		/// Application sequence (see FActiveEffectDefinition::GetSequence()). Handles aren't saved,
+		/// they are only meaningful to the process that generated them.
+		/// </summary>
+		int64 Sequence = 0;
+		int32 Modification = 0;
+		int32 Layer = 0;
+		uint8 Attribute = 0;
+		uint8 Operation = 0;
+		uint8 Padding[6] = { };
+	};
+	static_assert(sizeof(FEffect) == 24, "Attribute state image layout changed, bump Version");
+}
+
+
+/// <summary>
+/// Builds an attribute state image of any number of objects, each added with AddObject(...).
+/// </summary>
+class WIZARDS_API FLayeredAttributeStateWriter
+{
+public:
+
+	/// <summary>
+	/// Appends the base values and effects of Attributes (its own, not shared effects).
+	/// </summary>
+	/// <returns>Index of the object in the image.</returns>
+	int32 AddObject(const FLayeredAttributeBlock& Attributes);
+
+	int32 NumObjects() const { return Objects.Num(); }
+
+	/// <summary>
+	/// Writes the image of every object added so far to OutBytes, replacing its contents.
+	/// Images are sized in 64 bits, so they can grow past 2 GB.
+	/// </summary>
+	void Write(TArray64<uint8>& OutBytes) const;
+
+	/// <returns>False if the file couldn't be written.</returns>
+	bool SaveToFile(const FString& Filename) const;
+
+private:
+
+	TArray<LayeredAttributeStateImage::FObject> Objects;
+	TArray<int32> BaseValues;
+	TArray<LayeredAttributeStateImage::FEffect> Effects;
+};
+
+
+/// <summary>
+/// Reads an attribute state image in place. Doesn't copy or own the bytes, which must outlive it.
+/// Initialize(...) only checks the header; the records are read as they are restored.
+/// </summary>
+class WIZARDS_API FLayeredAttributeStateImage
+{
+public:
+
+	FLayeredAttributeStateImage() = default;
+
+	explicit FLayeredAttributeStateImage(TArrayView64<const uint8> InBytes) { Initialize(InBytes); }
+
+	/// <returns>False (and the image is empty) if InBytes isn't a complete image of a version this build reads.</returns>
+	bool Initialize(TArrayView64<const uint8> InBytes);
+
+	bool IsValid() const { return Header != nullptr; }
+
+	int32 NumObjects() const { return IsValid() ? static_cast<int32>(Header->NumObjects) : 0; }
+
+	/// <returns>Saved base value of Key on an object, or 0 if the image doesn't have Key.</returns>
+	int32 GetBaseValue(int32 ObjectIndex, EAttributeKey Key) const;
+
+	/// <returns>Saved effects of an object, in the order they were saved.</returns>
+	TArrayView<const LayeredAttributeStateImage::FEffect> GetEffects(int32 ObjectIndex) const;
+
+	/// <summary>
+	/// Replaces the base values and effects of Attributes with those of an object in the image.
+	/// Effects get new handles and keep their application order, also relative to effects added after.
+	/// Doesn't broadcast: meant for loading, before anything listens.
+	/// </summary>
+	/// <returns>False if ObjectIndex isn't in the image.</returns>
+	bool RestoreObject(int32 ObjectIndex, FLayeredAttributeBlock& Attributes) const;
+
+private:
+
+	const LayeredAttributeStateImage::FHeader* Header = nullptr;
+	const LayeredAttributeStateImage::FObject* Objects = nullptr;
+	const int32* BaseValues = nullptr;
+	const LayeredAttributeStateImage::FEffect* Effects = nullptr;
+};
+
+
+/// <summary>
+/// Attribute state image memory mapped from a file, so loading costs no more than the pages restoring touches.
+/// </summary>
+class WIZARDS_API FMappedLayeredAttributeStateImage : public FNoncopyable
+{
+public:
+
+	FMappedLayeredAttributeStateImage();
+	~FMappedLayeredAttributeStateImage();
+
+	/// <returns>False if the file couldn't be mapped or isn't a valid image.</returns>
+	bool Open(const FString& Filename);
+
+	void Close();
+
+	const FLayeredAttributeStateImage& GetImage() const { return Image; }
+
+private:
+
+	TUniquePtr<IMappedFileHandle> MappedFile;
+	TUniquePtr<IMappedFileRegion> MappedRegion;
+	FLayeredAttributeStateImage Image;
+};
@@ -0,0 +1,80 @@
+// Copyright 2023 John McElmurray (johnmcelmurray.com). All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "ProfilingDebugging/CpuProfilerTrace.h"
+#include "Stats/Stats.h"
+#include "Trace/Trace.h"
+
+/// <summary>
+/// Profiling of attribute operations, viewable with "stat LayeredAttributes" and in Unreal Insights
+/// (run with -trace=default,stats,LayeredAttributes). Compiled out of shipping builds.
+/// </summary>
+#ifndef LAYERED_ATTRIBUTES_STATS
+#define LAYERED_ATTRIBUTES_STATS !UE_BUILD_SHIPPING
+#endif
+
+#if LAYERED_ATTRIBUTES_STATS
+
+DECLARE_STATS_GROUP(TEXT("LayeredAttributes"), STATGROUP_LayeredAttributes, STATCAT_Advanced);
+
+DECLARE_CYCLE_STAT_EXTERN(TEXT("SetBaseAttribute"), STAT_LayeredAttributes_SetBaseAttribute, STATGROUP_LayeredAttributes, WIZARDS_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("GetCurrentAttribute"), STAT_LayeredAttributes_GetCurrentAttribute, STATGROUP_LayeredAttributes, WIZARDS_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("AddLayeredEffect"), STAT_LayeredAttributes_AddLayeredEffect, STATGROUP_LayeredAttributes, WIZARDS_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("RemoveLayeredEffect"), STAT_LayeredAttributes_RemoveLayeredEffect, STATGROUP_LayeredAttributes, WIZARDS_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("ClearLayeredEffects"), STAT_LayeredAttributes_ClearLayeredEffects, STATGROUP_LayeredAttributes, WIZARDS_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Broadcast"), STAT_LayeredAttributes_Broadcast, STATGROUP_LayeredAttributes, WIZARDS_API);
+
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Broadcasts"), STAT_LayeredAttributes_Broadcasts, STATGROUP_LayeredAttributes, WIZARDS_API);
+
+// Histogram of effect stack depths, counting every stack an effect was added to by its depth after the add
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Stack depth 1"), STAT_LayeredAttributes_Depth1, STATGROUP_LayeredAttributes, WIZARDS_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Stack depth 2-3"), STAT_LayeredAttributes_Depth2, STATGROUP_LayeredAttributes, WIZARDS_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Stack depth 4-7"), STAT_LayeredAttributes_Depth4, STATGROUP_LayeredAttributes, WIZARDS_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Stack depth 8-15"), STAT_LayeredAttributes_Depth8, STATGROUP_LayeredAttributes, WIZARDS_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Stack depth 16-63"), STAT_LayeredAttributes_Depth16, STATGROUP_LayeredAttributes, WIZARDS_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Stack depth 64-255"), STAT_LayeredAttributes_Depth64, STATGROUP_LayeredAttributes, WIZARDS_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Stack depth 256-1023"), STAT_LayeredAttributes_Depth256, STATGROUP_LayeredAttributes, WIZARDS_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Stack depth 1024+"), STAT_LayeredAttributes_Depth1024, STATGROUP_LayeredAttributes, WIZARDS_API);
+
+UE_TRACE_CHANNEL_EXTERN(LayeredAttributesChannel, WIZARDS_API);
+
+/// <summary>
+/// Times the rest of the enclosing scope as the Name stat, and as a "LayeredAttributes::Name" Insights event.
+/// </summary>
+#define LAYERED_ATTRIBUTES_SCOPE(Name) \
+	SCOPE_CYCLE_COUNTER(STAT_LayeredAttributes_##Name); \
+	TRACE_CPUPROFILER_EVENT_SCOPE_ON_CHANNEL_STR("LayeredAttributes::" #Name, LayeredAttributesChannel)
+
+namespace LayeredAttributeStats
+{
+	/// <summary>
+	/// Counts a broadcast towards this frame's total.
+	/// </summary>
+	WIZARDS_API void RecordBroadcast();
+
+	/// <summary>
+	/// Adds a stack that was just added to, with NumEffects effects, to the depth histogram.
+	/// </summary>
+	WIZARDS_API void RecordStackDepth(int32 NumEffects);
+
+	/// <summary>
+	/// Sends the totals since the last call to Insights as one frame's worth. Called every frame by ULayeredAttributeSubsystem;
+	/// only the first call per frame counts.
+	/// </summary>
+	WIZARDS_API void EndFrame();
+}
+
+#else
+
+#define LAYERED_ATTRIBUTES_SCOPE(Name)
+
+namespace LayeredAttributeStats
+{
+	inline void RecordBroadcast() { }
+	inline void RecordStackDepth(int32 NumEffects) { }
+	inline void EndFrame() { }
+}
+
+#endif
@@ -0,0 +1,247 @@
+// Copyright 2023 John McElmurray (johnmcelmurray.com). All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include "LayeredEffectDefinition.h"
+#include "SharedEffectRegistry.h"
+
+#include "LayeredAttributeStore.generated.h"
+
+/// <summary>
+/// Identifies an entity whose attributes live in a FLayeredAttributeStore.
+/// The generation goes stale once the entity is destroyed, even if its index is reused.
+/// </summary>
+USTRUCT(BlueprintType)
+struct WIZARDS_API FLayeredAttributeEntityHandle
+{
+	GENERATED_BODY()
+
+public:
+
+	static const FLayeredAttributeEntityHandle kInvalid;
+
+	FLayeredAttributeEntityHandle() = default;
+	FLayeredAttributeEntityHandle(int32 InIndex, uint32 InGeneration)
+		: Index(InIndex)
+		, Generation(InGeneration)
+	{ }
+
+	int32 GetIndex() const { return Index; }
+	uint32 GetGeneration() const { return Generation; }
+
+	bool IsValid() const { return Index != INDEX_NONE; }
+
+	bool operator==(const FLayeredAttributeEntityHandle& Other) const
+	{
+		return Index == Other.Index && Generation == Other.Generation;
+	}
+
+	bool operator!=(const FLayeredAttributeEntityHandle& Other) const
+	{
+		return !(*this == Other);
+	}
+
+	friend inline uint32 GetTypeHash(const FLayeredAttributeEntityHandle& Key)
+	{
+		return HashCombine(::GetTypeHash(Key.Index), ::GetTypeHash(Key.Generation));
+	}
+
+private:
+
+	int32 Index = INDEX_NONE;
+
+	uint32 Generation = 0;
+};
+
+
+/// <summary>
+/// Attributes of many entities stored as structure-of-arrays: one column per EAttributeKey for
+/// base values and memoized current values, indexed by entity.
+/// Effect stacks are only allocated for the (entity, attribute) pairs that actually have effects,
+/// so an entity with no effects costs a few ints per attribute.
+/// Entities do not broadcast changes; objects that need notifications bind a FLayeredAttributeBlock
+/// to an entity instead (see FLayeredAttributeBlock::BindToStore(...)).
+/// Like FSortedEffectDefinitions, removing effects doesn't release their handles; the caller does.
+/// Destroying an entity releases the handles of every effect still on it.
+/// </summary>
+class WIZARDS_API FLayeredAttributeStore
+{
+public:
+
+	FLayeredAttributeEntityHandle CreateEntity();
+
+	/// <summary>
+	/// Releases every effect on Entity and frees its index for reuse.
+	/// </summary>
+	/// <returns>False if Entity was already destroyed.</returns>
+	bool DestroyEntity(const FLayeredAttributeEntityHandle& Entity);
+
+	bool IsValid(const FLayeredAttributeEntityHandle& Entity) const
+	{
+		// Destroying an entity bumps its slot's generation, so free slots never match a handle
+		return Generations.IsValidIndex(Entity.GetIndex()) && Generations[Entity.GetIndex()] == Entity.GetGeneration();
+	}
+
+	/// <returns>Number of live entities.</returns>
+	int32 Num() const { return Generations.Num() - FreeEntities.Num(); }
+
+	/// <returns>Number of entity indices, live or free. Columns are this long.</returns>
+	int32 NumSlots() const { return Generations.Num(); }
+
+	// The accessors below take a raw entity index, which callers are expected to have validated
+
+	int32 GetBaseValue(int32 Entity, EAttributeKey Key) const
+	{
+		return BaseValues[EAttributeKeyUtils::ToIndex(Key)][Entity];
+	}
+
+	void SetBaseValue(int32 Entity, EAttributeKey Key, int32 Value);
+
+	/// <returns>The base value of Key, modified by all of its active layered effects.</returns>
+	int32 GetCurrentValue(int32 Entity, EAttributeKey Key) const
+	{
+		const int32 Index = EAttributeKeyUtils::ToIndex(Key);
+		const uint32 KeyBit = (1u << Index);
+		if (SharedEffects != nullptr && SharedEffects->GetVersion(Key) != SharedEffectVersions[Index])
+		{
+			SyncSharedEffectVersion(Index);
+		}
+		if ((DirtyMasks[Entity] & KeyBit) != 0)
+		{
+			CurrentValues[Index][Entity] = EvaluateAttribute(Entity, Index);
+			DirtyMasks[Entity] &= ~KeyBit;
+		}
+		return CurrentValues[Index][Entity];
+	}
+
+	/// <returns>Effects applied to Key on Entity, or an empty stack if it has none.</returns>
+	const FSortedEffectDefinitions& GetEffects(int32 Entity, EAttributeKey Key) const;
+
+	/// <summary>
+	/// See FSortedEffectDefinitions::AddLayeredEffect(...).
+	/// </summary>
+	FActiveEffectHandle AddLayeredEffect(int32 Entity, const FLayeredEffectDefinition& Effect);
+
+	/// <summary>
+	/// See FSortedEffectDefinitions::AddActiveEffect(...).
+	/// </summary>
+	bool AddActiveEffect(int32 Entity, const FActiveEffectDefinition& Effect);
+
+	/// <summary>
+	/// See FSortedEffectDefinitions::RemoveLayeredEffect(...).
+	/// </summary>
+	bool RemoveLayeredEffect(int32 Entity, const FActiveEffectHandle& InHandle);
+
+	/// <summary>
+	/// Removes every layered effect applied to Key on Entity.
+	/// </summary>
+	/// <returns>True if any effect was removed.</returns>
+	bool ClearLayeredEffects(int32 Entity, EAttributeKey Key);
+
+	/// <summary>
+	/// Overwrites the base value and effects of Key on Entity.
+	/// </summary>
+	void SetAttributeState(int32 Entity, EAttributeKey Key, int32 BaseValue, const FSortedEffectDefinitions& InEffects);
+
+	/// <summary>
+	/// Applies the shared effects of InSharedEffects that target each entity on top of its own effects.
+	/// Pass nullptr to stop. The registry must outlive the binding.
+	/// </summary>
+	void SetSharedEffects(FSharedEffectRegistry* InSharedEffects);
+	FSharedEffectRegistry* GetSharedEffects() const { return SharedEffects; }
+
+	/// <summary>
+	/// Re-evaluates every stale current value, spreading entities across worker threads.
+	/// Must not run concurrently with anything that mutates the store.
+	/// </summary>
+	void RecomputeDirtyValues();
+
+	/// <summary>
+	/// Current value of Key for every entity slot, indexed by entity. Free slots read as 0.
+	/// Only up to date after RecomputeDirtyValues().
+	/// </summary>
+	TConstArrayView<int32> GetCurrentValueColumn(EAttributeKey Key) const
+	{
+		return CurrentValues[EAttributeKeyUtils::ToIndex(Key)];
+	}
+
+private:
+
+	int32 EvaluateAttribute(int32 Entity, int32 KeyIndex) const;
+
+	void MarkDirty(int32 Entity, EAttributeKey Key)
+	{
+		// Which shared effects apply depends on Controller and Types, so changing them can change any attribute
+		const bool bChangesSharedTargets = (SharedEffects != nullptr && FSharedEffectRegistry::IsTargetingAttribute(Key));
+		DirtyMasks[Entity] |= bChangesSharedTargets ? MAX_uint32 : (1u << EAttributeKeyUtils::ToIndex(Key));
+	}
+
+	/// <summary>
+	/// Marks the attribute stale on every entity, after shared effects on it were added or removed.
+	/// </summary>
+	void SyncSharedEffectVersion(int32 KeyIndex) const;
+
+	/// <returns>The effect stack for Key on Entity, allocating it if needed.</returns>
+	FSortedEffectDefinitions& FindOrAddEffects(int32 Entity, EAttributeKey Key);
+
+	/// <summary>
+	/// Frees the effect stack for Key on Entity, if it has one.
+	/// </summary>
+	void ReleaseEffects(int32 Entity, EAttributeKey Key);
+
+	static_assert(EAttributeKeyUtils::Num <= 32, "DirtyMasks needs one bit per EAttributeKey");
+
+	/// <summary>
+	/// Entities evaluated per ParallelFor task in RecomputeDirtyValues().
+	/// </summary>
+	static constexpr int32 RecomputeBatchSize = 1024;
+
+	/// <summary>
+	/// Base value of each attribute, one column per EAttributeKey.
+	/// </summary>
+	TArray<int32> BaseValues[EAttributeKeyUtils::Num];
+
+	/// <summary>
+	/// Memoized current value of each attribute, one column per EAttributeKey.
+	/// Only valid where the entity's DirtyMasks bit is clear.
+	/// </summary>
+	mutable TArray<int32> CurrentValues[EAttributeKeyUtils::Num];
+
+	/// <summary>
+	/// Index into EffectStacks for each attribute, one column per EAttributeKey.
+	/// INDEX_NONE for attributes without effects.
+	/// </summary>
+	TArray<int32> EffectStackIndices[EAttributeKeyUtils::Num];
+
+	/// <summary>
+	/// One bit per attribute of each entity whose current value is stale.
+	/// </summary>
+	mutable TArray<uint32> DirtyMasks;
+
+	/// <summary>
+	/// Generation of each entity slot, bumped every time the slot is destroyed.
+	/// </summary>
+	TArray<uint32> Generations;
+
+	/// <summary>
+	/// Destroyed entity slots available for reuse.
+	/// </summary>
+	TArray<int32> FreeEntities;
+
+	/// <summary>
+	/// Effects shared with other objects, applied on top of each entity's own effects. See SetSharedEffects(...).
+	/// </summary>
+	FSharedEffectRegistry* SharedEffects = nullptr;
+
+	/// <summary>
+	/// Version of each attribute in SharedEffects that CurrentValues was evaluated against.
+	/// </summary>
+	mutable uint32 SharedEffectVersions[EAttributeKeyUtils::Num] = { };
+
+	/// <summary>
+	/// Effect stacks shared out to (entity, attribute) pairs through EffectStackIndices.
+	/// </summary>
+	TSparseArray<FSortedEffectDefinitions> EffectStacks;
+};
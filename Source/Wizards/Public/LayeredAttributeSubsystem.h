@@ -0,0 +1,235 @@
+// Copyright 2023 John McElmurray (johnmcelmurray.com). All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+
+#include "LayeredAttributeCommandQueue.h"
+#include "LayeredAttributeStore.h"
+#include "LayeredAttributeTimeline.h"
+#include "LayeredEffectExpiry.h"
+#include "SharedEffectRegistry.h"
+
+#include "LayeredAttributeSubsystem.generated.h"
+
+/// <summary>
+/// Per-world services for objects implementing ILayeredAttributes.
+/// Owners in ELayeredAttributeNotifyMode::Deferred queue themselves here the first time an
+/// attribute changes in a frame, and their changes are broadcast together once per frame.
+/// Also owns the world's FLayeredAttributeStore, which holds attributes for lightweight entities
+/// (tokens, emblems, cards in libraries) that are far too numerous to be actors, as well as for any
+/// ILayeredAttributes implementer that binds its block to an entity.
+/// Shared effects registered here apply to every matching entity and bound block without being copied into them.
+/// Other threads change attributes through the command queue, which is applied at the start of every tick.
+/// Effects with an FLayeredEffectExpiry are removed here when their time runs out or their scope ends.
+/// </summary>
+UCLASS()
+class WIZARDS_API ULayeredAttributeSubsystem : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+
+	/// <summary>
+	/// Queues Owner to have its pending attribute changes broadcast on the next flush.
+	/// Owners are expected to queue themselves at most once per flush.
+	/// </summary>
+	void QueueDeferredNotifications(UObject* Owner);
+
+	/// <summary>
+	/// Broadcasts the pending attribute changes of every queued owner.
+	/// Changes made by listeners during the flush are broadcast on the next one.
+	/// </summary>
+	void FlushDeferredNotifications();
+
+	/// <summary>
+	/// Republishes Owner's attribute snapshot every frame, so readers pick up changes that happen
+	/// without Owner being modified (e.g. shared effects). See ILayeredAttributes::GetAttributeSnapshotReader().
+	/// </summary>
+	void RegisterSnapshotOwner(UObject* Owner);
+
+	/// <summary>
+	/// Tells Owner about changes to its attributes when shared effects are added or removed through this subsystem,
+	/// for as long as it has listeners. For objects whose block uses GetSharedEffects(), directly or by being bound to GetStore().
+	/// Targets without listeners aren't visited at all; they pick up the change the next time they read the attribute.
+	/// </summary>
+	void RegisterSharedEffectTarget(UObject* Owner);
+	void UnregisterSharedEffectTarget(UObject* Owner);
+
+	/// <summary>
+	/// Starts telling Owner about shared effect changes right away, if it is a registered target.
+	/// Called when a native listener subscribes to Owner; Blueprint listeners are picked up on the next tick.
+	/// </summary>
+	void NoteSharedEffectListener(UObject* Owner);
+
+	/// <summary>
+	/// Creates an entity whose attributes all start at 0 with no effects.
+	/// </summary>
+	UFUNCTION(BlueprintCallable, Category = Attributes)
+	FLayeredAttributeEntityHandle CreateAttributeEntity() { return Store.CreateEntity(); }
+
+	/// <returns>False if Entity was already destroyed.</returns>
+	UFUNCTION(BlueprintCallable, Category = Attributes)
+	bool DestroyAttributeEntity(const FLayeredAttributeEntityHandle& Entity) { return Store.DestroyEntity(Entity); }
+
+	UFUNCTION(BlueprintPure, Category = Attributes)
+	bool IsAttributeEntityValid(const FLayeredAttributeEntityHandle& Entity) const { return Store.IsValid(Entity); }
+
+	UFUNCTION(BlueprintCallable, Category = Attributes)
+	void SetEntityBaseAttribute(const FLayeredAttributeEntityHandle& Entity, EAttributeKey Key, int32 Value);
+
+	/// <returns>The base value of Key on Entity, modified by all of its active layered effects. 0 if Entity is invalid.</returns>
+	UFUNCTION(BlueprintPure, Category = Attributes)
+	int32 GetEntityCurrentAttribute(const FLayeredAttributeEntityHandle& Entity, EAttributeKey Key) const;
+
+	/// <summary>
+	/// See ILayeredAttributes::AddLayeredEffect(...).
+	/// </summary>
+	UFUNCTION(BlueprintCallable, Category = Attributes)
+	FActiveEffectHandle AddEntityLayeredEffect(const FLayeredAttributeEntityHandle& Entity, const FLayeredEffectDefinition& Effect, bool& bSuccess);
+
+	UFUNCTION(BlueprintCallable, Category = Attributes)
+	bool RemoveEntityLayeredEffect(const FLayeredAttributeEntityHandle& Entity, const FActiveEffectHandle& Handle);
+
+	/// <summary>
+	/// Removes every layered effect applied to any attribute of Entity.
+	/// </summary>
+	UFUNCTION(BlueprintCallable, Category = Attributes)
+	void ClearEntityLayeredEffects(const FLayeredAttributeEntityHandle& Entity);
+
+	/// <summary>
+	/// Removes Handle from Target once Expiry is reached, counting from now.
+	/// See ILayeredAttributes::AddExpiringLayeredEffect(...).
+	/// </summary>
+	void ScheduleEffectExpiry(const FLayeredAttributeCommandTarget& Target, const FActiveEffectHandle& Handle, const FLayeredEffectExpiry& Expiry);
+
+	/// <summary>
+	/// Removes every effect that expires at the end of Scope (e.g. "Turn") right away.
+	/// Listeners hear about each object's removals together, once per changed attribute.
+	/// </summary>
+	UFUNCTION(BlueprintCallable, Category = Attributes)
+	void EndExpiryScope(FName Scope);
+
+	/// <summary>
+	/// Removes every effect whose duration ran out by the current world time. Runs every tick, after queued commands.
+	/// </summary>
+	void ExpireEffects();
+
+	/// <summary>
+	/// Re-evaluates every stale attribute in the world in parallel. Runs every tick before notifications are flushed,
+	/// so bulk readers of FLayeredAttributeStore::GetCurrentValueColumn(...) should call this first if they run earlier.
+	/// </summary>
+	void RecomputeAttributes() { Store.RecomputeDirtyValues(); }
+
+	/// <summary>
+	/// Applies Effect to every attribute entity and block using this subsystem's shared effects that matches Filter,
+	/// in their usual layer/sequence order. See FSharedEffectRegistry.
+	/// Registered targets whose value changes broadcast it like any other change (see RegisterSharedEffectTarget(...)).
+	/// </summary>
+	UFUNCTION(BlueprintCallable, Category = Attributes)
+	FActiveEffectHandle AddSharedLayeredEffect(const FLayeredEffectDefinition& Effect, const FSharedEffectTargetFilter& Filter, bool& bSuccess);
+
+	/// <summary>
+	/// Removes a shared effect, broadcasting to registered targets like AddSharedLayeredEffect(...).
+	/// </summary>
+	UFUNCTION(BlueprintCallable, Category = Attributes)
+	bool RemoveSharedLayeredEffect(const FActiveEffectHandle& Handle);
+
+	FSharedEffectRegistry& GetSharedEffects() { return SharedEffects; }
+
+	/// <summary>
+	/// Commands that any thread can enqueue to change attributes in this world.
+	/// Fetch it on the game thread and hand the reference to jobs; it lives as long as the world.
+	/// </summary>
+	FLayeredAttributeCommandQueue& GetCommandQueue() { return CommandQueue; }
+
+	/// <summary>
+	/// Applies every command queued so far. Runs at the start of every tick, before attributes are recomputed.
+	/// </summary>
+	/// <returns>Number of commands applied or dropped.</returns>
+	int32 ExecuteQueuedCommands() { return CommandQueue.Execute(*this); }
+
+	/// <summary>
+	/// Undo log for every object in this world that attaches to it (see FLayeredAttributeBlock::SetTimeline(...)).
+	/// A checkpoint of the whole world is a Checkpoint() away.
+	/// </summary>
+	FLayeredAttributeTimeline& GetTimeline() { return Timeline; }
+
+	FLayeredAttributeStore& GetStore() { return Store; }
+	const FLayeredAttributeStore& GetStore() const { return Store; }
+
+	// "UTickableWorldSubsystem" interface methods
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+
+private:
+
+	/// <summary>
+	/// Owners with pending attribute changes, in the order they first changed.
+	/// </summary>
+	TArray<TWeakObjectPtr<UObject>> QueuedOwners;
+
+	/// <summary>
+	/// Attributes of every entity in this world, stored as structure-of-arrays.
+	/// </summary>
+	FLayeredAttributeStore Store;
+
+	/// <summary>
+	/// Owners with snapshot readers, republished every frame.
+	/// </summary>
+	TArray<TWeakObjectPtr<UObject>> SnapshotOwners;
+
+	/// <summary>
+	/// Owners that shared effects apply to. See RegisterSharedEffectTarget(...).
+	/// </summary>
+	TSet<TWeakObjectPtr<UObject>> SharedEffectTargets;
+
+	/// <summary>
+	/// SharedEffectTargets that had listeners when last checked, the only ones visited when a shared effect changes.
+	/// </summary>
+	TSet<TWeakObjectPtr<UObject>> ListenedSharedEffectTargets;
+
+	/// <summary>
+	/// Rebuilds ListenedSharedEffectTargets, dropping targets that are gone or stopped listening. Called every tick.
+	/// </summary>
+	void RefreshSharedEffectListeners();
+
+	/// <summary>
+	/// A registered target that a shared effect change may affect, with what BeginAttributeChange(...) returned for it.
+	/// </summary>
+	using FSharedEffectTargetChange = TPair<ILayeredAttributes*, TOptional<int32>>;
+
+	/// <summary>
+	/// Starts an attribute change on Key of every listened target that uses SharedEffects and matches Filter.
+	/// Call right before adding or removing a shared effect on Key.
+	/// </summary>
+	void BeginSharedEffectChange(EAttributeKey Key, const FSharedEffectTargetFilter& Filter, TArray<FSharedEffectTargetChange>& OutTargets);
+
+	/// <summary>
+	/// Broadcasts the changes started by BeginSharedEffectChange(...) and republishes the targets' snapshots.
+	/// </summary>
+	void EndSharedEffectChange(EAttributeKey Key, const TArray<FSharedEffectTargetChange>& Targets);
+
+	/// <summary>
+	/// Effects applied by reference to every matching entity in Store, and to blocks that opt in.
+	/// </summary>
+	FSharedEffectRegistry SharedEffects;
+
+	FLayeredAttributeCommandQueue CommandQueue;
+
+	FLayeredEffectExpiryScheduler ExpiryScheduler;
+
+	FLayeredAttributeTimeline Timeline;
+
+	/// <summary>
+	/// Removes Expired from their targets, one transaction per object. Empties Expired.
+	/// </summary>
+	void RemoveExpiredEffects(TArray<FExpiredLayeredEffect>& Expired);
+
+	/// <summary>
+	/// Scratch space for ExpireEffects(), kept to avoid reallocating every tick.
+	/// </summary>
+	TArray<FExpiredLayeredEffect> ExpiredEffects;
+};
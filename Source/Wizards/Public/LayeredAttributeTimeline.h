@@ -0,0 +1,203 @@
+// Copyright 2023 John McElmurray (johnmcelmurray.com). All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include "LayeredEffectDefinition.h"
+
+class FLayeredAttributeTimeline;
+class ILayeredAttributes;
+struct FLayeredAttributeBlock;
+
+/// <summary>
+/// Point in a FLayeredAttributeTimeline that it can be rolled back to.
+/// </summary>
+struct FLayeredAttributeCheckpoint
+{
+	bool IsSet() const { return Position != INDEX_NONE; }
+
+private:
+
+	friend class FLayeredAttributeTimeline;
+
+	/// <summary>
+	/// Number of changes recorded before this checkpoint, since the timeline was created.
+	/// </summary>
+	int64 Position = INDEX_NONE;
+
+	/// <summary>
+	/// Serial of the last change before this checkpoint, so the checkpoint is known to be stale
+	/// once that change was rolled back (and the position reused).
+	/// </summary>
+	uint64 Serial = 0;
+};
+
+
+/// <summary>
+/// Ties a FLayeredAttributeBlock to the timeline recording its changes. Copies start out detached,
+/// so copying a block never records into (or detaches) the original's timeline.
+/// </summary>
+struct WIZARDS_API FLayeredAttributeTimelineBinding
+{
+	FLayeredAttributeTimelineBinding() = default;
+	FLayeredAttributeTimelineBinding(const FLayeredAttributeTimelineBinding&) { }
+	FLayeredAttributeTimelineBinding& operator=(const FLayeredAttributeTimelineBinding&) { return *this; }
+	~FLayeredAttributeTimelineBinding();
+
+	FLayeredAttributeTimeline* Timeline = nullptr;
+
+	/// <summary>
+	/// Index of the bound block in the timeline.
+	/// </summary>
+	int32 Participant = INDEX_NONE;
+};
+
+
+/// <summary>
+/// Undo log of attribute changes for any number of blocks (e.g. every object in a world), for rewinding rules
+/// and replay timelines. Rather than copying state, every change made to an attached block while the timeline
+/// records is logged with what it takes to undo it: the old base value, the handle of an added effect, or
+/// the removed effect itself.
+/// Taking a checkpoint is O(1), rolling back is O(changes since the checkpoint), and nothing is logged
+/// until the first checkpoint is taken.
+///
+/// Handles of removed effects are only released once no checkpoint can bring them back (see Forget(...)),
+/// so restored effects keep their original handles.
+/// Only changes made through attached blocks are logged: shared effects, entities changed directly in a
+/// FLayeredAttributeStore, and blocks that were destroyed or detached in the meantime are not rolled back.
+/// </summary>
+class WIZARDS_API FLayeredAttributeTimeline : public FNoncopyable
+{
+public:
+
+	~FLayeredAttributeTimeline();
+
+	/// <summary>
+	/// Marks the current state of every attached block, and starts recording if not already.
+	/// </summary>
+	FLayeredAttributeCheckpoint Checkpoint();
+
+	/// <returns>True if Checkpoint can still be rolled back to (it wasn't forgotten, or rolled back past).</returns>
+	bool IsValid(const FLayeredAttributeCheckpoint& Checkpoint) const;
+
+	/// <summary>
+	/// Undoes every change recorded since Checkpoint, newest first. Owners broadcast once per attribute
+	/// that ended somewhere new. Checkpoints taken after Checkpoint become invalid; Checkpoint itself stays valid.
+	/// Attached blocks must not be in a transaction.
+	/// </summary>
+	/// <returns>False if Checkpoint isn't valid.</returns>
+	bool Rollback(const FLayeredAttributeCheckpoint& Checkpoint);
+
+	/// <summary>
+	/// Drops the changes recorded before Oldest, which is the oldest checkpoint still needed,
+	/// and releases the handles of effects they removed for good.
+	/// </summary>
+	void Forget(const FLayeredAttributeCheckpoint& Oldest);
+
+	/// <summary>
+	/// Forgets every change and checkpoint, and stops recording until the next checkpoint.
+	/// </summary>
+	void Reset();
+
+	/// <returns>True while changes to attached blocks are logged.</returns>
+	bool IsRecording() const { return bRecording && !bRollingBack; }
+
+	int32 NumChanges() const { return Changes.Num(); }
+
+private:
+
+	friend struct FLayeredAttributeBlock;
+	friend struct FLayeredAttributeTimelineBinding;
+
+	enum class EChangeType : uint8
+	{
+		BaseValue,
+		AddedEffect,
+		RemovedEffect,
+		AttributeState,
+		ReleasedHandle,
+	};
+
+	struct FChange
+	{
+		EChangeType Type = EChangeType::BaseValue;
+		bool bOwnsHandle = false;
+		EAttributeKey Key = EAttributeKey::Invalid;
+		int32 Participant = INDEX_NONE;
+		int32 OldBaseValue = 0;
+		uint64 Serial = 0;
+
+		/// <summary>
+		/// Handle of the added effect (AddedEffect) or of the effect whose release is held back (ReleasedHandle).
+		/// </summary>
+		FActiveEffectHandle Handle;
+
+		/// <summary>
+		/// The whole removed effect (RemovedEffect).
+		/// </summary>
+		FActiveEffectDefinition Effect;
+
+		/// <summary>
+		/// Effects of Key before they were overwritten (AttributeState), which is rare enough to pay for a copy.
+		/// </summary>
+		TUniquePtr<FSortedEffectDefinitions> OldEffects;
+	};
+
+	struct FParticipant
+	{
+		FLayeredAttributeBlock* Block = nullptr;
+
+		/// <summary>
+		/// Broadcasts the changes made by rolling back, if set.
+		/// </summary>
+		ILayeredAttributes* Owner = nullptr;
+
+		/// <summary>
+		/// Number of Changes referring to this participant. Once detached, the slot is only reused when this reaches 0.
+		/// </summary>
+		int32 NumChanges = 0;
+	};
+
+	// Called by the attached blocks
+	void Attach(FLayeredAttributeBlock& Block, FLayeredAttributeTimelineBinding& Binding, ILayeredAttributes* Owner);
+	void Detach(FLayeredAttributeTimelineBinding& Binding);
+	void RecordBaseValue(int32 Participant, EAttributeKey Key, int32 OldBaseValue);
+	void RecordAddedEffect(int32 Participant, const FActiveEffectHandle& InHandle, bool bOwnsHandle);
+	void RecordRemovedEffect(int32 Participant, const FActiveEffectDefinition& Effect);
+	void RecordAttributeState(int32 Participant, EAttributeKey Key, int32 OldBaseValue, const FSortedEffectDefinitions& OldEffects);
+	void RecordReleasedHandle(const FActiveEffectHandle& InHandle);
+
+	FChange& AddChange(EChangeType Type, int32 Participant, EAttributeKey Key);
+
+	/// <summary>
+	/// Drops a reference from a forgotten or undone change to Participant, freeing its slot if it was the last one of a detached block.
+	/// </summary>
+	void ReleaseParticipant(int32 Participant);
+
+	/// <returns>Serial of the last change before Position.</returns>
+	uint64 GetSerialBefore(int64 Position) const;
+
+	/// <summary>
+	/// Changes since the oldest checkpoint still needed, oldest first.
+	/// </summary>
+	TArray<FChange> Changes;
+
+	/// <summary>
+	/// Number of changes forgotten from the front of Changes.
+	/// </summary>
+	int64 FirstPosition = 0;
+
+	/// <summary>
+	/// Serial of the last forgotten change.
+	/// </summary>
+	uint64 FirstSerial = 0;
+
+	uint64 NextSerial = 1;
+
+	TArray<FParticipant> Participants;
+	TArray<int32> FreeParticipants;
+
+	bool bRecording = false;
+	bool bRollingBack = false;
+};
@@ -0,0 +1,90 @@
+// Copyright 2023 John McElmurray (johnmcelmurray.com). All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include "LayeredEffectDefinition.h"
+
+namespace EEffectOperationUtils
+{
+	/// <summary>
+	/// Applies Operation to every value in place, using the matching entry of Modifications as the right hand operand.
+	/// Equivalent to calling Evaluate(...) per value, but runs 16 values per iteration through vector registers.
+	/// </summary>
+	WIZARDS_API void EvaluateRun(EEffectOperation Operation, TArrayView<int32> Values, TConstArrayView<int32> Modifications);
+
+	/// <summary>
+	/// Finds the modification for which Operation leaves every value unchanged.
+	/// </summary>
+	/// <returns>False for operations without one (EEffectOperation::Set).</returns>
+	WIZARDS_API bool GetIdentityModification(EEffectOperation Operation, int32& OutModification);
+}
+
+
+/// <summary>
+/// Evaluates the effect stacks of many attributes in lockstep instead of one effect at a time.
+/// Each lane is one attribute of one object: its base value, then the operation and modification of each
+/// of its effects in application order. Steps are stored step-major, so step N of every lane is contiguous,
+/// and consecutive lanes applying the same operation at a step are evaluated as one vectorized run.
+/// Lanes with the same effects (e.g. every creature under the same "+1/+1" effect) therefore cost
+/// one kernel call per step rather than one switch per effect per object.
+/// </summary>
+class WIZARDS_API FLayeredEffectBatch
+{
+public:
+
+	/// <summary>
+	/// Removes every lane, keeping allocations for the next batch.
+	/// </summary>
+	void Reset();
+
+	/// <summary>
+	/// Adds a lane evaluating every active effect of Effects on top of BaseValue.
+	/// </summary>
+	/// <returns>Lane index, for GetResult(...).</returns>
+	int32 AddLane(int32 BaseValue, const FSortedEffectDefinitions& Effects);
+
+	int32 Num() const { return Values.Num(); }
+
+	/// <summary>
+	/// Runs every step of every lane. Lanes with fewer steps than others are padded with no-op steps.
+	/// </summary>
+	void Evaluate();
+
+	/// <returns>Value of Lane. Only its final value after Evaluate().</returns>
+	int32 GetResult(int32 Lane) const { return Values[Lane]; }
+
+private:
+
+	/// <summary>
+	/// Appends a step to Lane, which must be the most recently added lane.
+	/// </summary>
+	void AddStep(int32 Lane, int32 Step, EEffectOperation Operation, int32 Modification);
+
+	/// <summary>
+	/// Pads Step with no-op steps up to NumLanes. Padding repeats the previous lane's operation where it
+	/// has an identity, so it doesn't split that lane's run.
+	/// </summary>
+	void PadStep(int32 Step, int32 NumLanes);
+
+	/// <summary>
+	/// Value of each lane. The base value until Evaluate() is called, then the result.
+	/// </summary>
+	TArray<int32> Values;
+
+	/// <summary>
+	/// Operation of each lane, one array per step. Only the first NumSteps arrays are in use.
+	/// </summary>
+	TArray<TArray<EEffectOperation>> StepOperations;
+
+	/// <summary>
+	/// Modification of each lane, one array per step, parallel to StepOperations.
+	/// </summary>
+	TArray<TArray<int32>> StepModifications;
+
+	/// <summary>
+	/// Length of the longest lane.
+	/// </summary>
+	int32 NumSteps = 0;
+};
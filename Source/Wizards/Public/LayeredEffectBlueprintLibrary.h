@@ -0,0 +1,185 @@
+// Copyright 2023 John McElmurray (johnmcelmurray.com). All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Kismet/BlueprintFunctionLibrary.h"
+
+#include "LayeredEffectDefinition.h"
+
+#include "LayeredEffectBlueprintLibrary.generated.h"
+
+/// <summary>
+/// Exposing helper methods for layered effects to blueprint.
+/// </summary>
+UCLASS()
+class WIZARDS_API ULayeredEffectBlueprintLibrary : public UBlueprintFunctionLibrary
+{
+	GENERATED_BODY()
+
+public:
+
+	UFUNCTION(BlueprintPure, Category = "LayeredEffectDefinition")
+	static bool IsValid(const FLayeredEffectDefinition& Effect) { return Effect.IsValid(); }
+
+	UFUNCTION(BlueprintPure, meta = (CompactNodeTitle = "->", BlueprintAutocast), Category = "LayeredEffectDefinition")
+	static FString ToString(const FLayeredEffectDefinition& Effect) { return Effect.ToString(); }
+
+	UFUNCTION(BlueprintPure, meta = (DisplayName = "ToColor (int)", CompactNodeTitle = "->", BlueprintAutocast), Category = "Utilities|Attributes")
+	static FColor Conv_IntToColor(int32 Value);
+
+	UFUNCTION(BlueprintPure, meta = (DisplayName = "ToInt (color)", CompactNodeTitle = "->", BlueprintAutocast), Category = "Utilities|Attributes")
+	static int32 Conv_ColorToInt(FColor Value);
+};
+
+
+/// <summary>
+/// Exposing enum helper methods to C++.
+/// </summary>
+UCLASS()
+class WIZARDS_API UEnumLibrary : public UBlueprintFunctionLibrary
+{
+	GENERATED_BODY()
+
+public:
+
+	/**
+	 * Converts an enum value to an FName.
+	 *
+	 * E.g., for
+	 * UStaticLibrary::GetEnumValueAsString(EMyEnum::OptionA),
+	 * this will return "EMyEnum::OptionA".
+	 *
+	 * @tparam TEnum Type of the enum (e.g., <ENetRole>).
+	 * @param Value Enum value to convert to an FName.
+	 * @returns The enum value as an FName.
+	 */
+	template <typename TEnum>
+	static FORCEINLINE FName GetEnumValueAsName(TEnum Value)
+	{
+		FName AsName = NAME_None;
+		UEnum::GetValueAsName(Value, AsName);
+		return AsName;
+	}
+
+	/**
+	 * Converts an enum value to an FString.
+	 *
+	 * E.g., for
+	 * UStaticLibrary::GetEnumValueAsString(EMyEnum::OptionA),
+	 * this will return "EMyEnum::OptionA".
+	 *
+	 * @tparam TEnum Type of the enum (e.g., <ENetRole>).
+	 * @param Value Enum value to convert to an FString.
+	 * @returns The enum value as an FString.
+	 */
+	template <typename TEnum>
+	static FORCEINLINE FString GetEnumValueAsString(TEnum Value)
+	{
+		return GetEnumValueAsName(Value).ToString();
+	}
+
+	/**
+	 * Converts an enum value's name to a string (no namespace).
+	 *
+	 * E.g., for
+	 * UStaticLibrary::GetEnumValueShortAsString(EMyEnum::OptionA),
+	 * this will return "OptionA".
+	 *
+	 * @tparam TEnum Type of the enum (e.g., <ENetRole>).
+	 * @param Value Enum value to convert to a string.
+	 * @returns The enum value's name as string.
+	 */
+	template <typename TEnum>
+	static FORCEINLINE FString GetEnumValueShortAsString(TEnum Value)
+	{
+		FString AsString;
+		GetEnumValueAsString(Value).Split("::", nullptr, &AsString, ESearchCase::IgnoreCase, ESearchDir::FromStart);
+		return AsString;
+	}
+
+	/**
+	 * Gets the enum pointer from the templated argument.
+	 *
+	 * @tparam TEnum Type of the enum (e.g., <ENetRole>).
+	 * @returns	UEnum* Pointer to enum class.
+	 */
+	template <typename TEnum>
+	static FORCEINLINE UEnum* GetEnumPtr()
+	{
+		static_assert(TIsEnum<TEnum>::Value, "Should only call this with enum types");
+		UEnum* EnumClass = StaticEnum<TEnum>();
+		check(EnumClass != nullptr);
+		return EnumClass;
+	}
+
+	/**
+	 * Gets the number of enum names in TEnum.
+	 * Includes autogenerated _MAX entry.
+	 *
+	 * E.g., for
+	 * UENUM(BlueprintType)
+	 * enum class EMyEnum : uint8
+	 * {
+	 *     OptionA                                          = 0,
+	 *     OptionB                                          = 1,
+	 *     OptionC                                          = 4,
+	 * };
+	 * UEnumLibrary::GetEnumNumEntries<EMyEnum>(true),
+	 * this will return "4" (OptionA, OptionB, OptionC, and autogenerated _MAX entry).
+	 * UEnumLibrary::GetEnumNumEntries<EMyEnum>(false),
+	 * will return "3" (excludes the autogenerated MAX)
+	 *
+	 * @tparam TEnum Type of the enum (e.g., <ENetRole>).
+	 * @param bIncludeMax Whether the autogenerated _MAX entry should be included.
+	 * @returns How many entries are in this enum.
+	 */
+	template <typename TEnum>
+	static FORCEINLINE int32 GetEnumNumEntries(bool bIncludeMax = false)
+	{
+		return GetEnumNumEntries(GetEnumPtr<TEnum>());
+	}
+	static FORCEINLINE int32 GetEnumNumEntries(const UEnum* EnumClass, bool bIncludeMax = false)
+	{
+		if (EnumClass == nullptr)
+		{
+			return INDEX_NONE;
+		}
+
+		int32 NumEnums = EnumClass->NumEnums();
+
+		if (!bIncludeMax && EnumClass->ContainsExistingMax())
+		{
+			NumEnums--;
+		}
+
+		return NumEnums;
+	}
+
+	/**
+	 * Retrieve the values within an enum as an iterable array.
+	 *
+	 * @tparam	TEnum Type of the enum (e.g., <EMyEnum>).
+	 * @param	StartingValue (inclusive) Only enum values greater or equal to this one will be included.
+	 * @param	bIncludeMax Whether the autogenerated _MAX entry should be included.
+	 * @returns	All of the requested enum values.
+	 */
+	template <typename TEnum>
+	static TArray<TEnum> GetEnumEntries(TEnum StartingValue = (TEnum)0, bool bIncludeMax = false)
+	{
+		TArray<TEnum> EnumEntries;
+
+		const UEnum* EnumPtr = GetEnumPtr<TEnum>();
+		const int32 EnumNumEntries = UEnumLibrary::GetEnumNumEntries<TEnum>(bIncludeMax);
+		for (uint8 i = 0; i < EnumNumEntries; i++)
+		{
+			TEnum CurEnumValue = (TEnum)EnumPtr->GetValueByIndex(i);
+			if (CurEnumValue >= StartingValue)
+			{
+				EnumEntries.Add(CurEnumValue);
+			}
+		}
+
+		return EnumEntries;
+	}
+};
@@ -4,12 +4,9 @@
 
 #include "CoreMinimal.h"
 #include "UObject/NoExportTypes.h"
-#include "Kismet/BlueprintFunctionLibrary.h"
 
 #include "LayeredEffectDefinition.generated.h"
 
-class ILayeredAttributes;
-
 DECLARE_LOG_CATEGORY_EXTERN(LogLayeredEffects, Warning, All);
 
 UENUM(BlueprintType)
@@ -27,6 +24,41 @@ enum class EAttributeKey : uint8
 	Mana,
 	Controller,
 };
+namespace EAttributeKeyUtils
+{
+	/// <summary>
+	/// Number of EAttributeKey values (including Invalid), so that a key can index a fixed-size array directly.
+	/// Keep in sync with the last entry of EAttributeKey.
+	/// </summary>
+	constexpr int32 Num = static_cast<int32>(EAttributeKey::Controller) + 1;
+
+	inline int32 ToIndex(EAttributeKey Key)
+	{
+		return static_cast<int32>(Key);
+	}
+
+	inline bool IsInRange(EAttributeKey Key)
+	{
+		return ToIndex(Key) < Num;
+	}
+
+	/// <summary>
+	/// True for keys that name an actual attribute: in range and not Invalid.
+	/// Check this before trusting keys from Blueprints or the network.
+	/// </summary>
+	inline bool IsValid(EAttributeKey Key)
+	{
+		return (Key != EAttributeKey::Invalid && IsInRange(Key));
+	}
+
+	/// <summary>
+	/// Single-bit mask for Key, for APIs that take a set of attributes.
+	/// </summary>
+	inline uint32 ToMask(EAttributeKey Key)
+	{
+		return (1u << ToIndex(Key));
+	}
+}
 
 
 UENUM(BlueprintType)
@@ -132,58 +164,6 @@ namespace EEffectOperationUtils
 }
 
 
-/// <summary>
-/// Temporary parameter struct used when an attribute has changed.
-/// The Owner should create this struct any time an attribute is being modified,
-/// so that attribute changes can be detected and broadcast to UI/etc.
-/// </summary>
-USTRUCT(BlueprintType)
-struct WIZARDS_API FOnAttributeChangedData
-{
-	GENERATED_BODY()
-
-public:
-
-	FOnAttributeChangedData() = default;
-
-	FOnAttributeChangedData(
-		UObject* InOwner,
-		EAttributeKey InAttribute,
-		int32 InOldValue);
-
-	bool IsValid() const;
-
-	ILayeredAttributes* GetOwner() const;
-
-
-private:
-
-	/// <summary>
-	/// Who owns this attribute.
-	/// </summary>
-	UPROPERTY(EditAnywhere, BlueprintReadOnly, meta = (AllowPrivateAccess = "true"))
-	UObject* Owner = nullptr;
-
-	/// <summary>
-	/// Which attribute was affected.
-	/// </summary>
-	UPROPERTY(EditAnywhere, BlueprintReadOnly, meta = (AllowPrivateAccess = "true"))
-	EAttributeKey Attribute = EAttributeKey::Invalid;
-
-	/// <summary>
-	/// New/current value for the attribute.
-	/// </summary>
-	UPROPERTY(EditAnywhere, BlueprintReadOnly, meta = (AllowPrivateAccess = "true"))
-	int32 NewValue = 0;
-
-	/// <summary>
-	/// Old/previous value for the attribute.
-	/// </summary>
-	UPROPERTY(EditAnywhere, BlueprintReadOnly, meta = (AllowPrivateAccess = "true"))
-	int32 OldValue = 0;
-};
-
-
 /// <summary>
 /// Parameter struct for AddLayeredEffect(...)
 /// </summary>
@@ -213,7 +193,7 @@ public:
 
 	bool IsValid() const
 	{
-		return (GetAttribute() != EAttributeKey::Invalid
+		return (EAttributeKeyUtils::IsValid(GetAttribute())
 			&& GetOperation() != EEffectOperation::Invalid);
 	}
 
@@ -257,6 +237,11 @@ private:
 /// This handle is required for referring to a specific active FActiveEffectDefinition.
 /// For example if a skill needs to create an active effect and then destroy that specific effect that it created,
 /// it has to do so through a handle; a pointer or index into the active list is not sufficient.
+/// Handles are generational slots (see FActiveEffectHandleAllocator), so they can be created from any thread,
+/// and a handle to a removed effect never matches a later effect that reuses its slot.
+/// Whoever removes an effect for good releases its handle: the owning object, the attribute subsystem,
+/// or the shared effect registry. A bare FSortedEffectDefinitions never releases handles, since
+/// copies of it (e.g. transaction snapshots) share them.
 /// </summary>
 USTRUCT(BlueprintType)
 struct WIZARDS_API FActiveEffectHandle
@@ -265,46 +250,58 @@ struct WIZARDS_API FActiveEffectHandle
 
 	FActiveEffectHandle() = default;
 
-	FActiveEffectHandle(int32 InHandle, EAttributeKey InAttribute)
-		: Handle(InHandle)
+	FActiveEffectHandle(int32 InIndex, uint32 InGeneration, EAttributeKey InAttribute)
+		: Index(InIndex)
+		, Generation(InGeneration)
 		, Attribute(InAttribute)
 	{ }
 
 	static const FActiveEffectHandle kInvalid;
 
 	/// <summary>
-	/// Creates a new handle, will be set to successfully applied.
+	/// Creates a new handle, will be set to successfully applied. Safe to call from any thread.
 	/// </summary>
 	static FActiveEffectHandle GenerateNewHandle(EAttributeKey Attribute);
 
+	/// <summary>
+	/// Frees InHandle's slot for reuse. Releasing the same handle again does nothing. Safe to call from any thread.
+	/// </summary>
+	static void Release(const FActiveEffectHandle& InHandle);
+
 	/// <summary>
 	/// True if this is tracking an active ongoing effect.
 	/// </summary>
 	bool IsValid() const
 	{
-		return Handle != INDEX_NONE;
+		return Index != INDEX_NONE;
 	}
 
+	/// <summary>
+	/// True if this handle was generated and hasn't been released since. O(1) and safe to call from any thread.
+	/// </summary>
+	bool IsLive() const;
+
 	FString ToString() const
 	{
-		return FString::Printf(TEXT("%d"), Handle);
+		return FString::Printf(TEXT("%d.%u"), Index, Generation);
 	}
 
 	bool Equals(const FActiveEffectHandle& Other) const
 	{
-		return Handle == Other.Handle;
+		return Index == Other.Index && Generation == Other.Generation;
 	}
 	bool operator==(const FActiveEffectHandle& Other) const { return Equals(Other); }
 	bool operator!=(const FActiveEffectHandle& Other) const { return !Equals(Other); }
 
 	friend uint32 GetTypeHash(const FActiveEffectHandle& InHandle)
 	{
-		return InHandle.Handle;
+		return HashCombine(::GetTypeHash(InHandle.Index), ::GetTypeHash(InHandle.Generation));
 	}
 
 	void Invalidate()
 	{
-		Handle = INDEX_NONE;
+		Index = INDEX_NONE;
+		Generation = 0;
 		Attribute = EAttributeKey::Invalid;
 	}
 
@@ -313,10 +310,16 @@ struct WIZARDS_API FActiveEffectHandle
 private:
 
 	/// <summary>
-	/// Unique ID for this effect.
+	/// Slot of this effect in FActiveEffectHandleAllocator.
+	/// </summary>
+	UPROPERTY()
+	int32 Index = INDEX_NONE;
+
+	/// <summary>
+	/// Generation of the slot when this handle was created. Tells this effect apart from later ones reusing the slot.
 	/// </summary>
 	UPROPERTY()
-	int32 Handle = INDEX_NONE;
+	uint32 Generation = 0;
 
 	/// <summary>
 	/// Which attribute this effect modifies (for faster lookup on Owner).
@@ -338,47 +341,79 @@ public:
 
 	FActiveEffectDefinition() = default;
 
-	FActiveEffectDefinition(const UWorld* World, const FLayeredEffectDefinition& InDef)
+	/// <summary>
+	/// Activates InDef now: generates its handle and stamps it with the next application sequence.
+	/// Safe to call from any thread.
+	/// </summary>
+	explicit FActiveEffectDefinition(const FLayeredEffectDefinition& InDef)
+		: Handle(FActiveEffectHandle::GenerateNewHandle(InDef.GetAttribute()))
+		, Sequence(GenerateSequence())
+		, Def(InDef)
+	{ }
+
+	/// <summary>
+	/// Activates InDef with a sequence from elsewhere (e.g. a saved game), generating a new handle.
+	/// Call ReserveSequence(...) first, so effects added afterwards still order after it.
+	/// </summary>
+	FActiveEffectDefinition(const FLayeredEffectDefinition& InDef, int64 InSequence)
 		: Handle(FActiveEffectHandle::GenerateNewHandle(InDef.GetAttribute()))
-		, StartServerWorldTime(World == nullptr ? -1.f : World->GetTimeSeconds())
+		, Sequence(InSequence)
 		, Def(InDef)
 	{ }
 
+	/// <summary>
+	/// Next value of the process-wide application sequence. Strictly increasing across all threads, starting at 1.
+	/// </summary>
+	static int64 GenerateSequence();
+
+	/// <summary>
+	/// Makes every later GenerateSequence() return more than Sequence.
+	/// </summary>
+	static void ReserveSequence(int64 Sequence);
+
 	bool IsValid() const
 	{
 		return (Handle.IsValid()
-			&& StartServerWorldTime >= 0.f
+			&& Sequence > 0
 			&& Def.IsValid());
 	}
 
 	FString ToString() const
 	{
-		return FString::Printf(TEXT("%s %.2f %s"),
+		return FString::Printf(TEXT("%s #%lld %s"),
 			*Handle.ToString(),
-			StartServerWorldTime,
+			Sequence,
 			*Def.ToString());
 	}
 
 	const FActiveEffectHandle& GetHandle() const { return Handle; }
 
-	float GetStartTime() const { return StartServerWorldTime; }
+	int64 GetSequence() const { return Sequence; }
 
 	const FLayeredEffectDefinition& GetEffectDefinition() const { return Def; }
 
+	/// <summary>
+	/// Turns this effect into a tombstone: it is no longer valid or applied,
+	/// but keeps its layer and sequence so the order it was stored in stays sorted.
+	/// </summary>
+	void Invalidate() { Handle.Invalidate(); }
+
 
 private:
 
 	/// <summary>
 	/// Globally unique ID for identify this active effect.
 	/// </summary>
-	UPROPERTY(EditAnywhere, BlueprintReadOnly, NotReplicated, meta = (AllowPrivateAccess = "true"))
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, meta = (AllowPrivateAccess = "true"))
 	FActiveEffectHandle Handle = FActiveEffectHandle::kInvalid;
 
 	/// <summary>
-	/// Server timestamp when this effect was applied (in seconds).
+	/// When this effect was applied, relative to every other effect (see GenerateSequence()).
+	/// Orders effects within a layer. Unlike world time it never loses precision, never ties,
+	/// and doesn't need a world, so stacks can be evaluated outside of one.
 	/// </summary>
 	UPROPERTY(EditAnywhere, BlueprintReadOnly, meta = (AllowPrivateAccess = "true"))
-	float StartServerWorldTime = 0.f;
+	int64 Sequence = 0;
 
 	/// <summary>
 	/// Effect definition. The static data that this spec points to.
@@ -389,226 +424,525 @@ private:
 
 
 /// <summary>
-/// Stores applied FLayeredEffectDefinition for a single attribute.
-/// All operations maintain an increasing sorted order by FLayeredEffectDefinition::Layer for faster layered attribute calculation.
+/// Which storage/evaluation strategy an FSortedEffectDefinitions uses.
+/// Selected once per stack when it is created (see "LayeredEffects.Backend").
+/// </summary>
+UENUM(BlueprintType)
+enum class ELayeredEffectBackend : uint8
+{
+	/// <summary>
+	/// Effects are kept in per-layer buckets and re-walked on every evaluation.
+	/// </summary>
+	LayerBuckets,
+
+	/// <summary>
+	/// Effects are kept in a balanced tree of composed transforms (see FComposedEffectTree).
+	/// </summary>
+	ComposedTree,
+};
+
+
+/// <summary>
+/// All active effects that share a single FLayeredEffectDefinition::Layer,
+/// kept in the order they are applied (timestamp order).
 /// </summary>
 USTRUCT(BlueprintType)
-struct WIZARDS_API FSortedEffectDefinitions
+struct WIZARDS_API FLayeredEffectBucket
 {
 	GENERATED_BODY()
 
 public:
 
+	FLayeredEffectBucket() = default;
+
+	explicit FLayeredEffectBucket(int32 InLayer)
+		: Layer(InLayer)
+	{ }
+
 	/// <summary>
-	/// Applies a new layered effect to this object's attributes.
+	/// Layer shared by every effect in this bucket.
 	/// </summary>
-	/// <param name="World">World that this effect is being applied it, so that we can track time of application.</param>
-	/// <param name="Effect">The new layered effect to apply.</param>
-	/// <returns>The handle to the newly applied effect, so that it can be removed later.</returns>
-	FActiveEffectHandle AddLayeredEffect(const UWorld* World, const FLayeredEffectDefinition& Effect);
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int32 Layer = 0;
 
 	/// <summary>
-	/// Removes an active layered effect.
+	/// Effects in this layer. New effects are appended, unless they were activated
+	/// before the last effect in the bucket.
 	/// </summary>
-	/// <param name="InHandle">Which active effect to remove.</param>
-	/// <returns>True if the effect was successfully removed.</returns>
-	bool RemoveLayeredEffect(const FActiveEffectHandle& InHandle);
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	TArray<FActiveEffectDefinition> Effects;
 
 	/// <summary>
-	/// Removes all layered effects from this object. After this call,
-	/// all current attributes will be equal to the base attributes.
+	/// How many entries of Effects are tombstones left behind by removals.
+	/// They are skipped during evaluation and compacted away once they outnumber live effects.
 	/// </summary>
-	/// <returns>True if any effect was successfully removed.</returns>
-	bool ClearLayeredEffects();
+	int32 NumTombstones = 0;
+
+	int32 NumLiveEffects() const { return Effects.Num() - NumTombstones; }
+};
+
+
+/// <summary>
+/// Closed-form composition of a run of effect operations.
+/// Set/Add/Subtract/Multiply compose as affine maps: (Value * A) + B.
+/// BitwiseOr/And/Xor compose as masks: (Value & A) ^ B.
+/// Arithmetic wraps at 32 bits, which matches evaluating the operations one by one.
+/// </summary>
+struct WIZARDS_API FComposedEffectTransform
+{
+	enum class EKind : uint8
+	{
+		/// <summary>
+		/// Leaves the value untouched.
+		/// </summary>
+		Identity,
+
+		/// <summary>
+		/// Discards the value and returns B (a Set somewhere in the run).
+		/// </summary>
+		Constant,
+
+		/// <summary>
+		/// Returns (Value * A) + B.
+		/// </summary>
+		Affine,
+
+		/// <summary>
+		/// Returns (Value & A) ^ B.
+		/// </summary>
+		Bitwise,
+
+		/// <summary>
+		/// Affine and bitwise operations interleave, so there's no closed form.
+		/// The run has to be evaluated piece by piece.
+		/// </summary>
+		Mixed,
+	};
 
 	/// <summary>
-	/// Modifies the BaseValue by all active layered effects.
+	/// Transform equivalent to applying a single effect operation.
 	/// </summary>
-	/// <param name="BaseValue">The base value for the attribute, as a starting point to calculate from.</param>
-	/// <returns>The current value of the attribute, accounting for all layered effects.</returns>
-	int32 GetCurrentValue(const int32 BaseValue) const;
+	static FComposedEffectTransform FromOperation(EEffectOperation Operation, int32 Modification);
 
-private:
+	/// <summary>
+	/// Transform equivalent to applying First, then Second.
+	/// </summary>
+	static FComposedEffectTransform Compose(const FComposedEffectTransform& First, const FComposedEffectTransform& Second);
 
 	/// <summary>
-	/// Sorted effects applied to an attribute.
+	/// True if Apply(...) can be used; Mixed transforms must be evaluated by their parts.
 	/// </summary>
-	UPROPERTY(EditAnywhere, BlueprintReadOnly, meta = (AllowPrivateAccess = "true"))
-	TArray<FActiveEffectDefinition> SortedEffects;
+	bool IsClosedForm() const { return Kind != EKind::Mixed; }
+
+	int32 Apply(int32 Value) const
+	{
+		checkSlow(IsClosedForm());
+		switch (Kind)
+		{
+			case EKind::Constant:
+				return static_cast<int32>(B);
+			case EKind::Affine:
+				return static_cast<int32>((static_cast<uint32>(Value) * A) + B);
+			case EKind::Bitwise:
+				return static_cast<int32>((static_cast<uint32>(Value) & A) ^ B);
+			default:
+				return Value;
+		}
+	}
+
+	EKind Kind = EKind::Identity;
+	uint32 A = 1;
+	uint32 B = 0;
 };
 
 
 /// <summary>
-/// Exposing helper methods for layered effects to blueprint.
+/// An effect stack compiled into a straight-line program of closed-form steps (see FComposedEffectTransform).
+/// Each run of operations that composes is folded into a single step, and a Set drops every step before it
+/// and folds everything after it into a constant. A new step is only needed where affine and bitwise
+/// operations interleave, so e.g. 500 adds, subtracts and multiplies evaluate as one multiply-add.
+/// Every step runs the same branch-free kernel: ((Value & Mask) * Multiplier + Addend) ^ Flip.
 /// </summary>
-UCLASS()
-class WIZARDS_API ULayeredEffectBlueprintLibrary : public UBlueprintFunctionLibrary
+struct WIZARDS_API FCompiledEffectProgram
 {
-	GENERATED_BODY()
+	struct FStep
+	{
+		uint32 Mask = MAX_uint32;
+		uint32 Multiplier = 1;
+		uint32 Addend = 0;
+		uint32 Flip = 0;
+	};
 
-public:
+	/// <summary>
+	/// Appends an operation, applied after every operation appended so far.
+	/// </summary>
+	void Append(EEffectOperation Operation, int32 Modification);
+
+	/// <summary>
+	/// Empties the program, so it returns the base value unchanged.
+	/// </summary>
+	void Reset();
+
+	int32 Evaluate(int32 BaseValue) const
+	{
+		uint32 Value = static_cast<uint32>(BaseValue);
+		for (const FStep& CurStep : Steps)
+		{
+			Value = (((Value & CurStep.Mask) * CurStep.Multiplier) + CurStep.Addend) ^ CurStep.Flip;
+		}
+		return static_cast<int32>(Value);
+	}
 
-	UFUNCTION(BlueprintPure, Category = "LayeredEffectDefinition")
-	static bool IsValid(const FLayeredEffectDefinition& Effect) { return Effect.IsValid(); }
+	int32 NumSteps() const { return Steps.Num(); }
 
-	UFUNCTION(BlueprintPure, meta = (CompactNodeTitle = "->", BlueprintAutocast), Category = "LayeredEffectDefinition")
-	static FString ToString(const FLayeredEffectDefinition& Effect) { return Effect.ToString(); }
+private:
 
-	UFUNCTION(BlueprintPure, meta = (DisplayName = "ToColor (int)", CompactNodeTitle = "->", BlueprintAutocast), Category = "Utilities|Attributes")
-	static FColor Conv_IntToColor(int32 Value);
+	/// <summary>
+	/// Straight-line steps, in order. Most stacks compile to one or two.
+	/// </summary>
+	TArray<FStep, TInlineAllocator<2>> Steps;
 
-	UFUNCTION(BlueprintPure, meta = (DisplayName = "ToInt (color)", CompactNodeTitle = "->", BlueprintAutocast), Category = "Utilities|Attributes")
-	static int32 Conv_ColorToInt(FColor Value);
+	/// <summary>
+	/// Transform the last step was made from, which new operations are folded into when they compose.
+	/// </summary>
+	FComposedEffectTransform LastTransform;
 };
 
 
 /// <summary>
-/// Exposing enum helper methods to C++.
+/// Alternative storage for the effects of a single attribute: a treap ordered by
+/// (Layer, Sequence), where every node caches the composed
+/// transform of its whole subtree.
+/// Inserting or removing an effect is O(log n), and evaluating the stack for a new
+/// base value is O(1) when the whole stack has a closed form. Stacks where affine and
+/// bitwise operations interleave fall back to evaluating the closed-form subtrees
+/// they are made of.
 /// </summary>
-UCLASS()
-class WIZARDS_API UEnumLibrary : public UBlueprintFunctionLibrary
+struct WIZARDS_API FComposedEffectTree
 {
-	GENERATED_BODY()
-
 public:
 
-	/**
-	 * Converts an enum value to an FName.
-	 *
-	 * E.g., for
-	 * UStaticLibrary::GetEnumValueAsString(EMyEnum::OptionA),
-	 * this will return "EMyEnum::OptionA".
-	 *
-	 * @tparam TEnum Type of the enum (e.g., <ENetRole>).
-	 * @param Value Enum value to convert to an FName.
-	 * @returns The enum value as an FName.
-	 */
-	template <typename TEnum>
-	static FORCEINLINE FName GetEnumValueAsName(TEnum Value)
+	/// <summary>
+	/// Inserts an already-created active effect in layer/sequence order.
+	/// </summary>
+	void Insert(const FActiveEffectDefinition& Effect);
+
+	/// <summary>
+	/// Removes the effect with the given handle.
+	/// </summary>
+	/// <returns>True if the effect was found and removed.</returns>
+	bool Remove(const FActiveEffectHandle& InHandle);
+
+	/// <summary>
+	/// Removes every effect.
+	/// </summary>
+	void Reset();
+
+	int32 Num() const { return HandleToNode.Num(); }
+
+	bool Contains(const FActiveEffectHandle& InHandle) const { return HandleToNode.Contains(InHandle); }
+
+	/// <returns>The effect with InHandle, or nullptr. Only valid until the tree changes.</returns>
+	const FActiveEffectDefinition* Find(const FActiveEffectHandle& InHandle) const
 	{
-		FName AsName = NAME_None;
-		UEnum::GetValueAsName(Value, AsName);
-		return AsName;
+		const int32* NodeIndex = HandleToNode.Find(InHandle);
+		return (NodeIndex != nullptr) ? &Nodes[*NodeIndex].Effect : nullptr;
 	}
 
-	/**
-	 * Converts an enum value to an FString.
-	 *
-	 * E.g., for
-	 * UStaticLibrary::GetEnumValueAsString(EMyEnum::OptionA),
-	 * this will return "EMyEnum::OptionA".
-	 *
-	 * @tparam TEnum Type of the enum (e.g., <ENetRole>).
-	 * @param Value Enum value to convert to an FString.
-	 * @returns The enum value as an FString.
-	 */
-	template <typename TEnum>
-	static FORCEINLINE FString GetEnumValueAsString(TEnum Value)
+	/// <summary>
+	/// Applies every effect in order to BaseValue.
+	/// </summary>
+	int32 Evaluate(const int32 BaseValue) const;
+
+	/// <summary>
+	/// Calls Visitor(const FActiveEffectDefinition&) for every effect, in application order.
+	/// </summary>
+	template <typename VisitorType>
+	void ForEachEffect(VisitorType&& Visitor) const
 	{
-		return GetEnumValueAsName(Value).ToString();
+		ForEachEffectInSubtree(Root, Visitor);
 	}
 
-	/**
-	 * Converts an enum value's name to a string (no namespace).
-	 *
-	 * E.g., for
-	 * UStaticLibrary::GetEnumValueShortAsString(EMyEnum::OptionA),
-	 * this will return "OptionA".
-	 *
-	 * @tparam TEnum Type of the enum (e.g., <ENetRole>).
-	 * @param Value Enum value to convert to a string.
-	 * @returns The enum value's name as string.
-	 */
-	template <typename TEnum>
-	static FORCEINLINE FString GetEnumValueShortAsString(TEnum Value)
+private:
+
+	struct FNode
 	{
-		FString AsString;
-		GetEnumValueAsString(Value).Split("::", nullptr, &AsString, ESearchCase::IgnoreCase, ESearchDir::FromStart);
-		return AsString;
-	}
+		FActiveEffectDefinition Effect;
+
+		/// <summary>
+		/// Heap priority keeping the tree balanced in expectation.
+		/// </summary>
+		uint32 Priority = 0;
+
+		int32 Left = INDEX_NONE;
+		int32 Right = INDEX_NONE;
+
+		/// <summary>
+		/// Transform of this node's own effect.
+		/// </summary>
+		FComposedEffectTransform Self;
+
+		/// <summary>
+		/// Transform of the whole subtree: Left, then Self, then Right.
+		/// </summary>
+		FComposedEffectTransform Composed;
+	};
 
-	/**
-	 * Gets the enum pointer from the templated argument.
-	 *
-	 * @tparam TEnum Type of the enum (e.g., <ENetRole>).
-	 * @returns	UEnum* Pointer to enum class.
-	 */
-	template <typename TEnum>
-	static FORCEINLINE UEnum* GetEnumPtr()
+	/// <summary>
+	/// True if node A is applied before node B.
+	/// </summary>
+	bool IsOrderedBefore(const FNode& A, const FNode& B) const;
+
+	const FComposedEffectTransform& GetComposed(int32 NodeIndex) const;
+	void UpdateComposed(int32 NodeIndex);
+
+	/// <summary>
+	/// Splits a subtree into nodes ordered before Pivot (OutLeft) and the rest (OutRight).
+	/// </summary>
+	void Split(int32 NodeIndex, const FNode& Pivot, int32& OutLeft, int32& OutRight);
+
+	/// <summary>
+	/// Joins two subtrees where every node of LeftIndex is ordered before every node of RightIndex.
+	/// </summary>
+	int32 Merge(int32 LeftIndex, int32 RightIndex);
+
+	/// <summary>
+	/// Removes NodeIndex from the subtree rooted at SubtreeIndex, returning the new subtree root.
+	/// </summary>
+	int32 Erase(int32 SubtreeIndex, int32 NodeIndex);
+
+	int32 EvaluateSubtree(int32 NodeIndex, int32 Value) const;
+
+	template <typename VisitorType>
+	void ForEachEffectInSubtree(int32 NodeIndex, VisitorType& Visitor) const
 	{
-		static_assert(TIsEnum<TEnum>::Value, "Should only call this with enum types");
-		UEnum* EnumClass = StaticEnum<TEnum>();
-		check(EnumClass != nullptr);
-		return EnumClass;
+		if (NodeIndex != INDEX_NONE)
+		{
+			const FNode& Node = Nodes[NodeIndex];
+			ForEachEffectInSubtree(Node.Left, Visitor);
+			Visitor(Node.Effect);
+			ForEachEffectInSubtree(Node.Right, Visitor);
+		}
 	}
 
-	/**
-	 * Gets the number of enum names in TEnum.
-	 * Includes autogenerated _MAX entry.
-	 *
-	 * E.g., for
-	 * UENUM(BlueprintType)
-	 * enum class EMyEnum : uint8
-	 * {
-	 *     OptionA                                          = 0,
-	 *     OptionB                                          = 1,
-	 *     OptionC                                          = 4,
-	 * };
-	 * UEnumLibrary::GetEnumNumEntries<EMyEnum>(true),
-	 * this will return "4" (OptionA, OptionB, OptionC, and autogenerated _MAX entry).
-	 * UEnumLibrary::GetEnumNumEntries<EMyEnum>(false),
-	 * will return "3" (excludes the autogenerated MAX)
-	 *
-	 * @tparam TEnum Type of the enum (e.g., <ENetRole>).
-	 * @param bIncludeMax Whether the autogenerated _MAX entry should be included.
-	 * @returns How many entries are in this enum.
-	 */
-	template <typename TEnum>
-	static FORCEINLINE int32 GetEnumNumEntries(bool bIncludeMax = false)
+	/// <summary>
+	/// Node pool. Removed nodes are recycled through FreeNodes.
+	/// </summary>
+	TArray<FNode> Nodes;
+	TArray<int32> FreeNodes;
+
+	int32 Root = INDEX_NONE;
+
+	/// <summary>
+	/// Lookup from an effect handle to its node, so removal doesn't have to search.
+	/// </summary>
+	TMap<FActiveEffectHandle, int32> HandleToNode;
+};
+
+
+/// <summary>
+/// Stores applied FLayeredEffectDefinition for a single attribute.
+/// All operations maintain an increasing sorted order by FLayeredEffectDefinition::Layer for faster layered attribute calculation.
+/// Effects are grouped into one bucket per layer, so adding an effect is a binary search
+/// over the (few) layers followed by an append, instead of a linear scan and a memmove of the tail.
+/// </summary>
+USTRUCT(BlueprintType)
+struct WIZARDS_API FSortedEffectDefinitions
+{
+	GENERATED_BODY()
+
+public:
+
+	/// <summary>
+	/// Creates an empty stack using the backend selected by "LayeredEffects.Backend".
+	/// </summary>
+	FSortedEffectDefinitions();
+
+	explicit FSortedEffectDefinitions(ELayeredEffectBackend InBackend)
+		: Backend(InBackend)
+	{ }
+
+	ELayeredEffectBackend GetBackend() const { return Backend; }
+
+	/// <summary>
+	/// Applies a new layered effect to this object's attributes.
+	/// </summary>
+	/// <param name="Effect">The new layered effect to apply.</param>
+	/// <returns>The handle to the newly applied effect, so that it can be removed later.</returns>
+	FActiveEffectHandle AddLayeredEffect(const FLayeredEffectDefinition& Effect);
+
+	/// <summary>
+	/// Inserts an effect that was activated elsewhere (e.g. on the server), keeping its handle and sequence.
+	/// </summary>
+	/// <returns>False if Effect is invalid or already in this stack.</returns>
+	bool AddActiveEffect(const FActiveEffectDefinition& Effect);
+
+	/// <summary>
+	/// Removes an active layered effect.
+	/// </summary>
+	/// <param name="InHandle">Which active effect to remove.</param>
+	/// <returns>True if the effect was successfully removed.</returns>
+	bool RemoveLayeredEffect(const FActiveEffectHandle& InHandle);
+
+	/// <summary>
+	/// Removes all layered effects from this object. After this call,
+	/// all current attributes will be equal to the base attributes.
+	/// </summary>
+	/// <returns>True if any effect was successfully removed.</returns>
+	bool ClearLayeredEffects();
+
+	/// <returns>True if any layered effect is active.</returns>
+	bool HasEffects() const { return (LayerBuckets.Num() > 0 || ComposedTree.Num() > 0); }
+
+	/// <returns>Number of active effects in this stack.</returns>
+	int32 NumEffects() const
 	{
-		return GetEnumNumEntries(GetEnumPtr<TEnum>());
+		return (Backend == ELayeredEffectBackend::ComposedTree) ? ComposedTree.Num() : HandleToSlot.Num();
 	}
-	static FORCEINLINE int32 GetEnumNumEntries(const UEnum* EnumClass, bool bIncludeMax = false)
+
+	/// <returns>True if the effect with InHandle is in this stack.</returns>
+	bool ContainsEffect(const FActiveEffectHandle& InHandle) const
 	{
-		if (EnumClass == nullptr)
-		{
-			return INDEX_NONE;
-		}
+		return (Backend == ELayeredEffectBackend::ComposedTree) ? ComposedTree.Contains(InHandle) : HandleToSlot.Contains(InHandle);
+	}
 
-		int32 NumEnums = EnumClass->NumEnums();
+	/// <returns>The effect with InHandle, or nullptr. Only valid until the stack changes.</returns>
+	const FActiveEffectDefinition* FindEffect(const FActiveEffectHandle& InHandle) const;
 
-		if (!bIncludeMax && EnumClass->ContainsExistingMax())
-		{
-			NumEnums--;
-		}
+	/// <summary>
+	/// Unique stamp of the stack's current effects, taken from the application sequence every time an effect
+	/// is added or removed. Copies keep it, so two stacks with the same revision hold the same effects.
+	/// </summary>
+	int64 GetRevision() const { return Revision; }
 
-		return NumEnums;
-	}
+	/// <summary>
+	/// Modifies the BaseValue by all active layered effects.
+	/// The result is memoized, so repeated reads with the same BaseValue are O(1)
+	/// until the effect stack changes.
+	/// </summary>
+	/// <param name="BaseValue">The base value for the attribute, as a starting point to calculate from.</param>
+	/// <returns>The current value of the attribute, accounting for all layered effects.</returns>
+	int32 GetCurrentValue(const int32 BaseValue) const;
 
-	/**
-	 * Retrieve the values within an enum as an iterable array.
-	 *
-	 * @tparam	TEnum Type of the enum (e.g., <EMyEnum>).
-	 * @param	StartingValue (inclusive) Only enum values greater or equal to this one will be included.
-	 * @param	bIncludeMax Whether the autogenerated _MAX entry should be included.
-	 * @returns	All of the requested enum values.
-	 */
-	template <typename TEnum>
-	static TArray<TEnum> GetEnumEntries(TEnum StartingValue = (TEnum)0, bool bIncludeMax = false)
+	/// <summary>
+	/// This stack compiled into a straight-line program, recompiled on first use after the stack changes.
+	/// ELayeredEffectBackend::LayerBuckets stacks evaluate through it.
+	/// </summary>
+	const FCompiledEffectProgram& GetCompiledProgram() const;
+
+	/// <summary>
+	/// Calls Visitor(const FActiveEffectDefinition&) for every active effect, in application order.
+	/// </summary>
+	template <typename VisitorType>
+	void ForEachEffect(VisitorType&& Visitor) const
 	{
-		TArray<TEnum> EnumEntries;
+		if (Backend == ELayeredEffectBackend::ComposedTree)
+		{
+			ComposedTree.ForEachEffect(Visitor);
+			return;
+		}
 
-		const UEnum* EnumPtr = GetEnumPtr<TEnum>();
-		const int32 EnumNumEntries = UEnumLibrary::GetEnumNumEntries<TEnum>(bIncludeMax);
-		for (uint8 i = 0; i < EnumNumEntries; i++)
+		for (const FLayeredEffectBucket& CurBucket : LayerBuckets)
 		{
-			TEnum CurEnumValue = (TEnum)EnumPtr->GetValueByIndex(i);
-			if (CurEnumValue >= StartingValue)
+			for (const FActiveEffectDefinition& CurEffect : CurBucket.Effects)
 			{
-				EnumEntries.Add(CurEnumValue);
+				if (CurEffect.IsValid())
+				{
+					Visitor(CurEffect);
+				}
 			}
 		}
+	}
+
+private:
 
-		return EnumEntries;
+	/// <summary>
+	/// Walks every active effect in order, starting from BaseValue.
+	/// </summary>
+	int32 EvaluateEffects(const int32 BaseValue) const;
+
+	/// <summary>
+	/// Forces the next GetCurrentValue(...) to re-evaluate the effect stack, and moves Revision forward.
+	/// </summary>
+	void MarkChanged()
+	{
+		bCachedValueDirty = true;
+		bProgramDirty = true;
+		Revision = FActiveEffectDefinition::GenerateSequence();
 	}
-};
\ No newline at end of file
+
+	/// <summary>
+	/// Where an active effect is stored in LayerBuckets.
+	/// </summary>
+	struct FEffectSlot
+	{
+		int32 Layer = 0;
+		int32 Index = INDEX_NONE;
+	};
+
+	/// <returns>Index into LayerBuckets for Layer, or INDEX_NONE.</returns>
+	int32 FindBucketIndex(int32 Layer) const;
+
+	/// <summary>
+	/// Points HandleToSlot at every live effect in a bucket, starting at StartIndex.
+	/// </summary>
+	void ReindexBucket(int32 BucketIndex, int32 StartIndex);
+
+	/// <summary>
+	/// Drops the tombstones of a bucket and re-points the slots of the effects that moved.
+	/// </summary>
+	void CompactBucket(int32 BucketIndex);
+
+	/// <summary>
+	/// See GetRevision(). 0 until the first effect is added.
+	/// </summary>
+	int64 Revision = 0;
+
+	/// <summary>
+	/// Which of LayerBuckets/ComposedTree holds the effects for this attribute.
+	/// </summary>
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, meta = (AllowPrivateAccess = "true"))
+	ELayeredEffectBackend Backend = ELayeredEffectBackend::LayerBuckets;
+
+	/// <summary>
+	/// Effects applied to an attribute, one bucket per layer, sorted by layer (ELayeredEffectBackend::LayerBuckets).
+	/// </summary>
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, meta = (AllowPrivateAccess = "true"))
+	TArray<FLayeredEffectBucket> LayerBuckets;
+
+	/// <summary>
+	/// Lookup from an effect handle to its slot in LayerBuckets, so removal doesn't have to search.
+	/// </summary>
+	TMap<FActiveEffectHandle, FEffectSlot> HandleToSlot;
+
+	/// <summary>
+	/// Effects applied to an attribute (ELayeredEffectBackend::ComposedTree).
+	/// </summary>
+	FComposedEffectTree ComposedTree;
+
+	/// <summary>
+	/// Base value that CachedCurrentValue was evaluated from.
+	/// A different base value is treated as a cache miss.
+	/// </summary>
+	mutable int32 CachedBaseValue = 0;
+
+	/// <summary>
+	/// Memoized result of evaluating the effect stack on top of CachedBaseValue.
+	/// </summary>
+	mutable int32 CachedCurrentValue = 0;
+
+	/// <summary>
+	/// True when the effect stack changed since CachedCurrentValue was evaluated.
+	/// </summary>
+	mutable bool bCachedValueDirty = true;
+
+	/// <summary>
+	/// See GetCompiledProgram(). Only valid while bProgramDirty is clear.
+	/// </summary>
+	mutable FCompiledEffectProgram CompiledProgram;
+
+	/// <summary>
+	/// True when the effect stack changed since CompiledProgram was compiled.
+	/// </summary>
+	mutable bool bProgramDirty = true;
+};
@@ -0,0 +1,149 @@
+// Copyright 2023 John McElmurray (johnmcelmurray.com). All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "UObject/NoExportTypes.h"
+
+#include "LayeredAttributeCommandQueue.h"
+#include "LayeredEffectDefinition.h"
+
+#include "LayeredEffectExpiry.generated.h"
+
+/// <summary>
+/// When an active effect removes itself. An effect with both a duration and a scope expires at whichever comes first.
+/// </summary>
+USTRUCT(BlueprintType)
+struct WIZARDS_API FLayeredEffectExpiry
+{
+	GENERATED_BODY()
+
+public:
+
+	FLayeredEffectExpiry() = default;
+
+	FLayeredEffectExpiry(double InDuration, FName InScope)
+		: Duration(InDuration)
+		, Scope(InScope)
+	{ }
+
+	static FLayeredEffectExpiry AfterSeconds(double InDuration) { return FLayeredEffectExpiry(InDuration, NAME_None); }
+	static FLayeredEffectExpiry UntilEndOf(FName InScope) { return FLayeredEffectExpiry(0.0, InScope); }
+
+	bool HasDuration() const { return Duration > 0.0; }
+	bool HasScope() const { return !Scope.IsNone(); }
+
+	/// <returns>False if the effect lasts until it's removed.</returns>
+	bool IsSet() const { return HasDuration() || HasScope(); }
+
+	double GetDuration() const { return Duration; }
+	FName GetScope() const { return Scope; }
+
+private:
+
+	/// <summary>
+	/// World time, in seconds from when the effect is added, after which it is removed. 0 for no time limit.
+	/// </summary>
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, meta = (AllowPrivateAccess = "true"))
+	double Duration = 0.0;
+
+	/// <summary>
+	/// Game event that removes the effect when it ends (e.g. "Turn"), see ULayeredAttributeSubsystem::EndExpiryScope(...).
+	/// None for no scope.
+	/// </summary>
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, meta = (AllowPrivateAccess = "true"))
+	FName Scope = NAME_None;
+};
+
+
+/// <summary>
+/// An effect whose expiry came due.
+/// </summary>
+struct FExpiredLayeredEffect
+{
+	FLayeredAttributeCommandTarget Target;
+	FActiveEffectHandle Handle;
+};
+
+
+/// <summary>
+/// Tracks when active effects expire, so nobody has to scan for them.
+/// Timed expiries live in a hierarchical timer wheel: 4 levels of 64 slots, at TicksPerSecond resolution.
+/// Scheduling is O(1), and advancing time only touches the slots it passes through, so the cost is
+/// O(expiring) plus an O(1) re-slot for each effect every time its timer moves down a level.
+/// Scoped expiries live in one bucket per scope, handed back whole when the scope ends.
+/// Effects removed before they expire are not unscheduled: their handles are stale by the time they come due
+/// (see FActiveEffectHandle::IsLive()), and they are dropped then.
+/// Doesn't depend on a world; the caller supplies the time.
+/// </summary>
+class WIZARDS_API FLayeredEffectExpiryScheduler
+{
+public:
+
+	static constexpr int32 TicksPerSecond = 60;
+
+	/// <summary>
+	/// Schedules Handle on Target to expire as described by Expiry, counting from Now (in seconds).
+	/// </summary>
+	void Schedule(const FLayeredAttributeCommandTarget& Target, const FActiveEffectHandle& Handle, const FLayeredEffectExpiry& Expiry, double Now);
+
+	/// <summary>
+	/// Moves time forward to Now (in seconds), appending every effect that expired on the way to OutExpired
+	/// in the order they expired. Effects that were removed in the meantime are skipped.
+	/// </summary>
+	void Advance(double Now, TArray<FExpiredLayeredEffect>& OutExpired);
+
+	/// <summary>
+	/// Appends every live effect scoped to Scope to OutExpired, and forgets them.
+	/// </summary>
+	void EndScope(FName Scope, TArray<FExpiredLayeredEffect>& OutExpired);
+
+	/// <summary>
+	/// Forgets every scheduled effect, without expiring them.
+	/// </summary>
+	void Reset();
+
+	/// <returns>Number of timers in the wheel, including those of effects that were removed early.</returns>
+	int32 NumTimers() const { return NumScheduledTimers; }
+
+private:
+
+	static constexpr int32 NumLevels = 4;
+	static constexpr int32 SlotBits = 6;
+	static constexpr int32 SlotsPerLevel = 1 << SlotBits;
+	static constexpr uint64 SlotMask = SlotsPerLevel - 1;
+
+	struct FTimer
+	{
+		FExpiredLayeredEffect Effect;
+		uint64 DueTick = 0;
+	};
+
+	static uint64 ToTick(double Seconds);
+
+	/// <summary>
+	/// Puts Timer in the slot of the lowest level whose span covers its due tick, or in Overflow.
+	/// </summary>
+	void Insert(FTimer&& Timer);
+
+	/// <summary>
+	/// Re-inserts every timer of a slot, which moves them down a level now that the wheel reached them.
+	/// </summary>
+	void Cascade(int32 Level, int32 SlotIndex);
+
+	TArray<FTimer> Slots[NumLevels][SlotsPerLevel];
+
+	/// <summary>
+	/// Timers due further out than the top level spans. Re-inserted every time the top level wraps around.
+	/// </summary>
+	TArray<FTimer> Overflow;
+
+	/// <summary>
+	/// Every timer due at or before this tick has been expired.
+	/// </summary>
+	uint64 CurrentTick = 0;
+
+	int32 NumScheduledTimers = 0;
+
+	TMap<FName, TArray<FExpiredLayeredEffect>> ScopedEffects;
+};
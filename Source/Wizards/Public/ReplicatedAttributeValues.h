@@ -0,0 +1,138 @@
+// Copyright 2023 John McElmurray (johnmcelmurray.com). All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/NetSerialization.h"
+
+#include "LayeredEffectDefinition.h"
+
+#include "ReplicatedAttributeValues.generated.h"
+
+class ILayeredAttributes;
+class UNetConnection;
+struct FLayeredAttributeBlock;
+
+/// <summary>
+/// What clients that don't own an object receive of its attributes.
+/// The owning client always receives the full effect stacks, so it can predict and inspect them.
+/// </summary>
+UENUM(BlueprintType)
+enum class EAttributeReplicationMode : uint8
+{
+	/// <summary>
+	/// Every active effect and base value (see FReplicatedLayeredEffects).
+	/// </summary>
+	EffectStacks,
+
+	/// <summary>
+	/// Only current values, sent when they change, to connections the object is relevant to
+	/// (see FReplicatedAttributeValues).
+	/// </summary>
+	CurrentValues,
+};
+
+
+/// <summary>
+/// How often each connection receives current values, in EAttributeReplicationMode::CurrentValues.
+/// </summary>
+USTRUCT(BlueprintType)
+struct WIZARDS_API FAttributeValueRelevancy
+{
+	GENERATED_BODY()
+
+public:
+
+	/// <summary>
+	/// Connections viewing from further away receive no updates. 0 for no limit.
+	/// </summary>
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (ClampMin = "0"))
+	float CullDistance = 0.f;
+
+	/// <summary>
+	/// Updates per second to the owning connection, to viewers of the object, and to connections right next to it.
+	/// 0 to update as often as the object replicates.
+	/// </summary>
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (ClampMin = "0"))
+	float MaxUpdateRate = 30.f;
+
+	/// <summary>
+	/// Updates per second to connections at CullDistance. The rate falls linearly with distance in between.
+	/// 0 to update as often as the object replicates.
+	/// </summary>
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (ClampMin = "0"))
+	float MinUpdateRate = 2.f;
+
+	/// <summary>
+	/// Whether hidden objects still update connections other than their owner's.
+	/// </summary>
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	bool bRelevantWhenHidden = false;
+};
+
+
+/// <summary>
+/// Replicates only the current value of each attribute, for clients that don't need the effects behind them.
+/// Each connection is sent the attributes that changed since the state it last acknowledged,
+/// as a bit mask followed by the changed values, each zigzag encoded and packed into as few bits as it needs.
+/// Attribute values are integers, so packing is lossless; no further quantization is applied.
+/// Nothing is sent (or even compared) for connections that are up to date, that the object isn't relevant to,
+/// or that were updated more recently than their priority allows (see FAttributeValueRelevancy).
+/// The server calls SyncFrom(...) before replicating; clients apply what they receive as base values of Owner,
+/// which therefore must not have effects of its own there.
+/// </summary>
+USTRUCT()
+struct WIZARDS_API FReplicatedAttributeValues
+{
+	GENERATED_BODY()
+
+public:
+
+	/// <summary>
+	/// Object the values are read from on the server (for relevancy), and applied to on clients.
+	/// </summary>
+	void SetOwner(ILayeredAttributes* InOwner) { Owner = InOwner; }
+
+	void SetRelevancy(const FAttributeValueRelevancy& InRelevancy) { Relevancy = InRelevancy; }
+
+	/// <summary>
+	/// Copies the current values of Attributes. Server only.
+	/// </summary>
+	/// <returns>True if any value changed since the last sync.</returns>
+	bool SyncFrom(const FLayeredAttributeBlock& Attributes);
+
+	/// <returns>Last synced (server) or received (client) value of Key.</returns>
+	int32 GetValue(EAttributeKey Key) const;
+
+	bool NetDeltaSerialize(FNetDeltaSerializeInfo& DeltaParams);
+
+private:
+
+	/// <summary>
+	/// Seconds Connection should wait between updates, or false if the object isn't relevant to it.
+	/// Without a connection (e.g. when serializing outside of a net driver), updates are never held back.
+	/// </summary>
+	bool GetUpdateInterval(const UNetConnection* Connection, double& OutInterval) const;
+
+	double GetTimeSeconds() const;
+
+	int32 Values[EAttributeKeyUtils::Num] = { };
+
+	/// <summary>
+	/// Bumped by every sync that changes a value, so connections that are up to date are skipped with one comparison.
+	/// </summary>
+	uint32 Revision = 0;
+
+	FAttributeValueRelevancy Relevancy;
+
+	ILayeredAttributes* Owner = nullptr;
+};
+
+template<>
+struct TStructOpsTypeTraits<FReplicatedAttributeValues> : public TStructOpsTypeTraitsBase2<FReplicatedAttributeValues>
+{
+	enum
+	{
+		WithNetDeltaSerializer = true,
+	};
+};
@@ -0,0 +1,116 @@
+// Copyright 2023 John McElmurray (johnmcelmurray.com). All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Net/Serialization/FastArraySerializer.h"
+
+#include "LayeredEffectDefinition.h"
+
+#include "ReplicatedLayeredEffects.generated.h"
+
+class FSharedEffectRegistry;
+class ILayeredAttributes;
+struct FLayeredAttributeBlock;
+struct FReplicatedLayeredEffects;
+
+/// <summary>
+/// One active effect of a replicated object, as sent to clients.
+/// </summary>
+USTRUCT()
+struct WIZARDS_API FReplicatedLayeredEffect : public FFastArraySerializerItem
+{
+	GENERATED_BODY()
+
+public:
+
+	FReplicatedLayeredEffect() = default;
+
+	explicit FReplicatedLayeredEffect(const FActiveEffectDefinition& InEffect)
+		: Effect(InEffect)
+	{ }
+
+	/// <summary>
+	/// Sent whole, handle included, so clients refer to the effect by the same handle as the server.
+	/// Active effects never change, so an item is only ever added or removed.
+	/// </summary>
+	UPROPERTY()
+	FActiveEffectDefinition Effect;
+
+	// "FFastArraySerializerItem" callbacks, on clients only
+	void PreReplicatedRemove(const FReplicatedLayeredEffects& InArraySerializer);
+	void PostReplicatedAdd(const FReplicatedLayeredEffects& InArraySerializer);
+};
+
+
+/// <summary>
+/// Replicates every active effect of an object as a fast array delta: only effects added or removed
+/// since a client's last update are sent, instead of the whole stack.
+/// The server calls SyncFrom(...) before replicating (e.g. in PreReplication), which diffs only the attributes
+/// whose stacks changed since the last sync (see FSortedEffectDefinitions::GetRevision()).
+/// Clients apply the changes to Owner through ILayeredAttributes, so listeners hear about them as usual.
+/// Handles on clients are the server's: they identify effects across the wire, but they are never live
+/// in the client's FActiveEffectHandleAllocator, and clients must not add effects of their own to replicated objects.
+/// Shared effects that apply to the object (see FSharedEffectRegistry) are sent as items like its own effects,
+/// keeping their sequence, so clients evaluate them in the same order without the server's registry.
+/// Clients must not apply shared effects of their own to replicated objects either.
+/// </summary>
+USTRUCT()
+struct WIZARDS_API FReplicatedLayeredEffects : public FFastArraySerializer
+{
+	GENERATED_BODY()
+
+public:
+
+	/// <summary>
+	/// Object that replicated changes are applied to, on clients.
+	/// </summary>
+	void SetOwner(ILayeredAttributes* InOwner) { Owner = InOwner; }
+	ILayeredAttributes* GetOwner() const { return Owner; }
+
+	/// <summary>
+	/// Adds and removes items until they match the effects of Attributes. Server only.
+	/// </summary>
+	/// <returns>True if any item was added or removed.</returns>
+	bool SyncFrom(const FLayeredAttributeBlock& Attributes);
+
+	const TArray<FReplicatedLayeredEffect>& GetItems() const { return Items; }
+
+	bool NetDeltaSerialize(FNetDeltaSerializeInfo& DeltaParams)
+	{
+		return FFastArraySerializer::FastArrayDeltaSerialize<FReplicatedLayeredEffect, FReplicatedLayeredEffects>(Items, DeltaParams, *this);
+	}
+
+private:
+
+	UPROPERTY()
+	TArray<FReplicatedLayeredEffect> Items;
+
+	/// <summary>
+	/// Revision of each attribute's stack when Items was last synced to it.
+	/// </summary>
+	int64 SyncedRevisions[EAttributeKeyUtils::Num] = { };
+
+	/// <summary>
+	/// Version of each attribute's shared effects when Items was last synced to it.
+	/// </summary>
+	uint32 SyncedSharedVersions[EAttributeKeyUtils::Num] = { };
+
+	/// <summary>
+	/// Shared effects, and the Controller and Types that chose which of them applied, at the last sync.
+	/// </summary>
+	const FSharedEffectRegistry* SyncedSharedEffects = nullptr;
+	int32 SyncedController = 0;
+	int32 SyncedTypes = 0;
+
+	ILayeredAttributes* Owner = nullptr;
+};
+
+template<>
+struct TStructOpsTypeTraits<FReplicatedLayeredEffects> : public TStructOpsTypeTraitsBase2<FReplicatedLayeredEffects>
+{
+	enum
+	{
+		WithNetDeltaSerializer = true,
+	};
+};
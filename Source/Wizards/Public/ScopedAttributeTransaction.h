@@ -0,0 +1,106 @@
+// Copyright 2023 John McElmurray (johnmcelmurray.com). All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include "LayeredEffectDefinition.h"
+
+class ILayeredAttributes;
+struct FLayeredAttributeBlock;
+
+/// <summary>
+/// Batches attribute mutations on a single ILayeredAttributes object.
+/// While the transaction is in scope, SetBaseAttribute/AddLayeredEffect/RemoveLayeredEffect/ClearLayeredEffects
+/// do not broadcast. On Commit() (or when the scope ends) each attribute that was touched is
+/// broadcast at most once, and only if its value ended somewhere other than where it started.
+/// Owners in ELayeredAttributeNotifyMode::Deferred broadcast the committed changes on the next flush instead.
+/// Rollback() restores every touched attribute to its state when the transaction began, without broadcasting.
+///
+/// Transactions nest: an inner transaction folds its changes into the outer one on commit.
+/// They must be committed or rolled back innermost first, and must not outlive the owner.
+/// </summary>
+class WIZARDS_API FScopedAttributeTransaction : public FNoncopyable
+{
+public:
+
+	explicit FScopedAttributeTransaction(ILayeredAttributes& InOwner);
+
+	/// <summary>
+	/// Commits the transaction if it is still active.
+	/// </summary>
+	~FScopedAttributeTransaction();
+
+	/// <summary>
+	/// Ends the transaction, keeping all changes and broadcasting one notification per changed attribute
+	/// (or queueing them, for deferred owners).
+	/// </summary>
+	void Commit();
+
+	/// <summary>
+	/// Ends the transaction, restoring every touched attribute (base value and effects) to its original state.
+	/// Effects removed during the transaction come back with their original handles.
+	/// </summary>
+	void Rollback();
+
+	/// <returns>True until Commit() or Rollback() is called.</returns>
+	bool IsActive() const { return Owner != nullptr; }
+
+private:
+
+	friend class ILayeredAttributes;
+	friend struct FLayeredAttributeBlock;
+
+	/// <summary>
+	/// State of an attribute the first time it was touched during this transaction.
+	/// </summary>
+	struct FSavedAttribute
+	{
+		EAttributeKey Key = EAttributeKey::Invalid;
+		int32 OldValue = 0;
+		int32 BaseValue = 0;
+		FSortedEffectDefinitions Effects;
+	};
+
+	/// <summary>
+	/// Called by the owner right before Key is modified. Only the first call per attribute saves its state,
+	/// so the current value is only evaluated once per attribute rather than on every change.
+	/// </summary>
+	void RecordChange(const FLayeredAttributeBlock& Attributes, EAttributeKey Key);
+
+	/// <summary>
+	/// Adopts a nested transaction's saved state for attributes this transaction hasn't touched yet.
+	/// </summary>
+	void MergeNested(FScopedAttributeTransaction& Nested);
+
+	/// <summary>
+	/// Called by the owner for every effect added during this transaction, to release its handle on rollback.
+	/// </summary>
+	void RecordAddedEffect(const FActiveEffectHandle& InHandle) { AddedEffects.Add(InHandle); }
+
+	/// <summary>
+	/// Called by the owner for every effect removed during this transaction, to release its handle on commit.
+	/// </summary>
+	void RecordRemovedEffect(const FActiveEffectHandle& InHandle) { RemovedEffects.Add(InHandle); }
+
+	bool HasTouched(EAttributeKey Key) const { return (TouchedMask & (1u << EAttributeKeyUtils::ToIndex(Key))) != 0; }
+
+	ILayeredAttributes* Owner = nullptr;
+	FScopedAttributeTransaction* OuterTransaction = nullptr;
+
+	/// <summary>
+	/// One bit per attribute recorded in SavedAttributes.
+	/// </summary>
+	uint32 TouchedMask = 0;
+
+	/// <summary>
+	/// Touched attributes, in the order they were first modified.
+	/// </summary>
+	TArray<FSavedAttribute, TInlineAllocator<4>> SavedAttributes;
+
+	/// <summary>
+	/// Handles of effects added or removed while this transaction was active.
+	/// </summary>
+	TArray<FActiveEffectHandle> AddedEffects;
+	TArray<FActiveEffectHandle> RemovedEffects;
+};
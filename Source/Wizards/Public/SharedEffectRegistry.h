@@ -0,0 +1,179 @@
+// Copyright 2023 John McElmurray (johnmcelmurray.com). All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include "LayeredEffectDefinition.h"
+
+#include "SharedEffectRegistry.generated.h"
+
+/// <summary>
+/// Which objects a shared layered effect applies to, based on their current Controller and Types attributes.
+/// </summary>
+USTRUCT(BlueprintType)
+struct WIZARDS_API FSharedEffectTargetFilter
+{
+	GENERATED_BODY()
+
+public:
+
+	FSharedEffectTargetFilter() = default;
+	FSharedEffectTargetFilter(
+		bool bInMatchController,
+		int32 InController,
+		int32 InRequiredTypes)
+		: bMatchController(bInMatchController)
+		, Controller(InController)
+		, RequiredTypes(InRequiredTypes)
+	{ }
+
+	bool Matches(int32 TargetController, int32 TargetTypes) const
+	{
+		return (!bMatchController || TargetController == Controller)
+			&& (TargetTypes & RequiredTypes) == RequiredTypes;
+	}
+
+private:
+
+	/// <summary>
+	/// Only affect objects whose Controller attribute equals Controller.
+	/// </summary>
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, meta = (AllowPrivateAccess = "true"))
+	bool bMatchController = false;
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, meta = (AllowPrivateAccess = "true", EditCondition = "bMatchController"))
+	int32 Controller = 0;
+
+	/// <summary>
+	/// Only affect objects whose Types attribute has every one of these bits set. 0 affects every object.
+	/// </summary>
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, meta = (AllowPrivateAccess = "true"))
+	int32 RequiredTypes = 0;
+};
+
+
+/// <summary>
+/// Layered effects that apply to every object matching a filter, e.g. "creatures you control get +1/+1".
+/// A shared effect is stored once rather than copied into every target's FSortedEffectDefinitions,
+/// and is merged into each target's layer/sequence order when that target evaluates the attribute.
+/// Adding or removing one is O(1): it only bumps the attribute's version, and targets notice the new
+/// version and re-evaluate the next time the attribute is read.
+/// Since targets are chosen by Controller and Types, shared effects can't modify those two attributes.
+/// The registry doesn't know its targets, so it broadcasts nothing itself; ULayeredAttributeSubsystem broadcasts
+/// to the objects registered with it when shared effects are added or removed through it.
+/// </summary>
+class WIZARDS_API FSharedEffectRegistry
+{
+public:
+
+	/// <returns>True if Key decides which shared effects apply to an object.</returns>
+	static bool IsTargetingAttribute(EAttributeKey Key)
+	{
+		return Key == EAttributeKey::Controller || Key == EAttributeKey::Types;
+	}
+
+	/// <summary>
+	/// Applies Effect to every object matching Filter.
+	/// </summary>
+	/// <returns>The handle to the shared effect, so that it can be removed later.</returns>
+	FActiveEffectHandle AddSharedEffect(const FLayeredEffectDefinition& Effect, const FSharedEffectTargetFilter& Filter);
+
+	/// <returns>True if the shared effect was found and removed.</returns>
+	bool RemoveSharedEffect(const FActiveEffectHandle& InHandle);
+
+	/// <summary>
+	/// Removes every shared effect.
+	/// </summary>
+	void Reset();
+
+	/// <returns>Which objects the shared effect applies to, or nullptr if InHandle isn't a live shared effect.</returns>
+	const FSharedEffectTargetFilter* FindFilter(const FActiveEffectHandle& InHandle) const
+	{
+		const int32* Index = HandleToIndex.Find(InHandle);
+		return (Index != nullptr) ? &Effects[*Index].Filter : nullptr;
+	}
+
+	bool HasEffects(EAttributeKey Key) const { return NumEffects[EAttributeKeyUtils::ToIndex(Key)] > 0; }
+
+	/// <summary>
+	/// Changes every time a shared effect on Key is added or removed. Targets compare it to the version they
+	/// last evaluated against to find out their cached value is stale.
+	/// </summary>
+	uint32 GetVersion(EAttributeKey Key) const { return Versions[EAttributeKeyUtils::ToIndex(Key)]; }
+
+	/// <summary>
+	/// Sorts and compacts the shared effects of every attribute that changed.
+	/// Evaluate(...) does this on demand, so this only needs to be called before evaluating from several threads at once.
+	/// </summary>
+	void PrepareForEvaluation();
+
+	/// <summary>
+	/// Applies OwnEffects and every shared effect on Key matching the target to BaseValue, in layer/sequence order,
+	/// as if the shared effects had been added to the target when they were added here.
+	/// </summary>
+	int32 Evaluate(EAttributeKey Key, int32 BaseValue, const FSortedEffectDefinitions& OwnEffects, int32 TargetController, int32 TargetTypes);
+
+	/// <summary>
+	/// Calls Visitor(const FActiveEffectDefinition&) for every shared effect on Key matching the target.
+	/// Effects are only visited in application order if the attribute was prepared since it last changed, so callers
+	/// that need the order sort by layer and sequence themselves. Unlike Evaluate(...), this never changes the registry.
+	/// </summary>
+	template <typename VisitorType>
+	void ForEachMatchingEffect(EAttributeKey Key, int32 TargetController, int32 TargetTypes, VisitorType&& Visitor) const
+	{
+		for (const int32 EffectIndex : OrderedEffects[EAttributeKeyUtils::ToIndex(Key)])
+		{
+			// Skip tombstones, which are only dropped once the attribute is prepared
+			const FSharedEffect& CurShared = Effects[EffectIndex];
+			if (CurShared.Effect.IsValid() && CurShared.Filter.Matches(TargetController, TargetTypes))
+			{
+				Visitor(CurShared.Effect);
+			}
+		}
+	}
+
+private:
+
+	struct FSharedEffect
+	{
+		/// <summary>
+		/// Invalidated (a tombstone) once removed, until PrepareForEvaluation() drops it.
+		/// </summary>
+		FActiveEffectDefinition Effect;
+
+		FSharedEffectTargetFilter Filter;
+	};
+
+	/// <summary>
+	/// Sorts and compacts OrderedEffects of a single attribute, if it changed.
+	/// </summary>
+	void PrepareForEvaluation(int32 KeyIndex);
+
+	/// <summary>
+	/// Every shared effect, including tombstones. Indexed by OrderedEffects.
+	/// </summary>
+	TSparseArray<FSharedEffect> Effects;
+
+	/// <summary>
+	/// Lookup from a handle to its entry in Effects.
+	/// </summary>
+	TMap<FActiveEffectHandle, int32> HandleToIndex;
+
+	/// <summary>
+	/// Indices into Effects of each attribute's shared effects, in application order where UnpreparedMask is clear.
+	/// </summary>
+	TArray<int32> OrderedEffects[EAttributeKeyUtils::Num];
+
+	/// <summary>
+	/// Number of live shared effects per attribute.
+	/// </summary>
+	int32 NumEffects[EAttributeKeyUtils::Num] = { };
+
+	uint32 Versions[EAttributeKeyUtils::Num] = { };
+
+	/// <summary>
+	/// One bit per attribute whose OrderedEffects is out of order or holds tombstones.
+	/// </summary>
+	uint32 UnpreparedMask = 0;
+};
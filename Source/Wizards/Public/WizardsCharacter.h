@@ -6,6 +6,8 @@
 #include "GameFramework/Character.h"
 
 #include "ILayeredAttributes.h"
+#include "ReplicatedAttributeValues.h"
+#include "ReplicatedLayeredEffects.h"
 
 #include "WizardsCharacter.generated.h"
 
@@ -21,11 +23,24 @@ public:
 
 	AWizardsCharacter();
 
+	virtual void PostInitializeComponents() override;
+
 	virtual void BeginPlay() override;
 
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
 	// Called every frame.
 	virtual void Tick(float DeltaSeconds) override;
 
+	virtual void GetLifetimeReplicatedProps(TArray<FLifetimeProperty>& OutLifetimeProps) const override;
+
+	virtual void PreReplication(IRepChangedPropertyTracker& ChangedPropertyTracker) override;
+
+	/// <summary>
+	/// Mirror of this character's active effects that is sent to clients. Only valid on the server after replication.
+	/// </summary>
+	const FReplicatedLayeredEffects& GetReplicatedEffects() const { return ReplicatedEffects; }
+
 	/** Returns TopDownCameraComponent subobject **/
 	FORCEINLINE class UCameraComponent* GetTopDownCameraComponent() const { return TopDownCameraComponent; }
 	/** Returns CameraBoom subobject **/
@@ -37,12 +52,14 @@ protected:
 	void HandleOnAnyAttributeValueChanged(const FOnAttributeChangedData& Data);
 
 	// "ILayeredAttributes" interface methods
-	virtual TMap<EAttributeKey, int32>& GetBaseAttributesMutable() override { return BaseAttributes; }
-	virtual const TMap<EAttributeKey, int32>& GetBaseAttributes() const override { return BaseAttributes; }
-	virtual TMap<EAttributeKey, FSortedEffectDefinitions>& GetActiveEffectsMutable() override { return ActiveEffects; }
-	virtual const TMap<EAttributeKey, FSortedEffectDefinitions>& GetActiveEffects() const override { return ActiveEffects; }
+	virtual FLayeredAttributeBlock& GetAttributesMutable() override { return Attributes; }
+	virtual const FLayeredAttributeBlock& GetAttributes() const override { return Attributes; }
 	virtual const FOnAttributeValueChangedEvent& GetOnAnyAttributeValueChanged() const override { return OnAnyAttributeValueChanged; }
 
+	virtual void OnAttributesCommitted() override;
+
+	UFUNCTION()
+	void OnRep_ReplicatedBaseValues();
 
 public:
 
@@ -64,16 +81,76 @@ private:
 	class USpringArmComponent* CameraBoom;
 
 	/// <summary>
-	/// Base attributes for this character
+	/// Base attributes for this character. Holds the initial values until it begins play,
+	/// then mirrors the base values of Attributes that were set, for Blueprints to read.
 	/// </summary>
 	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly, Category = Attributes, meta = (AllowPrivateAccess = "true"))
 	TMap<EAttributeKey, int32> BaseAttributes;
 
 	/// <summary>
-	/// Active effects modifying attributes for this character
+	/// Active effects modifying attributes for this character, mirrored from Attributes for Blueprints to read
 	/// </summary>
 	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = Attributes, meta = (AllowPrivateAccess = "true"))
 	TMap<EAttributeKey, FSortedEffectDefinitions> ActiveEffects;
 
+	/// <summary>
+	/// Revision of each effect stack of Attributes last copied into ActiveEffects, indexed by EAttributeKey
+	/// </summary>
+	int64 MirroredEffectRevisions[EAttributeKeyUtils::Num] = { };
+
+	/// <summary>
+	/// Whether attribute changes are broadcast as they happen, or coalesced and broadcast once per frame
+	/// </summary>
+	UPROPERTY(EditDefaultsOnly, Category = Attributes, meta = (AllowPrivateAccess = "true"))
+	ELayeredAttributeNotifyMode AttributeNotifyMode = ELayeredAttributeNotifyMode::Immediate;
+
+	/// <summary>
+	/// Whether this character's attribute values live in the world's ULayeredAttributeSubsystem rather than on the character
+	/// </summary>
+	UPROPERTY(EditDefaultsOnly, Category = Attributes, meta = (AllowPrivateAccess = "true"))
+	bool bStoreAttributesInSubsystem = false;
+
+	/// <summary>
+	/// Entity holding this character's attributes while bStoreAttributesInSubsystem is set
+	/// </summary>
+	UPROPERTY(VisibleInstanceOnly, Category = Attributes, meta = (AllowPrivateAccess = "true"))
+	FLayeredAttributeEntityHandle AttributeEntity;
+
+	/// <summary>
+	/// Base attributes and active effects modifying attributes for this character
+	/// </summary>
+	UPROPERTY(VisibleAnywhere, Category = Attributes, meta = (AllowPrivateAccess = "true"))
+	FLayeredAttributeBlock Attributes;
+
+	/// <summary>
+	/// Active effects of Attributes, synced from the server and sent to clients as deltas
+	/// </summary>
+	UPROPERTY(Replicated)
+	FReplicatedLayeredEffects ReplicatedEffects;
+
+	/// <summary>
+	/// Base value of every attribute of Attributes, indexed by EAttributeKey
+	/// </summary>
+	UPROPERTY(ReplicatedUsing = OnRep_ReplicatedBaseValues)
+	TArray<int32> ReplicatedBaseValues;
+
+	/// <summary>
+	/// Current value of every attribute of Attributes, for clients that don't own this character in AttributeReplicationMode::CurrentValues
+	/// </summary>
+	UPROPERTY(Replicated)
+	FReplicatedAttributeValues ReplicatedValues;
+
+	/// <summary>
+	/// What clients that don't own this character receive of its attributes
+	/// </summary>
+	UPROPERTY(EditDefaultsOnly, Category = Attributes, meta = (AllowPrivateAccess = "true"))
+	EAttributeReplicationMode AttributeReplicationMode = EAttributeReplicationMode::EffectStacks;
+
+	/// <summary>
+	/// Which clients receive current values, and how often, in AttributeReplicationMode::CurrentValues
+	/// </summary>
+	UPROPERTY(EditDefaultsOnly, Category = Attributes, meta = (AllowPrivateAccess = "true", EditCondition = "AttributeReplicationMode == EAttributeReplicationMode::CurrentValues"))
+	FAttributeValueRelevancy AttributeValueRelevancy;
+
 };
 
@@ -11,5 +11,6 @@ public class WizardsEditorTarget : TargetRules
 		DefaultBuildSettings = BuildSettingsVersion.V4;
 		IncludeOrderVersion = EngineIncludeOrderVersion.Unreal5_3;
 		ExtraModuleNames.Add("Wizards");
+		ExtraModuleNames.Add("WizardsEditor");
 	}
 }
@@ -0,0 +1,373 @@
+// Copyright 2023 John McElmurray (johnmcelmurray.com). All rights reserved.
+
+#include "LayeredAttributeBenchmarkCommandlet.h"
+
+#include "HAL/IConsoleManager.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Serialization/JsonWriter.h"
+#include "UObject/UObjectGlobals.h"
+
+#include "WizardsEditor.h"
+
+namespace
+{
+	/// <summary>
+	/// Most effects Clear re-adds between timed calls in a single case, so deep stacks take fewer Clear samples.
+	/// </summary>
+	constexpr int32 ClearEffectBudget = 1000000;
+
+	const EAttributeKey BenchmarkedAttribute = EAttributeKey::Power;
+
+	struct FBenchmarkCase
+	{
+		ELayeredEffectBackend Backend = ELayeredEffectBackend::LayerBuckets;
+		int32 Depth = 0;
+		int32 NumObjects = 0;
+		bool bListeners = false;
+	};
+
+	struct FBenchmarkResult
+	{
+		FBenchmarkCase Case;
+		const TCHAR* Operation = TEXT("");
+		int32 NumSamples = 0;
+		double OpsPerSecond = 0.0;
+		double MeanNs = 0.0;
+		double P50Ns = 0.0;
+		double P90Ns = 0.0;
+		double P99Ns = 0.0;
+		double MaxNs = 0.0;
+	};
+
+	/// <summary>
+	/// Times Op(SampleIndex) once per sample, calling the untimed Prepare(SampleIndex) before each.
+	/// </summary>
+	template <typename PrepareType, typename OpType>
+	void TimeSamples(int32 NumSamples, TArray<uint64>& OutCycles, PrepareType&& Prepare, OpType&& Op)
+	{
+		OutCycles.Reset(NumSamples);
+		for (int32 SampleIndex = 0; SampleIndex < NumSamples; SampleIndex++)
+		{
+			Prepare(SampleIndex);
+			const uint64 StartCycles = FPlatformTime::Cycles64();
+			Op(SampleIndex);
+			OutCycles.Add(FPlatformTime::Cycles64() - StartCycles);
+		}
+	}
+
+	FBenchmarkResult Summarize(const FBenchmarkCase& Case, const TCHAR* Operation, TArray<uint64>& Cycles)
+	{
+		FBenchmarkResult Result;
+		Result.Case = Case;
+		Result.Operation = Operation;
+		Result.NumSamples = Cycles.Num();
+		if (Cycles.Num() == 0)
+		{
+			return Result;
+		}
+
+		Cycles.Sort();
+		uint64 TotalCycles = 0;
+		for (const uint64 CurCycles : Cycles)
+		{
+			TotalCycles += CurCycles;
+		}
+
+		auto ToNs = [](uint64 InCycles) { return FPlatformTime::ToSeconds64(InCycles) * 1e9; };
+		auto Percentile = [&Cycles, &ToNs](double Fraction)
+		{
+			return ToNs(Cycles[FMath::Min(Cycles.Num() - 1, static_cast<int32>(Fraction * Cycles.Num()))]);
+		};
+
+		const double TotalSeconds = FPlatformTime::ToSeconds64(TotalCycles);
+		Result.OpsPerSecond = (TotalSeconds > 0.0) ? Cycles.Num() / TotalSeconds : 0.0;
+		Result.MeanNs = ToNs(TotalCycles) / Cycles.Num();
+		Result.P50Ns = Percentile(0.5);
+		Result.P90Ns = Percentile(0.9);
+		Result.P99Ns = Percentile(0.99);
+		Result.MaxNs = ToNs(Cycles.Last());
+		return Result;
+	}
+
+	FString GetBackendName(ELayeredEffectBackend Backend)
+	{
+		return StaticEnum<ELayeredEffectBackend>()->GetNameStringByValue(static_cast<int64>(Backend));
+	}
+
+	/// <summary>
+	/// Reads a comma separated list of counts, e.g. -Depths=1,10,100.
+	/// </summary>
+	TArray<int32> ParseCounts(const FString& Params, const TCHAR* Match, TArray<int32> Default)
+	{
+		FString Value;
+		if (!FParse::Value(*Params, Match, Value, false))
+		{
+			return Default;
+		}
+
+		TArray<FString> Parts;
+		Value.ParseIntoArray(Parts, TEXT(","));
+
+		TArray<int32> Counts;
+		for (const FString& CurPart : Parts)
+		{
+			if (const int32 CurCount = FCString::Atoi(*CurPart); CurCount > 0)
+			{
+				Counts.Add(CurCount);
+			}
+		}
+		return Counts;
+	}
+
+	/// <summary>
+	/// Effects that can't overflow however deep the stack gets, spread over a few layers.
+	/// </summary>
+	FLayeredEffectDefinition MakeRandomEffect(FRandomStream& Random)
+	{
+		const EEffectOperation Operation = Random.RandBool() ? EEffectOperation::Add : EEffectOperation::Subtract;
+		return FLayeredEffectDefinition(BenchmarkedAttribute, Operation, Random.RandRange(1, 8), Random.RandRange(0, 7));
+	}
+
+	void AddRandomEffects(ILayeredAttributes& Object, int32 NumEffects, FRandomStream& Random)
+	{
+		bool bSuccess = false;
+		for (int32 Index = 0; Index < NumEffects; Index++)
+		{
+			Object.AddLayeredEffect(MakeRandomEffect(Random), bSuccess);
+		}
+	}
+
+	FString ToCsv(const TArray<FBenchmarkResult>& Results)
+	{
+		FString Csv = TEXT("Backend,Operation,Depth,Objects,Listeners,Samples,OpsPerSecond,MeanNs,P50Ns,P90Ns,P99Ns,MaxNs\n");
+		for (const FBenchmarkResult& CurResult : Results)
+		{
+			Csv += FString::Printf(TEXT("%s,%s,%d,%d,%d,%d,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f\n"),
+				*GetBackendName(CurResult.Case.Backend),
+				CurResult.Operation,
+				CurResult.Case.Depth,
+				CurResult.Case.NumObjects,
+				CurResult.Case.bListeners ? 1 : 0,
+				CurResult.NumSamples,
+				CurResult.OpsPerSecond,
+				CurResult.MeanNs,
+				CurResult.P50Ns,
+				CurResult.P90Ns,
+				CurResult.P99Ns,
+				CurResult.MaxNs);
+		}
+		return Csv;
+	}
+
+	FString ToJson(const TArray<FBenchmarkResult>& Results)
+	{
+		FString Json;
+		TSharedRef<TJsonWriter<>> Writer = TJsonWriterFactory<>::Create(&Json);
+		Writer->WriteObjectStart();
+		Writer->WriteValue(TEXT("Platform"), FString(FPlatformProperties::IniPlatformName()));
+		Writer->WriteValue(TEXT("Time"), FDateTime::UtcNow().ToIso8601());
+		Writer->WriteArrayStart(TEXT("Results"));
+		for (const FBenchmarkResult& CurResult : Results)
+		{
+			Writer->WriteObjectStart();
+			Writer->WriteValue(TEXT("Backend"), GetBackendName(CurResult.Case.Backend));
+			Writer->WriteValue(TEXT("Operation"), FString(CurResult.Operation));
+			Writer->WriteValue(TEXT("Depth"), CurResult.Case.Depth);
+			Writer->WriteValue(TEXT("Objects"), CurResult.Case.NumObjects);
+			Writer->WriteValue(TEXT("Listeners"), CurResult.Case.bListeners);
+			Writer->WriteValue(TEXT("Samples"), CurResult.NumSamples);
+			Writer->WriteValue(TEXT("OpsPerSecond"), CurResult.OpsPerSecond);
+			Writer->WriteValue(TEXT("MeanNs"), CurResult.MeanNs);
+			Writer->WriteValue(TEXT("P50Ns"), CurResult.P50Ns);
+			Writer->WriteValue(TEXT("P90Ns"), CurResult.P90Ns);
+			Writer->WriteValue(TEXT("P99Ns"), CurResult.P99Ns);
+			Writer->WriteValue(TEXT("MaxNs"), CurResult.MaxNs);
+			Writer->WriteObjectEnd();
+		}
+		Writer->WriteArrayEnd();
+		Writer->WriteObjectEnd();
+		Writer->Close();
+		return Json;
+	}
+}
+
+#pragma region ULayeredAttributeBenchmarkCommandlet
+
+ULayeredAttributeBenchmarkCommandlet::ULayeredAttributeBenchmarkCommandlet()
+{
+	IsClient = false;
+	IsEditor = false;
+	IsServer = false;
+	LogToConsole = true;
+}
+
+int32 ULayeredAttributeBenchmarkCommandlet::Main(const FString& Params)
+{
+	const TArray<int32> Depths = ParseCounts(Params, TEXT("Depths="), { 1, 10, 100, 1000, 10000, 100000 });
+	const TArray<int32> ObjectCounts = ParseCounts(Params, TEXT("Objects="), { 1, 10, 100, 1000, 10000, 100000 });
+
+	int32 ObjectDepth = 8;
+	int32 NumSamples = 10000;
+	int32 Seed = 1;
+	FParse::Value(*Params, TEXT("ObjectDepth="), ObjectDepth);
+	FParse::Value(*Params, TEXT("Samples="), NumSamples);
+	FParse::Value(*Params, TEXT("Seed="), Seed);
+	NumSamples = FMath::Max(NumSamples, 1);
+	ObjectDepth = FMath::Max(ObjectDepth, 0);
+
+	TArray<ELayeredEffectBackend> Backends = { ELayeredEffectBackend::LayerBuckets, ELayeredEffectBackend::ComposedTree };
+	FString BackendName;
+	if (FParse::Value(*Params, TEXT("Backend="), BackendName) && BackendName != TEXT("All"))
+	{
+		const int64 BackendValue = StaticEnum<ELayeredEffectBackend>()->GetValueByNameString(BackendName);
+		if (BackendValue == INDEX_NONE)
+		{
+			UE_LOG(LogWizardsEditor, Error, TEXT("Unknown backend '%s'"), *BackendName);
+			return 1;
+		}
+		Backends = { static_cast<ELayeredEffectBackend>(BackendValue) };
+	}
+
+	FString OutputPath;
+	if (!FParse::Value(*Params, TEXT("Output="), OutputPath))
+	{
+		OutputPath = FPaths::ProjectSavedDir() / TEXT("Benchmarks") / FString::Printf(TEXT("LayeredAttributes-%s.csv"), *FDateTime::Now().ToString());
+	}
+
+	// Stacks pick their backend when they are created, so it is switched before every case's objects are
+	IConsoleVariable* BackendVariable = IConsoleManager::Get().FindConsoleVariable(TEXT("LayeredEffects.Backend"));
+	check(BackendVariable != nullptr);
+	const int32 OldBackend = BackendVariable->GetInt();
+
+	TArray<FBenchmarkCase> Cases;
+	for (const ELayeredEffectBackend CurBackend : Backends)
+	{
+		for (const bool bListeners : { false, true })
+		{
+			for (const int32 CurDepth : Depths)
+			{
+				Cases.Add({ CurBackend, CurDepth, 1, bListeners });
+			}
+			for (const int32 CurNumObjects : ObjectCounts)
+			{
+				Cases.Add({ CurBackend, ObjectDepth, CurNumObjects, bListeners });
+			}
+		}
+	}
+
+	TArray<FBenchmarkResult> Results;
+	TArray<uint64> Cycles;
+	TArray<int32> Targets;
+	TArray<TPair<int32, FActiveEffectHandle>> AddedEffects;
+	uint64 NumBroadcasts = 0;
+	int64 ValueSink = 0;
+
+	for (const FBenchmarkCase& CurCase : Cases)
+	{
+		UE_LOG(LogWizardsEditor, Display, TEXT("Benchmarking %s: depth %d, %d objects%s"),
+			*GetBackendName(CurCase.Backend), CurCase.Depth, CurCase.NumObjects, CurCase.bListeners ? TEXT(", with listeners") : TEXT(""));
+
+		FRandomStream Random(Seed);
+		BackendVariable->Set(static_cast<int32>(CurCase.Backend), ECVF_SetByCode);
+
+		Objects.Reset(CurCase.NumObjects);
+		for (int32 Index = 0; Index < CurCase.NumObjects; Index++)
+		{
+			ULayeredAttributeBenchmarkObject* Object = NewObject<ULayeredAttributeBenchmarkObject>(GetTransientPackage());
+			AddRandomEffects(*Object, CurCase.Depth, Random);
+			if (CurCase.bListeners)
+			{
+				Object->GetOnAnyAttributeValueChangedNative().AddLambda([&NumBroadcasts](const FOnAttributeChangedData& Data)
+				{
+					NumBroadcasts++;
+				});
+			}
+			Objects.Add(Object);
+		}
+
+		// Spread calls over every object in a random order, so many objects don't all stay in cache
+		Targets.Reset(NumSamples);
+		for (int32 SampleIndex = 0; SampleIndex < NumSamples; SampleIndex++)
+		{
+			Targets.Add(Random.RandHelper(CurCase.NumObjects));
+		}
+		auto GetTarget = [this, &Targets](int32 SampleIndex) -> ILayeredAttributes& { return *Objects[Targets[SampleIndex]]; };
+		auto NoPrepare = [](int32) { };
+
+		TimeSamples(NumSamples, Cycles, NoPrepare, [&](int32 SampleIndex)
+		{
+			GetTarget(SampleIndex).SetBaseAttribute(BenchmarkedAttribute, SampleIndex);
+		});
+		Results.Add(Summarize(CurCase, TEXT("SetBase"), Cycles));
+
+		TimeSamples(NumSamples, Cycles,
+			[&](int32 SampleIndex) { GetTarget(SampleIndex).SetBaseAttribute(BenchmarkedAttribute, -SampleIndex); },
+			[&](int32 SampleIndex) { ValueSink += GetTarget(SampleIndex).GetCurrentAttribute(BenchmarkedAttribute); });
+		Results.Add(Summarize(CurCase, TEXT("Get"), Cycles));
+
+		AddedEffects.Reset(NumSamples);
+		FLayeredEffectDefinition NewEffect;
+		TimeSamples(NumSamples, Cycles,
+			[&](int32 SampleIndex) { NewEffect = MakeRandomEffect(Random); },
+			[&](int32 SampleIndex)
+			{
+				bool bSuccess = false;
+				AddedEffects.Emplace(Targets[SampleIndex], GetTarget(SampleIndex).AddLayeredEffect(NewEffect, bSuccess));
+			});
+		Results.Add(Summarize(CurCase, TEXT("Add"), Cycles));
+
+		// Remove in a different order than added, so removal isn't always from the end
+		for (int32 Index = AddedEffects.Num() - 1; Index > 0; Index--)
+		{
+			AddedEffects.Swap(Index, Random.RandHelper(Index + 1));
+		}
+		TimeSamples(AddedEffects.Num(), Cycles, NoPrepare, [&](int32 SampleIndex)
+		{
+			Objects[AddedEffects[SampleIndex].Key]->RemoveLayeredEffect(AddedEffects[SampleIndex].Value);
+		});
+		Results.Add(Summarize(CurCase, TEXT("Remove"), Cycles));
+
+		const int32 NumClearSamples = FMath::Clamp(ClearEffectBudget / FMath::Max(CurCase.Depth, 1), 1, NumSamples);
+		TBitArray<> Cleared(false, CurCase.NumObjects);
+		TimeSamples(NumClearSamples, Cycles,
+			[&](int32 SampleIndex)
+			{
+				// Every clear starts from a full stack
+				if (Cleared[Targets[SampleIndex]])
+				{
+					AddRandomEffects(GetTarget(SampleIndex), CurCase.Depth, Random);
+				}
+			},
+			[&](int32 SampleIndex)
+			{
+				GetTarget(SampleIndex).ClearLayeredEffects();
+				Cleared[Targets[SampleIndex]] = true;
+			});
+		Results.Add(Summarize(CurCase, TEXT("Clear"), Cycles));
+
+		// Release every handle before dropping the objects, so later cases don't start with a fuller allocator,
+		// and collect them now rather than in the middle of a later case's timings
+		for (ULayeredAttributeBenchmarkObject* CurObject : Objects)
+		{
+			CurObject->ClearLayeredEffects();
+		}
+		Objects.Reset();
+		CollectGarbage(RF_NoFlags);
+	}
+
+	BackendVariable->Set(OldBackend, ECVF_SetByCode);
+	UE_LOG(LogWizardsEditor, Verbose, TEXT("%llu broadcasts, value sink %lld"), NumBroadcasts, ValueSink);
+
+	const bool bJson = FPaths::GetExtension(OutputPath).Equals(TEXT("json"), ESearchCase::IgnoreCase);
+	if (!FFileHelper::SaveStringToFile(bJson ? ToJson(Results) : ToCsv(Results), *OutputPath))
+	{
+		UE_LOG(LogWizardsEditor, Error, TEXT("Couldn't write benchmark results to '%s'"), *OutputPath);
+		return 1;
+	}
+
+	UE_LOG(LogWizardsEditor, Display, TEXT("Wrote %d benchmark results to '%s'"), Results.Num(), *OutputPath);
+	return 0;
+}
+
+#pragma endregion
@@ -0,0 +1,74 @@
+// Copyright 2023 John McElmurray (johnmcelmurray.com). All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+
+#include "ILayeredAttributes.h"
+
+#include "LayeredAttributeBenchmarkCommandlet.generated.h"
+
+/// <summary>
+/// Bare object with layered attributes, so benchmarks measure the attribute code rather than actors and worlds.
+/// </summary>
+UCLASS(Transient)
+class WIZARDSEDITOR_API ULayeredAttributeBenchmarkObject : public UObject, public ILayeredAttributes
+{
+	GENERATED_BODY()
+
+public:
+
+	UPROPERTY(BlueprintAssignable, Category = Attributes)
+	FOnAttributeValueChangedEvent OnAnyAttributeValueChanged;
+
+protected:
+
+	// "ILayeredAttributes" interface methods
+	virtual FLayeredAttributeBlock& GetAttributesMutable() override { return Attributes; }
+	virtual const FLayeredAttributeBlock& GetAttributes() const override { return Attributes; }
+	virtual const FOnAttributeValueChangedEvent& GetOnAnyAttributeValueChanged() const override { return OnAnyAttributeValueChanged; }
+
+private:
+
+	FLayeredAttributeBlock Attributes;
+};
+
+
+/// <summary>
+/// Headless micro-benchmarks of the ILayeredAttributes operations (SetBase, Get, Add, Remove, Clear),
+/// for tracking regressions between effect backends. Each operation is timed one call at a time, for
+/// throughput and latency percentiles, across stack depths on a single object and across object counts,
+/// with and without a listener bound to every object.
+///
+///		UnrealEditor-Cmd Wizards.uproject -run=LayeredAttributeBenchmark -nullrhi -unattended
+///			[-Output=Results.csv|Results.json]	defaults to Saved/Benchmarks/LayeredAttributes-(time).csv
+///			[-Backend=All|LayerBuckets|ComposedTree]
+///			[-Depths=1,10,100,1000,10000,100000]	effects on the benchmarked attribute of a single object
+///			[-Objects=1,10,100,1000,10000,100000]	objects, each with -ObjectDepth effects
+///			[-ObjectDepth=8]
+///			[-Samples=10000]	calls timed per operation and case
+///			[-Seed=1]
+///
+/// Latencies include the cost of reading the cycle counter, so compare them between runs rather than taking
+/// them as absolute. Get is timed right after an untimed SetBase, so it always re-evaluates the stack.
+/// </summary>
+UCLASS()
+class WIZARDSEDITOR_API ULayeredAttributeBenchmarkCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+
+	ULayeredAttributeBenchmarkCommandlet();
+
+	virtual int32 Main(const FString& Params) override;
+
+private:
+
+	/// <summary>
+	/// Objects of the case being run, kept referenced here in case anything collects garbage mid-run.
+	/// </summary>
+	UPROPERTY(Transient)
+	TArray<TObjectPtr<ULayeredAttributeBenchmarkObject>> Objects;
+};
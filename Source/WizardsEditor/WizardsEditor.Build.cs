@@ -0,0 +1,14 @@
+// Copyright 2023 John McElmurray (johnmcelmurray.com). All rights reserved.
+
+using UnrealBuildTool;
+
+public class WizardsEditor : ModuleRules
+{
+	public WizardsEditor(ReadOnlyTargetRules Target) : base(Target)
+	{
+		PCHUsage = PCHUsageMode.UseExplicitOrSharedPCHs;
+
+		PublicDependencyModuleNames.AddRange(new string[] { "Core", "CoreUObject", "Engine", "Wizards" });
+		PrivateDependencyModuleNames.AddRange(new string[] { "Json" });
+	}
+}
@@ -0,0 +1,8 @@
+// Copyright 2023 John McElmurray (johnmcelmurray.com). All rights reserved.
+
+#include "WizardsEditor.h"
+#include "Modules/ModuleManager.h"
+
+IMPLEMENT_MODULE(FDefaultModuleImpl, WizardsEditor);
+
+DEFINE_LOG_CATEGORY(LogWizardsEditor)